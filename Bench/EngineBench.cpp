@@ -0,0 +1,251 @@
+/*
+  ==============================================================================
+
+    EngineBench.cpp
+
+    オーディオエンジンのヘッドレスベンチマーク（デバイス不要）
+    LooperAudio::processBlock / InputManager::analyze / SmartGate::processBlock を
+    合成入力で回し、ブロックサイズ・トラック数・チャンネル数を掃引する。
+    looperParallel はワーカー（コア数-1）で並列ミックスした時の値。
+
+    出力は1行1条件のCSV（バージョン間の比較用）:
+      stage,blockSize,tracks,channels,blocks,nsPerSample,meanNs,p99Ns,worstNs,allocsPerBlock
+
+    ビルド（リポジトリ直下）:
+      cmake -S . -B build -DCMAKE_BUILD_TYPE=Release
+      cmake --build build --target SimplooperBench
+    --quick で掃引を間引く。
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "LooperAudio.h"
+#include "InputManager.h"
+#include "SmartGate.h"
+#include "AllocationTripwire.h"
+#include "RtProfiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr double benchSampleRate = 48000.0;
+	constexpr double secondsPerCondition = 2.0; //1条件あたりに処理する音声の長さ
+	constexpr int minMeasuredBlocks = 500;
+	constexpr size_t benchStorageBudgetBytes = (size_t)128 * 1024 * 1024;
+
+	struct Result
+	{
+		int blocks = 0;
+		double nsPerSample = 0.0;
+		double meanNs = 0.0;
+		double p99Ns = 0.0;
+		double worstNs = 0.0;
+		double allocsPerBlock = 0.0;
+	};
+
+	int numBlocksFor(int blockSize)
+	{
+		return juce::jmax(minMeasuredBlocks, (int)(benchSampleRate * secondsPerCondition / blockSize));
+	}
+
+	//しきい値未満のノイズ（トリガーは立たない定常状態）
+	void fillNoise(juce::AudioBuffer<float>& buffer, std::mt19937& rng)
+	{
+		std::uniform_real_distribution<float> noise(-0.004f, 0.004f);
+
+		for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+		{
+			auto* data = buffer.getWritePointer(ch);
+			for (int i = 0; i < buffer.getNumSamples(); ++i)
+				data[i] = noise(rng);
+		}
+	}
+
+	//setup は計測外で毎ブロック、run だけを1ブロックずつ計る
+	template <typename Setup, typename Run>
+	Result measure(int blockSize, Setup&& setup, Run&& run)
+	{
+		const int numBlocks = numBlocksFor(blockSize);
+		std::vector<double> times((size_t)numBlocks);
+
+		for (int i = 0; i < numBlocks / 10; ++i) { setup(); run(); } //ウォームアップ
+
+		AllocationTripwire::resetCounts();
+
+		for (int i = 0; i < numBlocks; ++i)
+		{
+			setup();
+
+			const auto start = std::chrono::steady_clock::now();
+			{
+				AllocationTripwire::ScopedArm arm;
+				run();
+			}
+			const auto end = std::chrono::steady_clock::now();
+
+			times[(size_t)i] = std::chrono::duration<double, std::nano>(end - start).count();
+		}
+
+		const auto allocations = AllocationTripwire::getAllocationCount();
+
+		Result r;
+		r.blocks = numBlocks;
+
+		double total = 0.0;
+		for (auto t : times) total += t;
+
+		std::sort(times.begin(), times.end());
+		r.meanNs = total / numBlocks;
+		r.nsPerSample = r.meanNs / blockSize;
+		r.p99Ns = times[(size_t)juce::jmin(numBlocks - 1, (int)(numBlocks * 0.99))];
+		r.worstNs = times.back();
+		r.allocsPerBlock = (double)allocations / numBlocks;
+		return r;
+	}
+
+	void printResult(const char* stage, int blockSize, int tracks, int channels, const Result& r)
+	{
+		std::printf("%s,%d,%d,%d,%d,%.3f,%.1f,%.1f,%.1f,%.3f\n",
+					stage, blockSize, tracks, channels, r.blocks,
+					r.nsPerSample, r.meanNs, r.p99Ns, r.worstNs, r.allocsPerBlock);
+		std::fflush(stdout);
+	}
+
+	//==============================================
+	// LooperAudio: 全トラックがマスターに揃って再生中の定常状態
+	//==============================================
+	Result benchLooper(int blockSize, int numTracks, int numChannels, int numWorkers, std::mt19937& rng)
+	{
+		//SIMPLOOPER_RT_PROFILER=1 のビルドでは計測そのもののコストも含めて計る
+		RtProfiler profiler;
+		profiler.prepare(benchSampleRate);
+		profiler.start();
+
+		LooperAudio looper(benchStorageBudgetBytes);
+		looper.setParallelMixing(numWorkers);
+		looper.setProfiler(&profiler);
+		looper.prepareToPlay(blockSize, benchSampleRate);
+
+		for (int id = 1; id <= numTracks; ++id)
+			looper.addTrack(id);
+
+		juce::AudioBuffer<float> input(numChannels, blockSize), output(numChannels, blockSize);
+		fillNoise(input, rng);
+
+		const int loopLength = (int)benchSampleRate; //1秒ループ
+		auto runSamples = [&] (int numSamples)
+		{
+			for (int done = 0; done < numSamples; done += blockSize)
+				looper.processBlock(output, input);
+		};
+
+		//1本目でマスター長を決め、残りはマスターに揃えて1周録る
+		looper.postCommand(LooperAudio::Command::Type::startRecording, 1);
+		runSamples(loopLength);
+		looper.postCommand(LooperAudio::Command::Type::stopRecording, 1);
+		looper.postCommand(LooperAudio::Command::Type::startPlaying, 1);
+
+		for (int id = 2; id <= numTracks; ++id)
+			looper.postCommand(LooperAudio::Command::Type::startRecording, id);
+
+		//1ブロックで捌けるコマンド数には上限があるので、遅れて始まる分も含めて2周回す
+		runSamples(loopLength * 2);
+		looper.dispatchPendingEvents();
+
+		auto result = measure(blockSize, [] {}, [&]
+		{
+			RtProfiler::ScopedCallback profile(&profiler, blockSize);
+			looper.processBlock(output, input);
+		});
+		looper.releaseResources();
+		profiler.stop();
+		return result;
+	}
+
+	//==============================================
+	// InputManager: 全チャンネルの解析＋履歴書き込み
+	//==============================================
+	Result benchInputManager(int blockSize, int numChannels, std::mt19937& rng)
+	{
+		InputManager manager;
+		manager.prepare(benchSampleRate, blockSize);
+
+		juce::AudioBuffer<float> input(numChannels, blockSize);
+		fillNoise(input, rng);
+
+		return measure(blockSize, [] {}, [&] { manager.analyze(input); });
+	}
+
+	//==============================================
+	// SmartGate（全チャンネル。lookaheadMs > 0 なら遅延も含む）
+	// しきい値をノイズより下げて開きっぱなしにし、ゲインを掛ける経路まで必ず通す
+	//==============================================
+	Result benchSmartGate(int blockSize, int numChannels, float lookaheadMs, std::mt19937& rng)
+	{
+		SmartGate gate;
+		gate.setThresholds(0.001f, 0.001f);
+		gate.setLookahead(lookaheadMs);
+		gate.prepare(benchSampleRate, numChannels);
+
+		juce::AudioBuffer<float> input(numChannels, blockSize), output(numChannels, blockSize);
+		fillNoise(input, rng);
+
+		return measure(blockSize, [] {}, [&] { gate.processBlock(input, output); });
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool quick = false;
+	for (int i = 1; i < argc; ++i)
+		if (std::strcmp(argv[i], "--quick") == 0)
+			quick = true;
+
+	juce::ScopedNoDenormals noDenormals;
+	std::mt19937 rng(1234);
+
+	const std::vector<int> blockSizes = quick ? std::vector<int> { 64, 512 }
+											  : std::vector<int> { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+	const std::vector<int> trackCounts = quick ? std::vector<int> { 1, 16 }
+											   : std::vector<int> { 1, 4, 16, 64, 128 };
+	const std::vector<int> looperChannels = { 1, 2 };
+	//並列ミックスはオーディオスレッド＋ワーカーでコア数まで
+	const int mixWorkers = juce::jlimit(1, RealtimeWorkerPool::maxWorkers, juce::SystemStats::getNumCpus() - 1);
+	const std::vector<int> inputChannels = quick ? std::vector<int> { 2 }
+												 : std::vector<int> { 1, 2, 8, 32 };
+
+	if (! AllocationTripwire::isEnabled())
+		std::fprintf(stderr, "note: built without SIMPLOOPER_ALLOCATION_TRIPWIRE, allocsPerBlock is always 0\n");
+	if (RtProfiler::isEnabled())
+		std::fprintf(stderr, "note: built with SIMPLOOPER_RT_PROFILER, looper timings include the profiler\n");
+
+	std::printf("stage,blockSize,tracks,channels,blocks,nsPerSample,meanNs,p99Ns,worstNs,allocsPerBlock\n");
+
+	for (int blockSize : blockSizes)
+	{
+		for (int numTracks : trackCounts)
+			for (int numChannels : looperChannels)
+				printResult("looper", blockSize, numTracks, numChannels, benchLooper(blockSize, numTracks, numChannels, 0, rng));
+
+		for (int numTracks : trackCounts)
+			if (numTracks >= 16)
+				printResult("looperParallel", blockSize, numTracks, 2, benchLooper(blockSize, numTracks, 2, mixWorkers, rng));
+
+		for (int numChannels : inputChannels)
+			printResult("inputManager", blockSize, 0, numChannels, benchInputManager(blockSize, numChannels, rng));
+
+		for (int numChannels : inputChannels)
+			printResult("smartGate", blockSize, 0, numChannels, benchSmartGate(blockSize, numChannels, 0.0f, rng));
+
+		for (int numChannels : inputChannels)
+			printResult("smartGateLookahead", blockSize, 0, numChannels, benchSmartGate(blockSize, numChannels, 3.0f, rng));
+	}
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+  ==============================================================================
+
+    InputAnalysisBench.cpp
+
+    InputManager の入力解析のマイクロベンチマーク
+    旧実装（computeEnergy + detectTriggerSample の2パス）と
+    simd::analyzeChannel による1パス解析を比較する。
+
+    単体でビルド可能（JUCE不要）:
+      c++ -O2 -std=c++17 -I../Source InputAnalysisBench.cpp -o InputAnalysisBench
+
+  ==============================================================================
+*/
+
+#include "SimdKernels.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	//==============================================
+	// 旧実装（比較用にそのまま残したもの）
+	//==============================================
+	float legacyComputeEnergy(const float* const* data, int numChannels, int numSamples)
+	{
+		float total = 0.0f;
+
+		for (int ch = 0; ch < numChannels; ++ch)
+			for (int i = 0; i < numSamples; ++i)
+				total += data[ch][i] * data[ch][i];
+
+		return std::sqrt(total / (float)(numChannels * numSamples));
+	}
+
+	int legacyDetectTriggerSample(const float* const* data, int numChannels, int numSamples, float threshold)
+	{
+		for (int s = 0; s < numSamples; ++s)
+		{
+			float frameAmp = 0.0f;
+			for (int ch = 0; ch < numChannels; ++ch)
+				frameAmp += std::abs(data[ch][s]);
+
+			frameAmp /= (float)numChannels;
+
+			if (frameAmp > threshold)
+				return s;
+		}
+		return -1;
+	}
+
+	//==============================================
+	// 新実装（InputManager::analyzeChannels と同じ処理）
+	//==============================================
+	float fusedAnalyze(const float* const* data, int numChannels, int numSamples, float threshold,
+					   std::vector<simd::ChannelStats>& stats, int& firstCrossing)
+	{
+		float total = 0.0f;
+		firstCrossing = -1;
+
+		for (int ch = 0; ch < numChannels; ++ch)
+		{
+			stats[(size_t)ch] = simd::analyzeChannel(data[ch], numSamples, threshold);
+			total += stats[(size_t)ch].sumSquares;
+
+			const int s = stats[(size_t)ch].firstCrossing;
+			if (s >= 0 && (firstCrossing < 0 || s < firstCrossing))
+				firstCrossing = s;
+		}
+
+		return std::sqrt(total / (float)(numChannels * numSamples));
+	}
+
+	volatile float sink = 0.0f;
+
+	template <typename Fn>
+	double measureNsPerBlock(Fn&& fn, int iterations)
+	{
+		for (int i = 0; i < iterations / 10; ++i) fn(); //ウォームアップ
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i) fn();
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+}
+
+int main()
+{
+	//しきい値未満のノイズ（トリガーなし＝旧実装が最後まで走る最悪ケース）
+	const float threshold = 0.005f;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> noise(-0.004f, 0.004f);
+
+	std::printf("channels,blockSize,legacyNsPerBlock,fusedNsPerBlock,speedup\n");
+
+	for (int numChannels : { 2, 8, 16, 32 })
+	{
+		for (int blockSize : { 32, 64, 128, 256, 512 })
+		{
+			std::vector<std::vector<float>> storage((size_t)numChannels, std::vector<float>((size_t)blockSize));
+			std::vector<const float*> ptrs;
+
+			for (auto& ch : storage)
+			{
+				for (auto& s : ch) s = noise(rng);
+				ptrs.push_back(ch.data());
+			}
+
+			std::vector<simd::ChannelStats> stats((size_t)numChannels);
+			const int iterations = 2000000 / (numChannels * blockSize / 32 + 1) + 1000;
+
+			const double legacy = measureNsPerBlock([&]
+			{
+				sink = legacyComputeEnergy(ptrs.data(), numChannels, blockSize)
+					 + (float)legacyDetectTriggerSample(ptrs.data(), numChannels, blockSize, threshold);
+			}, iterations);
+
+			const double fused = measureNsPerBlock([&]
+			{
+				int first = -1;
+				sink = fusedAnalyze(ptrs.data(), numChannels, blockSize, threshold, stats, first) + (float)first;
+			}, iterations);
+
+			std::printf("%d,%d,%.1f,%.1f,%.2f\n", numChannels, blockSize, legacy, fused, legacy / fused);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+  ==============================================================================
+
+    MixMeteringBench.cpp
+
+    トラックのミックスにメーターを相乗りさせたコストのマイクロベンチマーク
+    simd::addWithGainRamp（メーターなし）と simd::addWithGainRampMeasured
+    （足した信号の二乗和とピークを同じパスで取る）を、トラック数とブロック長を変えて比較する。
+    ゲインは一定の時（ふだん）とランプ中の時の両方を測る。
+
+    単体でビルド可能（JUCE不要）:
+      c++ -O2 -std=c++17 -I../Source MixMeteringBench.cpp -o MixMeteringBench
+
+  ==============================================================================
+*/
+
+#include "SimdKernels.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr int numChannels = 2;
+	constexpr size_t loopSamples = (size_t)1 << 19; //1トラック1チャンネルあたり約11秒（48kHz）
+
+	volatile float sink = 0.0f;
+
+	template <typename Fn>
+	double measureNsPerBlock(Fn&& fn, int iterations)
+	{
+		for (int i = 0; i < iterations / 10; ++i) fn(); //ウォームアップ
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i) fn();
+		const auto end = std::chrono::steady_clock::now();
+
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+
+	//トラックの音を出力へ足していく（LooperAudio::mixTrack の1区間分と同じ呼び方）
+	//読み出し位置はブロックごとに進めて、ループ全体（キャッシュに乗らない長さ）をなめる
+	template <bool measure>
+	void mixTracks(std::vector<std::vector<float>>& output, const std::vector<std::vector<float>>& tracks,
+				   const simd::GainRamp& ramp, int blockSize, size_t& readPosition, std::vector<simd::ChannelStats>& levels)
+	{
+		for (auto& ch : output)
+			std::fill(ch.begin(), ch.end(), 0.0f);
+
+		readPosition = (readPosition + (size_t)blockSize) % loopSamples;
+
+		for (size_t t = 0; t < tracks.size(); ++t)
+		{
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				const float* in = tracks[t].data() + (size_t)ch * loopSamples + readPosition;
+				if constexpr (measure)
+					simd::addWithGainRampMeasured(output[(size_t)ch].data(), in, blockSize, ramp, levels[t]);
+				else
+					simd::addWithGainRamp(output[(size_t)ch].data(), in, blockSize, ramp);
+			}
+		}
+
+		sink = output[0][0] + (measure ? levels[0].peak : 0.0f);
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+	std::printf("ramp,tracks,blockSize,plainNsPerBlock,meteredNsPerBlock,overheadPercent\n");
+
+	for (const bool ramping : { false, true })
+	{
+		for (const int numTracks : { 1, 8, 32 })
+		{
+			for (const int blockSize : { 64, 256, 512 })
+			{
+				std::vector<std::vector<float>> tracks((size_t)numTracks, std::vector<float>((size_t)numChannels * loopSamples + 512));
+				for (auto& track : tracks)
+					for (auto& s : track) s = noise(rng);
+
+				std::vector<std::vector<float>> output((size_t)numChannels, std::vector<float>((size_t)blockSize));
+				std::vector<simd::ChannelStats> levels((size_t)numTracks);
+
+				//ランプ中はブロック全体がランプに入るようにする
+				simd::GainRamp ramp;
+				ramp.snapTo(0.7f);
+				if (ramping)
+					ramp.setTarget(0.2f, blockSize * 4);
+
+				const int iterations = 4000000 / (numTracks * blockSize / 16 + 1) + 1000;
+
+				//順番の影響を避けるため、2回ずつ交互に測って良い方を取る
+				size_t readPosition = 0;
+				double plain = 1.0e30, metered = 1.0e30;
+				for (int round = 0; round < 2; ++round)
+				{
+					plain = std::min(plain, measureNsPerBlock([&] { mixTracks<false>(output, tracks, ramp, blockSize, readPosition, levels); }, iterations));
+					metered = std::min(metered, measureNsPerBlock([&] { mixTracks<true>(output, tracks, ramp, blockSize, readPosition, levels); }, iterations));
+				}
+
+				std::printf("%s,%d,%d,%.1f,%.1f,%.1f\n", ramping ? "yes" : "no", numTracks, blockSize,
+							plain, metered, (metered / plain - 1.0) * 100.0);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+  ==============================================================================
+
+    AllocationTripwire.cpp
+
+  ==============================================================================
+*/
+
+#include "AllocationTripwire.h"
+#include <cstdlib>
+#include <new>
+
+//juce::HeapBlock（AudioBuffer の中身）は new ではなく malloc/free を直接呼ぶので、そちらも差し替える
+//本物のアロケータへは libc の別名（Linux）か既定のゾーン（macOS）で抜ける。Windows は new/delete だけ
+#if SIMPLOOPER_ALLOCATION_TRIPWIRE && (JUCE_LINUX || JUCE_MAC)
+ #define SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC 1
+#else
+ #define SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC 0
+#endif
+
+#if SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_LINUX
+extern "C"
+{
+	void* __libc_malloc (std::size_t);
+	void* __libc_calloc (std::size_t, std::size_t);
+	void* __libc_realloc (void*, std::size_t);
+	void __libc_free (void*);
+}
+#elif SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_MAC
+ #include <malloc/malloc.h>
+#endif
+
+namespace
+{
+	std::atomic<int> tripwireMode { (int)AllocationTripwire::Mode::count };
+	std::atomic<juce::int64> allocationCount { 0 };
+	std::atomic<juce::int64> deallocationCount { 0 };
+
+   #if SIMPLOOPER_ALLOCATION_TRIPWIRE
+	thread_local int armDepth = 0;
+
+	inline void noteAllocation() noexcept
+	{
+		if (armDepth <= 0) return;
+
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		if (tripwireMode.load(std::memory_order_relaxed) == (int)AllocationTripwire::Mode::abort)
+		{
+			armDepth = 0;
+			jassertfalse; // 🚨 オーディオスレッドでメモリ確保
+			std::abort();
+		}
+	}
+
+	inline void noteDeallocation() noexcept
+	{
+		if (armDepth <= 0) return;
+
+		deallocationCount.fetch_add(1, std::memory_order_relaxed);
+
+		if (tripwireMode.load(std::memory_order_relaxed) == (int)AllocationTripwire::Mode::abort)
+		{
+			armDepth = 0;
+			jassertfalse; // 🚨 オーディオスレッドでメモリ解放
+			std::abort();
+		}
+	}
+
+	//数えずに確保・解放する（差し替えた malloc/free と new/delete の両方から呼ぶ）
+	void* rawMalloc(std::size_t size) noexcept
+	{
+	   #if SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_LINUX
+		return __libc_malloc(size);
+	   #elif SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_MAC
+		return malloc_zone_malloc(malloc_default_zone(), size);
+	   #else
+		return std::malloc(size);
+	   #endif
+	}
+
+	void rawFree(void* p) noexcept
+	{
+	   #if SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_LINUX
+		__libc_free(p);
+	   #elif SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC && JUCE_MAC
+		//システムのライブラリが別のゾーンで確保したものも来るので、持ち主のゾーンへ返す
+		if (auto* zone = malloc_zone_from_ptr(p))
+			malloc_zone_free(zone, p);
+	   #else
+		std::free(p);
+	   #endif
+	}
+
+	void* allocate(std::size_t size)
+	{
+		noteAllocation();
+
+		if (void* p = rawMalloc(size == 0 ? 1 : size))
+			return p;
+
+		throw std::bad_alloc();
+	}
+
+	void* allocateAligned(std::size_t size, std::align_val_t align)
+	{
+		noteAllocation();
+
+		const auto alignment = juce::jmax((std::size_t)align, sizeof(void*));
+
+	   #if JUCE_WINDOWS
+		if (void* p = _aligned_malloc(size == 0 ? 1 : size, alignment))
+			return p;
+	   #else
+		void* p = nullptr;
+		if (posix_memalign(&p, alignment, size == 0 ? 1 : size) == 0)
+			return p;
+	   #endif
+
+		throw std::bad_alloc();
+	}
+
+	void release(void* p) noexcept
+	{
+		if (p == nullptr) return;
+
+		noteDeallocation();
+		rawFree(p);
+	}
+
+	void releaseAligned(void* p) noexcept
+	{
+		if (p == nullptr) return;
+
+		noteDeallocation();
+	   #if JUCE_WINDOWS
+		_aligned_free(p);
+	   #else
+		rawFree(p);
+	   #endif
+	}
+   #endif
+}
+
+void AllocationTripwire::setMode(Mode newMode) noexcept
+{
+	tripwireMode.store((int)newMode);
+}
+
+AllocationTripwire::Mode AllocationTripwire::getMode() noexcept
+{
+	return (Mode)tripwireMode.load();
+}
+
+juce::int64 AllocationTripwire::getAllocationCount() noexcept   { return allocationCount.load(); }
+juce::int64 AllocationTripwire::getDeallocationCount() noexcept { return deallocationCount.load(); }
+
+void AllocationTripwire::resetCounts() noexcept
+{
+	allocationCount.store(0);
+	deallocationCount.store(0);
+}
+
+#if SIMPLOOPER_ALLOCATION_TRIPWIRE
+
+AllocationTripwire::ScopedArm::ScopedArm() noexcept    { ++armDepth; }
+AllocationTripwire::ScopedArm::~ScopedArm() noexcept   { --armDepth; }
+
+AllocationTripwire::ScopedSuspend::ScopedSuspend() noexcept
+	: wasArmed(armDepth > 0)
+{
+	if (wasArmed) --armDepth;
+}
+
+AllocationTripwire::ScopedSuspend::~ScopedSuspend() noexcept
+{
+	if (wasArmed) ++armDepth;
+}
+
+//==============================================================================
+// グローバル new/delete の置き換え（有効時のみ）
+//==============================================================================
+void* operator new (std::size_t size)                                    { return allocate(size); }
+void* operator new[] (std::size_t size)                                  { return allocate(size); }
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept    { try { return allocate(size); } catch (...) { return nullptr; } }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept  { try { return allocate(size); } catch (...) { return nullptr; } }
+void* operator new (std::size_t size, std::align_val_t a)                { return allocateAligned(size, a); }
+void* operator new[] (std::size_t size, std::align_val_t a)              { return allocateAligned(size, a); }
+
+void operator delete (void* p) noexcept                                  { release(p); }
+void operator delete[] (void* p) noexcept                                { release(p); }
+void operator delete (void* p, std::size_t) noexcept                     { release(p); }
+void operator delete[] (void* p, std::size_t) noexcept                   { release(p); }
+void operator delete (void* p, std::align_val_t) noexcept                { releaseAligned(p); }
+void operator delete[] (void* p, std::align_val_t) noexcept              { releaseAligned(p); }
+void operator delete (void* p, std::size_t, std::align_val_t) noexcept   { releaseAligned(p); }
+void operator delete[] (void* p, std::size_t, std::align_val_t) noexcept { releaseAligned(p); }
+
+#endif
+
+#if SIMPLOOPER_TRIPWIRE_HOOKS_MALLOC
+//==============================================================================
+// malloc/calloc/realloc/free の置き換え（有効時のみ。glibc の宣言は noexcept 付き）
+//==============================================================================
+#if JUCE_LINUX
+ #define SIMPLOOPER_MALLOC_NOEXCEPT noexcept
+#else
+ #define SIMPLOOPER_MALLOC_NOEXCEPT
+#endif
+
+extern "C"
+{
+	void* malloc (std::size_t size) SIMPLOOPER_MALLOC_NOEXCEPT
+	{
+		noteAllocation();
+		return rawMalloc(size);
+	}
+
+	void* calloc (std::size_t count, std::size_t size) SIMPLOOPER_MALLOC_NOEXCEPT
+	{
+		noteAllocation();
+	   #if JUCE_LINUX
+		return __libc_calloc(count, size);
+	   #else
+		return malloc_zone_calloc(malloc_default_zone(), count, size);
+	   #endif
+	}
+
+	void* realloc (void* p, std::size_t size) SIMPLOOPER_MALLOC_NOEXCEPT
+	{
+		//大きさを変えるだけでも中で確保し直しうるので、確保として数える
+		noteAllocation();
+	   #if JUCE_LINUX
+		return __libc_realloc(p, size);
+	   #else
+		auto* zone = p != nullptr ? malloc_zone_from_ptr(p) : nullptr;
+		return malloc_zone_realloc(zone != nullptr ? zone : malloc_default_zone(), p, size);
+	   #endif
+	}
+
+	void free (void* p) SIMPLOOPER_MALLOC_NOEXCEPT
+	{
+		if (p == nullptr) return;
+
+		noteDeallocation();
+		rawFree(p);
+	}
+}
+
+#undef SIMPLOOPER_MALLOC_NOEXCEPT
+#endif
@@ -0,0 +1,69 @@
+/*
+  ==============================================================================
+
+    AllocationTripwire.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+
+//------------------------------------------------------------
+// オーディオコールバック中の malloc/free を検知するトリップワイヤー
+// new/delete と malloc/calloc/realloc/free を差し替えて数える（Windows は new/delete のみ）
+// SIMPLOOPER_ALLOCATION_TRIPWIRE=1 でビルドした時だけ有効（オプトイン）
+// 無効時は ScopedArm も空のクラスになり、コストはゼロ
+//------------------------------------------------------------
+#ifndef SIMPLOOPER_ALLOCATION_TRIPWIRE
+ #define SIMPLOOPER_ALLOCATION_TRIPWIRE 0
+#endif
+
+class AllocationTripwire
+{
+public:
+	enum class Mode
+	{
+		count,  //回数を数えるだけ
+		abort   //検知した瞬間に止める（デバッガで呼び出し元を確認する用）
+	};
+
+	static void setMode(Mode newMode) noexcept;
+	static Mode getMode() noexcept;
+
+	//監視区間中に発生した確保・解放の累計
+	static juce::int64 getAllocationCount() noexcept;
+	static juce::int64 getDeallocationCount() noexcept;
+	static void resetCounts() noexcept;
+
+	static constexpr bool isEnabled() noexcept { return SIMPLOOPER_ALLOCATION_TRIPWIRE != 0; }
+
+	//このスコープの間、現在のスレッドでの確保を監視する
+	struct ScopedArm
+	{
+	   #if SIMPLOOPER_ALLOCATION_TRIPWIRE
+		ScopedArm() noexcept;
+		~ScopedArm() noexcept;
+	   #else
+		ScopedArm() noexcept {}
+	   #endif
+
+		JUCE_DECLARE_NON_COPYABLE(ScopedArm)
+	};
+
+	//監視中でも一時的に見逃したい区間用（ログ出力など）
+	struct ScopedSuspend
+	{
+	   #if SIMPLOOPER_ALLOCATION_TRIPWIRE
+		ScopedSuspend() noexcept;
+		~ScopedSuspend() noexcept;
+	   private:
+		bool wasArmed = false;
+	   public:
+	   #else
+		ScopedSuspend() noexcept {}
+	   #endif
+
+		JUCE_DECLARE_NON_COPYABLE(ScopedSuspend)
+	};
+};
@@ -0,0 +1,320 @@
+/*
+  ==============================================================================
+
+    DiskStreamer.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "PagedAudioStorage.h"
+#include "RingBuffer.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------
+// 録音したページをディスクへ書き出し、必要になったら読み戻すバックグラウンドスレッド
+// オーディオスレッドは要求を SPSC キューに積んで完了をキューから受け取るだけで、I/O を待たない
+// ・書き出し: ページを retain して渡し、書き終えたらこちらで release する
+// ・読み戻し: こちらでアリーナからページを取って読み込み、完了と一緒に渡す
+// テイク（録音1回分のページ表）ごとに1ファイル。ファイルは stop() でまとめて消す
+//------------------------------------------------------------
+class DiskStreamer : private juce::Thread
+{
+public:
+	struct Completion
+	{
+		enum class Type { written, writeFailed, loaded, loadFailed };
+		Type type = Type::written;
+		int takeId = -1;
+		int pageIndex = 0;
+		int page = PageArena::invalidPage; //loaded の時だけ（受け取った側のもの）
+	};
+
+	DiskStreamer() : juce::Thread("Simplooper disk streamer") {}
+	~DiskStreamer() override { stop(); }
+
+	//メッセージスレッドで呼ぶ（オーディオ停止中）。directory の下にこのセッション用のフォルダを作る
+	bool start(PageArena& newArena, const juce::File& directory)
+	{
+		stop();
+
+		sessionDirectory = directory.getChildFile("Simplooper-stream-" + juce::String(juce::Time::currentTimeMillis()));
+		if (! sessionDirectory.createDirectory())
+			return false;
+
+		arena = &newArena;
+		nextTakeId = 0;
+		pagesWritten.store(0);
+		pagesRead.store(0);
+		ioFailures.store(0);
+		worstReadLatencyMs.store(0.0);
+
+		startThread(juce::Thread::Priority::high);
+		return true;
+	}
+
+	void stop()
+	{
+		if (arena == nullptr) return;
+
+		stopThread(2000);
+		openFiles.clear();
+
+		//渡しそびれたページは持ち主に返す
+		Request request;
+		while (requests.pop(request))
+			if (request.type == Request::Type::writePage)
+				arena->release(request.page);
+
+		Completion completion;
+		while (completions.pop(completion))
+			if (completion.type == Completion::Type::loaded)
+				arena->release(completion.page);
+
+		sessionDirectory.deleteRecursively();
+		arena = nullptr;
+	}
+
+	bool isRunning() const noexcept { return arena != nullptr; }
+
+	//===オーディオスレッド側===
+
+	//新しいテイク番号（使い回さない）
+	int createTakeId() noexcept { return nextTakeId++; }
+
+	//書き出しを頼む。キューが満杯なら false（次のブロックでやり直す）
+	bool requestWrite(int takeId, int pageIndex, int page) noexcept
+	{
+		arena->retain(page);
+		if (requests.push({ Request::Type::writePage, takeId, pageIndex, page, 0 }))
+			return true;
+
+		arena->release(page);
+		return false;
+	}
+
+	//読み戻しを頼む。キューが満杯なら false
+	bool requestRead(int takeId, int pageIndex) noexcept
+	{
+		return requests.push({ Request::Type::readPage, takeId, pageIndex, PageArena::invalidPage,
+							   juce::Time::getHighResolutionTicks() });
+	}
+
+	bool popCompletion(Completion& completion) noexcept { return completions.pop(completion); }
+
+	//書き出し済みのページをファイルから直接読む（セッション保存スレッド用。ストリーマーの処理とは独立）
+	bool readStoredPage(int takeId, int pageIndex, float* dest) const
+	{
+		if (arena == nullptr) return false;
+
+		juce::FileInputStream input(takeFileFor(takeId));
+		return input.openedOk()
+			&& input.setPosition(offsetOf(pageIndex))
+			&& input.read(dest, (int)pageBytes()) == (int)pageBytes();
+	}
+
+	//===統計（どのスレッドからでも）===
+	juce::uint32 getPagesWritten() const noexcept { return pagesWritten.load(std::memory_order_relaxed); }
+	juce::uint32 getPagesRead() const noexcept { return pagesRead.load(std::memory_order_relaxed); }
+	juce::uint32 getIoFailures() const noexcept { return ioFailures.load(std::memory_order_relaxed); }
+	juce::uint32 getRequestOverflows() const noexcept { return requests.getOverflowCount(); }
+	//読み戻しを頼んでから届くまでの最悪値（先読み量を決める目安）
+	double getWorstReadLatencyMs() const noexcept { return worstReadLatencyMs.load(std::memory_order_relaxed); }
+
+private:
+	struct Request
+	{
+		enum class Type { writePage, readPage };
+		Type type = Type::writePage;
+		int takeId = -1;
+		int pageIndex = 0;
+		int page = PageArena::invalidPage;
+		juce::int64 requestTicks = 0;
+	};
+
+	//開いているテイクのファイル（古いものから閉じる）
+	struct TakeFile
+	{
+		int takeId = -1;
+		juce::File file;
+		std::unique_ptr<juce::FileOutputStream> output;
+		std::unique_ptr<juce::FileInputStream> input;
+		juce::uint32 lastUsed = 0;
+	};
+
+	static constexpr int maxOpenFiles = 16;
+	static constexpr int queueSize = 1024;
+	static constexpr int idleWaitMs = 2;
+
+	void run() override
+	{
+		while (! threadShouldExit())
+		{
+			Request request;
+			if (! requests.peek())
+			{
+				wait(idleWaitMs);
+				continue;
+			}
+
+			//完了を返す場所がない時は、空くまで要求を取り出さない
+			if (completions.getNumReady() >= completions.getCapacity())
+			{
+				wait(1);
+				continue;
+			}
+
+			requests.pop(request);
+
+			if (request.type == Request::Type::writePage)
+				writePage(request);
+			else
+				readPage(request);
+		}
+	}
+
+	void writePage(const Request& request)
+	{
+		bool ok = false;
+
+		if (auto* take = openTake(request.takeId))
+		{
+			if (take->output == nullptr)
+			{
+				take->output = std::make_unique<juce::FileOutputStream>(take->file);
+				if (take->output->failedToOpen())
+					take->output.reset();
+			}
+
+			if (take->output != nullptr && take->output->setPosition(offsetOf(request.pageIndex)))
+			{
+				//アリーナのページはチャンネル分が連続しているのでそのまま1回で書く
+				ok = take->output->write(arena->getReadPointer(request.page, 0), pageBytes());
+				take->output->flush();
+			}
+		}
+
+		arena->release(request.page);
+
+		if (ok) pagesWritten.fetch_add(1, std::memory_order_relaxed);
+		else    ioFailures.fetch_add(1, std::memory_order_relaxed);
+
+		completions.push({ ok ? Completion::Type::written : Completion::Type::writeFailed,
+						   request.takeId, request.pageIndex, PageArena::invalidPage });
+	}
+
+	void readPage(const Request& request)
+	{
+		int page = arena->allocate();
+		bool ok = false;
+
+		if (page != PageArena::invalidPage)
+		{
+			if (auto* take = openTake(request.takeId))
+			{
+				if (take->input == nullptr && take->file.existsAsFile())
+				{
+					take->input = std::make_unique<juce::FileInputStream>(take->file);
+					if (take->input->failedToOpen())
+						take->input.reset();
+				}
+
+				if (take->input != nullptr && take->input->setPosition(offsetOf(request.pageIndex)))
+					ok = take->input->read(arena->getWritePointer(page, 0), (int)pageBytes()) == (int)pageBytes();
+			}
+
+			//波形表示用のピークは渡す前にここで作り直す
+			if (ok)
+				arena->rebuildPeaks(page);
+
+			if (! ok)
+			{
+				arena->release(page);
+				page = PageArena::invalidPage;
+			}
+		}
+
+		if (ok)
+		{
+			pagesRead.fetch_add(1, std::memory_order_relaxed);
+
+			const double latencyMs = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - request.requestTicks) * 1000.0;
+			if (latencyMs > worstReadLatencyMs.load(std::memory_order_relaxed))
+				worstReadLatencyMs.store(latencyMs, std::memory_order_relaxed);
+		}
+		else
+		{
+			ioFailures.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		completions.push({ ok ? Completion::Type::loaded : Completion::Type::loadFailed,
+						   request.takeId, request.pageIndex, page });
+	}
+
+	TakeFile* openTake(int takeId)
+	{
+		++useCounter;
+
+		for (auto& take : openFiles)
+		{
+			if (take.takeId == takeId)
+			{
+				take.lastUsed = useCounter;
+				return &take;
+			}
+		}
+
+		//いちばん長く使っていないファイルを閉じて入れ替える
+		if ((int)openFiles.size() >= maxOpenFiles)
+		{
+			auto oldest = std::min_element(openFiles.begin(), openFiles.end(),
+										   [] (const TakeFile& a, const TakeFile& b) { return a.lastUsed < b.lastUsed; });
+			openFiles.erase(oldest);
+		}
+
+		TakeFile take;
+		take.takeId = takeId;
+		take.file = takeFileFor(takeId);
+		take.lastUsed = useCounter;
+		openFiles.push_back(std::move(take));
+		return &openFiles.back();
+	}
+
+	juce::File takeFileFor(int takeId) const
+	{
+		return sessionDirectory.getChildFile("take-" + juce::String(takeId) + ".f32");
+	}
+
+	size_t pageBytes() const noexcept
+	{
+		return PageArena::bytesPerPage(arena->getNumChannels(), arena->getPageSize());
+	}
+
+	juce::int64 offsetOf(int pageIndex) const noexcept
+	{
+		return (juce::int64)pageIndex * (juce::int64)pageBytes();
+	}
+
+	PageArena* arena = nullptr;
+	juce::File sessionDirectory;
+
+	SpscQueue<Request> requests { queueSize };		//オーディオ → ディスク
+	SpscQueue<Completion> completions { queueSize }; //ディスク → オーディオ
+
+	int nextTakeId = 0; //オーディオスレッドだけが触る
+
+	//ディスクスレッドだけが触る
+	std::vector<TakeFile> openFiles;
+	juce::uint32 useCounter = 0;
+
+	std::atomic<juce::uint32> pagesWritten { 0 };
+	std::atomic<juce::uint32> pagesRead { 0 };
+	std::atomic<juce::uint32> ioFailures { 0 };
+	std::atomic<double> worstReadLatencyMs { 0.0 };
+
+	JUCE_DECLARE_NON_COPYABLE(DiskStreamer)
+};
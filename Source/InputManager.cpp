@@ -18,8 +18,16 @@ void InputManager::prepare(double newSampleRate, int bufferSize)
 	triggerEvent.reset();
 	smoothedEnergy = 0.0f;
 
-	//あとでRingBufferの準備を追加
-	//ringBuffer.prepare(numChannels, bufferSize * 8);
+	//入力履歴：プリロール探索に十分な長さ（最低2秒）を確保
+	ringBuffer.prepare(historyChannels, juce::jmax(bufferSize * 8, (int)(sampleRate * historySeconds)));
+
+	channelStats.assign(maxInputChannels, {});
+	numAnalyzedChannels = 0;
+	numAnalyzedSamples = 0;
+
+	for (auto& meter : inputMeters)
+		meter.prepare(sampleRate);
+	numMeteredChannels.store(0, std::memory_order_relaxed);
 
 	DBG("InputManager::prepare sampleRate = " << sampleRate << "bufferSize = " << bufferSize);
 
@@ -42,51 +50,129 @@ void InputManager::reset()
 
 void InputManager::analyze(const juce::AudioBuffer<float>& input)
 {
-	float energy = computeEnergy(input);
+	// (0) ブロック先頭の絶対位置を控えてから履歴に積む
+	const juce::int64 blockStartAbs = ringBuffer.getTotalWritten();
+	ringBuffer.write(input, input.getNumSamples());
+
+	// (1) 全チャンネルを1パスで解析し、エネルギーとしきい値検知をまとめて求める
+	analyzeChannels(input);
 
-	// (1) ブロック内でしきい値検知を実行
-	bool trig = detectTriggerSample(input);
+	const float energy = computeEnergy();
+	smoothedEnergy += energySmoothing * (energy - smoothedEnergy);
+
+	bool trig = detectTriggerSample();
 
 	// (2) 状態更新
 	if (trig && !triggered)
 	{
 		triggered = true;
-		//トリガー値を更新(仮、　absIndexはあとでリングバッファ実装時に設定 )
-		triggered = true;
-		triggerEvent.fire(0, -1);
-		DBG("Trigger ON | energy = " << smoothedEnergy);
+		//しきい値を超えた位置から遡って、実際のアタック開始位置を記録
+		const int triggerSample = triggerEvent.sampleInBlock;
+		const long triggerAbs = (long)(blockStartAbs + triggerSample);
+		triggerEvent.fire(triggerSample, findAttackStartAbs(triggerAbs));
 	}
 	else if(!trig && triggered)
 	{
 		triggered = false;
 		triggerEvent.reset();
-
-		DBG("Trigger OFF | energy = " << smoothedEnergy);
 	}
 	updateStateMachine();
 }
 
+//==============================================================================
+// チャンネル解析（SIMD・1パス）
+//==============================================================================
+
+void InputManager::analyzeChannels(const juce::AudioBuffer<float>& input)
+{
+	numAnalyzedChannels = juce::jmin(input.getNumChannels(), (int)channelStats.size());
+	numAnalyzedSamples = input.getNumSamples();
+
+	for (int ch = 0; ch < numAnalyzedChannels; ++ch)
+	{
+		const auto& stats = channelStats[(size_t)ch] = simd::analyzeChannel(input.getReadPointer(ch), numAnalyzedSamples, config.userThreshold);
+
+		//メーターは求めた二乗和とピークをそのまま使う（入力をもう1度なめない）
+		inputMeters[(size_t)ch].addBlock(stats.peak, stats.sumSquares, numAnalyzedSamples, numAnalyzedSamples);
+	}
+
+	numMeteredChannels.store(numAnalyzedChannels, std::memory_order_relaxed);
+}
+
 //==============================================================================
 // エネルギー（RMS）を計算
 //==============================================================================
 
-float InputManager::computeEnergy(const juce::AudioBuffer<float>& input)
+float InputManager::computeEnergy() const
 {
-	const int numChannels = input.getNumChannels();
-	const int numSamples = input.getNumSamples();
+	if (numAnalyzedChannels == 0 || numAnalyzedSamples == 0)
+		return 0.0f;
+
 	float total = 0.0f;
 
-	for (int ch = 0; ch < numChannels; ++ch)
+	for (int ch = 0; ch < numAnalyzedChannels; ++ch)
+		total += channelStats[(size_t)ch].sumSquares;
+
+	const float mean = total / (float)(numAnalyzedChannels * numAnalyzedSamples);
+	return std::sqrt(mean);
+}
+
+//==============================================================================
+// プリロール探索
+//==============================================================================
+
+// トリガー位置から maxPreRollMs まで遡り、直前の無音が終わった位置を返す
+long InputManager::findSilenceStartAbs(long triggerAbsIndex)
+{
+	const long limit = (long)juce::jmax(ringBuffer.getOldestAbs(),
+										(juce::int64)(triggerAbsIndex - msToSamples(config.maxPreRollMs)));
+
+	for (long pos = triggerAbsIndex - 1; pos >= limit; --pos)
 	{
-		const float* data = input.getReadPointer(ch);
-		for (int i = 0; i < numSamples; ++i)
-		{
-			total += data[i] * data[i];
-		}
+		if (ringBuffer.getFrameAmplitude(pos) < config.silenceThreshold)
+			return pos + 1;
 	}
 
-	const float mean = total / (float)(numChannels * numSamples);
-	return std::sqrt(mean);
+	//無音が見つからなければ遡れるところまで
+	return limit;
+}
+
+// attackWindowMs の範囲で平滑化した包絡を遡り、勾配がなくなる点（アタックの根元）を返す
+long InputManager::findAttackStartAbs(long triggerAbsIndex)
+{
+	const int smoothN = juce::jlimit(1, maxSmoothN, config.slopeSmoothN);
+	const long preRollLimit = triggerAbsIndex - msToSamples(config.maxPreRollMs);
+	const long windowStart = (long)juce::jmax(ringBuffer.getOldestAbs(),
+											  (juce::int64)(triggerAbsIndex - msToSamples(config.attackWindowMs)),
+											  (juce::int64)preRollLimit);
+
+	//直近 smoothN サンプルの移動平均を遡りながら更新
+	float window[maxSmoothN] {};
+	float sum = 0.0f;
+	float prevEnvelope = std::numeric_limits<float>::max();
+	int filled = 0;
+
+	for (long pos = triggerAbsIndex; pos >= windowStart; --pos)
+	{
+		const float amp = ringBuffer.getFrameAmplitude(pos);
+		sum += amp - window[filled % smoothN];
+		window[filled % smoothN] = amp;
+		++filled;
+
+		if (filled < smoothN) continue;
+
+		const float envelope = sum / (float)smoothN;
+
+		//無音まで下がった、またはしきい値未満で包絡が下がらなくなった所が立ち上がり
+		if (envelope < config.silenceThreshold
+			|| (envelope < config.userThreshold && envelope >= prevEnvelope))
+			return juce::jmin(triggerAbsIndex, pos + smoothN - 1);
+
+		prevEnvelope = envelope;
+	}
+
+	//窓の中で見つからなければ無音区間の終わりを探す
+	return juce::jmax(preRollLimit, findSilenceStartAbs(triggerAbsIndex));
 }
 
 //==============================================================================
@@ -115,32 +201,32 @@ const SmartRecConfig& InputManager::getConfig() const noexcept
 	return config;
 }
 //==============================================================================
-// 閾値検知：ブロック内の最大音量を確認
+// 閾値検知：履歴に残すチャンネルのどれかが最初にしきい値を超えた位置
+// （アタックの根元は履歴から探すので、履歴にないチャンネルでは発火させない）
 //==============================================================================
 
-bool InputManager::detectTriggerSample(const juce::AudioBuffer<float>& input)
+bool InputManager::detectTriggerSample()
 {
-	const int numChannels = input.getNumChannels();
-	const int numSamples = input.getNumSamples();
-	const float threshold = config.userThreshold;
+	int firstSample = -1;
+	int firstChannel = 0;
+	const int numTriggerChannels = juce::jmin(numAnalyzedChannels, historyChannels);
 
-	for(int s = 0; s < numSamples; ++s)
+	for (int ch = 0; ch < numTriggerChannels; ++ch)
 	{
-		float frameAmp = 0.0f;
-		for ( int ch = 0; ch < numChannels; ++ch)
-		{
-			frameAmp += std::abs(input.getReadPointer(ch)[s]);
-		}
-
-		frameAmp /= (float)numChannels;
+		const int s = channelStats[(size_t)ch].firstCrossing;
 
-		if(frameAmp > threshold)
+		if (s >= 0 && (firstSample < 0 || s < firstSample))
 		{
-			triggerEvent.sampleInBlock = s;
-			triggerEvent.channel = 0;
-			return true;
+			firstSample = s;
+			firstChannel = ch;
 		}
 	}
-	return false;
+
+	if (firstSample < 0)
+		return false;
+
+	triggerEvent.sampleInBlock = firstSample;
+	triggerEvent.channel = firstChannel;
+	return true;
 }
 
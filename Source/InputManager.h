@@ -11,6 +11,10 @@
 #pragma once
 #include <JuceHeader.h>
 #include "TriggerEvent.h"
+#include "RingBuffer.h"
+#include "SimdKernels.h"
+#include "LevelMeter.h"
+#include <array>
 
 struct SmartRecConfig
 {
@@ -52,18 +56,43 @@ class InputManager
 	void setConfig(const SmartRecConfig& newConfig) noexcept;
 	const SmartRecConfig& getConfig() const noexcept;
 
+	//入力履歴（絶対位置でプリロールを取り出すのに使う）
+	const HistoryRingBuffer& getInputHistory() const noexcept { return ringBuffer; }
+
+	//入力メーター（解析のついでに更新。どのスレッドからでも読める）
+	int getNumInputMeters() const noexcept { return numMeteredChannels.load(std::memory_order_relaxed); }
+	LevelMeter::Reading getInputLevel(int channel) const noexcept { return inputMeters[(size_t)channel].read(); }
+
 private:
 
-	float computeEnergy(const juce::AudioBuffer<float>& input);
+	//全チャンネルを1パスで解析（RMS・ピーク・しきい値超え位置）
+	void analyzeChannels(const juce::AudioBuffer<float>& input);
+	float computeEnergy() const;
 
 	//内部ロジック
-	bool detectTriggerSample(const juce::AudioBuffer<float>& input);
+	bool detectTriggerSample();
 	long findSilenceStartAbs(long triggerAbsIndex);
 	long findAttackStartAbs(long triggerAbsIndex);
 	void updateStateMachine();
 
+	static constexpr int maxSmoothN = 64;		   //包絡平滑化の最大サンプル数
+	static constexpr double historySeconds = 2.0; //入力履歴の長さ
+	static constexpr int historyChannels = 2;	   //入力履歴に残すチャンネル数（ルーパーが録るのもこの分）
+	static constexpr float energySmoothing = 0.2f; //エネルギー表示用の平滑化係数
+
+	int msToSamples(int ms) const noexcept { return (int)(sampleRate * ms / 1000.0); }
+
 	//===内部データ===
-//	RingBuffer ringBuffer;
+	HistoryRingBuffer ringBuffer;
+
+	//チャンネル毎の解析結果（prepareで確保して使い回す）
+	std::vector<simd::ChannelStats> channelStats;
+	int numAnalyzedChannels = 0;
+	int numAnalyzedSamples = 0;
+	static constexpr int maxInputChannels = 64;
+
+	std::array<LevelMeter, maxInputChannels> inputMeters;
+	std::atomic<int> numMeteredChannels { 0 };
 
 	SmartRecConfig config;
 	juce::TriggerEvent triggerEvent;
@@ -2,107 +2,99 @@
 #include <JuceHeader.h>
 #include "InputManager.h"
 #include "SmartGate.h"
+#include "RingBuffer.h"
+#include "AllocationTripwire.h"
+#include "RtProfiler.h"
 
 //------------------------------------------------------------
-// 入力オーディオデータをキャプチャして保持するユーティリティ
+// 入力段（ゲート → 解析・入力履歴）
+// MainComponent のデバイスコールバックの中で、ルーパーより先に同じブロックを処理する
+// デバイスの入力バッファはコピーせずそのまま参照し、作業用バッファを使うのは
+//   ・ゲートをかける時（ゲートが作業用へ書き出す）
+//   ・入力と出力が同じメモリを指すデバイス、参照しきれないほどチャンネルが多い時（先に写す）
+// だけ
 //------------------------------------------------------------
-class InputTap : public juce::AudioIODeviceCallback
+class InputTap
 {
 	public:
 
 	std::atomic<bool> triggerFlag = false;
 
-	InputTap() {	}
+	InputTap()
+	{
+		smartGate.setThresholds(0.015f, 0.1f);
+		smartGate.setTimes(1.0f, 50.0f, 80.0f);
+		smartGate.setLookahead(3.0f);
+	}
 
-	void prepare(double newSampleRate, int bufferSize)
+	//オーディオ停止中に呼ぶ（デバイスの入力チャンネル数で作業用を確保する）
+	//process に渡せるのは bufferSize まで。それより大きいブロックは呼ぶ側で分けて渡す
+	void prepare(double newSampleRate, int bufferSize, int numInputChannels)
 	{
 		sampleRate = newSampleRate;
-		buffer.setSize(2, bufferSize);
-		buffer.clear();
+		maxBlockSize = juce::jmax(1, bufferSize);
+		scratch.setSize(juce::jmax(1, numInputChannels), maxBlockSize);
+		scratch.clear();
 
 		inputManager.prepare(sampleRate, bufferSize);
-
+		smartGate.prepare(sampleRate, numInputChannels);
+		blockStartSample = 0;
 	}
-	void process(const juce::AudioBuffer<float>& input);
 
-	void audioDeviceAboutToStart(juce::AudioIODevice* device) override
+	//===オーディオスレッド===
+	//このブロックの入力を処理して、ルーパーに渡す入力を返す（次の process まで有効）
+	//numSamples は getMaxBlockSize() まで（作業用を確保し直さないため）
+	const juce::AudioBuffer<float>& process(const float* const* inputChannelData, int numInputChannels,
+											const float* const* outputChannelData, int numOutputChannels,
+											int numSamples) noexcept
 	{
-		const int inCh = device ? device->getActiveInputChannels().countNumberOfSetBits() : 0;
-		const int bufSize = device ? device->getCurrentBufferSizeSamples() : 512;
-		buffer.setSize(juce::jmax(1, inCh), bufSize);
-		buffer.clear();
-		//DBG("🎧 InputTap started: channels=" << inCh << " bufferSize=" << bufSize);
-	}
+		RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::input);
 
-	// ✅ JUCE 7.0.5以降（macOS含む）で使用
-	void audioDeviceIOCallbackWithContext(const float* const* inputChannelData,
-										  int numInputChannels,
-										  float* const* outputChannelData,
-										  int numOutputChannels,
-										  int numSamples,
-										  const juce::AudioIODeviceCallbackContext&) override
-	{
-		juce::ignoreUnused(outputChannelData, numOutputChannels);
-		if (numInputChannels == 0) return;
+		//このブロック先頭の入力絶対位置（入力履歴に積む前の通算）
+		blockStartSample = inputManager.getInputHistory().getTotalWritten();
 
-		buffer.setSize(numInputChannels, numSamples, false, false, true);
-		smartGate.setThresholds (0.015f,0.1f);
-		smartGate.setSpeeds(0.05f, 0.03f);
+		jassert(numSamples <= maxBlockSize);
 
+		//確保済みの範囲で長さだけ合わせる（チャンネル数は prepare の時のまま）
+		const juce::AudioBuffer<float>* input = &scratch;
+		scratch.setSize(scratch.getNumChannels(), numSamples, false, false, true);
 
-		for (int ch = 0; ch < numInputChannels; ++ch)
+		if (canReferTo(inputChannelData, numInputChannels, outputChannelData, numOutputChannels))
 		{
-			if (inputChannelData[ch] != nullptr)
-				buffer.copyFrom(ch, 0, inputChannelData[ch], numSamples);
+			deviceInput.setDataToReferTo(const_cast<float* const*>(inputChannelData), numInputChannels, numSamples);
+			input = &deviceInput;
 		}
-
-		//smartGate.processBlock(buffer,buffer);
-
-
-		inputManager.analyze(buffer);
-
-
-		// 🎙️ 音声レベルチェック
-		if (numInputChannels > 0 && inputChannelData[0] != nullptr)
+		else
 		{
-			auto range = juce::FloatVectorOperations::findMinAndMax(inputChannelData[0], numSamples);
-			if (std::abs(range.getStart()) > 0.001f || std::abs(range.getEnd()) > 0.001f)
+			for (int ch = 0; ch < scratch.getNumChannels(); ++ch)
 			{
-//				DBG("🎙️ Input active | range: "
-//					<< range.getStart() << " ~ " << range.getEnd());
+				if (ch < numInputChannels && inputChannelData[ch] != nullptr)
+					scratch.copyFrom(ch, 0, inputChannelData[ch], numSamples);
+				else
+					scratch.clear(ch, 0, numSamples);
 			}
 		}
-//		if(inputManager.getTriggerEvent().triggerd)
-//			triggerFlag.store(true);
 
-	}
+		//ゲートは解析の前に（トリガーも録音もゲート後の音で揃える）
+		if (gateEnabled.load(std::memory_order_relaxed))
+		{
+			smartGate.processBlock(*input, scratch);
+			input = &scratch;
+		}
 
+		//解析して入力履歴へ積む（ルーパーがプリロールを取り出す時には履歴に必ず残っている）
+		//入力レベルは analyze のついでに InputManager のメーターが測っている
+		inputManager.analyze(*input);
 
-	// ✅ JUCE 7.0.4以前（もしくは別環境）用の後方互換
-	void audioDeviceIOCallback(const float* const* inputChannelData,
-							   int numInputChannels,
-							   float* const* outputChannelData,
-							   int numOutputChannels,
-							   int numSamples) 
-	{
-		juce::ignoreUnused(outputChannelData, numOutputChannels);
-		captureInput(inputChannelData, numInputChannels, numSamples);
-		
+		return *input;
 	}
 
-	void audioDeviceStopped() override
-	{
-		buffer.setSize(0, 0);
-		//DBG("🛑 InputTap stopped");
-	}
+	//process に一度に渡せる最大のサンプル数
+	int getMaxBlockSize() const noexcept { return maxBlockSize; }
+
+	//直前の process で処理したブロック先頭の入力絶対位置
+	juce::int64 getBlockStartSample() const noexcept { return blockStartSample; }
 
-	void getLatestInput(juce::AudioBuffer<float>& dest)
-	{
-		const int channels = juce::jmin(dest.getNumChannels(), buffer.getNumChannels());
-		const int samples  = juce::jmin(dest.getNumSamples(),  buffer.getNumSamples());
-		for (int ch = 0; ch < channels; ++ch)
-			dest.copyFrom(ch, 0, buffer, ch, 0, samples);
-	}
 	void resetTriggerEvent()
 	{
 		auto& trig = inputManager.getTriggerEvent();
@@ -117,29 +109,45 @@ class InputTap : public juce::AudioIODeviceCallback
 	const InputManager& getManager() const noexcept {return inputManager;}
 	juce::TriggerEvent& getTriggerEvent() noexcept {return inputManager.getTriggerEvent();}
 
+	//入力ゲート（パラメータは SmartGate へ直接。どのスレッドからでも）
+	SmartGate& getGate() noexcept { return smartGate; }
+	void setGateEnabled(bool shouldBeEnabled) noexcept { gateEnabled.store(shouldBeEnabled, std::memory_order_relaxed); }
+	bool isGateEnabled() const noexcept { return gateEnabled.load(std::memory_order_relaxed); }
+
+	//入力の処理時間を profiler へ渡す（オーディオ停止中にセット）
+	void setProfiler(RtProfiler* newProfiler) noexcept { profiler = newProfiler; }
+
 private:
-	juce::AudioBuffer<float> buffer;
+	juce::AudioBuffer<float> deviceInput;	//デバイスの入力を参照するだけ（中身を持たない）
+	juce::AudioBuffer<float> scratch;		//ゲートの出力・写した入力
 	InputManager inputManager;
 	SmartGate smartGate;
+	std::atomic<bool> gateEnabled { false };
+	RtProfiler* profiler = nullptr;
 
 	double sampleRate = 44100.0;
+	int maxBlockSize = 1;
+	juce::int64 blockStartSample = 0;
 
-	void captureInput(const float* const* inputChannelData, int numInputChannels, int numSamples)
+	//AudioBuffer がメモリ確保なしで参照できるチャンネル数（これを超えると参照のたびに確保する）
+	static constexpr int maxReferencedChannels = 31;
+
+	//入力をそのまま参照してよいか（出力と同じメモリを指すデバイスでは、ルーパーが出力を消す前に写す必要がある）
+	static bool canReferTo(const float* const* inputs, int numInputs, const float* const* outputs, int numOutputs) noexcept
 	{
-		if (numInputChannels == 0)
-			return;
+		if (numInputs <= 0 || numInputs > maxReferencedChannels)
+			return false;
 
-		buffer.setSize(numInputChannels, numSamples, false, false, true);
-		for (int ch = 0; ch < numInputChannels; ++ch)
+		for (int in = 0; in < numInputs; ++in)
 		{
-			if (inputChannelData[ch] != nullptr)
-				buffer.copyFrom(ch, 0, inputChannelData[ch], numSamples);
+			if (inputs[in] == nullptr)
+				return false;
+
+			for (int out = 0; out < numOutputs; ++out)
+				if (inputs[in] == outputs[out])
+					return false;
 		}
 
-		// 🎙️ Debugログ（入力検知）
-		//auto range = juce::FloatVectorOperations::findMinAndMax(buffer.getReadPointer(0), numSamples);
-		//if (std::abs(range.getStart()) > 0.001f || std::abs(range.getEnd()) > 0.001f)
-		//	DBG("🎙️ InputTap active | range: " << range.getStart() << " ~ " << range.getEnd());
+		return true;
 	}
 };
-
@@ -0,0 +1,246 @@
+/*
+  ==============================================================================
+
+    LatencyCalibrator.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "SimdKernels.h"
+#include <atomic>
+#include <vector>
+
+//------------------------------------------------------------
+// 往復レイテンシ（出力 → ケーブルで入力へ戻す → 入力）の測定
+// テスト信号（ノイズバースト）を出力へ流しながら入力を取り込み、
+// 取り込み終わったら裏のスレッドで相互相関を取ってピークの位置を往復の遅れとする
+//
+// 測った値は「同じコールバックで出力したサンプルが、何サンプル後の入力に現れるか」
+// 測っていない・測れなかった時はデバイスが申告する入力＋出力のレイテンシを使う
+//
+// オーディオスレッドは captureInput（コールバックの頭、デバイスの入力のまま）と
+// renderOutput（コールバックの最後、出力を書き終えた後）を呼ぶだけ
+//------------------------------------------------------------
+class LatencyCalibrator : private juce::Thread
+{
+public:
+	enum class State
+	{
+		idle,
+		armed,		//start() 済み。次のコールバックから流す
+		playing,	//テスト信号を流して入力を取り込み中
+		analysing,	//裏のスレッドで相関を計算中
+		succeeded,
+		failed		//信号が戻ってこない・ピークがはっきりしない
+	};
+
+	static constexpr int testSignalLength = 8192;
+	static constexpr float testSignalLevel = 0.25f;
+	static constexpr int testSignalFadeLength = 64;
+	//これより長い往復は探さない
+	static constexpr double maxLatencyMs = 500.0;
+	//相関のピークが相関全体の RMS の何倍あれば信用するか
+	static constexpr float minConfidence = 8.0f;
+	//戻ってきた信号がこれより小さければ失敗（ケーブルがつながっていない）
+	static constexpr float minCapturedPeak = 0.001f;
+
+	LatencyCalibrator() : juce::Thread("Simplooper latency calibration") {}
+	~LatencyCalibrator() override { stopThread(2000); }
+
+	//===メッセージスレッド===
+
+	//オーディオ停止中に呼ぶ。サンプルレートとバッファサイズが前と同じなら測った値は残す
+	void prepare(double newSampleRate, int newBufferSize, int reportedRoundTripSamples)
+	{
+		stopThread(2000);
+
+		if (newSampleRate != sampleRate || newBufferSize != bufferSize)
+			measuredSamples.store(-1, std::memory_order_relaxed);
+
+		sampleRate = newSampleRate;
+		bufferSize = newBufferSize;
+		reportedSamples.store(juce::jmax(0, reportedRoundTripSamples), std::memory_order_relaxed);
+
+		//テスト信号は毎回同じノイズ（頭と尻だけなめらかに）
+		testSignal.resize((size_t)testSignalLength);
+		juce::Random random(0x5eed);
+		for (int i = 0; i < testSignalLength; ++i)
+		{
+			const int edge = juce::jmin(i, testSignalLength - 1 - i);
+			const float fade = edge < testSignalFadeLength
+				? 0.5f - 0.5f * std::cos(juce::MathConstants<float>::pi * (float)edge / (float)testSignalFadeLength)
+				: 1.0f;
+			testSignal[(size_t)i] = (random.nextFloat() * 2.0f - 1.0f) * testSignalLevel * fade;
+		}
+
+		maxLagSamples = (int)std::ceil(maxLatencyMs * sampleRate / 1000.0);
+		captured.assign((size_t)(testSignalLength + maxLagSamples), 0.0f);
+
+		state.store(measuredSamples.load(std::memory_order_relaxed) >= 0 ? State::succeeded : State::idle,
+					std::memory_order_release);
+	}
+
+	//測定を始める（測定中なら false）。オーディオが動いていれば次のコールバックから流れる
+	bool start()
+	{
+		const auto current = state.load(std::memory_order_acquire);
+		if (current == State::armed || current == State::playing || current == State::analysing || captured.empty())
+			return false;
+
+		stopThread(2000);
+		state.store(State::armed, std::memory_order_release);
+		startThread(juce::Thread::Priority::low);
+		return true;
+	}
+
+	State getState() const noexcept { return state.load(std::memory_order_acquire); }
+	bool isRunning() const noexcept
+	{
+		const auto current = getState();
+		return current == State::armed || current == State::playing || current == State::analysing;
+	}
+
+	//録音の補正に使う往復レイテンシ（測れていれば測った値、なければデバイスの申告）
+	int getRoundTripSamples() const noexcept
+	{
+		const int measured = measuredSamples.load(std::memory_order_relaxed);
+		return measured >= 0 ? measured : reportedSamples.load(std::memory_order_relaxed);
+	}
+
+	//測った値（まだなら -1）とデバイスの申告
+	int getMeasuredSamples() const noexcept { return measuredSamples.load(std::memory_order_relaxed); }
+	int getReportedSamples() const noexcept { return reportedSamples.load(std::memory_order_relaxed); }
+	//最後の測定の相関ピーク÷RMS
+	float getConfidence() const noexcept { return confidence.load(std::memory_order_relaxed); }
+
+	double samplesToMs(int samples) const noexcept { return sampleRate > 0.0 ? samples * 1000.0 / sampleRate : 0.0; }
+
+	//===オーディオスレッド===
+
+	//コールバックの頭で（出力を書く前のデバイスの入力）。全チャンネルを足して取り込む
+	void captureInput(const float* const* inputs, int numInputs, int numSamples) noexcept
+	{
+		auto current = state.load(std::memory_order_acquire);
+
+		if (current == State::armed)
+		{
+			capturePosition = renderPosition = 0;
+			current = State::playing;
+			state.store(current, std::memory_order_release);
+		}
+
+		if (current != State::playing) return;
+
+		const int length = juce::jmin(numSamples, (int)captured.size() - capturePosition);
+		float* dest = captured.data() + capturePosition;
+		juce::FloatVectorOperations::clear(dest, length);
+
+		for (int ch = 0; ch < numInputs; ++ch)
+			if (inputs[ch] != nullptr)
+				juce::FloatVectorOperations::add(dest, inputs[ch], length);
+
+		capturePosition += length;
+
+		//取り込み終わったら裏のスレッドへ（起こさず、向こうが見に来る）
+		if (capturePosition >= (int)captured.size())
+			state.store(State::analysing, std::memory_order_release);
+	}
+
+	//コールバックの最後で。流している間は出力をテスト信号で置き換えて true を返す
+	bool renderOutput(juce::AudioBuffer<float>& output) noexcept
+	{
+		if (state.load(std::memory_order_acquire) != State::playing)
+			return false;
+
+		const int numSamples = output.getNumSamples();
+		const int length = juce::jlimit(0, numSamples, testSignalLength - renderPosition);
+
+		for (int ch = 0; ch < output.getNumChannels(); ++ch)
+		{
+			output.clear(ch, 0, numSamples);
+			if (length > 0)
+				output.copyFrom(ch, 0, testSignal.data() + renderPosition, length);
+		}
+
+		renderPosition += numSamples;
+		return true;
+	}
+
+private:
+	void run() override
+	{
+		while (getState() != State::analysing)
+		{
+			if (threadShouldExit()) return;
+			wait(idleWaitMs);
+		}
+
+		analyse();
+	}
+
+	//lag ごとにテスト信号と取り込んだ音の内積を取り、絶対値のピークを探す（位相が反転していてもよい）
+	void analyse()
+	{
+		float capturedPeak = 0.0f;
+		for (auto sample : captured)
+			capturedPeak = juce::jmax(capturedPeak, std::abs(sample));
+
+		int bestLag = -1;
+		float bestValue = 0.0f;
+		double sumSquares = 0.0;
+
+		for (int lag = 0; lag <= maxLagSamples; ++lag)
+		{
+			if ((lag & 1023) == 0 && threadShouldExit())
+				return;
+
+			const float value = std::abs(simd::dotProduct(testSignal.data(), captured.data() + lag, testSignalLength));
+			sumSquares += (double)value * value;
+
+			if (value > bestValue)
+			{
+				bestValue = value;
+				bestLag = lag;
+			}
+		}
+
+		const double rms = std::sqrt(sumSquares / (double)(maxLagSamples + 1));
+		const float ratio = rms > 0.0 ? (float)(bestValue / rms) : 0.0f;
+		confidence.store(ratio, std::memory_order_relaxed);
+
+		if (capturedPeak < minCapturedPeak || ratio < minConfidence || bestLag < 0)
+		{
+			DBG("⚠️ Latency calibration failed: peak " << capturedPeak << ", confidence " << ratio);
+			state.store(State::failed, std::memory_order_release);
+			return;
+		}
+
+		measuredSamples.store(bestLag, std::memory_order_relaxed);
+		state.store(State::succeeded, std::memory_order_release);
+
+		DBG("⏱ Round-trip latency " << bestLag << " samples (reported " << reportedSamples.load()
+			<< ", confidence " << ratio << ")");
+	}
+
+	static constexpr int idleWaitMs = 10;
+
+	//prepare で作り、測定中は読むだけ
+	double sampleRate = 0.0;
+	int bufferSize = 0;
+	int maxLagSamples = 0;
+	std::vector<float> testSignal;
+	std::vector<float> captured;	//オーディオスレッドが埋め、analysing になってから裏のスレッドが読む
+
+	//オーディオスレッドだけが触る
+	int capturePosition = 0;
+	int renderPosition = 0;
+
+	std::atomic<State> state { State::idle };
+	std::atomic<int> measuredSamples { -1 };
+	std::atomic<int> reportedSamples { 0 };
+	std::atomic<float> confidence { 0.0f };
+
+	JUCE_DECLARE_NON_COPYABLE(LatencyCalibrator)
+};
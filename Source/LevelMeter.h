@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    LevelMeter.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <cmath>
+
+//------------------------------------------------------------
+// 1本分のレベルメーター（ピーク・RMS・クリップ保持）
+// オーディオスレッドがブロックごとに、すでに求めてある二乗和とピークを渡して更新し、
+// 表示用の値をアトミックに置くだけ。UIはいつ読んでもよい（ロックなし・読んでも値は消えない）
+//------------------------------------------------------------
+class LevelMeter
+{
+public:
+	struct Reading
+	{
+		float peak = 0.0f;		//落ちていくピーク（リニア）
+		float rms = 0.0f;		//rmsWindowMs で平均した RMS（リニア）
+		bool clipped = false;	//clipHoldMs 以内にクリップした
+	};
+
+	static constexpr double rmsWindowMs = 300.0;
+	static constexpr double peakFallDbPerSecond = 20.0;
+	static constexpr double clipHoldMs = 2000.0;
+	static constexpr float clipLevel = 0.999f;
+
+	//オーディオ停止中に呼ぶ
+	void prepare(double sampleRate) noexcept
+	{
+		samplesPerMs = sampleRate / 1000.0;
+		peakFallPerSample = (float)(peakFallDbPerSecond / 20.0 * std::log(10.0) / sampleRate);
+		reset();
+	}
+
+	void reset() noexcept
+	{
+		heldPeak = meanSquare = 0.0f;
+		clipHoldSamples = 0;
+		publish();
+	}
+
+	//===オーディオスレッド===
+	//numValues 個（サンプル数×チャンネル数）の二乗和とピークで更新する
+	void addBlock(float peak, float sumSquares, int numValues, int numSamples) noexcept
+	{
+		if (numSamples <= 0) return;
+
+		//ピークはすぐ上がり、ゆっくり落ちる（ブロックの長さに比例して落とす）
+		heldPeak = std::fmax(peak, heldPeak * std::exp(-peakFallPerSample * (float)numSamples));
+
+		const float blockMeanSquare = numValues > 0 ? sumSquares / (float)numValues : 0.0f;
+		const float coeff = 1.0f - std::exp(-(float)numSamples / (float)(rmsWindowMs * samplesPerMs));
+		meanSquare += coeff * (blockMeanSquare - meanSquare);
+
+		if (peak >= clipLevel)
+			clipHoldSamples = (int)(clipHoldMs * samplesPerMs);
+		else
+			clipHoldSamples = juce::jmax(0, clipHoldSamples - numSamples);
+
+		publish();
+	}
+
+	//===どのスレッドからでも===
+	Reading read() const noexcept
+	{
+		return { publishedPeak.load(std::memory_order_relaxed),
+				 publishedRms.load(std::memory_order_relaxed),
+				 publishedClip.load(std::memory_order_relaxed) };
+	}
+
+	//表示用（-60dB 未満は -60dB）
+	static float toDecibels(float level) noexcept { return juce::Decibels::gainToDecibels(level, -60.0f); }
+
+private:
+	void publish() noexcept
+	{
+		//極小値はデノーマルにならないよう0に丸める
+		if (heldPeak < 1.0e-6f) heldPeak = 0.0f;
+		if (meanSquare < 1.0e-12f) meanSquare = 0.0f;
+
+		publishedPeak.store(heldPeak, std::memory_order_relaxed);
+		publishedRms.store(std::sqrt(meanSquare), std::memory_order_relaxed);
+		publishedClip.store(clipHoldSamples > 0, std::memory_order_relaxed);
+	}
+
+	//オーディオスレッドだけが触る
+	double samplesPerMs = 44.1;
+	float peakFallPerSample = 0.0f;
+	float heldPeak = 0.0f;
+	float meanSquare = 0.0f;
+	int clipHoldSamples = 0;
+
+	std::atomic<float> publishedPeak { 0.0f };
+	std::atomic<float> publishedRms { 0.0f };
+	std::atomic<bool> publishedClip { false };
+};
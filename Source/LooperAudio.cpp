@@ -1,19 +1,110 @@
 #include "LooperAudio.h"
 
+namespace
+{
+	//センターで左右とも 1.0 になるバランス型の等パワーパン
+	void panToGains(float gain, float pan, bool muted, float& left, float& right) noexcept
+	{
+		if (muted)
+		{
+			left = right = 0.0f;
+			return;
+		}
+
+		const float halfPi = juce::MathConstants<float>::halfPi;
+		left  = gain * std::cos(juce::jmax(0.0f,  pan) * halfPi);
+		right = gain * std::cos(juce::jmax(0.0f, -pan) * halfPi);
+	}
+}
+
 
-LooperAudio::LooperAudio(double sr, int max)
-: sampleRate(sr), maxSamples(max)
+LooperAudio::LooperAudio(size_t storageBudgetBytes)
 {
+	//録音用のページを予算分だけ最初に1度だけ確保（トラックは録音が進んだ分だけ借りる）
+	const size_t maxPages = (size_t)std::numeric_limits<int>::max() / pageSize;
+	const int numPages = (int)juce::jlimit((size_t)1, maxPages,
+										   storageBudgetBytes / PageArena::bytesPerPage(numStorageChannels, pageSize));
+	pageArena.prepare(numStorageChannels, pageSize, numPages);
+	trackPageCapacity = numPages;
+
+	//UNDO/REDO はページ表だけ（中身はトラックと入れ替える）
+	undoHistory.prepare(pageArena, numPages, numPages * historyBudgetPercent / 100);
+
+	slotById.fill(-1);
 }
 
 LooperAudio::~LooperAudio()
 {
+	saveThread.stopThread(10000); //書きかけの保存は書き終えてから（ページをアリーナへ返す）
+	resampleThread.stopThread(10000); //変換しかけは取りやめてページを返す（伸ばすスレッドを止めることがあるので先に）
+	stretchThread.stopThread(10000); //伸ばしかけは取りやめてページを返す
+	sessionPeakThread.stopThread(10000); //マップを外す前に
+	mixWorkers.stop();
+	diskStreamer.stop(); //アリーナより先に止める
 	//removeListener(listeners);
 }
 
 void LooperAudio::prepareToPlay(int samplesPerBlockExpected, double sr)
 {
+	//デバイスのレートが変わったら、ループを新しいレートへ裏で変換する（ここでは待たない。失敗したら全トラックを止め、次の prepareToPlay で変換し直す）
+	//変換中にまた変わったら、裏のスレッドが新しいレートで変換し直す
+	const double contentRate = contentSampleRate.load();
+	if (isResamplePending())
+		resampleTargetRate.store(sr);
+	else if (contentRate > 0.0 && contentRate != sr)
+		startResample(contentRate, sr);
+	else
+		contentSampleRate.store(sr);
+
 	sampleRate = sr;
+
+	transferScratch.setSize(numStorageChannels, pageSize);
+	transferScratch.clear();
+
+	mixSmoothingSamples = juce::jmax(1, juce::roundToInt(sr * mixSmoothingMs / 1000.0));
+	streamingReadAheadPages = (int)std::ceil(streamingReadAheadSeconds * sr / pageSize);
+
+	//止まっていた所から鳴り始めるので、モニターはフェードせず今の設定から始める
+	monitorRamp.snapTo(monitorMuted.load(std::memory_order_relaxed) ? 0.0f : monitorGain.load(std::memory_order_relaxed));
+
+	for (auto& meter : trackMeters)
+		meter.prepare(sr);
+
+	//つなぎ目の等パワーのフェード表（つなぎ目の前後に半分ずつ。1ページを超えない）
+	seamFadeLength = juce::jlimit(0, pageSize, juce::roundToInt(sr * seamFadeMs / 1000.0)) & ~1;
+	seamFadeIn.resize((size_t)seamFadeLength);
+	seamFadeOut.resize((size_t)seamFadeLength);
+	for (int i = 0; i < seamFadeLength; ++i)
+	{
+		const double angle = juce::MathConstants<double>::halfPi * (i + 0.5) / seamFadeLength;
+		seamFadeIn[(size_t)i] = (float)std::sin(angle);
+		seamFadeOut[(size_t)i] = (float)std::cos(angle);
+	}
+	seamPreRolls.assign((size_t)(maxTracks * numStorageChannels * (seamFadeLength / 2)), 0.0f);
+	seamCurrent.setSize(numStorageChannels, juce::jmax(1, seamFadeLength));
+	seamOther.setSize(numStorageChannels, juce::jmax(1, seamFadeLength));
+	for (auto& job : seamJobs)
+		job = {};
+	numPendingSeams = 0;
+
+	//テンポの格子は新しいサンプルレートで作り直す
+	appliedTempoVersion = -1;
+
+	for (auto& bus : mixBuses)
+	{
+		bus.setSize(numStorageChannels, samplesPerBlockExpected);
+		bus.clear();
+	}
+
+	mixWorkers.start(requestedMixWorkers, samplesPerBlockExpected, sr);
+}
+
+void LooperAudio::processBlock(juce::AudioBuffer<float>& output, const juce::AudioBuffer<float>& input,
+							   juce::int64 blockStartSample)
+{
+	//入力はコピーせずそのまま録音・モニターに使う（入力履歴の通算位置とそろえる）
+	currentSamplePosition = (long)blockStartSample;
+	processBlock(output, input);
 }
 
 void LooperAudio::processBlock(juce::AudioBuffer<float>& output,
@@ -21,270 +112,2419 @@ void LooperAudio::processBlock(juce::AudioBuffer<float>& output,
 {
 	// 録音・再生処理
 	output.clear();
-	recordIntoTracks(input);
-	mixTracksToOutput(output);
 
-	//入力音をモニター出力
-	const int numChannels = juce::jmin(input.getNumChannels(), output.getNumChannels());
 	const int numSamples = input.getNumSamples();
+	const long blockStart = currentSamplePosition;
+
+	{
+		RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::diskService);
+
+		//ディスクとのページのやり取り（届いたページを置き、先読み・書き出し・追い出しを頼む）
+		serviceDiskStreaming();
+
+		//読み込んだセッションのピークができた分を波形へ
+		applySessionPeaks();
 
-	for (int ch =0; ch < numChannels; ++ch)
+		//サンプルレートの変換が終わっていればここで入れ替える
+		if (resampleState.load(std::memory_order_acquire) == ResampleState::waitingForSwap)
+			applyResample();
+
+		//変換できなかったループは前のレートのままなので、違う速さで鳴らさないよう止める
+		if (stopForFailedResample.load(std::memory_order_relaxed) && stopForFailedResample.exchange(false, std::memory_order_acq_rel))
+		{
+			const int count = numTracks.load(std::memory_order_acquire);
+			for (int slot = 0; slot < count; ++slot)
+				tracks[(size_t)slot].isPlaying = false;
+		}
+
+		//保存の依頼があればブロック境界で中身を写す（録音中は録り終えるまで、レートの変換中は終わるまで待つ）
+		if (snapshotRequested.load(std::memory_order_relaxed) && ! isRecordingActive() && ! isResamplePending())
+		{
+			bool expected = true;
+			if (snapshotRequested.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+			{
+				takeSessionSnapshot();
+				snapshotReady.store(true, std::memory_order_release);
+			}
+		}
+
+		//テンポ変更の依頼があれば元のページを写す（録音中・つなぎ目を書く前は待つ）
+		if (stretchRequested.load(std::memory_order_relaxed) && ! isRecordingActive() && numPendingSeams == 0 && ! isResamplePending())
+		{
+			bool expected = true;
+			if (stretchRequested.compare_exchange_strong(expected, false, std::memory_order_acq_rel))
+				takeStretchSnapshot();
+		}
+	}
+
+	//サンプルレートの変換中は前のレートの音を鳴らさず、マスターも進めない
+	//（コマンドはキューに残しておき、入れ替えた後の位置でクオンタイズする）
+	const bool holdForResample = isResamplePending();
+
+	//コマンドの実行位置でブロックを区切り、区間ごとに録音・再生する
+	if (! holdForResample)
+	{
+		RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::commands);
+		updateTempoGrid(blockStart);
+		collectCommands(blockStart);
+	}
+
+	int offset = holdForResample ? numSamples : 0;
+	while (offset < numSamples)
+	{
+		currentSamplePosition = blockStart + offset;
+
+		int segmentEnd = numSamples;
+		{
+			RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::commands);
+			segmentEnd = applyDueCommands(blockStart, offset, numSamples);
+
+			//1周録り終えたトラックをこの位置で再生へ切り替え、次のパンチアウト位置でも区切る
+			finishCompletedRecordings();
+			segmentEnd = juce::jmin(segmentEnd, offset + samplesUntilNextPunchOut(segmentEnd - offset));
+
+			//伸ばし終えた音はループの頭で入れ替える（そこで区切る）
+			if (stretchState.load(std::memory_order_acquire) == StretchState::waitingForLoopStart)
+			{
+				if (masterReadPosition == 0 || masterLoopLength <= 0 || contentEdits != stretchSourceEdits)
+					applyStretch();
+				else
+					segmentEnd = juce::jmin(segmentEnd, offset + (masterLoopLength - masterReadPosition));
+			}
+		}
+
+		const int segmentLength = segmentEnd - offset;
+		{
+			RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::record);
+			recordIntoTracks(input, offset, segmentLength);
+		}
+		{
+			RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::mix);
+			mixTracksToOutput(output, offset, segmentLength);
+		}
+
+		offset = segmentEnd;
+	}
+	currentSamplePosition = blockStart;
+
+	//入力音をモニター出力
 	{
-		output.addFrom(ch, 0, input, ch, 0, numSamples);
+		RtProfiler::ScopedStage stage(profiler, RtProfiler::Stage::monitor);
+		addMonitorInput(output, input, numSamples);
 	}
 
+	currentSamplePosition += numSamples;
+	publishedSamplePosition.store(currentSamplePosition, std::memory_order_relaxed);
+
+	RtProfiler::ScopedStage housekeeping(profiler, RtProfiler::Stage::housekeeping);
+
+	//捨てた履歴のページを少しずつアリーナへ返す
+	undoHistory.collectGarbage(historyReleasePagesPerBlock);
+
+	//録り終えたループのつなぎ目を書く（オーバーシュートがそろった分から、1ブロックに数本まで）
+	applyPendingSeams();
+
+	publishWaveformTransport();
+	publishTrackLevels(numSamples);
+
 //	float rms = output.getRMSLevel(0, 0, output.getNumSamples());
 //	if (rms > 0.001f)
 //		DBG("🔊 Output RMS: " << rms);
 }
 
+//------------------------------------------------------------
+// コマンド処理
+
+bool LooperAudio::postCommand(const Command& command)
+{
+	if (commandQueue.push(command))
+		return true;
+
+	DBG("⚠️ Looper command queue overflow");
+	return false;
+}
+
+bool LooperAudio::postCommandFromAudioThread(const Command& command) noexcept
+{
+	if (numLocalCommands >= maxLocalCommands)
+	{
+		scheduleOverflowCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	localCommands[(size_t)numLocalCommands++] = command;
+	return true;
+}
+
+// キューに届いたコマンドを時刻順の実行待ちリストへ移す（オーディオスレッド）
+void LooperAudio::collectCommands(long blockStart)
+{
+	//オーディオスレッド自身が頼んだ分も同じ決め方で並べる
+	for (int i = 0; i < numLocalCommands; ++i)
+		scheduleCommand(localCommands[(size_t)i], blockStart);
+	numLocalCommands = 0;
+
+	while (numScheduledCommands < maxScheduledCommands)
+	{
+		Command command;
+		if (! commandQueue.pop(command))
+			break;
+
+		scheduleCommand(command, blockStart);
+	}
+
+	if (numScheduledCommands == maxScheduledCommands && commandQueue.getNumReady() > 0)
+		scheduleOverflowCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LooperAudio::scheduleCommand(Command command, long blockStart) noexcept
+{
+	if (numScheduledCommands >= maxScheduledCommands)
+	{
+		scheduleOverflowCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	//時刻指定なしはこのブロックの先頭（クオンタイズ中の録音・再生は次の拍・小節の頭）
+	//過ぎてしまったものは先頭で実行
+	if (command.sampleTime < 0)
+		command.sampleTime = getQuantizedTime(command.type, blockStart);
+	else if (command.sampleTime < blockStart)
+	{
+		lateCommandCount.fetch_add(1, std::memory_order_relaxed);
+		command.sampleTime = blockStart;
+	}
+
+	//挿入ソート（同時刻なら届いた順を保つ）
+	int i = numScheduledCommands++;
+	while (i > 0 && scheduledCommands[(size_t)i - 1].sampleTime > command.sampleTime)
+	{
+		scheduledCommands[(size_t)i] = scheduledCommands[(size_t)i - 1];
+		--i;
+	}
+	scheduledCommands[(size_t)i] = command;
+}
+
+// 時刻指定なしのコマンドの実行位置（録音・再生だけを格子の次の区切りへ送る）
+long LooperAudio::getQuantizedTime(Command::Type type, long blockStart) const noexcept
+{
+	const bool isTransport = type == Command::Type::startRecording || type == Command::Type::stopRecording
+						  || type == Command::Type::startPlaying || type == Command::Type::stopPlaying;
+
+	if (! isTransport || ! isQuantizing())
+		return blockStart;
+
+	const auto gridDivision = quantize.load(std::memory_order_relaxed) == Quantize::bar ? TempoGrid::Division::bar
+																						: TempoGrid::Division::beat;
+
+	//マスターがあればその頭が原点（マスターは小節の整数倍なので、ループの終わりも区切りとして扱う）
+	if (masterLoopLength > 0)
+	{
+		const juce::int64 position = masterReadPosition;
+		const auto next = juce::jmin<juce::int64>(tempoGrid.getNextBoundary(position, gridDivision), masterLoopLength);
+		return blockStart + (long)(next - position);
+	}
+
+	const juce::int64 position = blockStart - freeGridOrigin;
+	return blockStart + (long)(tempoGrid.getNextBoundary(position, gridDivision) - position);
+}
+
+bool LooperAudio::isQuantizing() const noexcept
+{
+	return quantize.load(std::memory_order_relaxed) != Quantize::off && tempoGrid.isActive();
+}
+
+// テンポ・拍子が変わっていたら格子を作り直す（ブロックの頭で。設定が変わった時だけ）
+void LooperAudio::updateTempoGrid(long blockStart) noexcept
+{
+	const int version = tempoVersion.load(std::memory_order_acquire);
+	if (version == appliedTempoVersion) return;
+	appliedTempoVersion = version;
+
+	tempoGrid.set(sampleRate,
+				  tempoBpm.load(std::memory_order_relaxed),
+				  tempoBeatsPerBar.load(std::memory_order_relaxed),
+				  tempoBeatUnit.load(std::memory_order_relaxed));
+	freeGridOrigin = blockStart;
+}
+
+// offset の時点で期限の来たコマンドを実行し、次のコマンドの位置（区間の終わり）を返す
+int LooperAudio::applyDueCommands(long blockStart, int offset, int numSamples)
+{
+	const long now = blockStart + offset;
+	int executed = 0;
+
+	while (executed < numScheduledCommands && scheduledCommands[(size_t)executed].sampleTime <= now)
+	{
+		currentSamplePosition = now;
+		executeCommand(scheduledCommands[(size_t)executed]);
+		++executed;
+	}
+
+	if (executed > 0)
+	{
+		for (int i = executed; i < numScheduledCommands; ++i)
+			scheduledCommands[(size_t)(i - executed)] = scheduledCommands[(size_t)i];
+		numScheduledCommands -= executed;
+	}
+
+	if (numScheduledCommands > 0 && scheduledCommands[0].sampleTime < blockStart + numSamples)
+		return (int)(scheduledCommands[0].sampleTime - blockStart);
+
+	return numSamples;
+}
+
+void LooperAudio::executeCommand(const Command& command)
+{
+	switch (command.type)
+	{
+		case Command::Type::startRecording:      startRecording(command.trackId); break;
+		case Command::Type::stopRecording:       stopRecording(command.trackId); break;
+		case Command::Type::startPlaying:        startPlaying(command.trackId); break;
+		case Command::Type::stopPlaying:         stopPlaying(command.trackId); break;
+		case Command::Type::clearTrack:          clearTrack(command.trackId); break;
+		case Command::Type::masterPositionReset: masterPositionReset(); break;
+		case Command::Type::undo:                undoLastRecording(); break;
+		case Command::Type::redo:                redoLastUndo(); break;
+	}
+}
+
 //------------------------------------------------------------
 // トラック管理
+// メッセージスレッド専用。スロットを埋めてから numTracks を進めるので、
+// オーディオスレッドからは完成したスロットしか見えない
 void LooperAudio::addTrack(int trackId)
 {
-	TrackData track;
-	track.buffer.setSize(2, maxSamples);
-	track.buffer.clear();
-	tracks[trackId] = std::move(track);
+	const int slot = numTracks.load();
+
+	if (! juce::isPositiveAndBelow(trackId, maxTrackIds) || findSlot(trackId) >= 0 || slot >= maxTracks)
+	{
+		jassertfalse;
+		return;
+	}
+
+	//ページ表だけ用意する（サンプルのページは録音時に取る）。履歴と入れ替えられるよう同じ大きさにする
+	trackStorage[(size_t)slot].pages.prepare(pageArena, trackPageCapacity, diskStreamer.isRunning());
+
+	tracks[(size_t)slot] = TrackData();
+	tracks[(size_t)slot].trackId = trackId;
+	trackMeters[(size_t)slot].reset();
+	seamJobs[(size_t)slot] = {};
+	slotById[(size_t)trackId] = slot;
+	prepareWaveform(slot);
+
+	numTracks.store(slot + 1, std::memory_order_release);
 }
 
 void LooperAudio::startRecording(int trackId)
 {
-	//履歴に追加
+	const int slot = findSlot(trackId);
+	if (slot < 0) return;
+
+	//今の中身を履歴へ移す（トラックは空のページ表から録り直す）
 	backupTrackBeforeRecord(trackId);
 
-	auto& track = tracks[trackId];
+	auto& track = tracks[(size_t)slot];
 	track.isRecording = true;
 	track.isPlaying     = false;
 	track.recordLength  = 0;
 
-	//マスターが再生中なら、その位置から録音開始
-	if (masterLoopLength > 0 && tracks.find(masterTrackId) != tracks.end() &&tracks[masterTrackId].isPlaying)
+	//マスターがあれば頼まれた長さの比で録る（ページ表に入らなければ倍数を減らす。マスターになる録音は1倍）
+	track.lengthRatio = {};
+	if (masterLoopLength > 0)
 	{
-		//マスターの位置に同期させる
-		track.writePosition = masterReadPosition;
-		track.recordStartSample = masterReadPosition;
-		DBG("🎬 Start recording track " << trackId
-			<< " aligned with master at position " << masterReadPosition);
+		track.lengthRatio = mixParams[(size_t)slot].lengthRatio.load(std::memory_order_relaxed);
+		while (track.lengthRatio.multiple > 1
+			   && getLoopLengthFor(masterLoopLength, track.lengthRatio) > trackStorage[(size_t)slot].pages.getCapacity())
+			track.lengthRatio.multiple /= 2;
+	}
 
-	}//TriggerEventが有効なら記録開始位置として反映
-	else if(triggerRef && triggerRef->triggerd)
+	//マスターが再生中なら、その位置から録音開始
+	const int masterSlot = findSlot(masterTrackId);
+	if (masterLoopLength > 0 && masterSlot >= 0 && tracks[(size_t)masterSlot].isPlaying)
+	{
+		//マスターの時計から出したこのトラックの位置に同期させる
+		//いま届く入力は往復レイテンシ分だけ前に出力した音に合わせて弾かれたものなので、その位置へ書く
+		//1/n のトラックは周の長さが1サンプル違うことがあるので、録り始めた周の折り返しで1周とする
+		const int latency = recordLatencySamples.load(std::memory_order_relaxed) % getRecordLoopLength(slot);
+		const auto point = getLoopPoint(track, getMasterClock() - latency);
+
+		track.writePosition = point.position;
+		track.recordFirstWritePosition = point.position;
+		track.recordStartSample = currentSamplePosition;
+		track.recordClockLag = latency;
+		track.recordTakeLength = point.position + point.samplesToWrap;
+
+	}//TriggerEventが有効ならアタック開始位置から録音（過ぎた分は履歴から埋め戻す）
+	//クオンタイズ中はこのコマンドが格子の区切りで実行されているので、アタックではなく区切りから録る
+	else if(triggerRef && triggerRef->triggerd && triggerRef->absIndex >= 0 && ! isQuantizing())
 	{
-		track.recordStartSample = static_cast<int>(triggerRef->absIndex) ;
-		track.writePosition = juce::jlimit(0, maxSamples -1, (int)triggerRef->absIndex);
-		DBG("🎬 Start recording track " << trackId
-			<< " triggered at " << triggerRef->absIndex);
+		track.recordClockLag = -1;
+		track.readPosition  = 0;
+		track.writePosition = 0;
+		track.recordFirstWritePosition = 0;
+		track.recordStartSample = triggerRef->absIndex;
+		backfillPreRoll(slot);
 	}else
 	{
+		track.recordClockLag = -1;
 		track.readPosition  = 0;
 		track.writePosition= 0;
-		track.recordStartSample = 0;
-
-		DBG("🎬 Start recording track " << trackId << " from beginning");
+		track.recordFirstWritePosition = 0;
+		track.recordStartSample = currentSamplePosition;
 	}
-	track.buffer.clear();
 
-	listeners.call([&] (Listener& l) { l.onRecordingStarted(trackId); });
+	captureSeamPreRoll(slot);
+	notifyListeners(PendingEvent::Type::recordingStarted, trackId);
 }
 //------------------------------------------------------------
 
 
 void LooperAudio::stopRecording(int trackId)
 {
-	auto& track = tracks[trackId];
+	const int slot = findSlot(trackId);
+	if (slot < 0) return;
+
+	//録り終えたトラックに Stop が来ても確定し直さない（つなぎ目のフェードが二重にかかる）
+	auto& track = tracks[(size_t)slot];
+	if (! track.isRecording) return;
 	track.isRecording = false;
 
 	// 現在の録音長を保持
-	const int recordedLength = track.writePosition;
+	const int recordedLength = track.recordLength;
 	if (recordedLength <= 0) return;
 
 	if (masterLoopLength <= 0)
 	{
-		// 録音長をそのままマスター長に採用
+		// 録音長をそのままマスター長に採用（テンポの格子があれば一番近い小節数に丸める）
 		masterTrackId = trackId;
 		masterLoopLength = recordedLength;
-		track.recordLength = masterLoopLength;
+		if (tempoGrid.isActive())
+			masterLoopLength = tempoGrid.snapLengthToBars(recordedLength, trackStorage[(size_t)slot].pages.getCapacity(),
+														  track.recordStartSample - freeGridOrigin);
+
+		//長すぎた分は捨て、足りない分は無音のまま回す
+		track.recordLength = juce::jmin(recordedLength, masterLoopLength);
 		track.lengthInSample = masterLoopLength;
 		masterStartSample = track.recordStartSample;
 
-		DBG("🎛 Master loop length set to " << masterLoopLength
-			<< " samples | recorded=" << recordedLength
-			<< " | masterStart=" << masterStartSample);
+		//格子に乗せたまま回すため、録音を始めてからの経過どおりの位置から再生する
+		//（丸めなければ経過はちょうど1周で、今までどおり頭から）
+		masterCycle = 0;
+		if (tempoGrid.isActive())
+			masterReadPosition = (int)((currentSamplePosition - masterStartSample) % masterLoopLength);
+
 		//return;
 	}else
 	{
+		// 🎯 録音はマスター位相どおりに書いてあり、録っていない部分は録音開始時に無音化済み
+		const int loopLength = getRecordLoopLength(slot);
+		int copyLen = juce::jmin(recordedLength, loopLength);
 
-		juce::AudioBuffer<float> aligned;
-		aligned.setSize(2, masterLoopLength,false,false,true);
-		aligned.clear();
-
-		const int copyLen = juce::jmin(recordedLength, masterLoopLength);
-
-		aligned.copyFrom(0, 0, track.buffer, 0, 0, copyLen);
-		aligned.copyFrom(1, 0, track.buffer, 1, 0, copyLen);
-
+		//短い周で1周録り終えたら、長い周にだけ回ってくる最後の1サンプルは手前の音を延ばして埋める
+		if (copyLen < loopLength && copyLen >= getRecordTakeLength(slot) && loopLength >= 2)
+		{
+			readLoopRange(trackStorage[(size_t)slot].pages, loopLength, loopLength - 2, transferScratch, 0, 1);
+			writeLoopRange(slot, loopLength, loopLength - 1, transferScratch, 0, 1);
+			copyLen = loopLength;
+		}
 
-		// 🎯 整列済みループを保存
-		track.buffer.makeCopyOf(aligned);
-		track.lengthInSample = masterLoopLength;
+		track.lengthInSample = loopLength;
 		track.recordLength = copyLen;
-
-		DBG("🟢 Track " << trackId << ": aligned to master (length " << masterLoopLength << ")");
 	}
 
-	listeners.call([&] (Listener& l){ l.onRecordingStopped(trackId); });
+	scheduleSeam(slot);
+	notifyListeners(PendingEvent::Type::recordingStopped, trackId);
 }
 
 void LooperAudio::startPlaying(int trackId)
 {
-	if (auto it = tracks.find(trackId); it != tracks.end())
+	if (const int slot = findSlot(trackId); slot >= 0)
 	{
-		auto& track = it->second;
+		auto& track = tracks[(size_t)slot];
 		track.isPlaying = true;
 
-		// 🔥 再生開始位置をマスター位置に合わせる
+		//止まっている間に変えたミキサー設定はランプなしで反映
+		updateMixTargets(slot, true);
+
+		// 🔥 再生開始位置をマスター位置に合わせる（以降もミックスのたびにマスターの時計から出す）
 		if (masterLoopLength > 0)
 		{
-			track.readPosition = masterReadPosition % masterLoopLength;
+			track.readPosition = getLoopPoint(track, getMasterClock()).position;
 		}
 		else
 		{
 			track.readPosition = 0;
 		}
-
-		DBG("▶️ Start playing track " << trackId
-			<< " aligned to master at " << track.readPosition);
 	}
 }
 
 
 void LooperAudio::stopPlaying(int trackId)
 {
-	if (auto it = tracks.find(trackId); it != tracks.end())
-		it->second.isPlaying = false;
+	if (const int slot = findSlot(trackId); slot >= 0)
+		tracks[(size_t)slot].isPlaying = false;
 }
 
 void LooperAudio::clearTrack(int trackId)
 {
-	if (auto it = tracks.find(trackId); it != tracks.end())
-		it->second.buffer.clear();
+	//消した中身は履歴に残るので UNDO で戻せる
+	if (findSlot(trackId) >= 0)
+		backupTrackBeforeRecord(trackId);
 }
 
 
 // 録音・再生処理
 
 
-void LooperAudio::recordIntoTracks(const juce::AudioBuffer<float>& input)
+void LooperAudio::recordIntoTracks(const juce::AudioBuffer<float>& input, int startSample, int numSamples)
 {
+	const int count = numTracks.load(std::memory_order_acquire);
 
-	for (auto& [id, track] : tracks)
+	for (int slot = 0; slot < count; ++slot)
 	{
+		auto& track = tracks[(size_t)slot];
 		if (!track.isRecording) continue;
 
+		auto& pages = trackStorage[(size_t)slot].pages;
 
-		const int numChannels = juce::jmin(input.getNumChannels(), track.buffer.getNumChannels());
-		const int numSamples  = input.getNumSamples();
+		// 🎯 録音開始位置がこの区間の途中（または先）ならそこまで飛ばす
+		const int startOffset = (int)juce::jlimit(0L, (long)numSamples, track.recordStartSample - currentSamplePosition);
+		const int available = numSamples - startOffset;
+		if (available <= 0) continue;
 
-		const int loopLength = (masterLoopLength > 0) ? masterLoopLength : track.buffer.getNumSamples();
+		const int loopLength = getRecordLoopLength(slot);
 
-		int remaining = loopLength - track.writePosition;
+		// 🔚 1周分を超えては録らない（区間はパンチアウト位置で区切られている）
+		const int samplesToRecord = juce::jmin(available, getRecordTakeLength(slot) - track.recordLength);
+		if (samplesToRecord <= 0) continue;
 
-		int samplesToCopy = juce::jmin(numSamples, remaining);
+		// 🧮 書き込み位置をループに沿って進める（マスター途中からの録音は頭に回り込む）
+		//マスターに合わせて録るトラックは、再生と同じくマスターの時計から位置と折り返しを出す
+		int written = 0;
+		while (written < samplesToRecord)
+		{
+			int chunk = 0;
+			if (track.recordClockLag >= 0 && masterLoopLength > 0)
+			{
+				const auto point = getLoopPoint(track, getMasterClock() + startOffset + written - track.recordClockLag);
+				track.writePosition = point.position;
+				chunk = juce::jmin(samplesToRecord - written, point.samplesToWrap);
+			}
+			else
+			{
+				if (track.writePosition >= loopLength)
+					track.writePosition = 0;
+
+				chunk = juce::jmin(samplesToRecord - written, loopLength - track.writePosition);
+			}
+
+			//ページは書き込む位置に来た時だけアリーナから取る
+			if (const int dropped = pages.write(input, startSample + startOffset + written, track.writePosition, chunk); dropped > 0)
+			{
+				//ページが尽きたら古い履歴を手放して次のブロックに備える
+				droppedRecordSamples.fetch_add((juce::uint32)dropped, std::memory_order_relaxed);
+				undoHistory.shedOldest();
+			}
+
+			publishWaveform(slot, track.writePosition / pageSize, (track.writePosition + chunk - 1) / pageSize + 1);
+
+			track.writePosition += chunk;
+			written += chunk;
+		}
 
-		for(int ch = 0; ch < numChannels; ++ch)
-			track.buffer.copyFrom(ch, track.writePosition, input, ch, 0, samplesToCopy);
+		track.recordLength += samplesToRecord;
+	}
 
-		// 🧮 書き込み位置をループに沿って進める
+}
 
-		track.writePosition += samplesToCopy;
+// 1周分録り終えたトラックを、ちょうどその位置で停止→再生へ切り替える
+void LooperAudio::finishCompletedRecordings()
+{
+	const int count = numTracks.load(std::memory_order_acquire);
 
-		// 🔚 もし録音が1周分終わったら止める
-		track.recordLength += numSamples;
-		if (track.recordLength >= loopLength)
-		{
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		if (!track.isRecording) continue;
 
-			stopRecording(id);
+		if (track.recordLength < getRecordTakeLength(slot)) continue;
 
+		const int id = track.trackId;
+		stopRecording(id);
+		startPlaying(id);
+	}
+}
 
-			startPlaying(id);
+// 現在位置から、いずれかの録音が1周に達するまでのサンプル数（最大 maxSamplesAhead）
+int LooperAudio::samplesUntilNextPunchOut(int maxSamplesAhead) const
+{
+	int result = maxSamplesAhead;
+	const int count = numTracks.load(std::memory_order_acquire);
 
-			DBG("✅ Track " << id << " finished seamless loop (" << loopLength << " samples)");
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		if (!track.isRecording) continue;
 
-		}
+		const long startOffset = juce::jmax(0L, track.recordStartSample - currentSamplePosition);
+		const long untilEnd = startOffset + (getRecordTakeLength(slot) - track.recordLength);
 
+		if (untilEnd < result)
+			result = (int)untilEnd;
 	}
 
+	return juce::jmax(1, result);
 }
-void LooperAudio::mixTracksToOutput(juce::AudioBuffer<float>& output)
+// トリガー位置が処理中ブロックより前なら、その間を入力履歴からコピーする
+void LooperAudio::backfillPreRoll(int slot)
 {
-	const int numSamples = output.getNumSamples();
+	auto& track = tracks[(size_t)slot];
+	auto& pages = trackStorage[(size_t)slot].pages;
+
+	const long preRoll = currentSamplePosition - track.recordStartSample;
+	if (preRoll <= 0 || inputHistory == nullptr || transferScratch.getNumSamples() == 0) return;
+
+	const int length = (int)juce::jmin(preRoll, (long)pages.getCapacity());
 
-	for (auto& [id, track] : tracks)
+	//中継バッファ1枚分ずつページへ移す（履歴から消えている古い部分は無音のまま、位置は保つ）
+	for (int done = 0; done < length;)
 	{
-		if (!track.isPlaying) continue;
+		const int chunk = juce::jmin(length - done, transferScratch.getNumSamples());
+
+		transferScratch.clear();
+		inputHistory->read(track.recordStartSample + done, transferScratch, 0, chunk);
+
+		if (const int dropped = pages.write(transferScratch, 0, done, chunk); dropped > 0)
+			droppedRecordSamples.fetch_add((juce::uint32)dropped, std::memory_order_relaxed);
+
+		done += chunk;
+	}
+
+	track.writePosition = length;
+	track.recordLength  = length;
+
+	publishWaveform(slot, 0, (length + pageSize - 1) / pageSize);
+}
+
+//------------------------------------------------------------
+// ループのつなぎ目
+
+//録音開始位置の手前 seamFadeLength/2 を控えておく（1周後には入力履歴から消えている）
+void LooperAudio::captureSeamPreRoll(int slot)
+{
+	const int half = seamFadeLength / 2;
+	if (half <= 0 || inputHistory == nullptr) return;
+
+	const auto& track = tracks[(size_t)slot];
+	transferScratch.clear(0, half);
+	inputHistory->read(track.recordStartSample - half, transferScratch, 0, half);
+
+	for (int ch = 0; ch < numStorageChannels; ++ch)
+		juce::FloatVectorOperations::copy(seamPreRolls.data() + ((size_t)slot * numStorageChannels + (size_t)ch) * (size_t)half,
+										  transferScratch.getReadPointer(ch), half);
+}
+
+void LooperAudio::scheduleSeam(int slot)
+{
+	const auto& track = tracks[(size_t)slot];
+	if (seamFadeLength <= 0 || masterLoopLength <= 0) return;
+
+	auto& job = seamJobs[(size_t)slot];
+	if (! job.pending) ++numPendingSeams;
+
+	//つなぎ目はトラック自身の長さで回る位置に書く
+	const int loopLength = getPlaybackLoopLength(slot);
+	job.pending = true;
+	job.fullLoop = track.recordLength >= loopLength;
+	job.recordStartSample = track.recordStartSample;
+	job.seamPosition = track.recordFirstWritePosition % loopLength;
+	job.length = juce::jmin(track.recordLength, loopLength);
+	job.loopLength = loopLength;
+	job.takeLength = getRecordTakeLength(slot);
+}
+
+void LooperAudio::cancelSeam(int slot) noexcept
+{
+	auto& job = seamJobs[(size_t)slot];
+	if (job.pending) --numPendingSeams;
+	job = {};
+}
+
+void LooperAudio::applyPendingSeams()
+{
+	if (numPendingSeams <= 0) return;
+
+	int applied = 0;
+	const int count = numTracks.load(std::memory_order_acquire);
+
+	for (int slot = 0; slot < count && applied < maxSeamsPerBlock; ++slot)
+	{
+		if (seamJobs[(size_t)slot].pending && applySeam(slot))
+		{
+			cancelSeam(slot);
+			++applied;
+		}
+	}
+}
 
-		const int numChannels = juce::jmin(output.getNumChannels(), track.buffer.getNumChannels());
-		const int totalSamples = track.buffer.getNumSamples();
-		const int loopLength = (masterLoopLength > 0)
-		? masterLoopLength
-		: juce::jmax(1, track.recordLength > 0 ? track.recordLength : track.buffer.getNumSamples());
+//書いた（または書けないと分かって諦めた）ら true。オーバーシュートがまだ届いていなければ false
+bool LooperAudio::applySeam(int slot)
+{
+	const auto job = seamJobs[(size_t)slot];
+	const int fade = seamFadeLength;
+	const int half = fade / 2;
+	const int loopLength = job.loopLength;
+	const auto& pages = trackStorage[(size_t)slot].pages;
 
-		int remaining = numSamples;
-		int readPos = track.readPosition;
+	//ループが変わった・短すぎる
+	if (masterLoopLength <= 0 || loopLength != getPlaybackLoopLength(slot) || job.length < 2 * fade)
+		return true;
 
-		while (remaining > 0)
+	if (job.fullLoop)
+	{
+		//つなぎ目の後ろ half は、録り終えた後も弾き続けた音（オーバーシュート）と混ぜる
+		const juce::int64 overshootStart = job.recordStartSample + job.takeLength;
+		if (inputHistory == nullptr || inputHistory->getOldestAbs() > overshootStart)
+			return true;
+		if (inputHistory->getTotalWritten() < overshootStart + half)
+			return false;
+
+		const int tailStart = (job.seamPosition - half + loopLength) % loopLength;
+		if (! isLoopRangeExclusive(pages, loopLength, tailStart, fade))
+			return true;
+
+		//いまの中身: 尻の half（尻から続く入力 A）と頭の half（頭へ続く入力 B）
+		readLoopRange(pages, loopLength, tailStart, seamCurrent, 0, fade);
+
+		//相手: 尻にはプリロール（B の続き）、頭にはオーバーシュート（A の続き）
+		for (int ch = 0; ch < numStorageChannels; ++ch)
+			juce::FloatVectorOperations::copy(seamOther.getWritePointer(ch),
+											  seamPreRolls.data() + ((size_t)slot * numStorageChannels + (size_t)ch) * (size_t)half, half);
+		seamOther.clear(half, half);
+		inputHistory->read(overshootStart, seamOther, half, half);
+
+		//A * fadeOut + B * fadeIn。前半は中身が A、後半は中身が B
+		for (int ch = 0; ch < numStorageChannels; ++ch)
 		{
-			int samplesToEnd = totalSamples - readPos;
-			int samplesToCopy = juce::jmin(remaining, samplesToEnd);
+			float* current = seamCurrent.getWritePointer(ch);
+			float* other = seamOther.getWritePointer(ch);
 
-			for (int ch = 0; ch < numChannels; ++ch)
-				output.addFrom(ch, numSamples - remaining, track.buffer, ch, readPos, samplesToCopy);
+			juce::FloatVectorOperations::multiply(current, seamFadeOut.data(), half);
+			juce::FloatVectorOperations::addWithMultiply(current, other, seamFadeIn.data(), half);
 
-			readPos = (readPos + samplesToCopy) % loopLength;
-			remaining -= samplesToCopy;
+			juce::FloatVectorOperations::multiply(current + half, seamFadeIn.data() + half, half);
+			juce::FloatVectorOperations::addWithMultiply(current + half, other + half, seamFadeOut.data() + half, half);
 		}
 
-		track.readPosition = readPos;
+		writeLoopRange(slot, loopLength, tailStart, seamCurrent, 0, fade);
+		return true;
 	}
 
-	// ✅ ここでマスターを独立して進める
-	if (masterLoopLength > 0)
+	//1周に満たない録音: 入りをフェードイン、終わりをフェードアウト（外側は無音）
+	const int endStart = (job.seamPosition + job.length - fade) % loopLength;
+	if (! isLoopRangeExclusive(pages, loopLength, job.seamPosition, fade) || ! isLoopRangeExclusive(pages, loopLength, endStart, fade))
+		return true;
+
+	readLoopRange(pages, loopLength, job.seamPosition, seamCurrent, 0, fade);
+	readLoopRange(pages, loopLength, endStart, seamOther, 0, fade);
+
+	for (int ch = 0; ch < numStorageChannels; ++ch)
 	{
-		masterReadPosition = (masterReadPosition + numSamples) % masterLoopLength;
+		juce::FloatVectorOperations::multiply(seamCurrent.getWritePointer(ch), seamFadeIn.data(), fade);
+		juce::FloatVectorOperations::multiply(seamOther.getWritePointer(ch), seamFadeOut.data(), fade);
 	}
-}
 
+	writeLoopRange(slot, loopLength, job.seamPosition, seamCurrent, 0, fade);
+	writeLoopRange(slot, loopLength, endStart, seamOther, 0, fade);
+	return true;
+}
 
-void LooperAudio::backupTrackBeforeRecord (int trackId)
+//ループ上の範囲のページがすべてメモリにあり、このトラックだけが持っているか
+//（ディスクへ書き出し中・保存のスナップショット中のページは書き換えない）
+bool LooperAudio::isLoopRangeExclusive(const PagedTrackBuffer& pages, int loopLength, int position, int numSamples) const noexcept
 {
-	if (auto it = tracks.find(trackId); it != tracks.end())
+	for (int done = 0; done < numSamples;)
 	{
-		lastHistory = TrackHistory();
-		lastHistory->trackId = trackId;
-		lastHistory->previousBuffer.makeCopyOf(it->second.buffer);
+		const int pos = (position + done) % loopLength;
+		const int page = pages.getPage(pos / pageSize);
+		if (page == PageArena::invalidPage || pageArena.getRefCount(page) != 1)
+			return false;
 
-		DBG("💾 Backup created for track " << trackId);
+		done += juce::jmin(numSamples - done, pageSize - pos % pageSize, loopLength - pos);
 	}
+	return true;
 }
-void LooperAudio::undoLastRecording()
+
+//ループの終わりで折り返して読む・書く
+void LooperAudio::readLoopRange(const PagedTrackBuffer& pages, int loopLength, int position,
+								juce::AudioBuffer<float>& dest, int destStart, int numSamples) const
+{
+	dest.clear(destStart, numSamples);
+
+	const int first = juce::jmin(numSamples, loopLength - position);
+	pages.addTo(dest, destStart, position, first);
+	if (first < numSamples)
+		pages.addTo(dest, destStart + first, 0, numSamples - first);
+}
+
+void LooperAudio::writeLoopRange(int slot, int loopLength, int position, const juce::AudioBuffer<float>& src, int srcStart, int numSamples)
 {
-	if(!lastHistory.has_value())
+	auto& pages = trackStorage[(size_t)slot].pages;
+
+	const int first = juce::jmin(numSamples, loopLength - position);
+	pages.write(src, srcStart, position, first);
+	if (first < numSamples)
+		pages.write(src, srcStart + first, 0, numSamples - first);
+
+	publishWaveform(slot, position / pageSize, (position + first - 1) / pageSize + 1);
+	if (first < numSamples)
+		publishWaveform(slot, 0, (numSamples - first - 1) / pageSize + 1);
+}
+
+void LooperAudio::mixTracksToOutput(juce::AudioBuffer<float>& output, int startSample, int numSamples)
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	const int numGroups = (count + tracksPerMixGroup - 1) / tracksPerMixGroup;
+	const int busSize = mixBuses[0].getNumSamples();
+
+	if (numGroups <= 1 || busSize <= 0)
 	{
-		DBG("⚠️ Nothing  to undo");
-		return;
+		//グループが1つなら部分バスを通しても同じ値なので、直接足し込む
+		mixTrackRange(output, startSample, 0, count, numSamples);
+	}
+	else
+	{
+		int playing = 0;
+		for (int slot = 0; slot < count; ++slot)
+			if (tracks[(size_t)slot].isPlaying) ++playing;
+
+		const bool parallel = playing >= parallelMixThreshold;
+		const int numChannels = juce::jmin(output.getNumChannels(), mixBuses[0].getNumChannels());
+
+		//部分バスの長さずつ処理する（想定より大きいブロックでも確保しない）
+		for (int done = 0; done < numSamples;)
+		{
+			const int chunk = juce::jmin(numSamples - done, busSize);
+			currentMixJob = { chunk, count, done };
+
+			mixWorkers.run(&LooperAudio::mixGroupJob, this, numGroups, parallel);
+
+			//決まった順で足し合わせる
+			for (int group = 0; group < numGroups; ++group)
+				for (int ch = 0; ch < numChannels; ++ch)
+					output.addFrom(ch, startSample + done, mixBuses[(size_t)group], ch, 0, chunk);
+
+			done += chunk;
+		}
 	}
 
-	auto& history = lastHistory.value();
-	if(auto it = tracks.find(history.trackId); it != tracks.end())
+	// ✅ ここでマスターを独立して進める（トラックの位置はこの時計から出す）
+	if (masterLoopLength > 0)
+	{
+		masterReadPosition += numSamples;
+		while (masterReadPosition >= masterLoopLength)
+		{
+			masterReadPosition -= masterLoopLength;
+			++masterCycle;
+		}
+	}
+}
+
+//グループ1つ分を部分バスへミックスする（ワーカーまたはオーディオスレッドから）
+void LooperAudio::mixGroupJob(void* context, int group)
+{
+	auto& self = *static_cast<LooperAudio*>(context);
+	const auto& job = self.currentMixJob;
+	auto& bus = self.mixBuses[(size_t)group];
+
+	bus.clear(0, job.numSamples);
+
+	const int firstSlot = group * tracksPerMixGroup;
+	self.mixTrackRange(bus, 0, firstSlot, juce::jmin(job.numSlots, firstSlot + tracksPerMixGroup), job.numSamples, job.clockOffset);
+}
+
+void LooperAudio::mixTrackRange(juce::AudioBuffer<float>& dest, int destStart, int firstSlot, int endSlot, int numSamples, int clockOffset)
+{
+	for (int slot = firstSlot; slot < endSlot; ++slot)
 	{
-		it->second.buffer.makeCopyOf(history.previousBuffer);
-		it->second.isRecording =false;
-		it->second.isPlaying = false;
-		it->second.writePosition = 0;
-		it->second.recordLength = history.previousBuffer.getNumSamples();
+		auto& track = tracks[(size_t)slot];
+		if (!track.isPlaying) continue;
+
+		updateMixTargets(slot, false);
+
+		const auto& pages = trackStorage[(size_t)slot].pages;
+
+		//読む位置はマスターの時計から出し、トラック自身の折り返し位置で区切る（ページのない所は無音）
+		//マスターがなければトラックの readPosition を自分の長さで回す
+		const bool followsMaster = masterLoopLength > 0;
+		const juce::int64 clock = followsMaster ? getMasterClock() + clockOffset : 0;
+		const int ownLength = followsMaster ? 0 : getPlaybackLoopLength(slot);
+
+		for (int done = 0; done < numSamples;)
+		{
+			LoopPoint point;
+			if (followsMaster)
+			{
+				point = getLoopPoint(track, clock + done);
+			}
+			else
+			{
+				if (track.readPosition >= ownLength)
+					track.readPosition = 0;
+				point = { track.readPosition, ownLength - track.readPosition };
+			}
+
+			const int samplesToCopy = juce::jmin(numSamples - done, point.samplesToWrap);
+
+			//ゲイン・パンを掛けながら足し込む（出力を触るのは1回だけ）
+			if (const int missing = pages.addToWithGain(dest, destStart + done, point.position, samplesToCopy,
+														track.mixRamps.data(), (int)track.mixRamps.size(), &track.mixLevels); missing > 0)
+			{
+				//ディスクからの読み戻しが間に合わなかった
+				streamUnderrunSamples.fetch_add((juce::uint64)missing, std::memory_order_relaxed);
+				streamUnderrunBlocks.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			for (auto& ramp : track.mixRamps)
+				ramp = ramp.advancedBy(samplesToCopy);
+
+			track.readPosition = point.position + samplesToCopy;
+			done += samplesToCopy;
+		}
+
+		//表示・先読み用（区間の終わりでちょうど折り返す時も頭の位置にしておく）
+		if (followsMaster)
+			track.readPosition = getLoopPoint(track, clock + numSamples).position;
+
+		track.mixLevelSamples += numSamples;
+	}
+}
 
-		DBG("↩️ Undo applied to track " << history.trackId);
 
+//UIのミキサー設定が変わっていたら左右のゲインの目標を付け替える
+void LooperAudio::updateMixTargets(int slot, bool snap) noexcept
+{
+	auto& track = tracks[(size_t)slot];
+	const auto& params = mixParams[(size_t)slot];
+
+	const float gain = params.gain.load(std::memory_order_relaxed);
+	const float pan = params.pan.load(std::memory_order_relaxed);
+	const bool muted = params.muted.load(std::memory_order_relaxed);
+
+	if (! snap && gain == track.appliedGain && pan == track.appliedPan && muted == track.appliedMute)
+		return;
+
+	track.appliedGain = gain;
+	track.appliedPan = pan;
+	track.appliedMute = muted;
+
+	float left, right;
+	panToGains(gain, pan, muted, left, right);
+
+	const float targets[numStorageChannels] = { left, right };
+	for (int ch = 0; ch < numStorageChannels; ++ch)
+	{
+		if (snap) track.mixRamps[(size_t)ch].snapTo(targets[ch]);
+		else      track.mixRamps[(size_t)ch].setTarget(targets[ch], mixSmoothingSamples);
+	}
+}
+
+void LooperAudio::addMonitorInput(juce::AudioBuffer<float>& output, const juce::AudioBuffer<float>& input, int numSamples) noexcept
+{
+	const float target = monitorMuted.load(std::memory_order_relaxed) ? 0.0f : monitorGain.load(std::memory_order_relaxed);
+	monitorRamp.setTarget(target, mixSmoothingSamples);
+
+	const int numChannels = juce::jmin(input.getNumChannels(), output.getNumChannels());
+
+	for (int ch = 0; ch < numChannels; ++ch)
+		simd::addWithGainRamp(output.getWritePointer(ch), input.getReadPointer(ch), numSamples, monitorRamp);
+
+	monitorRamp = monitorRamp.advancedBy(numSamples);
+}
+
+void LooperAudio::setTrackGain(int trackId, float gain) noexcept
+{
+	if (const int slot = findSlot(trackId); slot >= 0)
+		mixParams[(size_t)slot].gain.store(juce::jmax(0.0f, gain), std::memory_order_relaxed);
+}
+
+void LooperAudio::setTrackPan(int trackId, float pan) noexcept
+{
+	if (const int slot = findSlot(trackId); slot >= 0)
+		mixParams[(size_t)slot].pan.store(juce::jlimit(-1.0f, 1.0f, pan), std::memory_order_relaxed);
+}
+
+void LooperAudio::setTrackMute(int trackId, bool shouldBeMuted) noexcept
+{
+	if (const int slot = findSlot(trackId); slot >= 0)
+		mixParams[(size_t)slot].muted.store(shouldBeMuted, std::memory_order_relaxed);
+}
+
+void LooperAudio::setTrackLengthRatio(int trackId, LengthRatio ratio) noexcept
+{
+	ratio.multiple = juce::jlimit(1, maxLengthRatio, ratio.multiple);
+	ratio.division = juce::jlimit(1, maxLengthRatio, ratio.division);
+	if (ratio.multiple > 1) ratio.division = 1; //2倍と1/2を同時には持たない
+
+	if (const int slot = findSlot(trackId); slot >= 0)
+		mixParams[(size_t)slot].lengthRatio.store(ratio, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------
+// マスターの時計
+
+//k 番目の区切りを round(k × マスター長 / division) に置くので、1/2・1/4 のトラックも周を重ねてずれない
+//（割り切れない時は区切りの間が1サンプル違うだけ）。倍数のトラックは何周目かで後ろの周を読む
+LooperAudio::LoopPoint LooperAudio::getLoopPointFor(int masterLength, LengthRatio ratio, juce::int64 clock) noexcept
+{
+	//時計は録音のレイテンシ分だけ 0 より前を指すこともある
+	const juce::int64 period = (juce::int64)masterLength * ratio.multiple;
+	clock %= period;
+	if (clock < 0)
+		clock += period;
+
+	if (ratio.multiple > 1)
+	{
+		const int position = (int)clock;
+		return { position, (int)(period - position) };
+	}
+
+	const int phase = (int)clock;
+
+	if (ratio.division > 1)
+	{
+		const juce::int64 division = ratio.division;
+		auto boundary = [&] (juce::int64 k) { return (int)((2 * k * masterLength + division) / (2 * division)); };
+
+		//割り算で出した区切りは丸めで1つずれることがあるので隣を確かめる
+		auto k = phase * division / masterLength;
+		if (boundary(k) > phase)
+			--k;
+		else if (boundary(k + 1) <= phase)
+			++k;
+
+		return { phase - boundary(k), boundary(k + 1) - phase };
+	}
+
+	return { phase, masterLength - phase };
+}
+
+LooperAudio::LengthRatio LooperAudio::getLengthRatioOf(int length, int masterLength) noexcept
+{
+	LengthRatio ratio;
+	if (length <= 0 || masterLength <= 0 || length == masterLength)
+		return ratio;
+
+	if (length > masterLength)
+		ratio.multiple = juce::jlimit(1, maxLengthRatio, (int)std::lround((double)length / masterLength));
+	else
+		ratio.division = juce::jlimit(1, maxLengthRatio, (masterLength + length - 1) / length);
+
+	return ratio;
+}
+
+void LooperAudio::backupTrackBeforeRecord (int trackId)
+{
+	const int slot = findSlot(trackId);
+	if (slot < 0) return;
+
+	auto& pages = trackStorage[(size_t)slot].pages;
+
+	//空きエントリを積んで中身を入れ替えるだけ（コピーなし）
+	if (auto* entry = undoHistory.push())
+	{
+		entry->pages.clear();
+		entry->trackId = trackId;
+		entry->lengthInSample = 0;
+		entry->recordLength = 0;
+		entry->lengthMultiple = 1;
+		entry->lengthDivision = 1;
+		entry->masterTrackId = masterTrackId;
+		entry->masterLoopLength = masterLoopLength;
+		entry->masterStartSample = masterStartSample;
+		swapWithHistory(*entry);
+		return;
+	}
+
+	//履歴に積めない時はその場で空にする
+	++contentEdits;
+	pages.clear();
+	cancelSeam(slot);
+	publishWaveform(slot);
+}
+
+void LooperAudio::undoLastRecording()
+{
+	auto* entry = undoHistory.popUndo();
+	if (entry == nullptr)
+		return;
+
+	//入れ替え後のエントリには戻す前の状態が残り、そのまま REDO になる
+	swapWithHistory(*entry);
+}
+
+void LooperAudio::redoLastUndo()
+{
+	auto* entry = undoHistory.popRedo();
+	if (entry == nullptr)
+		return;
+
+	swapWithHistory(*entry);
+}
+
+//トラックと履歴エントリの中身（ページ表・長さ・マスター情報）を入れ替える
+void LooperAudio::swapWithHistory(TrackHistory& entry)
+{
+	const int slot = findSlot(entry.trackId);
+	if (slot < 0) return;
+
+	auto& track = tracks[(size_t)slot];
+	trackStorage[(size_t)slot].pages.swapWith(entry.pages);
+	++contentEdits;
+
+	std::swap(track.lengthInSample, entry.lengthInSample);
+	std::swap(track.recordLength, entry.recordLength);
+	std::swap(track.lengthRatio.multiple, entry.lengthMultiple);
+	std::swap(track.lengthRatio.division, entry.lengthDivision);
+	std::swap(masterTrackId, entry.masterTrackId);
+	std::swap(masterLoopLength, entry.masterLoopLength);
+	std::swap(masterStartSample, entry.masterStartSample);
+
+	track.isRecording = false;
+	track.isPlaying = false;
+	track.writePosition = 0;
+
+	//入れ替わった中身にはつなぎ目を書かない
+	cancelSeam(slot);
+	publishWaveform(slot);
+
+	masterReadPosition = (masterLoopLength > 0) ? masterReadPosition % masterLoopLength : 0;
+}
+
+//------------------------------------------------------------
+// タイムストレッチ
+
+bool LooperAudio::stretchToTempo(double newBpm)
+{
+	const auto state = stretchState.load(std::memory_order_acquire);
+	if (state != StretchState::idle && state != StretchState::succeeded && state != StretchState::failed)
+		return false;
+
+	//サンプルレートの変換が renderTargets を使っている間は始めない
+	if (resampleThread.isThreadRunning())
+		return false;
+
+	stretchThread.stopThread(1000); //前回の後始末（終わっている）
+
+	//元のページの写しの置き場（ストリーミング中は追い出した分も）と、伸ばした音を書くページ表
+	//（オーディオスレッドは入れ替える時まで触らない）
+	numStretchTargets = numTracks.load();
+	int maxPages = pageArena.getNumPages() + pageArena.getNumExternalPages();
+	if (diskStreamer.isRunning())
+		maxPages += numStretchTargets * trackPageCapacity;
+
+	stretchSource.prepare(maxTracks, maxPages);
+	for (int i = 0; i < numStretchTargets; ++i)
+		renderTargets[(size_t)i].prepare(pageArena, trackPageCapacity, diskStreamer.isRunning());
+
+	stretchTargetBpm = newBpm;
+	stretchJobFailed.store(false, std::memory_order_relaxed);
+	stretchFramesDone.store(0, std::memory_order_relaxed);
+	stretchFramesTotal.store(0, std::memory_order_relaxed);
+	stretchRenderMs.store(0.0, std::memory_order_relaxed);
+	stretchNumTracks.store(0, std::memory_order_relaxed);
+	stretchNumThreads.store(0, std::memory_order_relaxed);
+
+	stretchState.store(StretchState::waitingForSnapshot, std::memory_order_release);
+	stretchRequested.store(true, std::memory_order_release);
+
+	stretchThread.startThread(juce::Thread::Priority::low);
+	return true;
+}
+
+LooperAudio::StretchStatus LooperAudio::getStretchStatus() const noexcept
+{
+	StretchStatus status;
+	status.state = stretchState.load(std::memory_order_acquire);
+
+	const int total = stretchFramesTotal.load(std::memory_order_relaxed);
+	status.progress = total > 0 ? juce::jmin(1.0f, (float)stretchFramesDone.load(std::memory_order_relaxed) / (float)total)
+								: (status.state == StretchState::succeeded ? 1.0f : 0.0f);
+
+	status.renderMs = stretchRenderMs.load(std::memory_order_relaxed);
+	status.numTracks = stretchNumTracks.load(std::memory_order_relaxed);
+	status.numThreads = stretchNumThreads.load(std::memory_order_relaxed);
+	return status;
+}
+
+//オーディオスレッド。ページは retain するだけでサンプルはコピーしない（保存の写しと同じ）
+void LooperAudio::takeStretchSnapshot()
+{
+	const int beatsPerBar = tempoBeatsPerBar.load(std::memory_order_relaxed);
+	const int beatUnit = tempoBeatUnit.load(std::memory_order_relaxed);
+
+	TempoGrid target;
+	target.set(sampleRate, stretchTargetBpm, beatsPerBar, beatUnit);
+
+	//新しいテンポでも同じ小節数になる長さ
+	const int capacity = trackStorage[0].pages.getCapacity();
+	if (masterLoopLength > 0 && tempoGrid.isActive() && target.isActive())
+	{
+		const double ratio = target.getSamplesPerBeat() / tempoGrid.getSamplesPerBeat();
+		stretchLength = target.snapLengthToBars((int)juce::jmin((double)capacity, std::round(masterLoopLength * ratio)), capacity);
+	}
+	else
+	{
+		stretchLength = masterLoopLength;
+	}
+
+	//伸ばすループがない（または長さが変わらない）ならテンポを変えるだけ
+	if (stretchLength == masterLoopLength)
+	{
+		setTempo(stretchTargetBpm, beatsPerBar, beatUnit);
+		stretchState.store(StretchState::succeeded, std::memory_order_release);
+		return;
+	}
+
+	const double lengthRatio = (double)stretchLength / (double)masterLoopLength;
+	if (lengthRatio < stretch::minRatio || lengthRatio > stretch::maxRatio)
+	{
+		stretchState.store(StretchState::failed, std::memory_order_release);
+		return;
+	}
+
+	auto& header = stretchSource.header;
+	header.sampleRate = sampleRate;
+	header.masterTrackId = masterTrackId;
+	header.masterLoopLength = masterLoopLength;
+	stretchSource.numTracks = 0;
+	stretchSource.numPages = 0;
+	stretchSource.overflowed = false;
+
+	const int count = juce::jmin(numTracks.load(std::memory_order_acquire), numStretchTargets);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		const auto& pages = trackStorage[(size_t)slot].pages;
+		if ((pages.getNumPagesHeld() == 0 && ! pages.hasDiskCopies()) || track.lengthInSample <= 0) continue; //空のトラックは長さを変えるだけ
+
+		stretchOutLengths[(size_t)stretchSource.numTracks] = getLoopLengthFor(stretchLength, track.lengthRatio);
+
+		const auto& info = addSnapshotTrack(stretchSource, slot);
+
+		//ページが1枚もなければ（全部無音）長さを変えるだけにする
+		if (info.numPages == 0)
+			--stretchSource.numTracks;
+	}
+
+	stretchSourceEdits = contentEdits;
+	stretchState.store(StretchState::rendering, std::memory_order_release);
+}
+
+//ループの頭で（オーディオスレッド）。写し取った後に中身が変わっていたら捨てる
+void LooperAudio::applyStretch()
+{
+	const bool stale = contentEdits != stretchSourceEdits || isRecordingActive()
+					   || masterLoopLength != stretchSource.header.masterLoopLength;
+
+	auto expected = StretchState::waitingForLoopStart;
+	if (! stretchState.compare_exchange_strong(expected, stale ? StretchState::failed : StretchState::swapping,
+											   std::memory_order_acq_rel))
+		return;
+
+	//録り直しなどで中身が変わっていたら捨てる
+	if (stale)
+		return;
+
+	//ページ表を入れ替えるだけ（前のページ表は renderTargets に残り、裏のスレッドが返す）
+	const double ratio = (double)stretchLength / (double)masterLoopLength;
+	for (int i = 0; i < stretchSource.numTracks; ++i)
+	{
+		const auto& info = stretchSource.tracks[(size_t)i];
+		const int slot = findSlot(info.trackId);
+		if (slot < 0) continue;
+
+		auto& track = tracks[(size_t)slot];
+		trackStorage[(size_t)slot].pages.swapWith(renderTargets[(size_t)i]);
+		track.recordLength = juce::jmin(stretchOutLengths[(size_t)i], (int)std::lround(info.recordLength * ratio));
+
+		cancelSeam(slot);
+		publishWaveform(slot);
+	}
+
+	//長さは比どおりに（再生位置はマスターの時計から出すので、ループの頭の 0 から）
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		auto& track = tracks[(size_t)slot];
+		track.readPosition = 0;
+		if (track.lengthInSample > 0)
+			track.lengthInSample = getLoopLengthFor(stretchLength, track.lengthRatio);
+	}
+
+	masterLoopLength = stretchLength;
+	masterReadPosition = 0;
+
+	//前のテンポの長さの段には戻せない
+	undoHistory.discardAll();
+	++contentEdits;
+
+	setTempo(stretchTargetBpm, tempoBeatsPerBar.load(std::memory_order_relaxed), tempoBeatUnit.load(std::memory_order_relaxed));
+	stretchState.store(StretchState::applied, std::memory_order_release);
+}
+
+//伸ばすスレッド（トラックは stretch::runInParallel で並列に）
+void LooperAudio::renderStretch()
+{
+	//オーディオスレッドが写し取るのを待つ
+	const auto waitStart = juce::Time::getMillisecondCounter();
+
+	while (stretchState.load(std::memory_order_acquire) == StretchState::waitingForSnapshot)
+	{
+		const bool timedOut = juce::Time::getMillisecondCounter() - waitStart > (juce::uint32)snapshotTimeoutMs;
+
+		//まだ取りかかっていなければ依頼を取り下げる
+		if ((stretchThread.threadShouldExit() || timedOut) && stretchRequested.exchange(false))
+		{
+			DBG("⚠️ Time stretch cancelled: audio is not running or a track keeps recording");
+			stretchState.store(StretchState::failed, std::memory_order_release);
+			return;
+		}
+
+		juce::Thread::sleep(2);
+	}
+
+	//テンポだけ変えた・受け付けられなかった
+	if (stretchState.load(std::memory_order_acquire) != StretchState::rendering)
+		return;
+
+	const int numJobs = stretchSource.numTracks;
+	const int numThreads = juce::jlimit(1, maxRenderThreads, juce::SystemStats::getNumCpus() - 1);
+
+	const stretch::LoopStretcher sizing(sampleRate);
+	int numFrames = 0;
+	for (int i = 0; i < numJobs; ++i)
+		numFrames += sizing.getNumFrames(stretchOutLengths[(size_t)i]);
+
+	stretchFramesTotal.store(numFrames, std::memory_order_relaxed);
+	stretchNumTracks.store(numJobs, std::memory_order_relaxed);
+	stretchNumThreads.store(juce::jmin(numThreads, numJobs), std::memory_order_relaxed);
+
+	const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+	if (stretchSource.overflowed)
+		stretchJobFailed.store(true, std::memory_order_relaxed);
+	else
+		stretch::runInParallel(numThreads, &LooperAudio::stretchTrackJob, this, numJobs);
+
+	stretchRenderMs.store(juce::Time::getMillisecondCounterHiRes() - startMs, std::memory_order_relaxed);
+
+	if (stretchJobFailed.load(std::memory_order_relaxed) || stretchThread.threadShouldExit())
+	{
+		DBG("⚠️ Time stretch failed: out of pages or cancelled");
+		releaseStretchPages();
+		stretchState.store(StretchState::failed, std::memory_order_release);
+		return;
+	}
+
+	DBG("⏩ Stretched " << numJobs << " tracks to " << stretchLength << " samples in "
+		<< stretchRenderMs.load() << " ms (" << stretchNumThreads.load() << " threads)");
+
+	//オーディオスレッドがループの頭で入れ替えるのを待つ（やめる時は、入れ替える前なら取り下げる）
+	stretchState.store(StretchState::waitingForLoopStart, std::memory_order_release);
+
+	for (;;)
+	{
+		auto state = stretchState.load(std::memory_order_acquire);
+		if (state == StretchState::applied || state == StretchState::failed)
+			break;
+
+		if (state == StretchState::waitingForLoopStart && stretchThread.threadShouldExit()
+			&& stretchState.compare_exchange_strong(state, StretchState::failed, std::memory_order_acq_rel))
+			break;
+
+		juce::Thread::sleep(2);
+	}
+
+	//入れ替えたなら前のページ、捨てたなら伸ばしたページを返す
+	const bool applied = stretchState.load(std::memory_order_acquire) == StretchState::applied;
+	releaseStretchPages();
+
+	if (applied)
+		stretchState.store(StretchState::succeeded, std::memory_order_release);
+}
+
+//写し取った元のページの参照と、renderTargets が持っているページを返す（伸ばすスレッド）
+void LooperAudio::releaseStretchPages() noexcept
+{
+	for (int i = 0; i < stretchSource.numPages; ++i)
+		pageArena.release(stretchSource.pages[(size_t)i].page);
+
+	stretchSource.numPages = 0;
+	stretchSource.numTracks = 0;
+
+	for (int i = 0; i < numStretchTargets; ++i)
+		renderTargets[(size_t)i].clear();
+}
+
+//トラック1本分（ワーカー）。元のページをつなげて伸ばし、新しいページへ書く
+void LooperAudio::stretchTrackJob(void* context, int index)
+{
+	auto& owner = *static_cast<LooperAudio*>(context);
+	if (owner.stretchJobFailed.load(std::memory_order_relaxed)) return;
+
+	const auto& source = owner.stretchSource;
+	const auto& info = source.tracks[(size_t)index];
+	const int inLength = info.lengthInSample;
+	const int outLength = owner.stretchOutLengths[(size_t)index];
+
+	//ディスクの控えが読めなければ入れ替えない
+	juce::AudioBuffer<float> input(numStorageChannels, inLength);
+	if (! owner.readSnapshotTrack(source, info, input))
+	{
+		owner.stretchJobFailed.store(true, std::memory_order_relaxed);
+		return;
+	}
+
+	juce::AudioBuffer<float> output(numStorageChannels, outLength);
+	stretch::LoopStretcher stretcher(source.header.sampleRate);
+
+	const bool finished = stretcher.process(input, inLength, output, outLength, owner.stretchFramesDone, [&owner]
+	{
+		return owner.stretchThread.threadShouldExit() || owner.stretchJobFailed.load(std::memory_order_relaxed);
+	});
+
+	//ページが足りなければ失敗（全トラックそろわないと入れ替えない）
+	if (! finished || owner.renderTargets[(size_t)index].write(output, 0, 0, outLength) > 0)
+		owner.stretchJobFailed.store(true, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------
+// サンプルレートの変換
+
+//prepareToPlay から（オーディオ停止中）。元のページを retain して写し、変換は裏のスレッドへ任せる
+//（伸ばしかけを止めるのもページを用意するのも裏のスレッドで。ここではデバイスの開始を待たせない）
+void LooperAudio::startResample(double fromRate, double toRate)
+{
+	resampleThread.stopThread(1000); //前回の後始末（終わっている）
+
+	//録音中のトラックは録れた所までで止める（入力の位置は新しいデバイスで数え直しになる）
+	const int count = numTracks.load();
+	for (int slot = 0; slot < count; ++slot)
+		if (tracks[(size_t)slot].isRecording)
+			stopRecording(tracks[(size_t)slot].trackId);
+
+	int maxPages = pageArena.getNumPages() + pageArena.getNumExternalPages();
+	if (diskStreamer.isRunning())
+		maxPages += count * trackPageCapacity;
+
+	resampleSource.prepare(maxTracks, maxPages);
+	resampleSource.header.sampleRate = fromRate;
+	resampleSource.header.masterLoopLength = masterLoopLength;
+	resampleJobs.clear();
+
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		const auto& pages = trackStorage[(size_t)slot].pages;
+		if (track.lengthInSample <= 0 || pages.isEmpty()) continue;
+
+		addSnapshotTrack(resampleSource, slot);
+		resampleJobs.push_back({ 0, track.lengthRatio });
+	}
+
+	resampleSourceEdits = contentEdits;
+	resampleTargetRate.store(toRate);
+	resampleState.store(ResampleState::rendering, std::memory_order_release);
+
+	resampleThread.startThread(juce::Thread::Priority::low);
+}
+
+bool LooperAudio::isResamplePending() const noexcept
+{
+	const auto state = resampleState.load(std::memory_order_acquire);
+	return state != ResampleState::idle && state != ResampleState::applied;
+}
+
+//マスターの長さ。テンポの格子に乗っていたループは、丸めの1サンプルも新しいレートの小節の長さにそろえる
+int LooperAudio::getResampledMasterLength(int masterLength, double toRate) const
+{
+	int newMasterLength = masterLength > 0 ? (int)std::lround(masterLength * toRate / resampleSource.header.sampleRate) : 0;
+	if (newMasterLength > 0)
+	{
+		TempoGrid grid;
+		grid.set(toRate, tempoBpm.load(), tempoBeatsPerBar.load(), tempoBeatUnit.load());
+
+		const int snapped = grid.snapLengthToBars(newMasterLength, trackStorage[0].pages.getCapacity());
+		if (std::abs(snapped - newMasterLength) <= 1)
+			newMasterLength = snapped;
+	}
+	return newMasterLength;
+}
+
+//マスターに乗っているトラックは長さの比どおり（丸めがマスターとずれない）
+int LooperAudio::getResampledLength(int lengthInSample, LengthRatio lengthRatio, int newMasterLength, double rateRatio) noexcept
+{
+	return newMasterLength > 0 ? getLoopLengthFor(newMasterLength, lengthRatio)
+							   : (int)std::lround(lengthInSample * rateRatio);
+}
+
+//変換のスレッド（トラックは stretch::runInParallel で並列に）。全部そろってからオーディオスレッドに入れ替えてもらう
+//1本でもページが足りなければ何も変えない
+void LooperAudio::renderResample()
+{
+	//伸ばしかけは前のレートの長さなので取りやめる（renderTargets を空けてもらう）
+	stretchThread.stopThread(10000);
+
+	const double fromRate = resampleSource.header.sampleRate;
+	const int numJobs = resampleSource.numTracks;
+	bool report = false;
+
+	for (int i = 0; i < numJobs; ++i)
+		renderTargets[(size_t)i].prepare(pageArena, trackPageCapacity, diskStreamer.isRunning());
+
+	for (;;)
+	{
+		//元のレートへ戻ったなら変換しない
+		const double toRate = resampleTargetRate.load();
+		if (toRate == fromRate || resampleThread.threadShouldExit())
+			break;
+
+		resampledMasterLength = getResampledMasterLength(resampleSource.header.masterLoopLength, toRate);
+		for (int i = 0; i < numJobs; ++i)
+			resampleJobs[(size_t)i].outLength = getResampledLength(resampleSource.tracks[(size_t)i].lengthInSample, resampleJobs[(size_t)i].lengthRatio,
+																	 resampledMasterLength, toRate / fromRate);
+
+		const int numThreads = juce::jlimit(1, maxRenderThreads, juce::SystemStats::getNumCpus() - 1);
+		const double startMs = juce::Time::getMillisecondCounterHiRes();
+
+		resampleJobFailed.store(resampleSource.overflowed);
+		stretch::runInParallel(numThreads, &LooperAudio::resampleTrackJob, this, numJobs);
+
+		if (resampleThread.threadShouldExit())
+			break;
+
+		lastResample.fromRate = fromRate;
+		lastResample.toRate = toRate;
+		lastResample.renderMs = juce::Time::getMillisecondCounterHiRes() - startMs;
+		lastResample.numTracks = numJobs;
+		lastResample.numThreads = juce::jmin(numThreads, numJobs);
+		lastResample.succeeded = ! resampleJobFailed.load();
+		report = true;
+
+		if (! lastResample.succeeded)
+		{
+			//前のレートの音を違う速さで鳴らさないよう、待機を解く前に止めてもらう（UI には変換の結果で知らせる）
+			DBG("⚠️ Could not resample loops from " << fromRate << " Hz to " << toRate << " Hz (out of pages)");
+			stopForFailedResample.store(true, std::memory_order_release);
+			break;
+		}
+
+		//変換している間にまたレートが変わっていたら、新しいレートで変換し直す
+		if (toRate == resampleTargetRate.load())
+		{
+			resampledRate = toRate;
+			resampleState.store(ResampleState::waitingForSwap, std::memory_order_release);
+
+			//オーディオスレッドがブロックの頭で入れ替えるのを待つ（やめる時は、入れ替える前なら取り下げる）
+			for (;;)
+			{
+				auto state = resampleState.load(std::memory_order_acquire);
+				if (state == ResampleState::applied || state == ResampleState::retarget)
+					break;
+
+				if (state == ResampleState::waitingForSwap && resampleThread.threadShouldExit()
+					&& resampleState.compare_exchange_strong(state, ResampleState::rendering, std::memory_order_acq_rel))
+					break;
+
+				juce::Thread::sleep(2);
+			}
+
+			if (resampleState.load(std::memory_order_acquire) == ResampleState::applied)
+			{
+				DBG("🔁 Resampled " << lastResample.numTracks << " tracks from " << fromRate << " Hz to " << toRate << " Hz in "
+					<< lastResample.renderMs << " ms (" << lastResample.numThreads << " threads)");
+				break;
+			}
+
+			if (resampleThread.threadShouldExit())
+			{
+				report = false;
+				break;
+			}
+
+			resampleState.store(ResampleState::rendering, std::memory_order_release);
+		}
+
+		report = false;
+		for (int i = 0; i < numJobs; ++i)
+			renderTargets[(size_t)i].clear();
+	}
+
+	//写し取った元のページの参照と、renderTargets のページ（入れ替えたなら前のレートのページ、でなければ変換したページ）を返す
+	for (int i = 0; i < resampleSource.numPages; ++i)
+		pageArena.release(resampleSource.pages[(size_t)i].page);
+
+	resampleSource.numPages = 0;
+	resampleSource.numTracks = 0;
+
+	for (int i = 0; i < numJobs; ++i)
+		renderTargets[(size_t)i].clear();
+
+	if (report)
+		resampleCount.fetch_add(1, std::memory_order_release);
+
+	resampleState.store(ResampleState::idle, std::memory_order_release);
+}
+
+//ブロックの頭で（オーディオスレッド）。ページ表の入れ替えと、長さ・位置の置き換えだけ
+void LooperAudio::applyResample()
+{
+	//変換している間にデバイスのレートがまた変わっていたら、変換し直してもらう
+	auto expected = ResampleState::waitingForSwap;
+	const bool retarget = resampledRate != resampleTargetRate.load(std::memory_order_relaxed);
+
+	if (! resampleState.compare_exchange_strong(expected, retarget ? ResampleState::retarget : ResampleState::swapping,
+												std::memory_order_acq_rel) || retarget)
+		return;
+
+	jassert(contentEdits == resampleSourceEdits); //変換中はトラックを変えていない
+
+	const double ratio = resampledRate / resampleSource.header.sampleRate;
+	const int newMasterLength = resampledMasterLength;
+
+	for (int i = 0; i < resampleSource.numTracks; ++i)
+		if (const int slot = findSlot(resampleSource.tracks[(size_t)i].trackId); slot >= 0)
+			trackStorage[(size_t)slot].pages.swapWith(renderTargets[(size_t)i]);
+
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		auto& track = tracks[(size_t)slot];
+		track.writePosition = 0;
+
+		if (track.lengthInSample > 0)
+		{
+			const int newLength = getResampledLength(track.lengthInSample, track.lengthRatio, newMasterLength, ratio);
+			track.readPosition = (int)(std::lround(track.readPosition * ratio) % newLength);
+			track.recordLength = juce::jmin(newLength, (int)std::lround(track.recordLength * ratio));
+			track.lengthInSample = newLength;
+		}
+
+		//止めていた所から鳴らし始めるので、ミキサーのゲインは0から上げる（プツッと入らない）
+		for (auto& ramp : track.mixRamps)
+		{
+			const float target = ramp.endGain;
+			ramp.snapTo(0.0f);
+			ramp.setTarget(target, mixSmoothingSamples);
+		}
+
+		cancelSeam(slot);
+		publishWaveform(slot);
+	}
+
+	if (masterLoopLength > 0)
+	{
+		masterReadPosition = (int)(std::lround(masterReadPosition * ratio) % newMasterLength);
+		masterLoopLength = newMasterLength;
+	}
+
+	//履歴の段は前のレートの長さなので戻せない。捨てる（prepareToPlay の説明どおり）
+	undoHistory.discardAll();
+	++contentEdits;
+
+	contentSampleRate.store(resampledRate);
+	resampleState.store(ResampleState::applied, std::memory_order_release);
+}
+
+//トラック1本分（ワーカー）。元のページをつなげて変換し、新しいページへ書く
+void LooperAudio::resampleTrackJob(void* context, int index)
+{
+	auto& owner = *static_cast<LooperAudio*>(context);
+	if (owner.resampleJobFailed.load(std::memory_order_relaxed)) return;
+
+	const auto& source = owner.resampleSource;
+	const auto& info = source.tracks[(size_t)index];
+	const int inLength = info.lengthInSample;
+	const int outLength = owner.resampleJobs[(size_t)index].outLength;
+
+	juce::AudioBuffer<float> input(numStorageChannels, inLength);
+	if (! owner.readSnapshotTrack(source, info, input))
+	{
+		owner.resampleJobFailed.store(true, std::memory_order_relaxed);
+		return;
+	}
+
+	juce::AudioBuffer<float> output(numStorageChannels, outLength);
+	resample::LoopResampler(inLength, outLength).process(input, output);
+
+	//ページが足りなければ失敗（全トラックそろわないと入れ替えない）
+	if (owner.renderTargets[(size_t)index].write(output, 0, 0, outLength) > 0)
+		owner.resampleJobFailed.store(true, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------
+// ディスクストリーミング
+
+bool LooperAudio::enableDiskStreaming(const juce::File& directory, double maxLoopMinutes)
+{
+	resampleThread.stopThread(10000); //ページ表を作り直すので変換しかけ・伸ばしかけは取りやめる
+	stretchThread.stopThread(10000);
+
+	streamingDirectory = directory;
+
+	if (! diskStreamer.start(pageArena, directory))
+	{
+		DBG("⚠️ Could not start disk streaming in " << directory.getFullPathName());
+		return false;
+	}
+
+	//ページ表をメモリより長いループが入る大きさにし、ページごとの控えの状態も持たせる
+	const double maxPagesForIntLength = (double)(std::numeric_limits<int>::max() / pageSize);
+	const int maxPages = (int)juce::jlimit((double)pageArena.getNumPages(), maxPagesForIntLength,
+										   std::ceil(maxLoopMinutes * 60.0 * streamingSizingSampleRate / pageSize));
+
+	trackPageCapacity = maxPages;
+	for (auto& storage : trackStorage)
+		storage.pages.prepare(pageArena, maxPages, true);
+
+	for (int slot = 0; slot < numTracks.load(); ++slot)
+		prepareWaveform(slot);
+
+	undoHistory.prepare(pageArena, maxPages, pageArena.getNumPages() * historyBudgetPercent / 100, true);
+	return true;
+}
+
+LooperAudio::StreamingStats LooperAudio::getStreamingStats() const noexcept
+{
+	StreamingStats stats;
+	stats.underrunSamples = streamUnderrunSamples.load(std::memory_order_relaxed);
+	stats.underrunBlocks = streamUnderrunBlocks.load(std::memory_order_relaxed);
+	stats.pagesWritten = diskStreamer.getPagesWritten();
+	stats.pagesRead = diskStreamer.getPagesRead();
+	stats.ioFailures = diskStreamer.getIoFailures();
+	stats.requestOverflows = diskStreamer.getRequestOverflows();
+	stats.worstReadLatencyMs = diskStreamer.getWorstReadLatencyMs();
+	stats.readAheadMs = sampleRate > 0.0 ? streamingReadAheadPages * pageSize * 1000.0 / sampleRate : 0.0;
+	return stats;
+}
+
+//オーディオスレッド。ブロック先頭で1回
+void LooperAudio::serviceDiskStreaming()
+{
+	if (! diskStreamer.isRunning()) return;
+
+	applyStreamingCompletions();
+
+	const bool evict = pageArena.getNumFreePages() < pageArena.getNumPages() * streamingEvictBelowFreePercent / 100;
+	int readsLeft = maxStreamingReadsPerBlock;
+	const int count = numTracks.load(std::memory_order_acquire);
+
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		auto& pages = trackStorage[(size_t)slot].pages;
+
+		const int numUsed = pages.getNumPagesUsed();
+		if (numUsed == 0) continue;
+
+		//再生（止まっていれば再開するはずのマスター位置）から先読み分がページの要る範囲
+		const int loopLength = getPlaybackLoopLength(slot);
+		const int loopPages = (loopLength + pageSize - 1) / pageSize;
+		const int playPosition = masterLoopLength > 0 ? getLoopPoint(track, getMasterClock()).position
+													  : track.readPosition % loopLength;
+		const int playPage = playPosition / pageSize;
+
+		auto isNeeded = [&] (int pageIndex)
+		{
+			//録音中は書いているページと、1周して戻ってくる最初のページを手元に置く
+			if (track.isRecording && (pageIndex == track.writePosition / pageSize
+									  || pageIndex == track.recordFirstWritePosition / pageSize))
+				return true;
+
+			if (pageIndex >= loopPages) return false;
+
+			const int ahead = (pageIndex - playPage + loopPages) % loopPages;
+			return ahead <= streamingReadAheadPages || ahead == loopPages - 1;
+		};
+
+		//先読み
+		if (pages.getTakeId() >= 0)
+		{
+			for (int k = 0; k <= streamingReadAheadPages && k < loopPages && readsLeft > 0; ++k)
+			{
+				const int pageIndex = (playPage + k) % loopPages;
+				if (pageIndex >= numUsed || pages.getPage(pageIndex) != PageArena::invalidPage) continue;
+
+				const auto flags = pages.getPageFlags(pageIndex);
+				if ((flags & PagedTrackBuffer::pageOnDisk) == 0 || (flags & PagedTrackBuffer::pageLoading) != 0) continue;
+
+				if (! diskStreamer.requestRead(pages.getTakeId(), pageIndex)) { readsLeft = 0; break; }
+
+				pages.setPageFlags(pageIndex, (juce::uint8)(flags | PagedTrackBuffer::pageLoading));
+				--readsLeft;
+			}
+		}
+
+		//書き出しと追い出し（ページ表を少しずつ巡回）
+		int cursor = pages.getDiskScanPosition();
+		for (int n = juce::jmin(numUsed, streamingScanPagesPerBlock); --n >= 0;)
+		{
+			if (++cursor >= numUsed) cursor = 0;
+
+			const int page = pages.getPage(cursor);
+			//マップしたセッションのページはメモリを食わないので書き出さない
+			if (page == PageArena::invalidPage || pageArena.isExternalPage(page)) continue;
+
+			const auto flags = pages.getPageFlags(cursor);
+			constexpr juce::uint8 busy = PagedTrackBuffer::pageOnDisk | PagedTrackBuffer::pageWriting | PagedTrackBuffer::pageDiskFailed;
+
+			if ((flags & busy) == 0)
+			{
+				//書き途中のページはまだ控えを取らない
+				if (track.isRecording && isNeeded(cursor)) continue;
+
+				if (pages.getTakeId() < 0)
+					pages.setTakeId(diskStreamer.createTakeId());
+
+				if (diskStreamer.requestWrite(pages.getTakeId(), cursor, page))
+					pages.setPageFlags(cursor, (juce::uint8)(flags | PagedTrackBuffer::pageWriting));
+			}
+			else if (evict && (flags & PagedTrackBuffer::pageOnDisk) != 0 && ! isNeeded(cursor))
+			{
+				pages.evictPage(cursor);
+				publishWaveform(slot, cursor, cursor + 1);
+			}
+		}
+		pages.setDiskScanPosition(cursor);
+	}
+}
+
+//ディスクスレッドから届いた完了をページ表へ反映する
+void LooperAudio::applyStreamingCompletions()
+{
+	DiskStreamer::Completion completion;
+
+	for (int n = 0; n < maxStreamingCompletionsPerBlock && diskStreamer.popCompletion(completion); ++n)
+	{
+		auto* pages = findPagesByTake(completion.takeId);
+		const auto flags = pages != nullptr ? pages->getPageFlags(completion.pageIndex) : (juce::uint8)0;
+
+		switch (completion.type)
+		{
+			case DiskStreamer::Completion::Type::written:
+				//書き出し中に書き換えられていたら控えは古いので採らない
+				if (pages != nullptr && (flags & PagedTrackBuffer::pageWriting) != 0)
+					pages->setPageFlags(completion.pageIndex, (juce::uint8)((flags & ~PagedTrackBuffer::pageWriting) | PagedTrackBuffer::pageOnDisk));
+				break;
+
+			case DiskStreamer::Completion::Type::writeFailed:
+				if (pages != nullptr && (flags & PagedTrackBuffer::pageWriting) != 0)
+					pages->setPageFlags(completion.pageIndex, (juce::uint8)((flags & ~PagedTrackBuffer::pageWriting) | PagedTrackBuffer::pageDiskFailed));
+				break;
+
+			case DiskStreamer::Completion::Type::loaded:
+				if (pages != nullptr)
+					pages->setPageFlags(completion.pageIndex, (juce::uint8)(flags & ~PagedTrackBuffer::pageLoading));
+
+				//テイクがもう無い・すでにページがある時は返す
+				if (pages == nullptr || (flags & PagedTrackBuffer::pageOnDisk) == 0
+					|| ! pages->installPage(completion.pageIndex, completion.page))
+					pageArena.release(completion.page);
+				else
+					publishWaveformPage(*pages, completion.pageIndex);
+				break;
+
+			case DiskStreamer::Completion::Type::loadFailed:
+				if (pages != nullptr)
+					pages->setPageFlags(completion.pageIndex, (juce::uint8)(flags & ~PagedTrackBuffer::pageLoading));
+				break;
+		}
+	}
+}
+
+//テイク番号からページ表を探す（トラック → 履歴の順）
+PagedTrackBuffer* LooperAudio::findPagesByTake(int takeId) noexcept
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+		if (trackStorage[(size_t)slot].pages.getTakeId() == takeId)
+			return &trackStorage[(size_t)slot].pages;
+
+	return undoHistory.findPagesByTake(takeId);
+}
+
+bool LooperAudio::isRecordingActive() const
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+		if (tracks[(size_t)slot].isRecording)
+			return true;
+
+	return false;
+}
+
+//------------------------------------------------------------
+// セッション保存・読み込み
+
+bool LooperAudio::saveSession(const juce::File& file)
+{
+	const auto state = saveState.load(std::memory_order_acquire);
+	if (state == SaveState::waitingForSnapshot || state == SaveState::writing)
+		return false;
+
+	saveThread.stopThread(1000); //前回の保存スレッドの後始末（終わっている）
+
+	//ページの写しの置き場（アリーナ＋マップ中のページ、ストリーミング中は追い出した分も）
+	int maxPages = pageArena.getNumPages() + pageArena.getNumExternalPages();
+	if (diskStreamer.isRunning())
+		maxPages += numTracks.load() * trackPageCapacity;
+
+	saveSnapshot.prepare(maxTracks, maxPages);
+	saveTarget = file;
+
+	snapshotReady.store(false, std::memory_order_relaxed);
+	saveState.store(SaveState::waitingForSnapshot, std::memory_order_release);
+	snapshotRequested.store(true, std::memory_order_release);
+
+	saveThread.startThread(juce::Thread::Priority::low);
+	return true;
+}
+
+//オーディオスレッド。ページは retain するだけでサンプルはコピーしない
+void LooperAudio::takeSessionSnapshot()
+{
+	auto& snapshot = saveSnapshot;
+	auto& header = snapshot.header;
+
+	header.sampleRate = sampleRate;
+	header.numChannels = numStorageChannels;
+	header.pageSize = pageSize;
+	header.masterTrackId = masterTrackId;
+	header.masterLoopLength = masterLoopLength;
+	header.masterStartSample = masterStartSample;
+
+	snapshot.numTracks = 0;
+	snapshot.numPages = 0;
+	snapshot.overflowed = false;
+
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& params = mixParams[(size_t)slot];
+
+		auto& info = addSnapshotTrack(snapshot, slot);
+		info.isPlaying = tracks[(size_t)slot].isPlaying;
+		info.muted = params.muted.load(std::memory_order_relaxed);
+		info.gain = params.gain.load(std::memory_order_relaxed);
+		info.pan = params.pan.load(std::memory_order_relaxed);
+	}
+}
+
+//トラック1本分の情報を snapshot の末尾へ足し、ページを retain して目録へ積む（サンプルはコピーしない）
+//無音のページは積まない。追い出したページはテイクを控えておき、読む側がディスクから読む
+session::TrackInfo& LooperAudio::addSnapshotTrack(session::Snapshot& snapshot, int slot)
+{
+	const auto& track = tracks[(size_t)slot];
+	const auto& pages = trackStorage[(size_t)slot].pages;
+
+	auto& info = snapshot.tracks[(size_t)snapshot.numTracks++];
+	info = {};
+	info.trackId = track.trackId;
+	info.lengthInSample = track.lengthInSample;
+	info.recordLength = track.recordLength;
+	info.firstPage = snapshot.numPages;
+
+	for (int pageIndex = 0; pageIndex < pages.getNumPagesUsed(); ++pageIndex)
+	{
+		const int page = pages.getPage(pageIndex);
+		const bool onDiskOnly = page == PageArena::invalidPage && pages.hasDiskCopies()
+								&& (pages.getPageFlags(pageIndex) & PagedTrackBuffer::pageOnDisk) != 0;
+
+		if (page == PageArena::invalidPage && ! onDiskOnly) continue;
+
+		if (snapshot.numPages >= (int)snapshot.pages.size())
+		{
+			snapshot.overflowed = true;
+			break;
+		}
+
+		if (page != PageArena::invalidPage)
+			pageArena.retain(page);
+
+		snapshot.pages[(size_t)snapshot.numPages++] = { pageIndex, page, pages.getTakeId() };
+	}
+
+	info.numPages = snapshot.numPages - info.firstPage;
+	return info;
+}
+
+//写し取ったトラック1本分のページを dest へつなげる（伸ばす・変換するワーカー）
+//ページのない所は無音。追い出したページはディスクの控えから読み、読めなければ false
+bool LooperAudio::readSnapshotTrack(const session::Snapshot& snapshot, const session::TrackInfo& info,
+									juce::AudioBuffer<float>& dest) const
+{
+	const int length = juce::jmin(dest.getNumSamples(), info.lengthInSample);
+	dest.clear();
+	std::vector<float> scratch;
+
+	for (int i = 0; i < info.numPages; ++i)
+	{
+		const auto& ref = snapshot.pages[(size_t)(info.firstPage + i)];
+		const int start = ref.pageIndex * pageSize;
+		const int pageLength = juce::jmin(pageSize, length - start);
+		if (pageLength <= 0) continue; //ループより後ろ（マスター長を短く丸めた分）
+
+		if (ref.page != PageArena::invalidPage)
+		{
+			for (int ch = 0; ch < numStorageChannels; ++ch)
+				dest.copyFrom(ch, start, pageArena.getReadPointer(ref.page, ch), pageLength);
+			continue;
+		}
+
+		scratch.resize((size_t)(numStorageChannels * pageSize));
+		if (! diskStreamer.readStoredPage(ref.takeId, ref.pageIndex, scratch.data()))
+			return false;
+
+		for (int ch = 0; ch < numStorageChannels; ++ch)
+			dest.copyFrom(ch, start, scratch.data() + (size_t)(ch * pageSize), pageLength);
+	}
+
+	return true;
+}
+
+//保存スレッド
+void LooperAudio::writeSavedSession()
+{
+	//オーディオスレッドが写し取るのを待つ
+	const auto waitStart = juce::Time::getMillisecondCounter();
+
+	while (! snapshotReady.load(std::memory_order_acquire))
+	{
+		const bool timedOut = juce::Time::getMillisecondCounter() - waitStart > (juce::uint32)snapshotTimeoutMs;
+
+		//まだ取りかかっていなければ依頼を取り下げる（取りかけなら写し終わるのを待つ）
+		if ((saveThread.threadShouldExit() || timedOut) && snapshotRequested.exchange(false))
+		{
+			DBG("⚠️ Session save cancelled: audio is not running or a track keeps recording");
+			saveState.store(SaveState::failed, std::memory_order_release);
+			return;
+		}
+
+		juce::Thread::sleep(2);
+	}
+
+	saveState.store(SaveState::writing, std::memory_order_release);
+
+	const bool ok = session::write(saveTarget, saveSnapshot, pageArena, diskStreamer);
+	snapshotReady.store(false, std::memory_order_relaxed);
+
+	DBG((ok ? "💾 Session saved to " : "⚠️ Session save failed: ") << saveTarget.getFullPathName());
+	saveState.store(ok ? SaveState::succeeded : SaveState::failed, std::memory_order_release);
+}
+
+bool LooperAudio::loadSession(const juce::File& file)
+{
+	auto mapped = std::make_unique<session::MappedSession>();
+	if (! mapped->open(file, numStorageChannels, pageSize))
+	{
+		DBG("⚠️ Could not load session " << file.getFullPathName() << ": " << mapped->getError());
+		return false;
+	}
+
+	//今のトラック表とページ表に収まるかを先に確かめる
+	int newTracks = 0;
+	for (const auto& info : mapped->getTracks())
+	{
+		if (! juce::isPositiveAndBelow(info.trackId, maxTrackIds)) return false;
+		if (findSlot(info.trackId) < 0) ++newTracks;
+
+		for (int i = 0; i < info.numPages; ++i)
+			if (! juce::isPositiveAndBelow(mapped->getPageIndex(info.firstPage + i), trackPageCapacity))
+				return false;
+	}
+
+	if (numTracks.load() + newTracks > maxTracks)
+		return false;
+
+	saveThread.stopThread(10000);
+	resampleThread.stopThread(10000);
+	stretchThread.stopThread(10000);
+	sessionPeakThread.stopThread(10000); //前のマップのピークを作りかけなら取りやめる
+	++contentEdits;
+
+	//書き出し待ちのページを手放させるため、ストリーミングは作り直す
+	if (diskStreamer.isRunning())
+	{
+		diskStreamer.stop();
+		diskStreamer.start(pageArena, streamingDirectory);
+	}
+
+	//今のトラックと履歴を捨てる
+	const int count = numTracks.load();
+	for (int slot = 0; slot < count; ++slot)
+	{
+		trackStorage[(size_t)slot].pages.clear();
+
+		const int trackId = tracks[(size_t)slot].trackId;
+		tracks[(size_t)slot] = TrackData();
+		tracks[(size_t)slot].trackId = trackId;
+		trackMeters[(size_t)slot].reset();
+		seamJobs[(size_t)slot] = {};
+	}
+	numPendingSeams = 0;
+
+	undoHistory.prepare(pageArena, trackPageCapacity, pageArena.getNumPages() * historyBudgetPercent / 100,
+						diskStreamer.isRunning());
+
+	//前のマップを外して（誰も持っていない）新しいファイルのページをつなぐ（ピークはあとで作る）
+	pageArena.attachExternalPages(mapped->getPageData(), mapped->getHeader().numPages);
+	loadedSession = std::move(mapped);
+	sessionPeakPagesBuilt.store(0, std::memory_order_relaxed);
+	sessionPeakPagesApplied = 0;
+
+	const auto& header = loadedSession->getHeader();
+
+	for (const auto& info : loadedSession->getTracks())
+	{
+		if (findSlot(info.trackId) < 0)
+			addTrack(info.trackId);
+
+		const int slot = findSlot(info.trackId);
+		if (slot < 0) continue;
+
+		auto& pages = trackStorage[(size_t)slot].pages;
+		for (int i = 0; i < info.numPages; ++i)
+		{
+			const int page = pageArena.getNumPages() + info.firstPage + i;
+			pageArena.retain(page);
+
+			if (! pages.adoptPage(loadedSession->getPageIndex(info.firstPage + i), page))
+				pageArena.release(page);
+		}
+
+		auto& track = tracks[(size_t)slot];
+		track.lengthInSample = info.lengthInSample;
+		track.recordLength = info.recordLength;
+		track.isPlaying = info.isPlaying;
+		track.lengthRatio = getLengthRatioOf(info.lengthInSample, header.masterLoopLength); //ファイルは長さだけ持つ
+
+		auto& params = mixParams[(size_t)slot];
+		params.gain.store(info.gain, std::memory_order_relaxed);
+		params.pan.store(info.pan, std::memory_order_relaxed);
+		params.muted.store(info.muted, std::memory_order_relaxed);
+		params.lengthRatio.store(track.lengthRatio, std::memory_order_relaxed);
+		updateMixTargets(slot, true);
+	}
+
+	masterTrackId = header.masterTrackId;
+	masterLoopLength = header.masterLoopLength;
+	masterStartSample = (long)header.masterStartSample;
+	masterReadPosition = 0;
+	masterCycle = 0;
+	sessionSampleRate = header.sampleRate;
+	contentSampleRate.store(header.sampleRate); //デバイスと違えば、次の prepareToPlay で変換する
+
+	for (int slot = 0; slot < numTracks.load(); ++slot)
+		publishWaveform(slot);
+	publishWaveformTransport();
+
+	sessionPeakThread.startThread(juce::Thread::Priority::low);
+
+	if (sampleRate > 0.0 && sessionSampleRate != sampleRate)
+		DBG("⚠️ Session was recorded at " << sessionSampleRate << " Hz, resampling to " << sampleRate << " Hz");
+
+	DBG("📂 Session loaded: " << header.numTracks << " tracks, " << header.numPages << " pages mapped");
+	return true;
+}
+
+//ピークのスレッド。マップしたページを先頭から読んでピークを作り、何枚かごとに知らせる
+void LooperAudio::buildSessionPeaks()
+{
+	const int firstPage = pageArena.getNumPages();
+	const int numPages = pageArena.getNumExternalPages();
+
+	for (int i = 0; i < numPages && ! sessionPeakThread.threadShouldExit(); ++i)
+	{
+		pageArena.rebuildPeaks(firstPage + i);
+
+		if ((i + 1) % sessionPeakPagesPerPublish == 0 || i + 1 == numPages)
+			sessionPeakPagesBuilt.store(i + 1, std::memory_order_release);
+	}
+}
+
+//オーディオスレッド。新しくピークのできた外部ページを持つトラックへ足し込み、その所だけ写し直す
+void LooperAudio::applySessionPeaks() noexcept
+{
+	const int built = sessionPeakPagesBuilt.load(std::memory_order_acquire);
+	if (built == sessionPeakPagesApplied) return;
+
+	const int firstPage = pageArena.getNumPages() + sessionPeakPagesApplied;
+	const int endPage = pageArena.getNumPages() + built;
+	sessionPeakPagesApplied = built;
+
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		auto& pages = trackStorage[(size_t)slot].pages;
+
+		for (int pageIndex = 0; pageIndex < pages.getNumPagesUsed(); ++pageIndex)
+		{
+			const int page = pages.getPage(pageIndex);
+			if (page < firstPage || page >= endPage) continue;
+
+			pages.mergePagePeaks(pageIndex);
+			publishWaveform(slot, pageIndex, pageIndex + 1);
+		}
+	}
+}
+
+std::vector<LooperAudio::TrackSummary> LooperAudio::getTrackSummaries() const
+{
+	std::vector<TrackSummary> summaries;
+
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		const auto& params = mixParams[(size_t)slot];
+
+		TrackSummary s;
+		s.trackId = track.trackId;
+		s.isPlaying = track.isPlaying;
+		s.hasAudio = trackStorage[(size_t)slot].pages.getNumPagesUsed() > 0;
+		s.gain = params.gain.load(std::memory_order_relaxed);
+		s.pan = params.pan.load(std::memory_order_relaxed);
+		s.muted = params.muted.load(std::memory_order_relaxed);
+		s.lengthRatio = params.lengthRatio.load(std::memory_order_relaxed);
+		summaries.push_back(s);
+	}
+
+	return summaries;
+}
+
+//------------------------------------------------------------
+// 波形表示
+
+//UIへ渡す写しの置き場を確保する（メッセージスレッド、そのスロットをオーディオスレッドが触る前か停止中）
+void LooperAudio::prepareWaveform(int slot)
+{
+	auto& waveform = waveforms[(size_t)slot];
+	const auto& pages = trackStorage[(size_t)slot].pages;
+
+	waveform.numPages = trackPageCapacity;
+	waveform.pages = std::make_unique<std::atomic<int>[]>((size_t)trackPageCapacity);
+	for (int i = 0; i < trackPageCapacity; ++i)
+		waveform.pages[(size_t)i].store(PageArena::invalidPage, std::memory_order_relaxed);
+
+	for (int i = 0; i < peaks::numTrackLevels; ++i)
+	{
+		const int numBins = pages.getNumTrackPeakBins(peaks::numPageLevels + i);
+		waveform.numTrackPeakBins[(size_t)i] = numBins;
+		waveform.trackPeaks[(size_t)i] = std::make_unique<std::atomic<peaks::Peak>[]>((size_t)numBins);
+		for (int bin = 0; bin < numBins; ++bin)
+			waveform.trackPeaks[(size_t)i][(size_t)bin].store(peaks::empty, std::memory_order_relaxed);
+	}
+
+	waveform.publishedPages = 0;
+	waveform.length.store(0, std::memory_order_relaxed);
+	waveform.position.store(-1, std::memory_order_relaxed);
+	waveform.recording.store(false, std::memory_order_relaxed);
+}
+
+//ページ [firstPage, endPage) のページ番号と、それを含むトラック単位のピークを写す（オーディオスレッド）
+void LooperAudio::publishWaveform(int slot, int firstPage, int endPage) noexcept
+{
+	auto& waveform = waveforms[(size_t)slot];
+	const auto& pages = trackStorage[(size_t)slot].pages;
+
+	endPage = juce::jmin(endPage, waveform.numPages);
+	if (firstPage >= endPage) return;
+
+	for (int i = firstPage; i < endPage; ++i)
+		waveform.pages[(size_t)i].store(pages.getPage(i), std::memory_order_relaxed);
+
+	for (int i = 0; i < peaks::numTrackLevels; ++i)
+	{
+		const int level = peaks::numPageLevels + i;
+		const int shift = peaks::binShifts[level];
+		const int lastBin = juce::jmin(waveform.numTrackPeakBins[(size_t)i] - 1, (int)(((juce::int64)endPage * pageSize - 1) >> shift));
+
+		for (int bin = (int)(((juce::int64)firstPage * pageSize) >> shift); bin <= lastBin; ++bin)
+			waveform.trackPeaks[(size_t)i][(size_t)bin].store(pages.getTrackPeak(level, bin), std::memory_order_relaxed);
+	}
+
+	waveform.publishedPages = juce::jmax(waveform.publishedPages, endPage);
+}
+
+//中身が丸ごと変わった時（UNDO/REDO・クリア・読み込み）。前に写した範囲も上書きする
+void LooperAudio::publishWaveform(int slot) noexcept
+{
+	auto& waveform = waveforms[(size_t)slot];
+	const int numUsed = trackStorage[(size_t)slot].pages.getNumPagesUsed();
+
+	publishWaveform(slot, 0, juce::jmax(numUsed, waveform.publishedPages));
+	waveform.publishedPages = numUsed;
+}
+
+//ディスクから読み戻したページ（トラックのものなら写す。履歴のものは何もしない）
+void LooperAudio::publishWaveformPage(const PagedTrackBuffer& pages, int pageIndex) noexcept
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+		if (&trackStorage[(size_t)slot].pages == &pages)
+			publishWaveform(slot, pageIndex, pageIndex + 1);
+}
+
+//長さと再生・録音位置（毎ブロック）
+void LooperAudio::publishWaveformTransport() noexcept
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		const auto& track = tracks[(size_t)slot];
+		auto& waveform = waveforms[(size_t)slot];
+
+		//録音中で長さが決まっていなければ、録れた所までを表示する
+		const int length = track.lengthInSample > 0 ? track.lengthInSample
+												   : (masterLoopLength > 0 && track.isRecording) ? getRecordLoopLength(slot)
+																								 : track.recordLength;
+		const int position = track.isRecording ? track.writePosition
+											   : track.isPlaying ? track.readPosition : -1;
+
+		waveform.length.store(length, std::memory_order_relaxed);
+		waveform.position.store(position, std::memory_order_relaxed);
+		waveform.recording.store(track.isRecording, std::memory_order_relaxed);
+	}
+}
+
+//ミックスで測ったレベルをメーターへ渡す（鳴っていないトラックもブロックの長さだけ落ちていく）
+void LooperAudio::publishTrackLevels(int numSamples) noexcept
+{
+	const int count = numTracks.load(std::memory_order_acquire);
+	for (int slot = 0; slot < count; ++slot)
+	{
+		auto& track = tracks[(size_t)slot];
+
+		trackMeters[(size_t)slot].addBlock(track.mixLevels.peak, track.mixLevels.sumSquares,
+										   track.mixLevelSamples * numStorageChannels, numSamples);
+		track.mixLevels = {};
+		track.mixLevelSamples = 0;
+	}
+}
+
+LevelMeter::Reading LooperAudio::getTrackLevel(int trackId) const noexcept
+{
+	const int slot = findSlot(trackId);
+	return slot >= 0 ? trackMeters[(size_t)slot].read() : LevelMeter::Reading();
+}
+
+void LooperAudio::readWaveform(int trackId, peaks::Columns& columns) const noexcept
+{
+	const int numColumns = columns.getNumColumns();
+	const int slot = findSlot(trackId);
+
+	columns.hasAudio = false;
+	columns.isRecording = false;
+	columns.playhead = -1.0f;
+
+	if (slot < 0 || numColumns == 0) return;
+
+	const auto& waveform = waveforms[(size_t)slot];
+	const int length = waveform.length.load(std::memory_order_relaxed);
+	if (length <= 0 || waveform.pages == nullptr)
+	{
+		std::fill(columns.mins.begin(), columns.mins.end(), 0.0f);
+		std::fill(columns.maxs.begin(), columns.maxs.end(), 0.0f);
+		return;
+	}
+
+	//1列が段のビン1つ以上をまたぐ、いちばん粗い段を使う（1列あたり高々16ビン程度）
+	const double samplesPerColumn = (double)length / numColumns;
+	int level = 0;
+	while (level + 1 < peaks::numLevels && peaks::binSize(level + 1) <= samplesPerColumn)
+		++level;
+
+	const int shift = peaks::binShifts[level];
+	const int binsPerPage = pageSize >> shift;
+
+	//段2のビン（ページが手元にない時の代わり）
+	auto coarsePeak = [&] (juce::int64 position)
+	{
+		const auto bin = position >> peaks::binShifts[peaks::numPageLevels];
+		return bin < waveform.numTrackPeakBins[0] ? waveform.trackPeaks[0][(size_t)bin].load(std::memory_order_relaxed) : peaks::empty;
+	};
+
+	auto readBin = [&] (juce::int64 bin) -> peaks::Peak
+	{
+		if (level >= peaks::numPageLevels)
+		{
+			const int i = level - peaks::numPageLevels;
+			return bin < waveform.numTrackPeakBins[(size_t)i] ? waveform.trackPeaks[(size_t)i][(size_t)bin].load(std::memory_order_relaxed)
+															 : peaks::empty;
+		}
+
+		const auto pageIndex = bin / binsPerPage;
+		if (pageIndex >= waveform.numPages) return peaks::empty;
+
+		//ディスクへ追い出したページは粗い段で代用する
+		const int page = waveform.pages[(size_t)pageIndex].load(std::memory_order_relaxed);
+		return page != PageArena::invalidPage ? pageArena.getPeak(page, level, (int)(bin % binsPerPage))
+											  : coarsePeak(bin << shift);
+	};
+
+	for (int col = 0; col < numColumns; ++col)
+	{
+		const auto start = (juce::int64)(col * samplesPerColumn);
+		const auto end = juce::jmax(start + 1, (juce::int64)((col + 1) * samplesPerColumn));
+
+		auto peak = peaks::empty;
+		for (auto bin = start >> shift; bin <= (end - 1) >> shift; ++bin)
+			peak = peaks::merge(peak, readBin(bin));
+
+		if (peaks::isEmpty(peak))
+		{
+			columns.mins[(size_t)col] = columns.maxs[(size_t)col] = 0.0f;
+			continue;
+		}
+
+		columns.mins[(size_t)col] = peaks::toFloat(peaks::minOf(peak));
+		columns.maxs[(size_t)col] = peaks::toFloat(peaks::maxOf(peak));
+		columns.hasAudio = true;
+	}
+
+	const int position = waveform.position.load(std::memory_order_relaxed);
+	columns.playhead = position >= 0 ? (float)juce::jmin(position, length) / (float)length : -1.0f;
+	columns.isRecording = waveform.recording.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------
+// リスナー通知
+
+void LooperAudio::notifyListeners(PendingEvent::Type type, int trackId)
+{
+	//メッセージスレッドからの操作はその場で通知、オーディオスレッドからはキューへ
+	if (juce::MessageManager::existsAndIsCurrentThread())
+	{
+		if (type == PendingEvent::Type::recordingStarted)
+			listeners.call([&] (Listener& l) { l.onRecordingStarted(trackId); });
+		else
+			listeners.call([&] (Listener& l) { l.onRecordingStopped(trackId); });
+		return;
+	}
+
+	pendingEvents.push({ type, trackId });
+}
+
+void LooperAudio::dispatchPendingEvents()
+{
+	PendingEvent e;
+	while (pendingEvents.pop(e))
+	{
+		if (e.type == PendingEvent::Type::recordingStarted)
+			listeners.call([&] (Listener& l) { l.onRecordingStarted(e.trackId); });
+		else
+			listeners.call([&] (Listener& l) { l.onRecordingStopped(e.trackId); });
 	}
-	lastHistory.reset();
 }
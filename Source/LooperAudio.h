@@ -1,15 +1,19 @@
 #pragma once
 #include <JuceHeader.h>
 #include "TriggerEvent.h"
-#include <map>
-
-
-//UNDO用の履歴
-struct TrackHistory
-{
-	int trackId = -1;
-	juce::AudioBuffer<float> previousBuffer;
-};
+#include "RingBuffer.h"
+#include "PagedAudioStorage.h"
+#include "UndoHistory.h"
+#include "RealtimeWorkerPool.h"
+#include "DiskStreamer.h"
+#include "SessionFile.h"
+#include "PeakPyramid.h"
+#include "LevelMeter.h"
+#include "RtProfiler.h"
+#include "TempoGrid.h"
+#include "TimeStretch.h"
+#include "Resampler.h"
+#include <array>
 
 
 class LooperAudio
@@ -24,19 +28,257 @@ class LooperAudio
 		virtual void onRecordingStopped(int trackID) = 0;
 	};
 
-	LooperAudio(double sr,int max);
+	//メッセージスレッドからの操作はすべてコマンドとしてキューに積み、
+	//オーディオスレッドが指定サンプル位置ちょうどで実行する
+	struct Command
+	{
+		enum class Type
+		{
+			startRecording,
+			stopRecording,
+			startPlaying,
+			stopPlaying,
+			clearTrack,
+			masterPositionReset,
+			undo,
+			redo
+		};
+
+		Type type = Type::startRecording;
+		int trackId = -1;
+		long sampleTime = -1; //実行する入力絶対位置（-1 なら次のブロック先頭）
+	};
+
+	//録音用ページの大きさ（サンプル数）と、全トラックで共有するメモリ予算の既定値
+	static constexpr int pageSize = 4096;
+	static constexpr int numStorageChannels = 2;
+	static constexpr size_t defaultStorageBudgetBytes = (size_t)256 * 1024 * 1024;
+	//UNDO/REDO が持ってよいページの割合（残りは録音用）
+	static constexpr int historyBudgetPercent = 50;
+
+	explicit LooperAudio(size_t storageBudgetBytes = defaultStorageBudgetBytes);
 
 	~LooperAudio();
 
+	//オーディオ停止中に呼ぶ。録ってあるループと違うサンプルレートなら、ループを新しいレートへ裏で変換し始めて戻る
+	//（変換し終えてブロックの頭で入れ替えるまで、ループは鳴らさず、コマンドも実行しない）
+	//入れ替えると UNDO/REDO の履歴は捨てる（前のレートの長さの段には戻せない）
+	//ページが足りずに変換できなければ、前のレートの音を違う速さで鳴らさないよう全トラックを止める（getLastResample で分かる）
 	void prepareToPlay(int samplesPerBlockExpected, double sr);
+
+	//並列ミックスに使うワーカー数（0で直列のみ）。次の prepareToPlay から有効
+	void setParallelMixing(int numWorkers) noexcept { requestedMixWorkers = juce::jmax(0, numWorkers); }
+	int getNumMixWorkers() const noexcept { return mixWorkers.getNumWorkers(); }
 	void processBlock(juce::AudioBuffer<float>& output, const juce::AudioBuffer<float>& input);
-	void releaseResources() {}
+	//デバイスのコールバックから（blockStartSample はこのブロック先頭の入力絶対位置）
+	void processBlock(juce::AudioBuffer<float>& output, const juce::AudioBuffer<float>& input, juce::int64 blockStartSample);
+	void releaseResources() { mixWorkers.stop(); }
 
 	//TriggerEventの参照をセット
 	void setTriggerReference(juce::TriggerEvent& ref)
 	{triggerRef = &ref;}
 
-//トラック操作
+	//入力履歴の参照をセット（トリガー録音のプリロール埋め戻し用）
+	void setInputHistory(const HistoryRingBuffer& history)
+	{inputHistory = &history;}
+
+	//入力が出力より遅れて届くサンプル数（往復レイテンシ＋入力側の処理の遅れ。どのスレッドからでも）
+	//マスターに重ねる録音は、この分だけ前の位置へ書いて再生とそろえる（録音開始時に1回ずらすだけ）
+	void setRecordLatency(int samples) noexcept { recordLatencySamples.store(juce::jmax(0, samples), std::memory_order_relaxed); }
+	int getRecordLatency() const noexcept { return recordLatencySamples.load(std::memory_order_relaxed); }
+
+	//ループのつなぎ目のクロスフェードの長さ（SmartRecConfig::fadeMs）。次の prepareToPlay から有効
+	void setSeamFadeMs(float milliseconds) noexcept { seamFadeMs = juce::jmax(0.0f, milliseconds); }
+
+	//===テンポ・拍子（どのスレッドからでも。オーディオスレッドが次のブロックの頭で反映する）===
+	//格子があると、最初に録ったループ（マスター）の長さを一番近い小節数に丸める
+	//格子の原点はマスターがあればマスターの頭、なければテンポを決めたブロックの頭
+	//bpm は4分音符で数える（0 以下で格子なし）
+	void setTempo(double bpm, int beatsPerBar = 4, int beatUnit = 4) noexcept
+	{
+		tempoBpm.store(bpm, std::memory_order_relaxed);
+		tempoBeatsPerBar.store(beatsPerBar, std::memory_order_relaxed);
+		tempoBeatUnit.store(beatUnit, std::memory_order_relaxed);
+		tempoVersion.fetch_add(1, std::memory_order_release);
+	}
+	double getTempo() const noexcept { return tempoBpm.load(std::memory_order_relaxed); }
+
+	//時刻指定なしの録音・再生のコマンドを次の拍・小節の頭まで待たせる（格子がなければすぐ実行）
+	enum class Quantize { off, beat, bar };
+	void setQuantize(Quantize newQuantize) noexcept { quantize.store(newQuantize, std::memory_order_relaxed); }
+	Quantize getQuantize() const noexcept { return quantize.load(std::memory_order_relaxed); }
+
+	//===テンポ変更のタイムストレッチ===
+	//録ったループを録り直さずに新しいテンポの長さへ伸び縮みさせる（音程はそのまま）
+	//伸ばした音は裏のスレッドがトラックごとに並列で新しいページへ書き、オーディオスレッドは
+	//次のループの頭で全トラックのページ表・マスター長・テンポをまとめて入れ替えるだけ
+	//書いている間に録音・クリア・UNDO があった時は結果を捨てる。入れ替えたら UNDO の段も捨てる
+	enum class StretchState
+	{
+		idle,
+		waitingForSnapshot,		//オーディオスレッドがページを retain するのを待っている
+		rendering,
+		waitingForLoopStart,	//書き終えて、次のループの頭を待っている
+		swapping,				//オーディオスレッドが入れ替え中
+		applied,				//入れ替えた（前のページを返している）
+		succeeded,
+		failed
+	};
+
+	struct StretchStatus
+	{
+		StretchState state = StretchState::idle;
+		float progress = 0.0f;	//0..1
+		double renderMs = 0.0;	//書き始めてから書き終えるまで
+		int numTracks = 0;
+		int numThreads = 0;
+	};
+
+	//メッセージスレッド。伸ばすループ（またはテンポの格子）がなければテンポを変えるだけ。処理中なら false
+	//ディスクへ追い出したページは控えから読んで伸ばす（読めない・ページが足りない時は失敗にして元のまま）
+	bool stretchToTempo(double newBpm);
+	StretchStatus getStretchStatus() const noexcept;
+
+	//最後にループのサンプルレートを変換した結果（変換のスレッドが書く。count が進んだら読み直す）
+	struct ResampleReport
+	{
+		int count = 0;			//変換した回数（失敗も数える）
+		bool succeeded = false;
+		double fromRate = 0.0;
+		double toRate = 0.0;
+		double renderMs = 0.0;
+		int numTracks = 0;
+		int numThreads = 0;
+	};
+	ResampleReport getLastResample() const noexcept
+	{
+		ResampleReport report = lastResample;
+		report.count = resampleCount.load(std::memory_order_acquire);
+		return report;
+	}
+
+	//処理の区間ごとの時間を profiler へ渡す（オーディオ停止中にセット。nullptr で計らない）
+	void setProfiler(RtProfiler* newProfiler) noexcept { profiler = newProfiler; }
+
+	//コマンド送信（メッセージスレッド専用）。キューが満杯なら false
+	bool postCommand(const Command& command);
+	bool postCommand(Command::Type type, int trackId = -1, long sampleTime = -1)
+	{return postCommand(Command { type, trackId, sampleTime });}
+
+	//オーディオスレッドから（トリガー録音など）。次の processBlock でキューのコマンドと同じくクオンタイズして実行する
+	bool postCommandFromAudioThread(const Command& command) noexcept;
+
+	//オーディオスレッドが処理済みの入力絶対位置（コマンドの実行時刻の基準）
+	long getSamplePosition() const noexcept { return publishedSamplePosition.load(std::memory_order_relaxed); }
+
+	//キューあふれ・遅延実行の回数
+	juce::uint32 getCommandOverflowCount() const noexcept { return commandQueue.getOverflowCount() + scheduleOverflowCount.load(std::memory_order_relaxed); }
+	juce::uint32 getLateCommandCount() const noexcept { return lateCommandCount.load(std::memory_order_relaxed); }
+
+	//録音用ページの残りと、ページ不足で録れなかったサンプル数
+	int getNumFreePages() const noexcept { return pageArena.getNumFreePages(); }
+	int getNumTotalPages() const noexcept { return pageArena.getNumPages(); }
+	juce::uint32 getDroppedRecordSampleCount() const noexcept { return droppedRecordSamples.load(std::memory_order_relaxed); }
+
+	//ミキサー（どのスレッドからでも可。オーディオスレッドで mixSmoothingMs かけて追従する）
+	void setTrackGain(int trackId, float gain) noexcept;
+	void setTrackPan(int trackId, float pan) noexcept;	//-1 で左、+1 で右
+	void setTrackMute(int trackId, bool shouldBeMuted) noexcept;
+	void setMonitorGain(float gain) noexcept { monitorGain.store(juce::jmax(0.0f, gain), std::memory_order_relaxed); }
+	void setMonitorMute(bool shouldBeMuted) noexcept { monitorMuted.store(shouldBeMuted, std::memory_order_relaxed); }
+
+	//===トラックの長さ（マスターの multiple / division 倍。2倍・4倍・1/2 など）===
+	struct LengthRatio
+	{
+		int multiple = 1;
+		int division = 1;
+	};
+	static constexpr int maxLengthRatio = 8;
+
+	//次にそのトラックを録る時から効く（マスターになる録音はいつも1倍）。どのスレッドからでも可
+	void setTrackLengthRatio(int trackId, LengthRatio ratio) noexcept;
+
+	//マスター長 masterLength に対する長さ（割り切れなければ切り上げ。短い周では最後の1サンプルを飛ばす）
+	static int getLoopLengthFor(int masterLength, LengthRatio ratio) noexcept
+	{
+		return (int)(((juce::int64)masterLength * ratio.multiple + ratio.division - 1) / ratio.division);
+	}
+
+	//マスターの時計 clock での、トラック自身のループ上の位置と、次に折り返すまでのサンプル数
+	struct LoopPoint
+	{
+		int position = 0;
+		int samplesToWrap = 0;
+	};
+	static LoopPoint getLoopPointFor(int masterLength, LengthRatio ratio, juce::int64 clock) noexcept;
+
+	//===ディスクストリーミング（RAM より長いループ用）===
+	//録音したページを directory の下へ書き出し、ページが足りなくなってきたら
+	//再生位置から遠いページを追い出して、再生位置の先から読み戻す
+	//オーディオ停止中・録音前にメッセージスレッドから呼ぶ（トラックと履歴は空になる）
+	static constexpr double defaultMaxStreamingMinutes = 60.0;
+	bool enableDiskStreaming(const juce::File& directory, double maxLoopMinutes = defaultMaxStreamingMinutes);
+	bool isDiskStreamingEnabled() const noexcept { return diskStreamer.isRunning(); }
+
+	//再生位置の何秒先まで読み戻しておくか。次の prepareToPlay から有効
+	void setStreamingReadAhead(double seconds) noexcept { streamingReadAheadSeconds = juce::jmax(0.0, seconds); }
+
+	struct StreamingStats
+	{
+		juce::uint64 underrunSamples = 0;	//読み戻しが間に合わず無音になったサンプル数
+		juce::uint32 underrunBlocks = 0;	//それが起きた（トラック×区間の）回数
+		juce::uint32 pagesWritten = 0;
+		juce::uint32 pagesRead = 0;
+		juce::uint32 ioFailures = 0;
+		juce::uint32 requestOverflows = 0;
+		double worstReadLatencyMs = 0.0;	//読み戻しを頼んでから届くまでの最悪値
+		double readAheadMs = 0.0;			//いまの先読み量
+	};
+	StreamingStats getStreamingStats() const noexcept;
+
+	//===セッション保存・読み込み===
+	static constexpr const char* sessionFileExtension = ".simploop";
+
+	enum class SaveState { idle, waitingForSnapshot, writing, succeeded, failed };
+
+	//保存を始める（メッセージスレッド）。オーディオスレッドが次のブロック境界
+	//（録音中なら録音が終わった所）でページを写し取り、ファイルへはバックグラウンドで書く。保存中なら false
+	bool saveSession(const juce::File& file);
+	SaveState getSaveState() const noexcept { return saveState.load(std::memory_order_acquire); }
+
+	//セッションを読み込む（メッセージスレッド、オーディオ停止中）。今のトラックと履歴は捨てる
+	//音声はファイルをマップしてそのままトラックのページにする（デコード・コピーなし）
+	bool loadSession(const juce::File& file);
+	//読み込んだセッションのサンプルレート（読み込んでいなければ 0）
+	double getSessionSampleRate() const noexcept { return sessionSampleRate; }
+
+	//トラックの一覧（読み込み後にUIを作り直す用。オーディオ停止中に呼ぶ）
+	struct TrackSummary
+	{
+		int trackId = -1;
+		bool isPlaying = false;
+		bool hasAudio = false;
+		float gain = 1.0f;
+		float pan = 0.0f;
+		bool muted = false;
+		LengthRatio lengthRatio;
+	};
+	std::vector<TrackSummary> getTrackSummaries() const;
+
+	//===波形表示===
+	//トラック全体を columns の列数に縮めた波形と再生位置を埋める（メッセージスレッド）
+	//オーディオスレッドが公開したピークをロックなしで読むだけで、生のサンプルには触らない
+	void readWaveform(int trackId, peaks::Columns& columns) const noexcept;
+
+	//===メーター===
+	//トラックの出力レベル（ゲイン・パン後）。ミックスのついでに測ったものをロックなしで読む
+	LevelMeter::Reading getTrackLevel(int trackId) const noexcept;
+
+	//UNDO/REDO できる段数
+	int getNumUndoLevels() const noexcept { return undoHistory.getNumUndoLevels(); }
+	int getNumRedoLevels() const noexcept { return undoHistory.getNumRedoLevels(); }
+
+//トラック操作（addTrack以外はオーディオスレッド専用。他スレッドからは postCommand を使う）
 	void addTrack(int trackId);
 	void startRecording(int trackId);
 	void stopRecording(int trackId);
@@ -47,7 +289,8 @@ class LooperAudio
 	void startSequentialRecording(const std::vector<int>& selectedTracks);
 	void stopRecordingAndContinue();
 
-	void masterPositionReset(){ masterReadPosition = 0;}
+	//倍の長さのトラックも頭から鳴るよう、周回の数も戻す
+	void masterPositionReset(){ masterReadPosition = 0; masterCycle = 0;}
 
 
 	bool isRecordingActive() const;
@@ -59,36 +302,128 @@ class LooperAudio
 	void addListener(Listener* l) {listeners.add(l);}
 	void removeListener(Listener* l){listeners.remove(l);}
 
-	//UNDO関連
+	//オーディオスレッドで溜まった通知をメッセージスレッドから配信する（Timerから呼ぶ）
+	void dispatchPendingEvents();
+
+	//UNDO関連（オーディオスレッド専用）
+	//トラックの中身を履歴へ移す。トラックは空になる（録音し直し・クリアの前に呼ぶ）
 	void backupTrackBeforeRecord (int trackId);
 	void undoLastRecording();
+	void redoLastUndo();
 
 private:
 
+	static constexpr int maxTracks = 128;	  //トラック表の固定容量
+	static constexpr int maxTrackIds = 256;  //trackId → スロット の引き表の大きさ
+
+	//毎ブロック触る状態だけをまとめたもの（連続配置でキャッシュに乗せる）
 	struct TrackData
 	{
-		juce::AudioBuffer<float> buffer;
+		int trackId = -1;
 		bool isRecording = false;
 		bool isPlaying = false;
 		int writePosition = 0;
 		int readPosition = 0;
 		int recordLength = 0;
-		int recordStartSample = 0; //グローバル位置での録音開始サンプル
+		long recordStartSample = 0; //グローバル位置（入力の絶対位置）での録音開始サンプル
+		int recordFirstWritePosition = 0; //最初に書いた位置（1周して戻ってくるページは書き終えるまで控えを取らない）
 		int lengthInSample = 0; //トラックの長さ
+		LengthRatio lengthRatio; //中身の長さのマスターに対する比（録り始めに決める）
+		int recordClockLag = -1; //マスターの時計に沿って録る時の遅れ（レイテンシ分。-1 なら書いた分だけ進める）
+		int recordTakeLength = 0; //マスターの時計に沿って録る時、録り始めた周の長さ（1/n のトラックは周ごとに1サンプル違う）
+
+		//ミックス用の左右のゲイン（目標へ1サンプルずつ近づける）と、それを作った設定値
+		std::array<simd::GainRamp, numStorageChannels> mixRamps;
+		float appliedGain = 1.0f;
+		float appliedPan = 0.0f;
+		bool appliedMute = false;
 
+		//このブロックでミックスした分のレベル（ブロックの終わりにメーターへ渡して戻す）
+		simd::ChannelStats mixLevels;
+		int mixLevelSamples = 0;
 	};
 
-	std::map<int, TrackData> tracks;
-	std::optional<TrackHistory> lastHistory;
+	//UIから書き込むミキサー設定（オーディオスレッドは区間ごとに読むだけ）
+	struct TrackMixParams
+	{
+		std::atomic<float> gain { 1.0f };
+		std::atomic<float> pan { 0.0f };
+		std::atomic<bool> muted { false };
+		std::atomic<LengthRatio> lengthRatio { LengthRatio() };	//次の録音の長さ（録り始めに読む）
+	};
+
+	//サンプル本体（ホットな状態とは別の配列に置く）。録音が進んだ分だけページを持つ
+	struct TrackStorage
+	{
+		PagedTrackBuffer pages;
+	};
 
+	//全トラック共有のページ置き場（トラックと履歴より先に作り、後に壊す）
+	PageArena pageArena;
+	UndoHistory undoHistory;
+	int trackPageCapacity = 0; //トラックと履歴のページ表の大きさ（そろっていないと入れ替えられない）
 
-	double sampleRate;
-	int maxSamples;
+	//捨てた履歴のページを1ブロックあたり何枚までアリーナへ返すか
+	static constexpr int historyReleasePagesPerBlock = 32;
+
+	std::array<TrackData, maxTracks> tracks;
+	std::array<TrackStorage, maxTracks> trackStorage;
+	std::array<TrackMixParams, maxTracks> mixParams;
+	std::array<int, maxTrackIds> slotById;
+	std::atomic<int> numTracks { 0 }; //addTrackはメッセージスレッド、読み出しはオーディオスレッド
+
+	//UIへ公開する波形（オーディオスレッドだけが書き、メッセージスレッドはロックなしで読む）
+	//ページ表とトラック単位のピークの写し。ページの中身のピークはアリーナから直接読む
+	struct TrackWaveform
+	{
+		std::unique_ptr<std::atomic<int>[]> pages;		//トラックのページ → アリーナのページ
+		std::array<std::unique_ptr<std::atomic<peaks::Peak>[]>, peaks::numTrackLevels> trackPeaks;
+		std::array<int, peaks::numTrackLevels> numTrackPeakBins {};
+		int numPages = 0;
+
+		std::atomic<int> length { 0 };		//表示する長さ（0なら空）
+		std::atomic<int> position { -1 };	//再生・録音位置（止まっていれば -1）
+		std::atomic<bool> recording { false };
+
+		int publishedPages = 0; //オーディオスレッド専用: ここまで写した
+	};
+	std::array<TrackWaveform, maxTracks> waveforms;
+
+	void prepareWaveform(int slot);
+	void publishWaveform(int slot, int firstPage, int endPage) noexcept;
+	void publishWaveform(int slot) noexcept;
+	void publishWaveformPage(const PagedTrackBuffer& pages, int pageIndex) noexcept;
+	void publishWaveformTransport() noexcept;
+
+	//トラックのメーター（オーディオスレッドが書き、UIが読む）
+	std::array<LevelMeter, maxTracks> trackMeters;
+	void publishTrackLevels(int numSamples) noexcept;
+
+	//trackId からスロット番号を引く（なければ-1）。挿入は addTrack だけ
+	int findSlot(int trackId) const noexcept
+	{
+		return juce::isPositiveAndBelow(trackId, maxTrackIds) ? slotById[(size_t)trackId] : -1;
+	}
+
+	//オーディオスレッドからリスナーへの通知（callAsyncはメモリ確保するので使わない）
+	struct PendingEvent
+	{
+		enum class Type { recordingStarted, recordingStopped };
+		Type type = Type::recordingStarted;
+		int trackId = -1;
+	};
+	SpscQueue<PendingEvent> pendingEvents { 256 };
+
+	void notifyListeners(PendingEvent::Type type, int trackId);
+
+
+	double sampleRate = 0.0;
 
 	int masterTrackId = -1;
 	int masterLoopLength = 0;
 	int masterReadPosition = 0;
-	long currentSamplePosition = 0;
+	juce::int64 masterCycle = 0;	//マスターが何周したか（masterCycle 周目の masterReadPosition がマスターの時計）
+	long currentSamplePosition = 0; //処理中ブロック先頭の入力絶対位置
 
 	std::vector<int> recordingQueue;
 	int currentRecordingIndex = -1;
@@ -96,11 +431,322 @@ private:
 	juce::ListenerList<Listener> listeners;
 
 	juce::TriggerEvent* triggerRef = nullptr;
+	const HistoryRingBuffer* inputHistory = nullptr;
+	RtProfiler* profiler = nullptr;
+
+	//入力履歴からページへ移すときの中継バッファ（prepareToPlayで確保）
+	juce::AudioBuffer<float> transferScratch;
+
+	std::atomic<juce::uint32> droppedRecordSamples { 0 };
+	std::atomic<int> recordLatencySamples { 0 };
+
+	//===コマンド処理===
+	SpscQueue<Command> commandQueue { 256 };
+
+	//キューから取り出して時刻順に並べた実行待ちコマンド（オーディオスレッド専用）
+	static constexpr int maxScheduledCommands = 64;
+	std::array<Command, maxScheduledCommands> scheduledCommands;
+	int numScheduledCommands = 0;
+
+	//オーディオスレッド自身が頼んだコマンド（次の collectCommands で実行待ちへ移す）
+	static constexpr int maxLocalCommands = 16;
+	std::array<Command, maxLocalCommands> localCommands;
+	int numLocalCommands = 0;
+
+	std::atomic<long> publishedSamplePosition { 0 };
+	std::atomic<juce::uint32> lateCommandCount { 0 };
+	std::atomic<juce::uint32> scheduleOverflowCount { 0 };
+
+	void collectCommands(long blockStart);
+	void scheduleCommand(Command command, long blockStart) noexcept;
+	long getQuantizedTime(Command::Type type, long blockStart) const noexcept;
+	bool isQuantizing() const noexcept; //録音・再生を格子の区切りへ送っているか
+	int applyDueCommands(long blockStart, int offset, int numSamples);
+	void executeCommand(const Command& command);
+
+	//===テンポの格子===
+	std::atomic<double> tempoBpm { 0.0 };
+	std::atomic<int> tempoBeatsPerBar { 4 };
+	std::atomic<int> tempoBeatUnit { 4 };
+	std::atomic<int> tempoVersion { 0 };
+	std::atomic<Quantize> quantize { Quantize::off };
+
+	//オーディオスレッドだけが触る（設定が変わったブロックの頭で作り直す）
+	TempoGrid tempoGrid;
+	int appliedTempoVersion = -1;
+	long freeGridOrigin = 0;	//マスターがない時の格子の原点（入力の絶対位置）
+
+	void updateTempoGrid(long blockStart) noexcept;
+
+	//===ページの写し取り（保存・タイムストレッチ・サンプルレートの変換で共通）===
+	session::TrackInfo& addSnapshotTrack(session::Snapshot& snapshot, int slot);
+	bool readSnapshotTrack(const session::Snapshot& snapshot, const session::TrackInfo& info, juce::AudioBuffer<float>& dest) const;
+
+	//===タイムストレッチ===
+	//元の音（オーディオスレッドがページを retain して埋める）と、伸ばした音を書くページ表
+	//入れ替えた後の renderTargets には前のページ表が入り、裏のスレッドが返す
+	//（renderTargets はサンプルレートの変換でも使う。変換のスレッドは伸ばすスレッドを止めてから使い、変換中は伸ばし始めない）
+	session::Snapshot stretchSource;
+	std::array<PagedTrackBuffer, maxTracks> renderTargets;
+	int numStretchTargets = 0;			//stretchToTempo で用意した数
+	double stretchTargetBpm = 0.0;		//stretchToTempo で書き、オーディオスレッドが写し取る時に読む
+	int stretchLength = 0;				//伸ばした後のマスター長（写し取る時に決める）
+	std::array<int, maxTracks> stretchOutLengths {};	//トラックごとの伸ばした後の長さ（長さの比どおり）
+
+	std::atomic<bool> stretchRequested { false };
+	std::atomic<StretchState> stretchState { StretchState::idle };
+	std::atomic<bool> stretchJobFailed { false };
+	std::atomic<int> stretchFramesDone { 0 };
+	std::atomic<int> stretchFramesTotal { 0 };
+	std::atomic<double> stretchRenderMs { 0.0 };
+	std::atomic<int> stretchNumTracks { 0 };
+	std::atomic<int> stretchNumThreads { 0 };
+
+	//トラックの中身が変わるたびに進める（オーディオスレッド専用）。写し取った時と違えば結果を捨てる
+	juce::uint32 contentEdits = 0;
+	juce::uint32 stretchSourceEdits = 0;
+
+	struct StretchThread : public juce::Thread
+	{
+		explicit StretchThread(LooperAudio& o) : juce::Thread("Simplooper time stretch"), owner(o) {}
+		void run() override { owner.renderStretch(); }
+		LooperAudio& owner;
+	};
+	StretchThread stretchThread { *this };
+
+	static constexpr int maxRenderThreads = 16;
+
+	void takeStretchSnapshot();
+	void applyStretch();
+	void renderStretch();
+	void releaseStretchPages() noexcept;
+	static void stretchTrackJob(void* context, int index);
+
+	//===サンプルレートの変換（prepareToPlay が始め、裏のスレッドで変換する）===
+	//トラックの音が今どのレートか（0 ならまだ決まっていない。セッションを読むとそのファイルのレート）
+	//変換できたら、オーディオスレッドが入れ替える時に書く
+	std::atomic<double> contentSampleRate { 0.0 };
+
+	enum class ResampleState
+	{
+		idle,
+		rendering,			//裏のスレッドが変換中（オーディオスレッドはループを鳴らさない）
+		waitingForSwap,		//変換し終えた。オーディオスレッドが次のブロックの頭で入れ替える
+		swapping,
+		retarget,			//変換中にデバイスのレートがまた変わった（新しいレートで変換し直す）
+		applied				//入れ替えた（前のページを返している。もう鳴らしてよい）
+	};
+	std::atomic<ResampleState> resampleState { ResampleState::idle };
+	std::atomic<double> resampleTargetRate { 0.0 };	//prepareToPlay が書く
+	double resampledRate = 0.0;		//変換し終えたレート（waitingForSwap にする前に書く）
+	int resampledMasterLength = 0;
+
+	//元のページ（prepareToPlay で retain して写す。変換中はオーディオスレッドもトラックを変えない）
+	session::Snapshot resampleSource;
+	juce::uint32 resampleSourceEdits = 0;
+
+	struct ResampleJob
+	{
+		int outLength = 0;
+		LengthRatio lengthRatio;
+	};
+	std::vector<ResampleJob> resampleJobs;	//resampleSource のトラックと同じ並び
+	std::atomic<bool> resampleJobFailed { false };
+	std::atomic<bool> stopForFailedResample { false };	//変換できなかった時、オーディオスレッドに全トラックを止めてもらう
+	ResampleReport lastResample;
+	std::atomic<int> resampleCount { 0 };
+
+	struct ResampleThread : public juce::Thread
+	{
+		explicit ResampleThread(LooperAudio& o) : juce::Thread("Simplooper resample"), owner(o) {}
+		void run() override { owner.renderResample(); }
+		LooperAudio& owner;
+	};
+	ResampleThread resampleThread { *this };
+
+	void startResample(double fromRate, double toRate);
+	void renderResample();
+	void applyResample();
+	bool isResamplePending() const noexcept;
+	int getResampledMasterLength(int masterLength, double toRate) const;
+	static int getResampledLength(int lengthInSample, LengthRatio lengthRatio, int newMasterLength, double rateRatio) noexcept;
+	static void resampleTrackJob(void* context, int index);
+
+	void recordIntoTracks(const juce::AudioBuffer<float>& input, int startSample, int numSamples);
+	void finishCompletedRecordings();
+	int samplesUntilNextPunchOut(int maxSamplesAhead) const;
+
+	//録音を1周で打ち切る長さ（マスター未確定ならページ表いっぱいまで）
+	int getRecordLoopLength(int slot) const noexcept
+	{
+		return (masterLoopLength > 0) ? getLoopLengthFor(masterLoopLength, tracks[(size_t)slot].lengthRatio)
+									  : trackStorage[(size_t)slot].pages.getCapacity();
+	}
+	//録音を打ち切るまでの長さ（マスターの時計に沿って録るなら、録り始めた周の折り返しまで）
+	int getRecordTakeLength(int slot) const noexcept
+	{
+		const auto& track = tracks[(size_t)slot];
+		return (track.recordClockLag >= 0 && masterLoopLength > 0) ? track.recordTakeLength : getRecordLoopLength(slot);
+	}
+	//再生で折り返す長さ
+	int getPlaybackLoopLength(int slot) const noexcept
+	{
+		const auto& track = tracks[(size_t)slot];
+		return (masterLoopLength > 0)
+			? getLoopLengthFor(masterLoopLength, track.lengthRatio)
+			: juce::jmax(1, track.recordLength > 0 ? track.recordLength : trackStorage[(size_t)slot].pages.getCapacity());
+	}
+
+	//===マスターの時計===
+	//どのトラックの再生位置もここから出す（トラックごとに数えないので、長さの比が違ってもずれない）
+	juce::int64 getMasterClock() const noexcept { return masterCycle * masterLoopLength + masterReadPosition; }
+
+	LoopPoint getLoopPoint(const TrackData& track, juce::int64 clock) const noexcept
+	{
+		return getLoopPointFor(masterLoopLength, track.lengthRatio, clock);
+	}
+
+	//長さから比を逆算する（比を持たないセッションの読み込み用）
+	static LengthRatio getLengthRatioOf(int length, int masterLength) noexcept;
+	void backfillPreRoll(int slot);
+	void swapWithHistory(TrackHistory& entry);
+
+	//===ループのつなぎ目===
+	//録り終えたループの頭と尻を、録音前の入力（プリロール）と録音後の入力（オーバーシュート）で
+	//クロスフェードしてページに書き込んでおく。ミックスは今までどおり足すだけ
+	//つなぎ目をはさんで seamFadeLength の間、「尻から続く入力」から「頭へ続く入力」へ等パワーで移る
+	//1周に満たない録音は、入りと終わりを等パワーのフェードで無音とつなぐ
+	struct SeamJob
+	{
+		bool pending = false;
+		bool fullLoop = false;
+		long recordStartSample = 0;	//ループ位置 seamPosition に書いた入力の絶対位置
+		int seamPosition = 0;		//録音を始めた位置
+		int length = 0;				//録った長さ
+		int takeLength = 0;			//1周に録った入力の長さ（オーバーシュートはその続き）
+		int loopLength = 0;
+	};
+	std::array<SeamJob, maxTracks> seamJobs;
+	int numPendingSeams = 0;
+	static constexpr int maxSeamsPerBlock = 4;
+
+	float seamFadeMs = 8.0f;
+	int seamFadeLength = 0;				//prepareToPlay で決める（偶数。0 ならクロスフェードしない）
+	std::vector<float> seamFadeIn;		//sin の 1/4 周期（等パワー）
+	std::vector<float> seamFadeOut;		//cos の 1/4 周期
+	std::vector<float> seamPreRolls;	//[スロット][チャンネル][seamFadeLength/2] 録音開始前の入力
+	juce::AudioBuffer<float> seamCurrent;	//ページの今の中身
+	juce::AudioBuffer<float> seamOther;		//混ぜる相手（プリロール・オーバーシュート）
+
+	void captureSeamPreRoll(int slot);
+	void scheduleSeam(int slot);
+	void cancelSeam(int slot) noexcept;
+	void applyPendingSeams();
+	bool applySeam(int slot);
+	bool isLoopRangeExclusive(const PagedTrackBuffer& pages, int loopLength, int position, int numSamples) const noexcept;
+	void readLoopRange(const PagedTrackBuffer& pages, int loopLength, int position, juce::AudioBuffer<float>& dest, int destStart, int numSamples) const;
+	void writeLoopRange(int slot, int loopLength, int position, const juce::AudioBuffer<float>& src, int srcStart, int numSamples);
+	void mixTracksToOutput(juce::AudioBuffer<float>& output, int startSample, int numSamples);
+	//clockOffset は区間の頭からこの範囲の頭までのサンプル数（マスターの時計はまだ区間の頭を指している）
+	void mixTrackRange(juce::AudioBuffer<float>& dest, int destStart, int firstSlot, int endSlot, int numSamples, int clockOffset = 0);
+	void updateMixTargets(int slot, bool snap) noexcept;
+	void addMonitorInput(juce::AudioBuffer<float>& output, const juce::AudioBuffer<float>& input, int numSamples) noexcept;
+	static void mixGroupJob(void* context, int group);
+
+	//===ミキサー===
+	//ゲイン・パン・ミュートの変化をこの時間かけて直線で追従させる（ジッパーノイズ防止）
+	static constexpr double mixSmoothingMs = 20.0;
+	int mixSmoothingSamples = 1; //prepareToPlayで決める
+
+	std::atomic<float> monitorGain { 1.0f };
+	std::atomic<bool> monitorMuted { false };
+	simd::GainRamp monitorRamp;
+
+	//===並列ミックス===
+	//トラックはスロット順に決まった数ずつグループに分け、グループごとの部分バスを
+	//グループ順に足し合わせる。分け方はワーカー数によらないので直列でも並列でも結果は同じ
+	static constexpr int tracksPerMixGroup = 8;
+	static constexpr int numMixGroups = maxTracks / tracksPerMixGroup;
+	//再生中のトラックがこれ未満ならワーカーを起こさない
+	static constexpr int parallelMixThreshold = 16;
+
+	RealtimeWorkerPool mixWorkers;
+	int requestedMixWorkers = 0;
+
+	std::array<juce::AudioBuffer<float>, numMixGroups> mixBuses; //prepareToPlayで確保
+
+	//ワーカーに渡す今回の区間（run() の間だけ有効）
+	struct MixJob
+	{
+		int numSamples = 0;
+		int numSlots = 0;
+		int clockOffset = 0;	//区間の頭からこの部分バス分の頭まで
+	};
+	MixJob currentMixJob;
+
+	//===ディスクストリーミング===
+	DiskStreamer diskStreamer;
+
+	//ページ表の大きさを決める時に想定するサンプルレート（これより高いと最長ループは短くなる）
+	static constexpr double streamingSizingSampleRate = 48000.0;
+	//1ブロックで書き出し・追い出しを調べるページ数（トラックごと）と、読み戻しを頼む数（全体）
+	static constexpr int streamingScanPagesPerBlock = 32;
+	static constexpr int maxStreamingReadsPerBlock = 16;
+	static constexpr int maxStreamingCompletionsPerBlock = 64;
+	//空きページがこの割合を切ったら追い出しを始める
+	static constexpr int streamingEvictBelowFreePercent = 25;
+
+	double streamingReadAheadSeconds = 2.0;
+	int streamingReadAheadPages = 0; //prepareToPlayで決める
+
+	std::atomic<juce::uint64> streamUnderrunSamples { 0 };
+	std::atomic<juce::uint32> streamUnderrunBlocks { 0 };
+
+	juce::File streamingDirectory;
+
+	void serviceDiskStreaming();
+	void applyStreamingCompletions();
+	PagedTrackBuffer* findPagesByTake(int takeId) noexcept;
+
+	//===セッション===
+	session::Snapshot saveSnapshot;	//saveSession で確保、オーディオスレッドが埋める
+	juce::File saveTarget;
+	std::atomic<bool> snapshotRequested { false };
+	std::atomic<bool> snapshotReady { false };
+	std::atomic<SaveState> saveState { SaveState::idle };
+	static constexpr int snapshotTimeoutMs = 5000;
+
+	struct SaveThread : public juce::Thread
+	{
+		explicit SaveThread(LooperAudio& o) : juce::Thread("Simplooper session save"), owner(o) {}
+		void run() override { owner.writeSavedSession(); }
+		LooperAudio& owner;
+	};
+	SaveThread saveThread { *this };
+
+	std::unique_ptr<session::MappedSession> loadedSession; //外部ページとして使っているマップ
+	double sessionSampleRate = 0.0;
+
+	//外部ページのピークは読み込み後にバックグラウンドで作る（メッセージスレッドでファイル全体を読まない）
+	//できたページ数（先頭から）をまとめて知らせ、オーディオスレッドがトラックの段2・段3へ足して波形へ写す
+	static constexpr int sessionPeakPagesPerPublish = 32;
+	std::atomic<int> sessionPeakPagesBuilt { 0 };
+	int sessionPeakPagesApplied = 0; //オーディオスレッド（読み込み時だけメッセージスレッドが戻す）
+
+	struct SessionPeakThread : public juce::Thread
+	{
+		explicit SessionPeakThread(LooperAudio& o) : juce::Thread("Simplooper session peaks"), owner(o) {}
+		void run() override { owner.buildSessionPeaks(); }
+		LooperAudio& owner;
+	};
+	SessionPeakThread sessionPeakThread { *this };
 
-	void recordIntoTracks(const juce::AudioBuffer<float>& input);
-	void mixTracksToOutput(juce::AudioBuffer<float>& output);
+	void takeSessionSnapshot();
+	void writeSavedSession();
+	void buildSessionPeaks();
+	void applySessionPeaks() noexcept;
 
 	//マスターの録音開始位置
-	int masterStartSample    = 0;
+	long masterStartSample    = 0;
 };
 
@@ -15,6 +15,9 @@ void LooperTrackUi::paint(juce::Graphics& g)
 
 	auto bounds = getLocalBounds().toFloat();
 
+	drawWaveform(g);
+	drawLevelMeter(g, meterArea, level);
+
 	if(isSelected){
 		g.setColour(juce::Colours::darkorange);
 	}else if(isMouseOver){
@@ -37,6 +40,61 @@ void LooperTrackUi::paint(juce::Graphics& g)
 
 }
 
+//1列に縦線1本なので描く手間は幅に比例するだけ
+void LooperTrackUi::drawWaveform(juce::Graphics& g)
+{
+	if(! waveform.hasAudio || waveformArea.isEmpty()) return;
+
+	const float centre = (float)waveformArea.getCentreY();
+	const float halfHeight = waveformArea.getHeight() * 0.5f;
+	const int numColumns = juce::jmin(waveform.getNumColumns(), waveformArea.getWidth());
+
+	g.setColour(waveform.isRecording ? juce::Colours::indianred : juce::Colours::skyblue.withAlpha(0.8f));
+	for(int i = 0; i < numColumns; ++i)
+	{
+		const float top = centre - waveform.maxs[(size_t)i] * halfHeight;
+		const float bottom = centre - waveform.mins[(size_t)i] * halfHeight;
+		g.drawVerticalLine(waveformArea.getX() + i, top, juce::jmax(top + 1.0f, bottom));
+	}
+
+	if(waveform.playhead >= 0.0f)
+	{
+		g.setColour(juce::Colours::white);
+		g.drawVerticalLine(waveformArea.getX() + (int)(waveform.playhead * waveformArea.getWidth()),
+						   (float)waveformArea.getY(), (float)waveformArea.getBottom());
+	}
+}
+
+//RMSを帯、ピークを線で描く（-60dB..0dB）。クリップを保持している間は上端を赤くする
+void LooperTrackUi::drawLevelMeter(juce::Graphics& g, juce::Rectangle<int> area, const LevelMeter::Reading& reading)
+{
+	if(area.isEmpty()) return;
+
+	auto bounds = area.toFloat();
+	const auto heightOf = [&bounds] (float value)
+	{
+		return juce::jmap(LevelMeter::toDecibels(value), -60.0f, 0.0f, 0.0f, bounds.getHeight());
+	};
+
+	g.setColour(juce::Colours::black.withAlpha(0.5f));
+	g.fillRect(bounds);
+
+	g.setColour(juce::Colours::limegreen);
+	g.fillRect(bounds.withTop(bounds.getBottom() - heightOf(reading.rms)));
+
+	if(reading.peak > 0.0f)
+	{
+		g.setColour(juce::Colours::yellow);
+		g.drawHorizontalLine((int)(bounds.getBottom() - heightOf(reading.peak)), bounds.getX(), bounds.getRight());
+	}
+
+	if(reading.clipped)
+	{
+		g.setColour(juce::Colours::red);
+		g.fillRect(bounds.withHeight(3.0f));
+	}
+}
+
 void LooperTrackUi::drawGlowingBorder(juce::Graphics& g,juce::Colour glowColour){
 	auto bounds = getLocalBounds().toFloat();
 
@@ -73,6 +131,82 @@ void LooperTrackUi::drawGlowingBorder(juce::Graphics& g,juce::Colour glowColour)
 }
 
 
+void LooperTrackUi::resized()
+{
+	//下の段にゲイン・パン・ミュート・長さを並べ、残りに波形を描く
+	auto area = getLocalBounds().reduced(6);
+	auto row = area.removeFromBottom(28);
+	const int w = row.getWidth() / 4;
+
+	meterArea = area.removeFromRight(6).reduced(0, 2);
+	waveformArea = area.reduced(2);
+	waveform.setNumColumns(waveformArea.getWidth());
+
+	gainSlider.setBounds(row.removeFromLeft(w));
+	panSlider.setBounds(row.removeFromLeft(w));
+	muteButton.setBounds(row.removeFromLeft(w).reduced(2));
+	lengthButton.setBounds(row.reduced(2));
+}
+
+void LooperTrackUi::setupMixControls()
+{
+	gainSlider.setRange(0.0, 2.0, 0.0);
+	gainSlider.setSkewFactorFromMidPoint(1.0);
+	gainSlider.setValue(1.0, juce::dontSendNotification);
+	gainSlider.setDoubleClickReturnValue(true, 1.0);
+	gainSlider.setTooltip("Gain");
+
+	panSlider.setRange(-1.0, 1.0, 0.0);
+	panSlider.setValue(0.0, juce::dontSendNotification);
+	panSlider.setDoubleClickReturnValue(true, 0.0);
+	panSlider.setTooltip("Pan");
+
+	muteButton.setClickingTogglesState(true);
+	muteButton.setColour(juce::TextButton::buttonOnColourId, juce::Colours::darkorange);
+
+	gainSlider.onValueChange = [this] { notifyMixChanged(); };
+	panSlider.onValueChange = [this] { notifyMixChanged(); };
+	muteButton.onClick = [this] { notifyMixChanged(); };
+
+	lengthButton.setTooltip("Loop length for the next recording (x master)");
+	lengthButton.onClick = [this] { cycleLengthRatio(); };
+
+	addAndMakeVisible(gainSlider);
+	addAndMakeVisible(panSlider);
+	addAndMakeVisible(muteButton);
+	addAndMakeVisible(lengthButton);
+}
+
+void LooperTrackUi::setMix(float gain, float pan, bool muted)
+{
+	gainSlider.setValue(gain, juce::dontSendNotification);
+	panSlider.setValue(pan, juce::dontSendNotification);
+	muteButton.setToggleState(muted, juce::dontSendNotification);
+}
+
+void LooperTrackUi::setLengthRatio(LooperAudio::LengthRatio ratio)
+{
+	lengthRatio = ratio;
+	lengthButton.setButtonText(ratio.division > 1 ? "1/" + juce::String(ratio.division) : "x" + juce::String(ratio.multiple));
+}
+
+void LooperTrackUi::cycleLengthRatio()
+{
+	if (lengthRatio.division > 1)
+		setLengthRatio(lengthRatio.division < 4 ? LooperAudio::LengthRatio { 1, 4 } : LooperAudio::LengthRatio {});
+	else
+		setLengthRatio(lengthRatio.multiple < 4 ? LooperAudio::LengthRatio { lengthRatio.multiple * 2, 1 } : LooperAudio::LengthRatio { 1, 2 });
+
+	notifyMixChanged();
+}
+
+void LooperTrackUi::notifyMixChanged()
+{
+	if(listener != nullptr)
+		listener->trackMixChanged(this);
+}
+
+
 void LooperTrackUi::mouseDown(const juce::MouseEvent&)
 {
 	if(listener != nullptr)
@@ -27,6 +27,7 @@ class LooperTrackUi : public juce::Component,juce::Timer
 	: trackId(id),state(initialState)
 	{
 		setInterceptsMouseClicks(true, true);
+		setupMixControls();
 	}
 	//リスナー関数のオーバーライド。クリックされたトラックの把握に必要
 	class Listener
@@ -34,6 +35,8 @@ class LooperTrackUi : public juce::Component,juce::Timer
 		public:
 		virtual ~Listener() = default;
 		virtual void trackClicked(LooperTrackUi* track) = 0;
+		//ゲイン・パン・ミュートが操作された
+		virtual void trackMixChanged(LooperTrackUi* /*track*/) {}
 	};
 	~LooperTrackUi() override = default;
 	//トラックの状態
@@ -49,6 +52,25 @@ class LooperTrackUi : public juce::Component,juce::Timer
 	bool getIsSelected() const;
 	void setListener(Listener* listener);
 
+	//ミキサー設定
+	float getGain() const { return (float)gainSlider.getValue(); }
+	float getPan() const { return (float)panSlider.getValue(); }
+	bool isMuted() const { return muteButton.getToggleState(); }
+	//読み込んだセッションの値を表示に反映する（リスナーには通知しない）
+	void setMix(float gain, float pan, bool muted);
+
+	//次に録るループの長さ（マスターの x1 → x2 → x4 → 1/2 → 1/4 の順に切り替える）
+	LooperAudio::LengthRatio getLengthRatio() const { return lengthRatio; }
+	void setLengthRatio(LooperAudio::LengthRatio ratio);
+
+	//波形表示（MainComponent が LooperAudio::readWaveform で埋めてから repaint する）
+	peaks::Columns& getWaveform() { return waveform; }
+
+	//レベルメーター（MainComponent が LooperAudio::getTrackLevel の値を渡す）
+	void setLevel(const LevelMeter::Reading& newLevel) { level = newLevel; }
+	//縦のメーターを1本描く（入力メーターでも使う）
+	static void drawLevelMeter(juce::Graphics& g, juce::Rectangle<int> area, const LevelMeter::Reading& reading);
+
 	//録音処理
 	void startRecording();
 	void stopRecording();
@@ -64,6 +86,7 @@ class LooperTrackUi : public juce::Component,juce::Timer
 
 	protected:
 	void paint(juce::Graphics& g) override;
+	void resized() override;
 
 
 
@@ -79,5 +102,25 @@ class LooperTrackUi : public juce::Component,juce::Timer
 
 	float flashProgress = 0.0f;
 	bool isFlashing = false;
+
+	//ミキサー
+	juce::Slider gainSlider { juce::Slider::RotaryHorizontalVerticalDrag, juce::Slider::NoTextBox };
+	juce::Slider panSlider { juce::Slider::RotaryHorizontalVerticalDrag, juce::Slider::NoTextBox };
+	juce::TextButton muteButton { "M" };
+	juce::TextButton lengthButton { "x1" };
+	LooperAudio::LengthRatio lengthRatio;
+
+	void setupMixControls();
+	void cycleLengthRatio();
+	void notifyMixChanged();
+
+	//波形（列数は描く幅と同じ）
+	peaks::Columns waveform;
+	juce::Rectangle<int> waveformArea;
+	void drawWaveform(juce::Graphics& g);
+
+	//メーター（波形の右端に細く描く）
+	LevelMeter::Reading level;
+	juce::Rectangle<int> meterArea;
 };
 
@@ -3,81 +3,182 @@
 //==============================================================================
 MainComponent::MainComponent()
 	: sharedTrigger(inputTap.getTriggerEvent()),
-		looper(44100, 44100 * 10)
+		looper(LooperAudio::defaultStorageBudgetBytes)
 {
-	setAudioChannels(2, 2);
-	deviceManager.addAudioCallback(&inputTap); // 入力だけTapする
-
-	startTimerHz(30);
+	startTimerHz(60); //波形と再生位置の表示
 
 	// トラック初期化（最初は4つ）
 	for (int i = 0; i < 4; ++i)
-	{
-		int newId = static_cast<int>(tracks.size() + 1);
-		auto track = std::make_unique<LooperTrackUi>(newId, LooperTrackUi::TrackState::Idle);
-		track->setListener(this);
-		addAndMakeVisible(track.get());
-		tracks.push_back(std::move(track));
-		looper.addTrack(newId);
-	}
+		looper.addTrack(i + 1);
+
+	//前回のセッションがあれば読み込む（オーディオを始める前に）
+	if (getDefaultSessionFile().existsAsFile())
+		looper.loadSession(getDefaultSessionFile());
+
+	rebuildTracksFromLooper();
 
 	// ボタン類設定
 	addAndMakeVisible(recordButton);
 	addAndMakeVisible(playAllButton);
 	addAndMakeVisible(stopAllButton);
 	addAndMakeVisible(undoButton);
+	addAndMakeVisible(redoButton);
 	addAndMakeVisible(settingButton);
 
 	recordButton.addListener(this);
 	playAllButton.addListener(this);
 	stopAllButton.addListener(this);
 	undoButton.addListener(this);
+	redoButton.addListener(this);
 	settingButton.onClick = [this] { showDeviceSettings(); };
 
 	recordButton.setColour(juce::TextButton::buttonColourId, juce::Colours::darkred);
 	playAllButton.setColour(juce::TextButton::buttonColourId, juce::Colours::darkgreen);
 	stopAllButton.setColour(juce::TextButton::buttonColourId, juce::Colours::darkgrey);
 
-	setSize(720, 600);
+	addAndMakeVisible(saveButton);
+	addAndMakeVisible(loadButton);
+	saveButton.onClick = [this] { saveSession(); };
+	loadButton.onClick = [this] { loadSession(getDefaultSessionFile()); };
+
+	//入力ゲート（パラメータは InputTap の SmartGate がロックなしで受け取る）
+	addAndMakeVisible(gateButton);
+	gateButton.setClickingTogglesState(true);
+	gateButton.setColour(juce::TextButton::buttonOnColourId, juce::Colours::darkorange);
+	gateButton.onClick = [this] { inputTap.setGateEnabled(gateButton.getToggleState()); };
+
+	addAndMakeVisible(calibrateButton);
+	calibrateButton.onClick = [this] { calibrator.start(); };
+
+	//テンポの格子（Free の間は格子なし。Bar/Beat でマスターを小節単位にし、録音・再生を区切りで始める）
+	addAndMakeVisible(gridButton);
+	gridButton.onClick = [this] { cycleGrid(); };
+
+	addAndMakeVisible(tempoSlider);
+	tempoSlider.setSliderStyle(juce::Slider::IncDecButtons);
+	tempoSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 50, 24);
+	tempoSlider.setRange(TempoGrid::minBpm, TempoGrid::maxBpm, 1.0);
+	tempoSlider.setValue(120.0, juce::dontSendNotification);
+	tempoSlider.setTextValueSuffix(" bpm");
+	//格子がある間のテンポ変更は、録ったループも伸ばして合わせる（伸ばし中なら終わってから）
+	tempoSlider.onValueChange = [this]
+	{
+		if (gridQuantize != LooperAudio::Quantize::off)
+			pendingTempo = tempoSlider.getValue();
+	};
+
+	setSize(1250, 600);
 
 
 	//ルーパーからのリスナーイベントを受け取る
 	looper.addListener(this);
+
+	if (RtProfiler::isEnabled())
+	{
+		addAndMakeVisible(traceButton);
+		traceButton.onClick = [this] { toggleTrace(); };
+	}
+
+	inputTap.setProfiler(&profiler);
+	looper.setProfiler(&profiler);
+	profiler.start();
+
+	//入力も出力も同じデバイス・同じコールバックで扱う
+	const auto error = deviceManager.initialiseWithDefaultDevices(2, 2);
+	if (error.isNotEmpty())
+		DBG("⚠️ Audio device: " << error);
+
+	deviceManager.addAudioCallback(this);
 }
 
 MainComponent::~MainComponent()
 {
-	shutdownAudio();
+	deviceManager.removeAudioCallback(this);
+	deviceManager.closeAudioDevice();
+	profiler.stop();
 }
 
-//==============================================================================
-
-void MainComponent::prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+void MainComponent::audioDeviceAboutToStart(juce::AudioIODevice* device)
 {
-	inputTap.prepare(sampleRate, samplesPerBlockExpected);
-	looper.prepareToPlay(samplesPerBlockExpected, sampleRate);
+	const double sampleRate = device->getCurrentSampleRate();
+	const int bufferSize = device->getCurrentBufferSizeSamples();
+	const int numInputs = device->getActiveInputChannels().countNumberOfSetBits();
+	const int numOutputs = device->getActiveOutputChannels().countNumberOfSetBits();
+
+	inputTap.prepare(sampleRate, bufferSize, numInputs);
+	chunkInputs.assign((size_t)numInputs, nullptr);
+	chunkOutputs.assign((size_t)numOutputs, nullptr);
+	profiler.prepare(sampleRate);
+	looper.setSeamFadeMs((float)inputTap.getManager().getConfig().fadeMs);
+	looper.prepareToPlay(bufferSize, sampleRate);
 	looper.setTriggerReference(inputTap.getManager().getTriggerEvent());
+	looper.setInputHistory(inputTap.getManager().getInputHistory());
+
+	//入力を別のコールバックから FIFO で受け取っていた時は、そこで1バッファ分待っていた
+	const int reportedRoundTrip = device->getInputLatencyInSamples() + device->getOutputLatencyInSamples();
+	profiler.setLatency(reportedRoundTrip, bufferSize);
+	calibrator.prepare(sampleRate, bufferSize, reportedRoundTrip);
 
 	DBG("InputTap trigger address = " + juce::String((juce::uint64)(uintptr_t)&inputTap.getTriggerEvent()));
 	DBG("Shared trigger address   = " + juce::String((juce::uint64)(uintptr_t)&sharedTrigger));
 
 }
 
-void MainComponent::releaseResources()
+void MainComponent::audioDeviceStopped()
 {
-	DBG("releaseResources called");
+	DBG("audioDeviceStopped called");
 }
 
-void MainComponent::getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill)
+void MainComponent::audioDeviceIOCallbackWithContext(const float* const* inputChannelData, int numInputChannels,
+													 float* const* outputChannelData, int numOutputChannels,
+													 int numSamples, const juce::AudioIODeviceCallbackContext&)
 {
-	auto& trig = sharedTrigger;
-	bufferToFill.clearActiveBufferRegion();
+	AllocationTripwire::ScopedArm tripwire; //ここから先はメモリ確保禁止
+	RtProfiler::ScopedCallback profile(&profiler, numSamples);
+
+	//測定中はデバイスの入力をそのまま取り込む（出力を書く前に）
+	calibrator.captureInput(inputChannelData, numInputChannels, numSamples);
+
+	//準備したより大きいブロックが来たら、準備した長さずつに分けて入力段とルーパーに通す
+	//（入力段の作業用を、オーディオスレッドで確保し直さないため）
+	const int chunkSize = inputTap.getMaxBlockSize();
+	if (numSamples <= chunkSize)
+	{
+		processChunk(inputChannelData, numInputChannels, outputChannelData, numOutputChannels, numSamples);
+	}
+	else
+	{
+		const int numChunkInputs = juce::jmin(numInputChannels, (int)chunkInputs.size());
+		const int numChunkOutputs = juce::jmin(numOutputChannels, (int)chunkOutputs.size());
+
+		for (int offset = 0; offset < numSamples; offset += chunkSize)
+		{
+			for (int ch = 0; ch < numChunkInputs; ++ch)
+				chunkInputs[(size_t)ch] = inputChannelData[ch] != nullptr ? inputChannelData[ch] + offset : nullptr;
+			for (int ch = 0; ch < numChunkOutputs; ++ch)
+				chunkOutputs[(size_t)ch] = outputChannelData[ch] != nullptr ? outputChannelData[ch] + offset : nullptr;
 
-	// 入力バッファを取得
-	juce::AudioBuffer<float> input(bufferToFill.buffer->getNumChannels(),
-								   bufferToFill.numSamples);
-	input.clear();
-	inputTap.getLatestInput(input);
+			processChunk(chunkInputs.data(), numChunkInputs, chunkOutputs.data(), numChunkOutputs,
+						 juce::jmin(chunkSize, numSamples - offset));
+		}
+	}
+
+	outputView.setDataToReferTo(outputChannelData, numOutputChannels, numSamples);
+
+	//測定中は出力をテスト信号に置き換える（ループとモニターは鳴らさない）
+	calibrator.renderOutput(outputView);
+}
+
+// 準備した長さまでの1区間分：入力段 → トリガー → ルーパー
+void MainComponent::processChunk(const float* const* inputChannelData, int numInputChannels,
+								 float* const* outputChannelData, int numOutputChannels, int numSamples)
+{
+	//入力はデバイスのバッファをそのまま（ゲートをかける時だけ InputTap の作業用へ）
+	const auto& input = inputTap.process(inputChannelData, numInputChannels,
+										 outputChannelData, numOutputChannels, numSamples);
+
+	auto& trig = sharedTrigger;
+	bool consumeTrigger = false;
 
 	// === トリガーが立ったら ===
 
@@ -97,18 +198,18 @@ void MainComponent::getNextAudioBlock(const juce::AudioSourceChannelInfo& buffer
 
 		if (!anyRecording)
 		{
-			// 🟢 新規録音を開始
+			// 🟢 新規録音を開始（クオンタイズ中はボタンと同じく次の拍・小節の頭ちょうどから、埋め戻しなし）
 			for (auto& t : tracks)
 			{
 				if (t->getIsSelected())
 				{
-					looper.startRecording(t->getTrackId());
-
-					juce::MessageManager::callAsync([this, &trig, &t]()
-					{t->setState(LooperTrackUi::TrackState::Recording);
-					});
+					//UIの状態はリスナー通知（timerCallback経由）で更新される
+					looper.postCommandFromAudioThread({ LooperAudio::Command::Type::startRecording, t->getTrackId() });
 				}
 			}
+
+			//クオンタイズなしならこの区間の頭で録り始めるので、アタックの位置から埋め戻せるよう消費は processBlock の後
+			consumeTrigger = true;
 		}
 		else
 		{
@@ -119,8 +220,13 @@ void MainComponent::getNextAudioBlock(const juce::AudioSourceChannelInfo& buffer
 		}
 			
 	}
-	// 🌀 LooperAudio の処理は常に実行
-	looper.processBlock(*bufferToFill.buffer, input);
+	// 🌀 LooperAudio の処理は常に実行（デバイスの出力へ直接書く）
+	outputView.setDataToReferTo(outputChannelData, numOutputChannels, numSamples);
+	looper.processBlock(outputView, input, inputTap.getBlockStartSample());
+
+	//同じトリガーで次のブロックに録音をやり直さないよう消費しておく
+	if (consumeTrigger)
+		trig.consume();
 }
 
 
@@ -130,6 +236,22 @@ void MainComponent::getNextAudioBlock(const juce::AudioSourceChannelInfo& buffer
 void MainComponent::paint(juce::Graphics& g)
 {
 	g.fillAll(juce::Colours::black);
+
+	//入力チャンネルごとに縦のメーターを並べる
+	const int numMeters = (int)inputLevels.size();
+	for (int ch = 0; ch < numMeters; ++ch)
+	{
+		auto meter = inputMeterArea.withTrimmedLeft(ch * inputMeterArea.getWidth() / numMeters)
+								   .withWidth(inputMeterArea.getWidth() / numMeters);
+		LooperTrackUi::drawLevelMeter(g, meter.reduced(1, 0), inputLevels[(size_t)ch]);
+	}
+
+	if (profilerText.isNotEmpty())
+	{
+		g.setColour(juce::Colours::lightgrey);
+		g.setFont(12.0f);
+		g.drawFittedText(profilerText, profilerArea, juce::Justification::centredLeft, 2);
+	}
 }
 
 void MainComponent::resized()
@@ -137,11 +259,25 @@ void MainComponent::resized()
 	auto area = getLocalBounds().reduced(15);
 	auto topArea = area.removeFromTop(topHeight);
 
+	if (RtProfiler::isEnabled())
+	{
+		profilerArea = area.removeFromBottom(36);
+		traceButton.setBounds(profilerArea.removeFromRight(80).reduced(5));
+	}
+
 	recordButton.setBounds(topArea.removeFromLeft(100).reduced(5));
 	playAllButton.setBounds(topArea.removeFromLeft(100).reduced(5));
 	stopAllButton.setBounds(topArea.removeFromLeft(100).reduced(5));
 	undoButton.setBounds(topArea.removeFromLeft(100).reduced(5));
+	redoButton.setBounds(topArea.removeFromLeft(100).reduced(5));
 	settingButton.setBounds(topArea.removeFromLeft(150).reduced(5));
+	saveButton.setBounds(topArea.removeFromLeft(100).reduced(5));
+	loadButton.setBounds(topArea.removeFromLeft(100).reduced(5));
+	gateButton.setBounds(topArea.removeFromLeft(60).reduced(5));
+	calibrateButton.setBounds(topArea.removeFromLeft(110).reduced(5));
+	gridButton.setBounds(topArea.removeFromLeft(70).reduced(5));
+	tempoSlider.setBounds(topArea.removeFromLeft(120).reduced(5));
+	inputMeterArea = topArea.reduced(5);
 
 	int x = 0, y = 0;
 	for (int i = 0; i < tracks.size(); i++)
@@ -179,6 +315,16 @@ void MainComponent::trackClicked(LooperTrackUi* clickedTrack)
 		DBG("🚫 All tracks deselected");
 }
 
+//ミキサー設定はアトミックに書くだけなのでコマンドキューを通さない
+void MainComponent::trackMixChanged(LooperTrackUi* track)
+{
+	const int id = track->getTrackId();
+	looper.setTrackGain(id, track->getGain());
+	looper.setTrackPan(id, track->getPan());
+	looper.setTrackMute(id, track->isMuted());
+	looper.setTrackLengthRatio(id, track->getLengthRatio());
+}
+
 
 void MainComponent::buttonClicked(juce::Button* button)
 {
@@ -219,8 +365,8 @@ void MainComponent::buttonClicked(juce::Button* button)
 				if (t->getState() == LooperTrackUi::TrackState::Recording)
 				{
 					int id = t->getTrackId();
-					looper.stopRecording(id);
-					looper.startPlaying(id);
+					looper.postCommand(LooperAudio::Command::Type::stopRecording, id);
+					looper.postCommand(LooperAudio::Command::Type::startPlaying, id);
 					t->setState(LooperTrackUi::TrackState::Playing);
 					t->setSelected(false);
 					//DBG("selected = " << (t->getIsSelected() ? "true" : "false"));
@@ -235,7 +381,7 @@ void MainComponent::buttonClicked(juce::Button* button)
 				if (t->getIsSelected())
 				{
 					int id = t->getTrackId();
-					looper.startRecording(id);
+					looper.postCommand(LooperAudio::Command::Type::startRecording, id);
 					t->setState(LooperTrackUi::TrackState::Recording);
 					DBG("🎙 Start recording track " << id);
 				}
@@ -248,22 +394,22 @@ void MainComponent::buttonClicked(juce::Button* button)
 		for (auto& t : tracks)
 		{
 			int id = t->getTrackId();
-			looper.stopRecording(id);
-			looper.stopPlaying(id);
+			looper.postCommand(LooperAudio::Command::Type::stopRecording, id);
+			looper.postCommand(LooperAudio::Command::Type::stopPlaying, id);
 
 		}
 		updateStateVisual();
 	}
 	else if (button == &playAllButton)
 	{
-		looper.masterPositionReset();
+		looper.postCommand(LooperAudio::Command::Type::masterPositionReset);
 		for (auto& t : tracks)
 		{
 			int id = t->getTrackId();
 
 			if(t->getState() != LooperTrackUi::TrackState::Idle)
 			{
-				looper.startPlaying(id);
+				looper.postCommand(LooperAudio::Command::Type::startPlaying, id);
 				t->setState(LooperTrackUi::TrackState::Playing);
 			}
 		}
@@ -273,8 +419,11 @@ void MainComponent::buttonClicked(juce::Button* button)
 	}else if (button == &undoButton)
 	{
 
-	 looper.undoLastRecording();
+	 looper.postCommand(LooperAudio::Command::Type::undo);
 
+	}else if (button == &redoButton)
+	{
+		looper.postCommand(LooperAudio::Command::Type::redo);
 	}
 
 }
@@ -365,7 +514,7 @@ void MainComponent::startRec()
 
 				for (int id : selectedIDs)
 				{
-					looper.startRecording(id);
+					looper.postCommand(LooperAudio::Command::Type::startRecording, id);
 				}
 
 			}
@@ -378,8 +527,275 @@ void MainComponent::startRec()
 		}
 }
 
+//==============================================================================
+// セッション
+
+juce::File MainComponent::getDefaultSessionFile()
+{
+	return juce::File::getSpecialLocation(juce::File::userDocumentsDirectory)
+		.getChildFile("Simplooper")
+		.getChildFile(juce::String("session") + LooperAudio::sessionFileExtension);
+}
+
+void MainComponent::saveSession()
+{
+	const auto file = getDefaultSessionFile();
+	file.getParentDirectory().createDirectory();
+
+	if (! looper.saveSession(file))
+		DBG("⚠️ A session save is already in progress");
+}
+
+//==============================================================================
+// レイテンシ
+
+//録音の位置合わせ＝往復レイテンシ＋ゲートの先読み（ゲートを切り替えても次の録音から合う）
+void MainComponent::updateRecordLatency()
+{
+	const int gateLatency = inputTap.isGateEnabled() ? inputTap.getGate().getLatencySamples() : 0;
+	looper.setRecordLatency(calibrator.getRoundTripSamples() + gateLatency);
+
+	const auto state = calibrator.getState();
+	if (state == shownCalibrationState)
+		return;
+
+	shownCalibrationState = state;
+	switch (state)
+	{
+		case LatencyCalibrator::State::armed:
+		case LatencyCalibrator::State::playing:
+		case LatencyCalibrator::State::analysing:
+			calibrateButton.setButtonText("Measuring...");
+			break;
+		case LatencyCalibrator::State::succeeded:
+			calibrateButton.setButtonText(juce::String(calibrator.samplesToMs(calibrator.getMeasuredSamples()), 1) + " ms");
+			break;
+		case LatencyCalibrator::State::failed:
+			calibrateButton.setButtonText("No loopback");
+			break;
+		default:
+			calibrateButton.setButtonText("Latency");
+			break;
+	}
+}
+
+//==============================================================================
+// テンポの格子
+
+void MainComponent::cycleGrid()
+{
+	switch (gridQuantize)
+	{
+		case LooperAudio::Quantize::off: gridQuantize = LooperAudio::Quantize::bar; break;
+		case LooperAudio::Quantize::bar: gridQuantize = LooperAudio::Quantize::beat; break;
+		default:                         gridQuantize = LooperAudio::Quantize::off; break;
+	}
+
+	//Free ならテンポごと外す（マスターの長さも録ったまま）。格子を付けた時のテンポは伸ばさずにそのまま
+	looper.setQuantize(gridQuantize);
+	if (gridQuantize != LooperAudio::Quantize::beat)
+		looper.setTempo(gridQuantize == LooperAudio::Quantize::off ? 0.0 : tempoSlider.getValue());
+
+	pendingTempo = 0.0;
+	shownStretchState = LooperAudio::StretchState::idle;
+	gridButton.setButtonText(getGridText());
+}
+
+juce::String MainComponent::getGridText() const
+{
+	return gridQuantize == LooperAudio::Quantize::bar  ? "Bar"
+		 : gridQuantize == LooperAudio::Quantize::beat ? "Beat"
+													   : "Free";
+}
+
+//待っているテンポ変更を頼み、伸ばしている間は進み具合をボタンに出す
+void MainComponent::updateStretch()
+{
+	if (pendingTempo > 0.0 && looper.stretchToTempo(pendingTempo))
+		pendingTempo = 0.0;
+
+	const auto status = looper.getStretchStatus();
+
+	switch (status.state)
+	{
+		case LooperAudio::StretchState::waitingForSnapshot:
+		case LooperAudio::StretchState::rendering:
+			gridButton.setButtonText(juce::String(juce::roundToInt(status.progress * 100.0f)) + "%");
+			break;
+		case LooperAudio::StretchState::waitingForLoopStart:
+		case LooperAudio::StretchState::swapping:
+		case LooperAudio::StretchState::applied:
+			gridButton.setButtonText("Next loop");
+			break;
+		default:
+			if (status.state != shownStretchState)
+			{
+				gridButton.setButtonText(getGridText());
+				if (status.state == LooperAudio::StretchState::succeeded && status.numTracks > 0)
+					tempoSlider.setTooltip("Stretched " + juce::String(status.numTracks) + " tracks in "
+										   + juce::String(status.renderMs, 0) + " ms (" + juce::String(status.numThreads) + " threads)");
+				else if (status.state == LooperAudio::StretchState::failed)
+					tempoSlider.setTooltip("Time stretch failed");
+			}
+			break;
+	}
+
+	shownStretchState = status.state;
+}
+
+//==============================================================================
+// プロファイラ
+
+void MainComponent::toggleTrace()
+{
+	if (profiler.isTracing())
+	{
+		profiler.stopTrace();
+		traceButton.setButtonText("Trace");
+		return;
+	}
+
+	//chrome://tracing や Perfetto で開ける JSON
+	const auto file = getDefaultSessionFile().getSiblingFile("trace-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S") + ".json");
+	file.getParentDirectory().createDirectory();
+
+	if (profiler.startTrace(file, RtProfiler::TraceFormat::json))
+		traceButton.setButtonText("Tracing...");
+	else
+		DBG("⚠️ Could not open trace file " << file.getFullPathName());
+}
+
+void MainComponent::updateProfilerText()
+{
+	const auto s = profiler.getSummary();
+
+	//デバイスが数えている xrun（数えないデバイスは -1）
+	int deviceXRuns = -1;
+	if (auto* device = deviceManager.getCurrentAudioDevice())
+		deviceXRuns = device->getXRunCount();
+
+	juce::String text;
+	text << "DSP " << juce::String(s.meanLoad * 100.0, 1) << "% (p99 " << juce::String(s.p99Load * 100.0, 0)
+		 << "%, max " << juce::String(s.maxLoad * 100.0, 0) << "%)"
+		 << "  over " << (int)s.deadlineMisses << "  late " << (int)s.lateCallbacks
+		 << "  xrun " << (deviceXRuns >= 0 ? juce::String(deviceXRuns) : juce::String("-"))
+		 << "  dropped " << (int)s.droppedFrames
+		 << "  latency " << juce::String(s.roundTripLatencyMs, 1) << "ms (-" << juce::String(s.savedLatencyMs, 1) << "ms)\n";
+
+	for (int i = 0; i < RtProfiler::numStages; ++i)
+		text << RtProfiler::getStageName((RtProfiler::Stage)i) << " " << juce::String(s.meanStageMicros[(size_t)i], 1)
+			 << "/" << juce::String(s.maxStageMicros[(size_t)i], 0) << "us  ";
+
+	if (text != profilerText)
+	{
+		profilerText = text;
+		repaint(profilerArea);
+	}
+}
+
+//読み込みはトラックを丸ごと入れ替えるので、オーディオを止めてから
+void MainComponent::loadSession(const juce::File& file)
+{
+	if (! file.existsAsFile()) return;
+
+	deviceManager.removeAudioCallback(this); //audioDeviceStopped まで待ってから戻る
+
+	if (looper.loadSession(file))
+		rebuildTracksFromLooper();
+
+	deviceManager.addAudioCallback(this); //audioDeviceAboutToStart からやり直す
+}
+
+void MainComponent::rebuildTracksFromLooper()
+{
+	selectedTrack = nullptr;
+	tracks.clear();
+
+	for (const auto& summary : looper.getTrackSummaries())
+	{
+		const auto state = summary.isPlaying ? LooperTrackUi::TrackState::Playing
+											 : summary.hasAudio ? LooperTrackUi::TrackState::Stopped
+																: LooperTrackUi::TrackState::Idle;
+
+		auto track = std::make_unique<LooperTrackUi>(summary.trackId, state);
+		track->setMix(summary.gain, summary.pan, summary.muted);
+		track->setLengthRatio(summary.lengthRatio);
+		track->setListener(this);
+		addAndMakeVisible(track.get());
+		tracks.push_back(std::move(track));
+	}
+
+	resized();
+	updateStateVisual();
+}
+
 void MainComponent::timerCallback()
 {
+	//オーディオスレッドから届いた録音開始/停止を配信
+	looper.dispatchPendingEvents();
+
+	//波形はオーディオスレッドが公開したピークを読むだけ（生のサンプルには触らない）
+	for (auto& t : tracks)
+	{
+		looper.readWaveform(t->getTrackId(), t->getWaveform());
+		t->setLevel(looper.getTrackLevel(t->getTrackId()));
+		t->repaint();
+	}
+
+	//入力メーター（数はデバイスの入力チャンネル数に合わせる）
+	const auto& inputManager = inputTap.getManager();
+	inputLevels.resize((size_t)inputManager.getNumInputMeters());
+	for (size_t ch = 0; ch < inputLevels.size(); ++ch)
+		inputLevels[ch] = inputManager.getInputLevel((int)ch);
+	repaint(inputMeterArea);
+
+	if (RtProfiler::isEnabled())
+		updateProfilerText();
+
+	updateRecordLatency();
+	updateStretch();
+
+	//デバイスのレートが変わってループを変換したら、結果を設定ボタンに出す
+	const auto resample = looper.getLastResample();
+	if (resample.count != shownResampleCount)
+	{
+		shownResampleCount = resample.count;
+		const auto rates = juce::String(resample.fromRate, 0) + " -> " + juce::String(resample.toRate, 0) + " Hz";
+		settingButton.setTooltip(resample.succeeded
+								 ? "Resampled " + juce::String(resample.numTracks) + " tracks " + rates + " in "
+								   + juce::String(resample.renderMs, 0) + " ms (" + juce::String(resample.numThreads) + " threads)"
+								 : "Could not resample loops " + rates + " (out of memory)");
+
+		//変換できなかった時はルーパーが全トラックを止めている。黙って違う速さで鳴らさないよう、はっきり知らせる
+		if (! resample.succeeded)
+		{
+			for (auto& t : tracks)
+				if (t->getState() == LooperTrackUi::TrackState::Playing)
+					t->setState(LooperTrackUi::TrackState::Stopped);
+			updateStateVisual();
+
+			juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon, "Loops stopped",
+												   "The loops could not be converted from " + rates + " because there is not enough memory, "
+												   "so playback was stopped. Clear some tracks and apply the sample rate again in Audio Settings to retry, "
+												   "or switch the device back to " + juce::String(resample.fromRate, 0) + " Hz.");
+		}
+	}
+
+	//保存の進み具合をボタンに出す
+	const auto saveState = looper.getSaveState();
+	if (saveState != shownSaveState)
+	{
+		shownSaveState = saveState;
+		switch (saveState)
+		{
+			case LooperAudio::SaveState::waitingForSnapshot:
+			case LooperAudio::SaveState::writing:   saveButton.setButtonText("Saving..."); break;
+			case LooperAudio::SaveState::succeeded: saveButton.setButtonText("Saved"); break;
+			case LooperAudio::SaveState::failed:    saveButton.setButtonText("Save failed"); break;
+			default:                                saveButton.setButtonText("Save"); break;
+		}
+	}
+
 	//if(inputTap.triggerFlag.exchange(false))
 		//DBG("TriggerDetected!");
 
@@ -5,12 +5,16 @@
 #include "LooperAudio.h"
 #include "InputTap.h"
 #include "Util.h"
+#include "AllocationTripwire.h"
+#include "RtProfiler.h"
+#include "LatencyCalibrator.h"
 
 //==============================================================================
 // ルーパーアプリ本体
 //==============================================================================
 class MainComponent :
-public juce::AudioAppComponent,
+public juce::Component,
+public juce::AudioIODeviceCallback,
 public LooperTrackUi::Listener,
 public juce::Button::Listener,
 public LooperAudio::Listener,
@@ -25,10 +29,14 @@ juce::Timer
 
 	~MainComponent() override;
 
-	// AudioAppComponent
-	void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override;
-	void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override;
-	void releaseResources() override;
+	// AudioIODeviceCallback（入力・録音・ミックス・モニターをこの1つのコールバックで処理する）
+	void audioDeviceAboutToStart(juce::AudioIODevice* device) override;
+	void audioDeviceIOCallbackWithContext(const float* const* inputChannelData, int numInputChannels,
+										  float* const* outputChannelData, int numOutputChannels,
+										  int numSamples, const juce::AudioIODeviceCallbackContext& context) override;
+	void audioDeviceStopped() override;
+	void processChunk(const float* const* inputChannelData, int numInputChannels,
+					  float* const* outputChannelData, int numOutputChannels, int numSamples);
 
 	// JUCE Component
 	void paint(juce::Graphics&) override;
@@ -36,19 +44,27 @@ juce::Timer
 
 	// UIイベント
 	void trackClicked(LooperTrackUi* trackClicked) override;
+	void trackMixChanged(LooperTrackUi* track) override;
 	void buttonClicked(juce::Button* button) override;
 	void showDeviceSettings();
 	void updateStateVisual();
 
 	void startRec();
 
+	//セッション
+	void saveSession();
+	void loadSession(const juce::File& file);
+	void rebuildTracksFromLooper();
+	static juce::File getDefaultSessionFile();
+
 
 
 	private:
 	// ===== オーディオ関連 =====
+	RtProfiler profiler; //inputTap と looper が指すので先に作る（SIMPLOOPER_RT_PROFILER=0 なら空）
 	InputTap inputTap;
 	juce::TriggerEvent& sharedTrigger;
-	LooperAudio looper ;//10秒バッファ
+	LooperAudio looper ;//ループの音は defaultStorageBudgetBytes のページアリーナに置く
 
 	void timerCallback()override;
 
@@ -56,13 +72,50 @@ juce::Timer
 
 	// ===== デバイス管理 =====
 	juce::AudioDeviceManager deviceManager;
+	juce::AudioBuffer<float> outputView; //デバイスの出力をそのまま指す（中身を持たない）
+	std::vector<const float*> chunkInputs;	//大きいブロックを分ける時の、区間ごとの入力の先頭
+	std::vector<float*> chunkOutputs;		//同じく出力の先頭
 
 	// ===== UI =====
 	juce::TextButton recordButton { "Rec" };
 	juce::TextButton playAllButton { "Play" };
 	juce::TextButton stopAllButton { "Stop" };
 	juce::TextButton undoButton {"UNDO"};
+	juce::TextButton redoButton {"REDO"};
 	juce::TextButton settingButton { "Audio Settings" };
+	juce::TextButton saveButton { "Save" };
+	juce::TextButton loadButton { "Load" };
+	juce::TextButton gateButton { "Gate" };
+	LooperAudio::SaveState shownSaveState = LooperAudio::SaveState::idle;
+	int shownResampleCount = 0; //サンプルレートを変えた時のループの変換の結果を設定ボタンに出す
+
+	//レイテンシ測定（出力を入力へケーブルでつないで押す）。結果は録音の位置合わせに使う
+	LatencyCalibrator calibrator;
+	juce::TextButton calibrateButton { "Latency" };
+	LatencyCalibrator::State shownCalibrationState = LatencyCalibrator::State::idle;
+	void updateRecordLatency();
+
+	//テンポの格子とクオンタイズ（Free → Bar → Beat の順に切り替える）
+	//格子がある間にテンポを変えると、録ったループを新しいテンポへ伸ばす
+	juce::TextButton gridButton { "Free" };
+	juce::Slider tempoSlider;
+	LooperAudio::Quantize gridQuantize = LooperAudio::Quantize::off;
+	double pendingTempo = 0.0;	//まだ頼めていないテンポ変更（0 ならなし）
+	LooperAudio::StretchState shownStretchState = LooperAudio::StretchState::idle;
+	void cycleGrid();
+	juce::String getGridText() const;
+	void updateStretch();
+
+	//入力メーター（上段の右端。timerCallback で読んで paint で描く）
+	std::vector<LevelMeter::Reading> inputLevels;
+	juce::Rectangle<int> inputMeterArea;
+
+	//プロファイラ（有効なビルドの時だけ下端に集計を出し、トレースを書ける）
+	juce::TextButton traceButton { "Trace" };
+	juce::String profilerText;
+	juce::Rectangle<int> profilerArea;
+	void toggleTrace();
+	void updateProfilerText();
 
 
 	std::vector<std::unique_ptr<LooperTrackUi>> tracks;
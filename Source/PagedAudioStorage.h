@@ -0,0 +1,600 @@
+/*
+  ==============================================================================
+
+    PagedAudioStorage.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "SimdKernels.h"
+#include "PeakPyramid.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------
+// 固定サイズのページを最初にまとめて確保しておく置き場
+// オーディオスレッドからでもロックなし・メモリ確保なしで取り出し/返却できる
+// ページは参照カウント付き（最後の release で空きリストへ戻る）
+// セッションファイルをマップしたメモリも「外部ページ」として読み取り専用で使える
+// ページごとに波形表示用のピーク（段0・段1）も持つ。書いた所だけ足し込み、UIはロックなしで読む
+//------------------------------------------------------------
+class PageArena
+{
+public:
+	static constexpr int invalidPage = -1;
+
+	PageArena() = default;
+
+	//メッセージスレッドで1度だけ呼ぶ（オーディオ停止中）。pageSize は2の累乗
+	void prepare(int newNumChannels, int newPageSize, int newNumPages)
+	{
+		jassert(juce::isPowerOfTwo(newPageSize) && newPageSize >= peaks::binSize(peaks::numPageLevels - 1));
+
+		numChannels = juce::jmax(1, newNumChannels);
+		pageSize = newPageSize;
+		numPages = juce::jmax(1, newNumPages);
+		peakBinsPerPage = (pageSize >> peaks::binShifts[0]) + (pageSize >> peaks::binShifts[1]);
+
+		//ここで全体を0で埋めるので、あとから触ってもページフォールトは起きない
+		samples.assign((size_t)numPages * (size_t)numChannels * (size_t)pageSize, 0.0f);
+		refCounts = std::make_unique<std::atomic<int>[]>((size_t)numPages);
+		nextFree = std::make_unique<std::atomic<int>[]>((size_t)numPages);
+		pagePeaks = std::make_unique<std::atomic<peaks::Peak>[]>((size_t)numPages * (size_t)peakBinsPerPage);
+
+		for (int i = 0; i < numPages; ++i)
+		{
+			refCounts[(size_t)i].store(0, std::memory_order_relaxed);
+			nextFree[(size_t)i].store(i + 1 < numPages ? i + 1 : invalidPage, std::memory_order_relaxed);
+			resetPeaks(i);
+		}
+
+		freeHead.store(pack(0, 0), std::memory_order_release);
+		numFree.store(numPages, std::memory_order_release);
+		allocationFailures.store(0, std::memory_order_relaxed);
+	}
+
+	//空きページを1枚取り出して無音にする（参照カウント1）。空きがなければ invalidPage
+	int allocate() noexcept
+	{
+		auto head = freeHead.load(std::memory_order_acquire);
+
+		for (;;)
+		{
+			const int page = indexOf(head);
+			if (page == invalidPage)
+			{
+				allocationFailures.fetch_add(1, std::memory_order_relaxed);
+				return invalidPage;
+			}
+
+			//タグを進めて ABA を防ぐ
+			const auto next = pack(nextFree[(size_t)page].load(std::memory_order_relaxed), tagOf(head) + 1);
+			if (freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				numFree.fetch_sub(1, std::memory_order_relaxed);
+				refCounts[(size_t)page].store(1, std::memory_order_relaxed);
+
+				for (int ch = 0; ch < numChannels; ++ch)
+					juce::FloatVectorOperations::clear(getWritePointer(page, ch), pageSize);
+
+				resetPeaks(page);
+				return page;
+			}
+		}
+	}
+
+	//ページを共有する側が増えた
+	void retain(int page) noexcept
+	{
+		jassert(isPositiveAndBelowPages(page));
+		refCountOf(page).fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//参照を1つ外し、誰も使わなくなったら空きリストへ戻す（外部ページは戻さない）
+	void release(int page) noexcept
+	{
+		if (! isPositiveAndBelowPages(page)) return;
+
+		const int previous = refCountOf(page).fetch_sub(1, std::memory_order_acq_rel);
+		jassert(previous > 0);
+		if (previous != 1 || isExternalPage(page)) return;
+
+		auto head = freeHead.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			nextFree[(size_t)page].store(indexOf(head), std::memory_order_relaxed);
+			if (freeHead.compare_exchange_weak(head, pack(page, tagOf(head) + 1),
+											   std::memory_order_release, std::memory_order_relaxed))
+				break;
+		}
+		numFree.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	float* getWritePointer(int page, int channel) noexcept
+	{
+		jassert(! isExternalPage(page)); //外部ページは読み取り専用
+		return samples.data() + ((size_t)page * (size_t)numChannels + (size_t)channel) * (size_t)pageSize;
+	}
+
+	const float* getReadPointer(int page, int channel) const noexcept
+	{
+		if (isExternalPage(page))
+			return externalData + ((size_t)(page - numPages) * (size_t)numChannels + (size_t)channel) * (size_t)pageSize;
+
+		return samples.data() + ((size_t)page * (size_t)numChannels + (size_t)channel) * (size_t)pageSize;
+	}
+
+	int getRefCount(int page) const noexcept { return refCountOf(page).load(std::memory_order_relaxed); }
+
+	//===波形表示用のピーク===
+	//[offsetInPage, offsetInPage+length) に書いた分をページのピークへ足し込み、その区間全体のピークを返す
+	//そのページに書くスレッドだけが呼ぶ（録音ならオーディオスレッド、読み戻しならディスクスレッド）
+	peaks::Peak accumulatePeaks(int page, int offsetInPage, int length) noexcept
+	{
+		auto* fine = peaksOf(page);
+		auto* coarse = fine + (pageSize >> peaks::binShifts[0]);
+		auto total = peaks::empty;
+
+		for (int done = 0; done < length;)
+		{
+			const int pos = offsetInPage + done;
+			const int bin = pos >> peaks::binShifts[0];
+			const int n = juce::jmin(length - done, ((bin + 1) << peaks::binShifts[0]) - pos);
+
+			auto range = juce::FloatVectorOperations::findMinAndMax(getReadPointer(page, 0) + pos, n);
+			for (int ch = 1; ch < numChannels; ++ch)
+				range = range.getUnionWith(juce::FloatVectorOperations::findMinAndMax(getReadPointer(page, ch) + pos, n));
+
+			const auto peak = peaks::fromRange(range.getStart(), range.getEnd());
+			mergeInto(fine[bin], peak);
+			mergeInto(coarse[pos >> peaks::binShifts[1]], peak);
+			total = peaks::merge(total, peak);
+			done += n;
+		}
+
+		return total;
+	}
+
+	//ページ全体を読み直してピークを作る（ディスクから読み戻したページ・外部ページ用。外部ページは触った所からファイルを読むので、オーディオ・メッセージスレッドでは呼ばない）
+	peaks::Peak rebuildPeaks(int page) noexcept
+	{
+		resetPeaks(page);
+		return accumulatePeaks(page, 0, pageSize);
+	}
+
+	//段0・段1のピーク（どのスレッドからでも。ページが返されて使い回された直後は別の中身が見えることがある）
+	peaks::Peak getPeak(int page, int level, int bin) const noexcept
+	{
+		jassert(level < peaks::numPageLevels);
+		const int offset = level == 0 ? 0 : (pageSize >> peaks::binShifts[0]);
+		return peaksOf(page)[offset + bin].load(std::memory_order_relaxed);
+	}
+
+	//ページ全体のピーク
+	peaks::Peak getPagePeak(int page) const noexcept
+	{
+		auto total = peaks::empty;
+		for (int bin = 0; bin < (pageSize >> peaks::binShifts[1]); ++bin)
+			total = peaks::merge(total, getPeak(page, 1, bin));
+		return total;
+	}
+
+	//===外部ページ===
+	//data から numPagesExternal 枚を番号 getNumPages() 以降のページとして使えるようにする
+	//並びはアリーナと同じ [ページ][チャンネル][pageSize]。オーディオ停止中、外部ページを誰も持っていない時に呼ぶ
+	//ピークはファイルに持たないので空のまま。呼んだ側がバックグラウンドで rebuildPeaks する（ここで全ページを読まない）
+	void attachExternalPages(const float* data, int numPagesExternal)
+	{
+		detachExternalPages();
+
+		externalData = data;
+		numExternalPages = data != nullptr ? juce::jmax(0, numPagesExternal) : 0;
+		externalRefCounts = std::make_unique<std::atomic<int>[]>((size_t)juce::jmax(1, numExternalPages));
+		externalPeaks = std::make_unique<std::atomic<peaks::Peak>[]>((size_t)juce::jmax(1, numExternalPages) * (size_t)peakBinsPerPage);
+
+		for (int i = 0; i < numExternalPages; ++i)
+		{
+			externalRefCounts[(size_t)i].store(0, std::memory_order_relaxed);
+			resetPeaks(numPages + i);
+		}
+	}
+
+	void detachExternalPages() noexcept
+	{
+	   #if JUCE_DEBUG
+		for (int i = 0; i < numExternalPages; ++i)
+			jassert(externalRefCounts[(size_t)i].load() == 0);
+	   #endif
+
+		externalData = nullptr;
+		numExternalPages = 0;
+	}
+
+	bool isExternalPage(int page) const noexcept { return page >= numPages; }
+	int getNumExternalPages() const noexcept { return numExternalPages; }
+
+	int getNumChannels() const noexcept { return numChannels; }
+	int getPageSize() const noexcept { return pageSize; }
+	int getNumPages() const noexcept { return numPages; }
+	int getNumFreePages() const noexcept { return numFree.load(std::memory_order_relaxed); }
+	juce::uint32 getAllocationFailureCount() const noexcept { return allocationFailures.load(std::memory_order_relaxed); }
+
+	//ページ1枚あたりのバイト数（メモリ予算からページ数を決める用）
+	static size_t bytesPerPage(int numChannels, int pageSize) noexcept
+	{
+		return (size_t)numChannels * (size_t)pageSize * sizeof(float);
+	}
+
+private:
+	static juce::uint64 pack(int index, juce::uint32 tag) noexcept
+	{
+		return ((juce::uint64)tag << 32) | (juce::uint32)index;
+	}
+	static int indexOf(juce::uint64 packed) noexcept { return (int)(juce::uint32)(packed & 0xffffffffu); }
+	static juce::uint32 tagOf(juce::uint64 packed) noexcept { return (juce::uint32)(packed >> 32); }
+
+	bool isPositiveAndBelowPages(int page) const noexcept { return juce::isPositiveAndBelow(page, numPages + numExternalPages); }
+
+	std::atomic<int>& refCountOf(int page) const noexcept
+	{
+		return isExternalPage(page) ? externalRefCounts[(size_t)(page - numPages)] : refCounts[(size_t)page];
+	}
+
+	//ページのピーク（段0の後ろに段1が続く）
+	std::atomic<peaks::Peak>* peaksOf(int page) const noexcept
+	{
+		return isExternalPage(page) ? externalPeaks.get() + (size_t)(page - numPages) * (size_t)peakBinsPerPage
+									: pagePeaks.get() + (size_t)page * (size_t)peakBinsPerPage;
+	}
+
+	void resetPeaks(int page) noexcept
+	{
+		auto* p = peaksOf(page);
+		for (int i = 0; i < peakBinsPerPage; ++i)
+			p[i].store(peaks::empty, std::memory_order_relaxed);
+	}
+
+	//書くのは1スレッドだけなので読んで足して書くだけでよい
+	static void mergeInto(std::atomic<peaks::Peak>& bin, peaks::Peak peak) noexcept
+	{
+		bin.store(peaks::merge(bin.load(std::memory_order_relaxed), peak), std::memory_order_relaxed);
+	}
+
+	int numChannels = 0;
+	int pageSize = 0;
+	int numPages = 0;
+	int peakBinsPerPage = 0;
+
+	std::vector<float> samples; //[ページ][チャンネル][pageSize]
+	std::unique_ptr<std::atomic<peaks::Peak>[]> pagePeaks; //[ページ][段0の列＋段1の列]
+	std::unique_ptr<std::atomic<int>[]> refCounts;
+	std::unique_ptr<std::atomic<int>[]> nextFree;
+
+	std::atomic<juce::uint64> freeHead { pack(invalidPage, 0) }; //上位32bitがタグ、下位がページ番号
+	std::atomic<int> numFree { 0 };
+	std::atomic<juce::uint32> allocationFailures { 0 };
+
+	const float* externalData = nullptr;
+	int numExternalPages = 0;
+	std::unique_ptr<std::atomic<int>[]> externalRefCounts;
+	std::unique_ptr<std::atomic<peaks::Peak>[]> externalPeaks;
+
+	JUCE_DECLARE_NON_COPYABLE(PageArena)
+};
+
+
+//------------------------------------------------------------
+// 1トラック分のページ表
+// 書き込んだ位置のページだけを PageArena から取り、ページのない所は無音として読む
+// ページ表はメッセージスレッドの prepare で確保し、以降は確保しない
+// ディスクストリーミング時はページごとに「ディスクに控えがあるか」も持ち、
+// 控えのあるページはアリーナへ返して（追い出して）あとで読み戻せる
+// 波形表示用の粗いピーク（段2・段3）もトラック単位で持ち、ページ表と一緒に入れ替わる
+//------------------------------------------------------------
+class PagedTrackBuffer
+{
+public:
+	//ディスクの控えに関するページごとの状態
+	enum PageFlags : juce::uint8
+	{
+		pageOnDisk		= 1 << 0,	//ディスクの控えが中身と一致している
+		pageWriting		= 1 << 1,	//書き出し待ち
+		pageLoading		= 1 << 2,	//読み戻し待ち
+		pageDiskFailed	= 1 << 3	//書き出しに失敗した（追い出さない）
+	};
+
+	PagedTrackBuffer() = default;
+	~PagedTrackBuffer() { clear(); }
+
+	//trackDiskCopies が true ならページごとの控えの状態も持つ（ディスクストリーミング用）
+	void prepare(PageArena& newArena, int maxPages, bool trackDiskCopies = false)
+	{
+		clear();
+		arena = &newArena;
+		pageShift = 0;
+		while ((1 << pageShift) < arena->getPageSize()) ++pageShift;
+		jassert(arena->getPageSize() <= peaks::binSize(peaks::numPageLevels));
+		pageTable.assign((size_t)juce::jmax(1, maxPages), PageArena::invalidPage);
+		pageFlags.assign(trackDiskCopies ? pageTable.size() : 0, 0);
+
+		for (int i = 0; i < peaks::numTrackLevels; ++i)
+		{
+			const int shift = peaks::binShifts[peaks::numPageLevels + i];
+			trackPeaks[(size_t)i].assign((size_t)((((juce::int64)pageTable.size() << pageShift) + (1 << shift) - 1) >> shift), peaks::empty);
+		}
+
+		numPagesUsed = 0;
+		numPagesHeld = 0;
+		takeId = -1;
+		diskScanPosition = 0;
+	}
+
+	bool isPrepared() const noexcept { return arena != nullptr; }
+
+	int getNumChannels() const noexcept { return arena != nullptr ? arena->getNumChannels() : 0; }
+	//ページ表が覆える最大サンプル数
+	int getCapacity() const noexcept { return arena != nullptr ? (int)pageTable.size() << pageShift : 0; }
+	int getNumPagesHeld() const noexcept { return numPagesHeld; }
+	bool isEmpty() const noexcept { return numPagesHeld == 0 && takeId < 0; }
+	int getNumPagesUsed() const noexcept { return numPagesUsed; }
+
+	//添字 pageIndex のページ（アリーナ上の番号。持っていなければ invalidPage）
+	int getPage(int pageIndex) const noexcept
+	{
+		return pageIndex < numPagesUsed ? pageTable[(size_t)pageIndex] : PageArena::invalidPage;
+	}
+
+	//===ディスクの控え（prepare で trackDiskCopies を指定した時だけ）===
+	bool hasDiskCopies() const noexcept { return ! pageFlags.empty(); }
+	juce::uint8 getPageFlags(int pageIndex) const noexcept { return pageFlags[(size_t)pageIndex]; }
+	void setPageFlags(int pageIndex, juce::uint8 flags) noexcept { pageFlags[(size_t)pageIndex] = flags; }
+
+	//書き出し先のテイク番号（まだ何も書き出していなければ -1）。ページ表と一緒に入れ替わる
+	int getTakeId() const noexcept { return takeId; }
+	void setTakeId(int newTakeId) noexcept { takeId = newTakeId; }
+
+	//段2・段3のピーク（オーディオスレッド専用。UIへは LooperAudio が写して渡す）
+	int getNumTrackPeakBins(int level) const noexcept { return (int)trackPeaks[(size_t)(level - peaks::numPageLevels)].size(); }
+	peaks::Peak getTrackPeak(int level, int bin) const noexcept { return trackPeaks[(size_t)(level - peaks::numPageLevels)][(size_t)bin]; }
+
+	//書き出し・追い出しの巡回位置
+	int getDiskScanPosition() const noexcept { return diskScanPosition; }
+	void setDiskScanPosition(int position) noexcept { diskScanPosition = position; }
+
+	//控えのあるページをアリーナへ返す（状態はそのまま残し、あとで installPage で戻す）
+	void evictPage(int pageIndex) noexcept
+	{
+		int& page = pageTable[(size_t)pageIndex];
+		if (page == PageArena::invalidPage) return;
+
+		arena->release(page);
+		page = PageArena::invalidPage;
+		--numPagesHeld;
+	}
+
+	//ページ表の空いている所へページを置く（セッションの読み込み用。参照は呼んだ側が retain 済み）
+	bool adoptPage(int pageIndex, int page) noexcept
+	{
+		if (! juce::isPositiveAndBelow(pageIndex, (int)pageTable.size()) || pageTable[(size_t)pageIndex] != PageArena::invalidPage)
+			return false;
+
+		pageTable[(size_t)pageIndex] = page;
+		numPagesUsed = juce::jmax(numPagesUsed, pageIndex + 1);
+		++numPagesHeld;
+		mergeTrackPeaks(pageIndex << pageShift, arena->getPagePeak(page));
+		return true;
+	}
+
+	//あとからピークのできたページ（読み込んだセッションの外部ページ）を段2・段3へ足し込む
+	void mergePagePeaks(int pageIndex) noexcept
+	{
+		const int page = getPage(pageIndex);
+		if (page != PageArena::invalidPage)
+			mergeTrackPeaks(pageIndex << pageShift, arena->getPagePeak(page));
+	}
+
+	//読み戻したページを置く。すでにページがあれば置かずに false（呼んだ側が返す）
+	bool installPage(int pageIndex, int page) noexcept
+	{
+		if (! juce::isPositiveAndBelow(pageIndex, numPagesUsed) || pageTable[(size_t)pageIndex] != PageArena::invalidPage)
+			return false;
+
+		pageTable[(size_t)pageIndex] = page;
+		++numPagesHeld;
+		return true;
+	}
+
+	//src の [srcStart, srcStart+numSamples) を位置 destPos から書き込む
+	//ページが取れずに書けなかったサンプル数を返す
+	int write(const juce::AudioBuffer<float>& src, int srcStart, int destPos, int numSamples) noexcept
+	{
+		if (arena == nullptr) return numSamples;
+
+		const int numChannels = juce::jmin(src.getNumChannels(), arena->getNumChannels());
+		int dropped = 0;
+
+		const int covered = forEachPageSpan(destPos, numSamples, [&] (int pageIndex, int offsetInPage, int done, int length)
+		{
+			int& page = pageTable[(size_t)pageIndex];
+			if (page == PageArena::invalidPage)
+			{
+				page = arena->allocate();
+				if (page == PageArena::invalidPage) { dropped += length; return; }
+				numPagesUsed = juce::jmax(numPagesUsed, pageIndex + 1);
+				++numPagesHeld;
+			}
+
+			//書き換えたのでディスクの控えは古くなる（書き出し中の分も完了時に無効）
+			if (hasDiskCopies())
+				pageFlags[(size_t)pageIndex] &= (juce::uint8)~(pageOnDisk | pageWriting);
+
+			for (int ch = 0; ch < numChannels; ++ch)
+				juce::FloatVectorOperations::copy(arena->getWritePointer(page, ch) + offsetInPage,
+												  src.getReadPointer(ch, srcStart + done), length);
+
+			//書いたそばから波形のピークへ足し込む（録音は空のページ表に書くので足すだけでよい）
+			mergeTrackPeaks((pageIndex << pageShift) + offsetInPage, arena->accumulatePeaks(page, offsetInPage, length));
+		});
+
+		//ページ表の外にはみ出した分も書けなかった扱い
+		return dropped + (numSamples - covered);
+	}
+
+	//位置 srcPos から numSamples 分を dest の destStart 以降に足し込む（ページのない所は無音）
+	void addTo(juce::AudioBuffer<float>& dest, int destStart, int srcPos, int numSamples) const noexcept
+	{
+		if (arena == nullptr) return;
+
+		const int numChannels = juce::jmin(dest.getNumChannels(), arena->getNumChannels());
+
+		forEachPageSpan(srcPos, numSamples, [&] (int pageIndex, int offsetInPage, int done, int length)
+		{
+			const int page = pageIndex < numPagesUsed ? pageTable[(size_t)pageIndex] : PageArena::invalidPage;
+			if (page == PageArena::invalidPage) return;
+
+			for (int ch = 0; ch < numChannels; ++ch)
+				juce::FloatVectorOperations::add(dest.getWritePointer(ch, destStart + done),
+												 arena->getReadPointer(page, ch) + offsetInPage, length);
+		});
+	}
+
+	//addTo と同じだが、チャンネルごとのゲイン（ランプ付き）を掛けながら1パスで足し込む
+	//ramps[ch] は srcPos の位置でのランプ。ページのない所もランプは位置どおり進む
+	//levels を渡すと、足した信号（ゲイン後・全チャンネル分）の二乗和とピークもついでに足し込む
+	//ディスクに控えがあるのに読み戻しが間に合わなかったサンプル数を返す
+	int addToWithGain(juce::AudioBuffer<float>& dest, int destStart, int srcPos, int numSamples,
+					  const simd::GainRamp* ramps, int numRamps, simd::ChannelStats* levels = nullptr) const noexcept
+	{
+		if (arena == nullptr) return 0;
+
+		const int numChannels = juce::jmin(dest.getNumChannels(), arena->getNumChannels(), numRamps);
+		int missing = 0;
+
+		forEachPageSpan(srcPos, numSamples, [&] (int pageIndex, int offsetInPage, int done, int length)
+		{
+			const int page = pageIndex < numPagesUsed ? pageTable[(size_t)pageIndex] : PageArena::invalidPage;
+			if (page == PageArena::invalidPage)
+			{
+				if (pageIndex < numPagesUsed && hasDiskCopies() && (pageFlags[(size_t)pageIndex] & pageOnDisk) != 0)
+					missing += length;
+				return;
+			}
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				float* out = dest.getWritePointer(ch, destStart + done);
+				const float* in = arena->getReadPointer(page, ch) + offsetInPage;
+
+				if (levels != nullptr)
+					simd::addWithGainRampMeasured(out, in, length, ramps[ch].advancedBy(done), *levels);
+				else
+					simd::addWithGainRamp(out, in, length, ramps[ch].advancedBy(done));
+			}
+		});
+
+		return missing;
+	}
+
+	//持っているページをすべてアリーナへ返す
+	void clear() noexcept
+	{
+		releasePages(numPagesUsed);
+	}
+
+	//後ろから最大 maxPagesToRelease 枚だけアリーナへ返す（数ブロックに分けて返す用）
+	//全部返し終えたら true
+	bool releasePages(int maxPagesToRelease) noexcept
+	{
+		if (arena == nullptr) return true;
+
+		int released = 0;
+		while (numPagesUsed > 0 && released < maxPagesToRelease)
+		{
+			const int pageIndex = --numPagesUsed;
+			if (hasDiskCopies())
+				pageFlags[(size_t)pageIndex] = 0;
+
+			int& page = pageTable[(size_t)pageIndex];
+			if (page == PageArena::invalidPage) continue;
+
+			arena->release(page);
+			page = PageArena::invalidPage;
+			--numPagesHeld;
+			++released;
+		}
+
+		if (numPagesUsed != 0) return false;
+
+		//ディスクのテイクとの縁も切る（ファイルは DiskStreamer の停止時にまとめて消す）
+		takeId = -1;
+		diskScanPosition = 0;
+
+		for (auto& level : trackPeaks)
+			std::fill(level.begin(), level.end(), peaks::empty);
+		return true;
+	}
+
+	//ページ表ごと入れ替える（同じアリーナ・同じ大きさ同士。コピーも確保もしない）
+	void swapWith(PagedTrackBuffer& other) noexcept
+	{
+		jassert(arena == other.arena && pageTable.size() == other.pageTable.size()
+				&& pageFlags.size() == other.pageFlags.size());
+		pageTable.swap(other.pageTable);
+		pageFlags.swap(other.pageFlags);
+		trackPeaks.swap(other.trackPeaks);
+		std::swap(numPagesUsed, other.numPagesUsed);
+		std::swap(numPagesHeld, other.numPagesHeld);
+		std::swap(takeId, other.takeId);
+		std::swap(diskScanPosition, other.diskScanPosition);
+	}
+
+private:
+	//[position, position+numSamples) をページ境界で区切って fn(ページ番号, ページ内位置, 済み, 長さ) を呼ぶ
+	//ページ表の範囲に収まったサンプル数を返す
+	template <typename Fn>
+	int forEachPageSpan(int position, int numSamples, Fn&& fn) const noexcept
+	{
+		const int pageSize = 1 << pageShift;
+		const int capacity = getCapacity();
+		int done = 0;
+
+		while (done < numSamples)
+		{
+			const int pos = position + done;
+			if (pos >= capacity) break;
+
+			const int offsetInPage = pos & (pageSize - 1);
+			const int length = juce::jmin(numSamples - done, pageSize - offsetInPage);
+			fn(pos >> pageShift, offsetInPage, done, length);
+			done += length;
+		}
+
+		return done;
+	}
+
+	//ページ1枚に収まる区間のピークを段2・段3へ足し込む（段2のビンはページの整数倍）
+	void mergeTrackPeaks(int position, peaks::Peak peak) noexcept
+	{
+		for (int i = 0; i < peaks::numTrackLevels; ++i)
+		{
+			auto& bin = trackPeaks[(size_t)i][(size_t)(position >> peaks::binShifts[peaks::numPageLevels + i])];
+			bin = peaks::merge(bin, peak);
+		}
+	}
+
+	PageArena* arena = nullptr;
+	std::vector<int> pageTable;
+	std::vector<juce::uint8> pageFlags; //PageFlags（ディスクストリーミング時だけ）
+	std::array<std::vector<peaks::Peak>, peaks::numTrackLevels> trackPeaks; //段2・段3
+	int numPagesUsed = 0; //一度でもページを持った最大の添字+1（clearの走査範囲）
+	int numPagesHeld = 0; //実際に持っているページ数
+	int pageShift = 0;
+	int takeId = -1;
+	int diskScanPosition = 0;
+
+	JUCE_DECLARE_NON_COPYABLE(PagedTrackBuffer)
+};
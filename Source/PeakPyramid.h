@@ -0,0 +1,76 @@
+/*
+  ==============================================================================
+
+    PeakPyramid.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//------------------------------------------------------------
+// 波形表示用の最小値・最大値のピラミッド
+//   段0: 64 サンプル / 段1: 1024 サンプル … ページごと（PageArena が持つ）
+//   段2: 16384 サンプル / 段3: 262144 サンプル … トラックごと（PagedTrackBuffer が持つ）
+// 録音で書いた分だけその場で足し込むので、表示側は生のサンプルを一切読まない
+// 値は全チャンネルをまとめた min/max を 8bit ずつに丸めて 16bit に詰める（アトミックに読み書きできる）
+//------------------------------------------------------------
+namespace peaks
+{
+	using Peak = juce::uint16;
+
+	constexpr int numLevels = 4;
+	constexpr int binShifts[numLevels] = { 6, 10, 14, 18 };
+	constexpr int binSize(int level) noexcept { return 1 << binShifts[level]; }
+
+	//ページが持つ段（0, 1）とトラックが持つ段（2, 3）
+	constexpr int numPageLevels = 2;
+	constexpr int numTrackLevels = numLevels - numPageLevels;
+
+	//上位8bitが最小値、下位8bitが最大値（どちらも -127..127）
+	constexpr Peak pack(int minValue, int maxValue) noexcept
+	{
+		return (Peak)(((juce::uint8)(juce::int8)minValue << 8) | (juce::uint8)(juce::int8)maxValue);
+	}
+	constexpr int minOf(Peak p) noexcept { return (juce::int8)(juce::uint8)(p >> 8); }
+	constexpr int maxOf(Peak p) noexcept { return (juce::int8)(juce::uint8)(p & 0xff); }
+
+	//まだ何も書いていない（最小 > 最大）
+	constexpr Peak empty = pack(127, -127);
+	constexpr bool isEmpty(Peak p) noexcept { return minOf(p) > maxOf(p); }
+
+	constexpr Peak merge(Peak a, Peak b) noexcept
+	{
+		return pack(std::min(minOf(a), minOf(b)), std::max(maxOf(a), maxOf(b)));
+	}
+
+	//丸めでピークが小さく見えないよう外側へ丸める
+	inline Peak fromRange(float minValue, float maxValue) noexcept
+	{
+		const int lo = (int)std::floor(juce::jlimit(-1.0f, 1.0f, minValue) * 127.0f);
+		const int hi = (int)std::ceil(juce::jlimit(-1.0f, 1.0f, maxValue) * 127.0f);
+		return pack(lo, hi);
+	}
+
+	inline float toFloat(int value) noexcept { return (float)value / 127.0f; }
+
+	//表示1列ぶんずつの波形（UIが持ち、LooperAudio::readWaveform が埋める）
+	struct Columns
+	{
+		void setNumColumns(int n)
+		{
+			mins.assign((size_t)juce::jmax(0, n), 0.0f);
+			maxs.assign((size_t)juce::jmax(0, n), 0.0f);
+		}
+		int getNumColumns() const noexcept { return (int)mins.size(); }
+
+		std::vector<float> mins, maxs;
+		float playhead = -1.0f;	//再生・録音位置（0..1、なければ負）
+		bool hasAudio = false;
+		bool isRecording = false;
+	};
+}
@@ -0,0 +1,213 @@
+/*
+  ==============================================================================
+
+    RealtimeWorkerPool.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+//------------------------------------------------------------
+// オーディオスレッドの仕事を分け合うリアルタイム優先度のワーカー群
+// run() は呼んだオーディオスレッド自身も仕事を取りに行くので、
+// ワーカーが寝ていても起きるのを待たずに全部終わらせられる（待つのは取りかけの分だけ）
+// 寝ているワーカーは std::atomic の wait/notify で起こす（futex 等。ロックを取らない）
+// start/stop はオーディオ停止中（prepareToPlay など）に呼ぶ
+//------------------------------------------------------------
+class RealtimeWorkerPool
+{
+public:
+	//std::function はコピー時に確保するので関数ポインタ＋コンテキストで渡す
+	using JobFunction = void (*) (void* context, int itemIndex);
+
+	static constexpr int maxWorkers = 16;
+	static constexpr int maxItems = 0xffff;
+
+	RealtimeWorkerPool() = default;
+	~RealtimeWorkerPool() { stop(); }
+
+	void start(int numWorkers, int samplesPerBlock, double sampleRate)
+	{
+		stop();
+
+		numWorkers = juce::jlimit(0, maxWorkers, numWorkers);
+
+		//仕事が切れてから寝るまで回って待つ時間（バッファ周期の spinFractionOfBlock 分の1。
+		//同じブロックの次の区間にはまず間に合い、ブロックの合間はリアルタイム優先度で CPU を占有しない）
+		const double blockSeconds = juce::jmax(1, samplesPerBlock) / (sampleRate > 0.0 ? sampleRate : 48000.0);
+		spinTicks = (juce::int64)(blockSeconds * (double)juce::Time::getHighResolutionTicksPerSecond() / spinFractionOfBlock);
+
+		const auto options = juce::Thread::RealtimeOptions{}
+								.withApproximateAudioProcessingTime(juce::jmax(1, samplesPerBlock), sampleRate);
+
+		for (int i = 0; i < numWorkers; ++i)
+		{
+			auto worker = std::make_unique<Worker>(*this, i);
+			if (! worker->startRealtimeThread(options))
+				worker->startThread(juce::Thread::Priority::highest);
+			workers.push_back(std::move(worker));
+		}
+	}
+
+	void stop()
+	{
+		for (auto& w : workers)
+			w->signalThreadShouldExit();
+		for (auto& w : workers)
+			w->wake();
+		for (auto& w : workers)
+			w->stopThread(1000);
+
+		workers.clear();
+	}
+
+	int getNumWorkers() const noexcept { return (int)workers.size(); }
+
+	//fn(context, 0..numItems-1) をワーカーと分担して実行し、全部終わってから戻る
+	//useWorkers が false なら（またはワーカーがいなければ）呼び出し元だけで順に実行する
+	void run(JobFunction fn, void* context, int numItems, bool useWorkers) noexcept
+	{
+		jassert(numItems <= maxItems);
+
+		if (! useWorkers || workers.empty())
+		{
+			for (int i = 0; i < numItems; ++i)
+				fn(context, i);
+			return;
+		}
+
+		jobFunction.store(fn, std::memory_order_relaxed);
+		jobContext.store(context, std::memory_order_relaxed);
+		itemsDone.store(0, std::memory_order_relaxed);
+
+		generation = (generation + 1) & 0xffffffffu;
+		claimState.store(pack(generation, numItems, 0)); //seq_cst: 寝る直前のワーカーと順序を揃える
+
+		//WaitableEvent::signal はミューテックスを取るので、ここでは atomic の通知だけ
+		for (auto& w : workers)
+			if (w->sleeping.load())
+				w->wake();
+
+		//自分でも取れるだけ取る
+		while (runOneItem()) {}
+
+		//他のワーカーが取りかけた分だけ待つ
+		while (itemsDone.load(std::memory_order_acquire) < numItems)
+			pause();
+	}
+
+private:
+	//上位32bit: 世代 / 16bit: 仕事の数 / 下位16bit: 次に取る番号
+	static juce::uint64 pack(juce::uint64 gen, int numItems, int next) noexcept
+	{
+		return (gen << 32) | ((juce::uint64)numItems << 16) | (juce::uint64)next;
+	}
+
+	//仕事を1つ取って実行する。もう残っていなければ false
+	bool runOneItem() noexcept
+	{
+		auto state = claimState.load(std::memory_order_acquire);
+
+		for (;;)
+		{
+			const int next = (int)(state & 0xffff);
+			const int numItems = (int)((state >> 16) & 0xffff);
+			if (next >= numItems) return false;
+
+			if (claimState.compare_exchange_weak(state, state + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				jobFunction.load(std::memory_order_relaxed)(jobContext.load(std::memory_order_relaxed), next);
+				itemsDone.fetch_add(1, std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+	bool hasPendingItems() const noexcept
+	{
+		const auto state = claimState.load();
+		return (int)(state & 0xffff) < (int)((state >> 16) & 0xffff);
+	}
+
+	static void pause() noexcept
+	{
+	   #if JUCE_INTEL
+		_mm_pause();
+	   #else
+		std::this_thread::yield();
+	   #endif
+	}
+
+	struct Worker : public juce::Thread
+	{
+		Worker(RealtimeWorkerPool& p, int index)
+			: juce::Thread("Simplooper mix worker " + juce::String(index)), pool(p) {}
+
+		void run() override
+		{
+			juce::int64 idleSince = -1;
+
+			while (! threadShouldExit())
+			{
+				if (pool.runOneItem())
+				{
+					idleSince = -1;
+					continue;
+				}
+
+				//同じブロックの次の仕事までは少しだけ回って待ち（回数でなく時間で区切る）、来なければ寝る
+				const auto now = juce::Time::getHighResolutionTicks();
+				if (idleSince < 0)
+					idleSince = now;
+
+				if (now - idleSince < pool.spinTicks)
+				{
+					pause();
+					continue;
+				}
+
+				//sleeping を立ててから仕事と終了を確かめる（run() は仕事を置いてから sleeping を見る）
+				sleeping.store(true);
+				const int seen = wakeCount.load();
+				if (! pool.hasPendingItems() && ! threadShouldExit())
+					wakeCount.wait(seen);
+				sleeping.store(false);
+				idleSince = -1;
+			}
+		}
+
+		//オーディオスレッドからも呼ぶ（futex / __ulock / WaitOnAddress で起こすだけ）
+		void wake() noexcept
+		{
+			wakeCount.fetch_add(1);
+			wakeCount.notify_one();
+		}
+
+		RealtimeWorkerPool& pool;
+		std::atomic<int> wakeCount { 0 };
+		std::atomic<bool> sleeping { false };
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	std::atomic<juce::uint64> claimState { 0 };
+	std::atomic<JobFunction> jobFunction { nullptr };
+	std::atomic<void*> jobContext { nullptr };
+	std::atomic<int> itemsDone { 0 };
+	juce::uint64 generation = 0; //オーディオスレッドだけが触る
+
+	static constexpr double spinFractionOfBlock = 16.0;
+	juce::int64 spinTicks = 0; //start でワーカーを立てる前に決める（以後は読むだけ）
+
+	JUCE_DECLARE_NON_COPYABLE(RealtimeWorkerPool)
+};
@@ -0,0 +1,134 @@
+/*
+  ==============================================================================
+
+    Resampler.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "SimdKernels.h"
+#include <cmath>
+#include <vector>
+
+namespace resample
+{
+	//------------------------------------------------------------
+	// ループ1本のサンプルレートを変える（長さ inLength → outLength。音程と速さはそのまま）
+	//   ・Kaiser 窓をかけた sinc のポリフェーズフィルタ。位相は numPhases 段の表の間を直線補間する
+	//   ・下げる時は低い方のナイキストの passband 倍より上を切る（折り返しを作らない）
+	//   ・1サンプルの計算は表の2行との内積（simd::dotProduct）を混ぜるだけ
+	// ループの頭と尻はつながっているものとして扱う（つなぎ目の前後もフィルタがまたぐ）
+	// 裏のスレッド用（ここでメモリを確保する）
+	//------------------------------------------------------------
+	class LoopResampler
+	{
+	public:
+		static constexpr int numPhases = 256;
+		static constexpr int zeroCrossings = 32;	//片側のゼロ交差の数（元のレートが一番低い時）
+		static constexpr double passband = 0.95;
+		static constexpr double kaiserBeta = 8.6;	//阻止域 約 -85 dB
+
+		LoopResampler(int inLength, int outLength)
+			: inLen(inLength), outLen(outLength)
+		{
+			jassert(inLength > 0 && outLength > 0);
+
+			//長さの比がそのままレートの比。下げる時はフィルタを広げて帯域を狭める
+			const double cutoff = passband * juce::jmin(1.0, (double)outLength / (double)inLength);
+			half = (int)std::ceil(zeroCrossings / cutoff);
+			numTaps = 2 * half;
+
+			//行 p は入力の位置から p / numPhases だけ後ろの点を作る係数（最後の行は次の入力の行 0 と同じ）
+			coefficients.resize((size_t)((numPhases + 1) * numTaps));
+			const double i0Beta = besselI0(kaiserBeta);
+
+			for (int p = 0; p <= numPhases; ++p)
+			{
+				float* row = coefficients.data() + (size_t)(p * numTaps);
+				const double frac = (double)p / numPhases;
+				double sum = 0.0;
+
+				for (int k = 0; k < numTaps; ++k)
+				{
+					const double distance = (double)(k - (half - 1)) - frac;
+					const double x = distance / half;
+					const double window = std::abs(x) < 1.0 ? besselI0(kaiserBeta * std::sqrt(1.0 - x * x)) / i0Beta : 0.0;
+					const double value = cutoff * sinc(cutoff * distance) * window;
+					row[k] = (float)value;
+					sum += value;
+				}
+
+				//直流の利得を 1 にそろえる（位相ごとの音量の揺れを消す）
+				for (int k = 0; k < numTaps; ++k)
+					row[k] = (float)(row[k] / sum);
+			}
+		}
+
+		//input の [0, inLength) を output の [0, outLength) へ
+		void process(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+		{
+			const int numChannels = juce::jmin(input.getNumChannels(), output.getNumChannels());
+			std::vector<float> extended((size_t)(inLen + numTaps));
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				//前に half-1、後ろに half だけ折り返して延ばす（extended[i] が入力の i - (half-1)）
+				const float* in = input.getReadPointer(ch);
+				for (int j = 0; j < inLen + numTaps; ++j)
+					extended[(size_t)j] = in[wrap(j - (half - 1), inLen)];
+
+				float* out = output.getWritePointer(ch);
+				for (int n = 0; n < outLen; ++n)
+				{
+					//出力の n は入力の n × inLength / outLength（整数で割って端数を位相にする）
+					const juce::int64 position = (juce::int64)n * inLen;
+					const int index = (int)(position / outLen);
+					const double phase = (double)(position % outLen) * numPhases / (double)outLen;
+					const int row = (int)phase;
+					const float mix = (float)(phase - row);
+
+					const float* x = extended.data() + index;
+					const float a = simd::dotProduct(x, coefficients.data() + (size_t)(row * numTaps), numTaps);
+					const float b = simd::dotProduct(x, coefficients.data() + (size_t)((row + 1) * numTaps), numTaps);
+					out[n] = a + mix * (b - a);
+				}
+			}
+		}
+
+	private:
+		static int wrap(int position, int length) noexcept
+		{
+			const int r = position % length;
+			return r < 0 ? r + length : r;
+		}
+
+		static double sinc(double x) noexcept
+		{
+			if (std::abs(x) < 1.0e-9) return 1.0;
+			const double px = juce::MathConstants<double>::pi * x;
+			return std::sin(px) / px;
+		}
+
+		//第1種変形ベッセル関数 I0（級数。Kaiser 窓用）
+		static double besselI0(double x) noexcept
+		{
+			double sum = 1.0, term = 1.0;
+			const double halfX = x * 0.5;
+			for (int k = 1; k < 50; ++k)
+			{
+				term *= (halfX / k) * (halfX / k);
+				sum += term;
+				if (term < sum * 1.0e-12) break;
+			}
+			return sum;
+		}
+
+		int inLen = 0;
+		int outLen = 0;
+		int half = 0;			//片側のタップ数
+		int numTaps = 0;
+		std::vector<float> coefficients;	//(numPhases + 1) 行 × numTaps
+	};
+}
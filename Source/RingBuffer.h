@@ -9,3 +9,180 @@
 */
 
 #pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <vector>
+
+//------------------------------------------------------------
+// 固定長の SPSC キュー（イベントやコマンドの受け渡し用）
+// ・容量はコンストラクタで確定、以降メモリ確保なし
+// ・満杯時は push が false を返し、overflow として記録
+//------------------------------------------------------------
+template <typename ElementType>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(int capacity)
+		: fifo(capacity + 1), items((size_t)capacity + 1)
+	{
+	}
+
+	//書き込み側
+	bool push(const ElementType& item) noexcept
+	{
+		if (fifo.getFreeSpace() < 1)
+		{
+			overflowCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		int start1, size1, start2, size2;
+		fifo.prepareToWrite(1, start1, size1, start2, size2);
+		items[(size_t)start1] = item;
+		fifo.finishedWrite(1);
+		return true;
+	}
+
+	//読み出し側
+	bool pop(ElementType& item) noexcept
+	{
+		if (fifo.getNumReady() < 1)
+			return false;
+
+		int start1, size1, start2, size2;
+		fifo.prepareToRead(1, start1, size1, start2, size2);
+		item = items[(size_t)start1];
+		fifo.finishedRead(1);
+		return true;
+	}
+
+	//先頭を取り出さずに覗く（読み出し側のみ）
+	const ElementType* peek() const noexcept
+	{
+		if (fifo.getNumReady() < 1)
+			return nullptr;
+
+		int start1, size1, start2, size2;
+		fifo.prepareToRead(1, start1, size1, start2, size2);
+		return &items[(size_t)start1];
+	}
+
+	int getNumReady() const noexcept { return fifo.getNumReady(); }
+	int getCapacity() const noexcept { return fifo.getTotalSize() - 1; }
+	juce::uint32 getOverflowCount() const noexcept { return overflowCount.load(std::memory_order_relaxed); }
+
+private:
+	juce::AbstractFifo fifo;
+	std::vector<ElementType> items;
+	std::atomic<juce::uint32> overflowCount { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE(SpscQueue)
+};
+
+
+//------------------------------------------------------------
+// 入力履歴用のリングバッファ（上書き型）
+// ・書き込みは1スレッドのみ、古いものから上書きされる
+// ・サンプルは絶対位置（prepare からの通算サンプル数）で参照する
+// ・読み出し側は「まだ上書きされていない範囲」だけを安全に読める
+//------------------------------------------------------------
+class HistoryRingBuffer
+{
+public:
+	HistoryRingBuffer() = default;
+
+	void prepare(int numChannels, int capacityInSamples)
+	{
+		storage.setSize(juce::jmax(1, numChannels), juce::jmax(1, capacityInSamples));
+		reset();
+	}
+
+	void reset()
+	{
+		storage.clear();
+		totalWritten.store(0);
+	}
+
+	//書き込み側：ブロックをそのまま履歴に積む
+	void write(const juce::AudioBuffer<float>& src, int numSamples)
+	{
+		const int capacity = storage.getNumSamples();
+		const auto writeAbs = totalWritten.load(std::memory_order_relaxed);
+
+		//容量を超える分は末尾だけ残す
+		const int skip = juce::jmax(0, numSamples - capacity);
+		const int toWrite = numSamples - skip;
+		const int start = (int)((writeAbs + skip) % capacity);
+		const int size1 = juce::jmin(toWrite, capacity - start);
+		const int size2 = toWrite - size1;
+
+		for (int ch = 0; ch < storage.getNumChannels(); ++ch)
+		{
+			if (ch < src.getNumChannels())
+			{
+				storage.copyFrom(ch, start, src, ch, skip, size1);
+				if (size2 > 0) storage.copyFrom(ch, 0, src, ch, skip + size1, size2);
+			}
+			else
+			{
+				storage.clear(ch, start, size1);
+				if (size2 > 0) storage.clear(ch, 0, size2);
+			}
+		}
+
+		activeChannels.store(juce::jlimit(1, storage.getNumChannels(), src.getNumChannels()), std::memory_order_relaxed);
+		totalWritten.store(writeAbs + numSamples, std::memory_order_release);
+	}
+
+	//読み出し側：[absStart, absStart+numSamples) を dest にコピー。読めたサンプル数を返す
+	int read(juce::int64 absStart, juce::AudioBuffer<float>& dest, int destStartSample, int numSamples) const
+	{
+		const auto newest = getTotalWritten();
+		const auto oldest = getOldestAbs();
+
+		const auto from = juce::jmax(absStart, oldest);
+		const auto to   = juce::jmin(absStart + numSamples, newest);
+		if (to <= from) return 0;
+
+		const int capacity = storage.getNumSamples();
+		const int count = (int)(to - from);
+		const int start = (int)(from % capacity);
+		const int size1 = juce::jmin(count, capacity - start);
+		const int size2 = count - size1;
+		const int destOffset = destStartSample + (int)(from - absStart);
+
+		const int numChannels = juce::jmin(dest.getNumChannels(), storage.getNumChannels());
+		for (int ch = 0; ch < numChannels; ++ch)
+		{
+			dest.copyFrom(ch, destOffset, storage, ch, start, size1);
+			if (size2 > 0) dest.copyFrom(ch, destOffset + size1, storage, ch, 0, size2);
+		}
+		return count;
+	}
+
+	//全チャンネル平均の振幅（トリガー位置の探索用）
+	float getFrameAmplitude(juce::int64 absIndex) const noexcept
+	{
+		const int index = (int)(absIndex % storage.getNumSamples());
+		const int numChannels = activeChannels.load(std::memory_order_relaxed);
+		float sum = 0.0f;
+
+		for (int ch = 0; ch < numChannels; ++ch)
+			sum += std::abs(storage.getReadPointer(ch)[index]);
+
+		return sum / (float)numChannels;
+	}
+
+	//次に書き込まれる絶対位置（＝これまでの通算サンプル数）
+	juce::int64 getTotalWritten() const noexcept { return totalWritten.load(std::memory_order_acquire); }
+	//まだ残っている最も古い絶対位置
+	juce::int64 getOldestAbs() const noexcept { return juce::jmax((juce::int64)0, getTotalWritten() - storage.getNumSamples()); }
+	int getCapacity() const noexcept { return storage.getNumSamples(); }
+
+private:
+	juce::AudioBuffer<float> storage;
+	std::atomic<juce::int64> totalWritten { 0 };
+	std::atomic<int> activeChannels { 1 };
+
+	JUCE_DECLARE_NON_COPYABLE(HistoryRingBuffer)
+};
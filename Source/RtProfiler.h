@@ -0,0 +1,467 @@
+/*
+  ==============================================================================
+
+    RtProfiler.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "RingBuffer.h"
+#include <array>
+#include <atomic>
+#include <memory>
+
+//------------------------------------------------------------
+// オーディオコールバックのプロファイラ
+// SIMPLOOPER_RT_PROFILER=1 でビルドした時だけ有効（オプトイン）
+// 無効時はすべて空の関数・空のクラスになり、時刻も読まない
+//
+// オーディオスレッドは区間ごとの時刻を1コールバック分の Frame にためて SPSC キューへ積むだけ
+// 集計（負荷・ヒストグラム・遅れの回数）とトレースファイルへの書き出しは裏のスレッドがやる
+//------------------------------------------------------------
+#ifndef SIMPLOOPER_RT_PROFILER
+ #define SIMPLOOPER_RT_PROFILER 0
+#endif
+
+class RtProfiler
+{
+public:
+	//計る区間（コールバックの中の並び順）
+	enum class Stage
+	{
+		input,			//ゲート・解析・入力履歴への書き込み（InputTap）
+		diskService,	//ディスクとのページのやり取り・保存のスナップショット
+		commands,		//コマンドの実行・録音の切り替え
+		record,
+		mix,
+		monitor,
+		housekeeping	//履歴の後片付け・波形とメーターの公開
+	};
+	static constexpr int numStages = 7;
+
+	static const char* getStageName(Stage stage) noexcept
+	{
+		static constexpr const char* names[numStages] = { "input", "disk", "commands", "record", "mix", "monitor", "housekeeping" };
+		return names[(int)stage];
+	}
+
+	static constexpr bool isEnabled() noexcept { return SIMPLOOPER_RT_PROFILER != 0; }
+
+	//負荷（処理時間÷バッファの周期）のヒストグラムは 5% 刻み。最後の箱は 195% 以上
+	static constexpr int numLoadBins = 40;
+	static constexpr double loadBinWidth = 0.05;
+
+	//前のコールバックから周期のこの倍以上あいたら「遅れて呼ばれた」とみなす
+	static constexpr double lateCallbackRatio = 1.5;
+
+	struct Summary
+	{
+		juce::uint64 callbacks = 0;
+		double meanLoad = 0.0;			//1.0 = 周期いっぱい
+		double maxLoad = 0.0;
+		double p99Load = 0.0;			//ヒストグラムの箱の上端
+		std::array<double, numStages> meanStageMicros {};
+		std::array<double, numStages> maxStageMicros {};
+		std::array<juce::uint32, numLoadBins> loadHistogram {};
+		juce::uint32 deadlineMisses = 0;	//処理が周期を超えた
+		juce::uint32 lateCallbacks = 0;		//前のコールバックから lateCallbackRatio 周期以上あいた
+		juce::uint32 droppedFrames = 0;		//キューがあふれて集計できなかった
+		double roundTripLatencyMs = 0.0;	//デバイスが申告する入力＋出力のレイテンシ
+		double savedLatencyMs = 0.0;		//入出力を同じコールバックで処理して減らせた分
+	};
+
+	enum class TraceFormat
+	{
+		csv,	//1コールバック1行
+		json	//Chrome のトレース形式（chrome://tracing や Perfetto で開ける）
+	};
+
+	//区間を計る（profiler が nullptr なら何もしない）
+	struct ScopedStage
+	{
+	   #if SIMPLOOPER_RT_PROFILER
+		ScopedStage(RtProfiler* p, Stage s) noexcept
+			: profiler(p), stage(s), startTicks(p != nullptr ? juce::Time::getHighResolutionTicks() : 0) {}
+		~ScopedStage() noexcept
+		{
+			if (profiler != nullptr)
+				profiler->addStage(stage, startTicks, juce::Time::getHighResolutionTicks());
+		}
+	   private:
+		RtProfiler* profiler;
+		Stage stage;
+		juce::int64 startTicks;
+	   public:
+	   #else
+		ScopedStage(RtProfiler*, Stage) noexcept {}
+	   #endif
+
+		JUCE_DECLARE_NON_COPYABLE(ScopedStage)
+	};
+
+	//コールバック1回分を囲む
+	struct ScopedCallback
+	{
+	   #if SIMPLOOPER_RT_PROFILER
+		ScopedCallback(RtProfiler* p, int numSamples) noexcept : profiler(p)
+		{
+			if (profiler != nullptr) profiler->beginCallback(numSamples);
+		}
+		~ScopedCallback() noexcept
+		{
+			if (profiler != nullptr) profiler->endCallback();
+		}
+	   private:
+		RtProfiler* profiler;
+	   public:
+	   #else
+		ScopedCallback(RtProfiler*, int) noexcept {}
+	   #endif
+
+		JUCE_DECLARE_NON_COPYABLE(ScopedCallback)
+	};
+
+   #if SIMPLOOPER_RT_PROFILER
+	RtProfiler() = default;
+	~RtProfiler() { stop(); }
+
+	//===メッセージスレッド===
+
+	//オーディオ停止中に呼ぶ
+	void prepare(double newSampleRate) noexcept
+	{
+		sampleRate = newSampleRate;
+		lastCallbackStart = 0;
+		current = {};
+		inCallback = false;
+	}
+
+	void start() { consumer.startThread(juce::Thread::Priority::low); }
+
+	//デバイスのレイテンシ（サンプル数）。prepare の後、オーディオ停止中に呼ぶ
+	//savedSamples は入力を別のコールバックから受け渡していた時より短くなった分
+	void setLatency(int roundTripSamples, int savedSamples) noexcept
+	{
+		const double msPerSample = sampleRate > 0.0 ? 1000.0 / sampleRate : 0.0;
+		roundTripLatencyMs.store(roundTripSamples * msPerSample, std::memory_order_relaxed);
+		savedLatencyMs.store(savedSamples * msPerSample, std::memory_order_relaxed);
+	}
+
+	void stop()
+	{
+		consumer.stopThread(1000);
+		stopTrace();
+	}
+
+	//以降のコールバックを file へ書き出す（既存のファイルは置き換える）
+	bool startTrace(const juce::File& file, TraceFormat format)
+	{
+		auto stream = std::make_unique<juce::FileOutputStream>(file);
+		if (stream->failedToOpen())
+			return false;
+
+		stream->setPosition(0);
+		stream->truncate();
+
+		if (format == TraceFormat::csv)
+		{
+			stream->writeText("callback,startUs,numSamples,periodUs,totalUs,load,intervalUs", false, false, nullptr);
+			for (int s = 0; s < numStages; ++s)
+				stream->writeText(juce::String(",") + getStageName((Stage)s) + "Us", false, false, nullptr);
+			stream->writeText("\n", false, false, nullptr);
+		}
+		else
+		{
+			stream->writeText("{\"traceEvents\":[\n", false, false, nullptr);
+		}
+
+		const juce::ScopedLock sl(traceLock);
+		closeTrace();
+		trace = std::move(stream);
+		traceFormat = format;
+		traceStartTicks = 0;
+		traceHasEvents = false;
+		return true;
+	}
+
+	void stopTrace()
+	{
+		const juce::ScopedLock sl(traceLock);
+		closeTrace();
+	}
+
+	bool isTracing() const
+	{
+		const juce::ScopedLock sl(traceLock);
+		return trace != nullptr;
+	}
+
+	//どのスレッドからでも（オーディオスレッド以外）
+	Summary getSummary() const
+	{
+		const juce::ScopedLock sl(summaryLock);
+
+		Summary s = summary;
+		s.droppedFrames = frames.getOverflowCount() - droppedAtReset;
+		s.roundTripLatencyMs = roundTripLatencyMs.load(std::memory_order_relaxed);
+		s.savedLatencyMs = savedLatencyMs.load(std::memory_order_relaxed);
+
+		if (s.callbacks > 0)
+		{
+			s.meanLoad = loadSum / (double)s.callbacks;
+			for (int i = 0; i < numStages; ++i)
+				s.meanStageMicros[(size_t)i] = stageMicrosSum[(size_t)i] / (double)s.callbacks;
+
+			//99% のコールバックが収まる箱の上端
+			const auto limit = (juce::uint64)((double)s.callbacks * 0.99);
+			juce::uint64 count = 0;
+			for (int bin = 0; bin < numLoadBins; ++bin)
+			{
+				count += s.loadHistogram[(size_t)bin];
+				if (count >= limit)
+				{
+					s.p99Load = juce::jmin(s.maxLoad, (bin + 1) * loadBinWidth);
+					break;
+				}
+			}
+		}
+
+		return s;
+	}
+
+	void resetSummary()
+	{
+		const juce::ScopedLock sl(summaryLock);
+		summary = {};
+		loadSum = 0.0;
+		stageMicrosSum = {};
+		droppedAtReset = frames.getOverflowCount();
+	}
+
+	//===オーディオスレッド（ScopedCallback / ScopedStage から）===
+
+	void beginCallback(int numSamples) noexcept
+	{
+		const auto now = juce::Time::getHighResolutionTicks();
+
+		current.startTicks = now;
+		current.intervalTicks = lastCallbackStart != 0 ? now - lastCallbackStart : 0;
+		current.periodTicks = sampleRate > 0.0 ? (juce::int64)((double)numSamples / sampleRate * ticksPerSecond) : 0;
+		current.numSamples = numSamples;
+		lastCallbackStart = now;
+		inCallback = true;
+	}
+
+	void endCallback() noexcept
+	{
+		current.endTicks = juce::Time::getHighResolutionTicks();
+		frames.push(current); //満杯なら捨てる（回数は droppedFrames に出る）
+
+		current = {};
+		inCallback = false;
+	}
+
+	//同じ区間が何度来ても（ブロックを区切った時など）足し込む
+	//コールバックの外で計った区間は次のコールバックの分に入れる
+	void addStage(Stage stage, juce::int64 startTicks, juce::int64 endTicks) noexcept
+	{
+		const auto index = (size_t)stage;
+		const auto ticks = endTicks - startTicks;
+
+		if (current.stageTicks[index] == 0)
+			current.stageStartTicks[index] = startTicks;
+		current.stageTicks[index] += ticks;
+
+		if (! inCallback)
+			current.outsideTicks += ticks;
+	}
+
+   #else
+	RtProfiler() = default;
+
+	void prepare(double) noexcept {}
+	void setLatency(int, int) noexcept {}
+	void start() {}
+	void stop() {}
+	bool startTrace(const juce::File&, TraceFormat) { return false; }
+	void stopTrace() {}
+	bool isTracing() const { return false; }
+	Summary getSummary() const { return {}; }
+	void resetSummary() {}
+   #endif
+
+private:
+   #if SIMPLOOPER_RT_PROFILER
+	struct Frame
+	{
+		juce::int64 startTicks = 0;
+		juce::int64 endTicks = 0;
+		juce::int64 periodTicks = 0;
+		juce::int64 intervalTicks = 0;	//前のコールバックの開始から（最初は0）
+		juce::int64 outsideTicks = 0;	//コールバックの外で計った区間の合計
+		int numSamples = 0;
+		std::array<juce::int64, numStages> stageStartTicks {};
+		std::array<juce::int64, numStages> stageTicks {};
+
+		juce::int64 getTotalTicks() const noexcept { return endTicks - startTicks + outsideTicks; }
+	};
+
+	//キューを読んで集計し、トレースに書く
+	class Consumer : public juce::Thread
+	{
+	public:
+		explicit Consumer(RtProfiler& o) : juce::Thread("Simplooper profiler"), owner(o) {}
+
+		void run() override
+		{
+			while (! threadShouldExit())
+			{
+				owner.drainFrames();
+				wait(drainIntervalMs);
+			}
+
+			owner.drainFrames();
+		}
+
+	private:
+		RtProfiler& owner;
+	};
+
+	static constexpr int queueSize = 4096;
+	static constexpr int drainIntervalMs = 20;
+
+	double toMicros(juce::int64 ticks) const noexcept { return (double)ticks * 1.0e6 / ticksPerSecond; }
+
+	void drainFrames()
+	{
+		Frame frame;
+		while (frames.pop(frame))
+		{
+			accumulate(frame);
+
+			const juce::ScopedLock sl(traceLock);
+			if (trace != nullptr)
+				writeTrace(frame);
+		}
+	}
+
+	void accumulate(const Frame& frame)
+	{
+		const juce::ScopedLock sl(summaryLock);
+
+		const double load = frame.periodTicks > 0 ? (double)frame.getTotalTicks() / (double)frame.periodTicks : 0.0;
+
+		++summary.callbacks;
+		loadSum += load;
+		summary.maxLoad = juce::jmax(summary.maxLoad, load);
+		++summary.loadHistogram[(size_t)juce::jlimit(0, numLoadBins - 1, (int)(load / loadBinWidth))];
+
+		if (load > 1.0)
+			++summary.deadlineMisses;
+		if (frame.intervalTicks > (juce::int64)((double)frame.periodTicks * lateCallbackRatio))
+			++summary.lateCallbacks;
+
+		for (size_t i = 0; i < (size_t)numStages; ++i)
+		{
+			const double micros = toMicros(frame.stageTicks[i]);
+			stageMicrosSum[i] += micros;
+			summary.maxStageMicros[i] = juce::jmax(summary.maxStageMicros[i], micros);
+		}
+	}
+
+	void writeTrace(const Frame& frame)
+	{
+		if (traceStartTicks == 0)
+			traceStartTicks = frame.startTicks;
+
+		const double startUs = toMicros(frame.startTicks - traceStartTicks);
+		juce::String line;
+
+		if (traceFormat == TraceFormat::csv)
+		{
+			line << (juce::int64)traceCallbacks << "," << startUs << "," << frame.numSamples << ","
+				 << toMicros(frame.periodTicks) << "," << toMicros(frame.getTotalTicks()) << ","
+				 << (frame.periodTicks > 0 ? (double)frame.getTotalTicks() / (double)frame.periodTicks : 0.0) << ","
+				 << toMicros(frame.intervalTicks);
+			for (auto ticks : frame.stageTicks)
+				line << "," << toMicros(ticks);
+			line << "\n";
+		}
+		else
+		{
+			//コールバック全体と、その中の区間を入れ子の区間として並べる
+			line << jsonEvent("callback", startUs, toMicros(frame.endTicks - frame.startTicks));
+			for (int s = 0; s < numStages; ++s)
+				if (frame.stageTicks[(size_t)s] > 0)
+					line << jsonEvent(getStageName((Stage)s), juce::jmax(0.0, toMicros(frame.stageStartTicks[(size_t)s] - traceStartTicks)),
+									  toMicros(frame.stageTicks[(size_t)s]));
+		}
+
+		trace->writeText(line, false, false, nullptr);
+		++traceCallbacks;
+	}
+
+	juce::String jsonEvent(const char* name, double startUs, double durationUs)
+	{
+		juce::String event;
+		event << (traceHasEvents ? ",\n" : "")
+			  << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+			  << juce::String(startUs, 3) << ",\"dur\":" << juce::String(durationUs, 3) << "}";
+		traceHasEvents = true;
+		return event;
+	}
+
+	//traceLock を持って呼ぶ
+	void closeTrace()
+	{
+		if (trace == nullptr) return;
+
+		//レイテンシはトレース全体の情報として最後に付ける
+		if (traceFormat == TraceFormat::json)
+		{
+			juce::String footer;
+			footer << "\n],\"otherData\":{\"roundTripLatencyMs\":" << juce::String(roundTripLatencyMs.load(std::memory_order_relaxed), 3)
+				   << ",\"savedLatencyMs\":" << juce::String(savedLatencyMs.load(std::memory_order_relaxed), 3) << "}}\n";
+			trace->writeText(footer, false, false, nullptr);
+		}
+
+		trace->flush();
+		trace.reset();
+		traceCallbacks = 0;
+	}
+
+	const double ticksPerSecond = (double)juce::Time::getHighResolutionTicksPerSecond();
+
+	//オーディオスレッドだけが触る
+	double sampleRate = 0.0;
+	juce::int64 lastCallbackStart = 0;
+	Frame current;
+	bool inCallback = false;
+
+	SpscQueue<Frame> frames { queueSize }; //オーディオ → 集計
+
+	//集計（裏のスレッドが書き、UIが読む）
+	juce::CriticalSection summaryLock;
+	Summary summary;
+	double loadSum = 0.0;
+	std::array<double, numStages> stageMicrosSum {};
+	juce::uint32 droppedAtReset = 0;
+
+	std::atomic<double> roundTripLatencyMs { 0.0 };
+	std::atomic<double> savedLatencyMs { 0.0 };
+
+	//トレース（裏のスレッドが書き、メッセージスレッドが開け閉めする）
+	juce::CriticalSection traceLock;
+	std::unique_ptr<juce::FileOutputStream> trace;
+	TraceFormat traceFormat = TraceFormat::csv;
+	juce::int64 traceStartTicks = 0;
+	juce::uint64 traceCallbacks = 0;
+	bool traceHasEvents = false;
+
+	Consumer consumer { *this };
+   #endif
+
+	JUCE_DECLARE_NON_COPYABLE(RtProfiler)
+};
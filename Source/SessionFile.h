@@ -0,0 +1,270 @@
+/*
+  ==============================================================================
+
+    SessionFile.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "PagedAudioStorage.h"
+#include "DiskStreamer.h"
+#include <cstring>
+#include <memory>
+#include <vector>
+
+//------------------------------------------------------------
+// セッションファイル（.simploop）
+//   [ヘッダ][トラック表][ページ目録] … dataOffset まで
+//   [ページ本体] … dataAlignment 境界から、ページを詰めて並べる
+// ページ本体はアリーナのページと同じ並び（[チャンネル][pageSize] の float）なので、
+// 読み込み時はファイルをマップしてそのままトラックのページにする（デコードもコピーもしない）
+// 数値はリトルエンディアン、サンプルはこのマシンの float をそのまま書く
+//------------------------------------------------------------
+namespace session
+{
+	constexpr char magic[8] = { 'S', 'P', 'L', 'O', 'O', 'P', '0', '1' };
+	constexpr int formatVersion = 1;
+	//ページ本体の先頭（どの OS のマップ粒度よりも大きく取る）
+	constexpr juce::int64 dataAlignment = 65536;
+
+	struct Header
+	{
+		double sampleRate = 0.0;
+		int numChannels = 0;
+		int pageSize = 0;
+		int masterTrackId = -1;
+		int masterLoopLength = 0;
+		juce::int64 masterStartSample = 0;
+		int numTracks = 0;
+		int numPages = 0;
+		juce::int64 dataOffset = 0;
+	};
+
+	struct TrackInfo
+	{
+		int trackId = -1;
+		bool isPlaying = false;
+		bool muted = false;
+		int lengthInSample = 0;
+		int recordLength = 0;
+		float gain = 1.0f;
+		float pan = 0.0f;
+		int firstPage = 0;	//ページ目録の何番目からがこのトラックか
+		int numPages = 0;
+	};
+
+	//保存する中身（オーディオスレッドがページを retain して埋め、保存スレッドが書いて release する）
+	struct Snapshot
+	{
+		struct PageRef
+		{
+			int pageIndex = 0;					//トラック内のページ位置
+			int page = PageArena::invalidPage;	//アリーナのページ（追い出し済みなら invalidPage）
+			int takeId = -1;					//追い出し済みの時に読むディスクのテイク
+		};
+
+		//メッセージスレッドで確保する
+		void prepare(int maxTracks, int maxPages)
+		{
+			tracks.resize((size_t)maxTracks);
+			pages.resize((size_t)juce::jmax(1, maxPages));
+			numTracks = numPages = 0;
+			overflowed = false;
+		}
+
+		Header header;
+		std::vector<TrackInfo> tracks;
+		std::vector<PageRef> pages;
+		int numTracks = 0;
+		int numPages = 0;
+		bool overflowed = false; //ページが入りきらなかった
+	};
+
+	//==============================================
+	// 書き出し（保存スレッド）
+	//==============================================
+	namespace detail
+	{
+		constexpr int headerBytes = 8 + 4 + 8 + 4 * 4 + 8 + 4 * 2 + 8;
+		constexpr int trackBytes = 4 * 8;
+
+		inline juce::int64 dataOffsetFor(int numTracks, int numPages)
+		{
+			const juce::int64 metadata = headerBytes + (juce::int64)numTracks * trackBytes + (juce::int64)numPages * 4;
+			return (metadata + dataAlignment - 1) / dataAlignment * dataAlignment;
+		}
+	}
+
+	//snapshot を file へ書く（一時ファイルに書いてから置き換える）。成否にかかわらず snapshot のページは release する
+	//※Windows ではマップ中のファイル（読み込んだセッションそのもの）は置き換えられない
+	inline bool write(const juce::File& file, Snapshot& snapshot, PageArena& arena, const DiskStreamer& streamer)
+	{
+		auto& header = snapshot.header;
+		header.numTracks = snapshot.numTracks;
+		header.numPages = snapshot.numPages;
+		header.dataOffset = detail::dataOffsetFor(header.numTracks, header.numPages);
+
+		const size_t bytesPerPage = PageArena::bytesPerPage(header.numChannels, header.pageSize);
+		bool ok = ! snapshot.overflowed;
+
+		{
+			juce::TemporaryFile temp(file);
+			juce::FileOutputStream out(temp.getFile());
+			ok = ok && out.openedOk();
+
+			if (ok)
+			{
+				out.write(magic, sizeof(magic));
+				out.writeInt(formatVersion);
+				out.writeDouble(header.sampleRate);
+				out.writeInt(header.numChannels);
+				out.writeInt(header.pageSize);
+				out.writeInt(header.masterTrackId);
+				out.writeInt(header.masterLoopLength);
+				out.writeInt64(header.masterStartSample);
+				out.writeInt(header.numTracks);
+				out.writeInt(header.numPages);
+				out.writeInt64(header.dataOffset);
+
+				for (int i = 0; i < snapshot.numTracks; ++i)
+				{
+					const auto& t = snapshot.tracks[(size_t)i];
+					out.writeInt(t.trackId);
+					out.writeInt((t.isPlaying ? 1 : 0) | (t.muted ? 2 : 0));
+					out.writeInt(t.lengthInSample);
+					out.writeInt(t.recordLength);
+					out.writeFloat(t.gain);
+					out.writeFloat(t.pan);
+					out.writeInt(t.firstPage);
+					out.writeInt(t.numPages);
+				}
+
+				for (int i = 0; i < snapshot.numPages; ++i)
+					out.writeInt(snapshot.pages[(size_t)i].pageIndex);
+
+				ok = out.writeRepeatedByte(0, (size_t)(header.dataOffset - out.getPosition()));
+
+				//ページ本体。追い出し済みのページはストリーミングのテイクから読む
+				std::vector<float> scratch(bytesPerPage / sizeof(float));
+
+				for (int i = 0; i < snapshot.numPages && ok; ++i)
+				{
+					const auto& ref = snapshot.pages[(size_t)i];
+					const float* data = scratch.data();
+
+					if (ref.page != PageArena::invalidPage)
+						data = arena.getReadPointer(ref.page, 0);
+					else if (! streamer.readStoredPage(ref.takeId, ref.pageIndex, scratch.data()))
+						ok = false;
+
+					ok = ok && out.write(data, bytesPerPage);
+				}
+
+				out.flush();
+				ok = ok && out.getStatus().wasOk();
+			}
+
+			if (ok)
+				ok = temp.overwriteTargetFileWithTemporary();
+		}
+
+		for (int i = 0; i < snapshot.numPages; ++i)
+			if (snapshot.pages[(size_t)i].page != PageArena::invalidPage)
+				arena.release(snapshot.pages[(size_t)i].page);
+
+		snapshot.numPages = 0;
+		return ok;
+	}
+
+	//==============================================
+	// 読み込み（ファイルをマップして目録だけ読む）
+	//==============================================
+	class MappedSession
+	{
+	public:
+		//チャンネル数とページの大きさが合わないファイルは開かない
+		bool open(const juce::File& file, int expectedChannels, int expectedPageSize)
+		{
+			mapping = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+
+			const auto* data = static_cast<const char*>(mapping->getData());
+			const auto size = (juce::int64)mapping->getSize();
+			if (data == nullptr || size < detail::headerBytes || std::memcmp(data, magic, sizeof(magic)) != 0)
+				return fail("not a session file");
+
+			juce::MemoryInputStream in(data, (size_t)size, false);
+			in.skipNextBytes(sizeof(magic));
+
+			if (in.readInt() != formatVersion)
+				return fail("unsupported version");
+
+			header.sampleRate = in.readDouble();
+			header.numChannels = in.readInt();
+			header.pageSize = in.readInt();
+			header.masterTrackId = in.readInt();
+			header.masterLoopLength = in.readInt();
+			header.masterStartSample = in.readInt64();
+			header.numTracks = in.readInt();
+			header.numPages = in.readInt();
+			header.dataOffset = in.readInt64();
+
+			if (header.numChannels != expectedChannels || header.pageSize != expectedPageSize)
+				return fail("page layout mismatch");
+
+			if (header.numTracks < 0 || header.numPages < 0
+				|| header.dataOffset != detail::dataOffsetFor(header.numTracks, header.numPages)
+				|| header.dataOffset + (juce::int64)header.numPages * (juce::int64)PageArena::bytesPerPage(header.numChannels, header.pageSize) > size)
+				return fail("truncated");
+
+			tracks.resize((size_t)header.numTracks);
+			for (auto& t : tracks)
+			{
+				t.trackId = in.readInt();
+				const int flags = in.readInt();
+				t.isPlaying = (flags & 1) != 0;
+				t.muted = (flags & 2) != 0;
+				t.lengthInSample = in.readInt();
+				t.recordLength = in.readInt();
+				t.gain = in.readFloat();
+				t.pan = in.readFloat();
+				t.firstPage = in.readInt();
+				t.numPages = in.readInt();
+
+				if (t.firstPage < 0 || t.numPages < 0 || t.firstPage + t.numPages > header.numPages)
+					return fail("bad track table");
+			}
+
+			pageIndices.resize((size_t)header.numPages);
+			for (auto& index : pageIndices)
+				index = in.readInt();
+
+			return true;
+		}
+
+		const Header& getHeader() const noexcept { return header; }
+		const std::vector<TrackInfo>& getTracks() const noexcept { return tracks; }
+		int getPageIndex(int entry) const noexcept { return pageIndices[(size_t)entry]; }
+		const juce::String& getError() const noexcept { return error; }
+
+		//ページ本体の先頭（アリーナの外部ページとしてそのまま使う）
+		const float* getPageData() const noexcept
+		{
+			return reinterpret_cast<const float*>(static_cast<const char*>(mapping->getData()) + header.dataOffset);
+		}
+
+	private:
+		bool fail(const juce::String& reason)
+		{
+			error = reason;
+			return false;
+		}
+
+		std::unique_ptr<juce::MemoryMappedFile> mapping;
+		Header header;
+		std::vector<TrackInfo> tracks;
+		std::vector<int> pageIndices;
+		juce::String error;
+	};
+}
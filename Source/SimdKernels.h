@@ -0,0 +1,468 @@
+/*
+  ==============================================================================
+
+    SimdKernels.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+//------------------------------------------------------------
+// オーディオスレッド用のSIMDカーネル集
+// JUCEに依存しないので単体のベンチマークからもそのまま使える
+// SSE2 / NEON が使えない環境ではスカラー版にフォールバック
+//------------------------------------------------------------
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define SIMPLOOPER_SIMD_SSE 1
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+ #include <arm_neon.h>
+ #define SIMPLOOPER_SIMD_NEON 1
+#endif
+
+#if defined (_MSC_VER)
+ #include <intrin.h>
+#endif
+
+namespace simd
+{
+	//1チャンネル分の解析結果
+	struct ChannelStats
+	{
+		float sumSquares = 0.0f; //二乗和（RMS計算用）
+		float peak = 0.0f;		 //絶対値の最大
+		int firstCrossing = -1;	 //しきい値を最初に超えたサンプル（なければ-1）
+	};
+
+	inline int countTrailingZeros(unsigned int mask) noexcept
+	{
+	   #if defined (_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int)index;
+	   #else
+		return __builtin_ctz(mask);
+	   #endif
+	}
+
+	//==============================================
+	// 二乗和・ピーク・しきい値超え位置を1パスで求める
+	//==============================================
+	inline ChannelStats analyzeChannel(const float* data, int numSamples, float threshold) noexcept
+	{
+		ChannelStats stats;
+		int i = 0;
+
+	   #if SIMPLOOPER_SIMD_SSE
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 thr = _mm_set1_ps(threshold);
+		__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+		__m128 peak0 = _mm_setzero_ps(), peak1 = _mm_setzero_ps();
+
+		for (; i + 8 <= numSamples; i += 8)
+		{
+			const __m128 a = _mm_loadu_ps(data + i);
+			const __m128 b = _mm_loadu_ps(data + i + 4);
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(a, a));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(b, b));
+
+			const __m128 absA = _mm_and_ps(a, absMask);
+			const __m128 absB = _mm_and_ps(b, absMask);
+			peak0 = _mm_max_ps(peak0, absA);
+			peak1 = _mm_max_ps(peak1, absB);
+
+			if (stats.firstCrossing < 0)
+			{
+				const int mask = _mm_movemask_ps(_mm_cmpgt_ps(absA, thr))
+							   | (_mm_movemask_ps(_mm_cmpgt_ps(absB, thr)) << 4);
+				if (mask != 0)
+					stats.firstCrossing = i + countTrailingZeros((unsigned int)mask);
+			}
+		}
+
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, _mm_add_ps(sum0, sum1));
+		stats.sumSquares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		_mm_store_ps(lanes, _mm_max_ps(peak0, peak1));
+		stats.peak = std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3]));
+
+	   #elif SIMPLOOPER_SIMD_NEON
+		const float32x4_t thr = vdupq_n_f32(threshold);
+		float32x4_t sum0 = vdupq_n_f32(0.0f), sum1 = vdupq_n_f32(0.0f);
+		float32x4_t peak0 = vdupq_n_f32(0.0f), peak1 = vdupq_n_f32(0.0f);
+
+		for (; i + 8 <= numSamples; i += 8)
+		{
+			const float32x4_t a = vld1q_f32(data + i);
+			const float32x4_t b = vld1q_f32(data + i + 4);
+			sum0 = vmlaq_f32(sum0, a, a);
+			sum1 = vmlaq_f32(sum1, b, b);
+
+			const float32x4_t absA = vabsq_f32(a);
+			const float32x4_t absB = vabsq_f32(b);
+			peak0 = vmaxq_f32(peak0, absA);
+			peak1 = vmaxq_f32(peak1, absB);
+
+			if (stats.firstCrossing < 0)
+			{
+				const uint32x4_t over = vorrq_u32(vcgtq_f32(absA, thr), vcgtq_f32(absB, thr));
+				const uint32x2_t half = vorr_u32(vget_low_u32(over), vget_high_u32(over));
+
+				if ((vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) != 0)
+				{
+					//8サンプルの中のどこかで超えたので位置だけスカラーで確定
+					for (int k = 0; k < 8; ++k)
+						if (std::fabs(data[i + k]) > threshold) { stats.firstCrossing = i + k; break; }
+				}
+			}
+		}
+
+		float sumLanes[4], peakLanes[4];
+		vst1q_f32(sumLanes, vaddq_f32(sum0, sum1));
+		vst1q_f32(peakLanes, vmaxq_f32(peak0, peak1));
+		stats.sumSquares = (sumLanes[0] + sumLanes[1]) + (sumLanes[2] + sumLanes[3]);
+		stats.peak = std::fmax(std::fmax(peakLanes[0], peakLanes[1]), std::fmax(peakLanes[2], peakLanes[3]));
+	   #endif
+
+		//端数（またはSIMDなし環境）はスカラーで処理
+		for (; i < numSamples; ++i)
+		{
+			const float x = data[i];
+			const float ax = std::fabs(x);
+			stats.sumSquares += x * x;
+			stats.peak = std::fmax(stats.peak, ax);
+
+			if (stats.firstCrossing < 0 && ax > threshold)
+				stats.firstCrossing = i;
+		}
+
+		return stats;
+	}
+
+	//==============================================
+	// ゲインのランプ（最初の rampSamples の間 step ずつ変化し、その後は endGain で一定）
+	// ゲインは常にランプの始点からの通算位置で出すので、どこで何回区切って進めても同じ値になる
+	//==============================================
+	struct GainRamp
+	{
+		float startGain = 1.0f;	//ランプを始めた時のゲイン
+		float step = 0.0f;		//1サンプルあたりの変化量
+		int elapsed = 0;		//ランプを始めてから進んだサンプル数
+		int rampSamples = 0;	//ランプの残りサンプル数
+		float endGain = 1.0f;	//ランプ後のゲイン（目標）
+
+		//いまから i サンプル先のゲイン（ランプ中のみ）
+		float gainAt(int i) const noexcept { return startGain + step * (float)(elapsed + i); }
+
+		//いまのゲイン
+		float getGain() const noexcept { return rampSamples > 0 ? gainAt(0) : endGain; }
+
+		//目標を変える（いまのゲインから numSamples かけて移る）
+		void setTarget(float newTarget, int numSamples) noexcept
+		{
+			if (newTarget == endGain) return;
+
+			startGain = getGain();
+			endGain = newTarget;
+			elapsed = 0;
+			rampSamples = std::max(1, numSamples);
+			step = (newTarget - startGain) / (float)rampSamples;
+		}
+
+		//ランプを飛ばしていきなり目標にする
+		void snapTo(float newTarget) noexcept
+		{
+			startGain = endGain = newTarget;
+			step = 0.0f;
+			elapsed = 0;
+			rampSamples = 0;
+		}
+
+		//numSamples 進めた後のランプ（始点と傾きはそのままで、通算位置だけ進める）
+		GainRamp advancedBy(int numSamples) const noexcept
+		{
+			if (numSamples >= rampSamples)
+				return { endGain, 0.0f, 0, 0, endGain };
+
+			return { startGain, step, elapsed + numSamples, rampSamples - numSamples, endGain };
+		}
+	};
+
+	//==============================================
+	// dest += src * ゲイン を1パスで（ゲインは ramp に沿って1サンプルずつ変える）
+	// measure なら足した信号（ゲイン後）の二乗和とピークも同じパスで levels へ足し込む（メーター用）
+	//==============================================
+	template <bool measure>
+	inline void addWithGainRampImpl(float* dest, const float* src, int numSamples, const GainRamp& ramp, ChannelStats* levels) noexcept
+	{
+		const int rampLength = std::min(numSamples, std::max(0, ramp.rampSamples));
+		int i = 0;
+
+	   #if SIMPLOOPER_SIMD_SSE
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		//4サンプルずつ交互に2組へ足す（1組だと足し込みの待ちで足を引っ張る）
+		__m128 sumSquares[2] = { _mm_setzero_ps(), _mm_setzero_ps() }, peak[2] = { _mm_setzero_ps(), _mm_setzero_ps() };
+
+		auto accumulate = [&] (__m128 v, int k) noexcept
+		{
+			if constexpr (measure)
+			{
+				sumSquares[k] = _mm_add_ps(sumSquares[k], _mm_mul_ps(v, v));
+				peak[k] = _mm_max_ps(peak[k], _mm_and_ps(v, absMask));
+			}
+			return v;
+		};
+	   #elif SIMPLOOPER_SIMD_NEON
+		float32x4_t sumSquares[2] = { vdupq_n_f32(0.0f), vdupq_n_f32(0.0f) }, peak[2] = { vdupq_n_f32(0.0f), vdupq_n_f32(0.0f) };
+
+		auto accumulate = [&] (float32x4_t v, int k) noexcept
+		{
+			if constexpr (measure)
+			{
+				sumSquares[k] = vmlaq_f32(sumSquares[k], v, v);
+				peak[k] = vmaxq_f32(peak[k], vabsq_f32(v));
+			}
+			return v;
+		};
+	   #endif
+
+		float scalarSumSquares = 0.0f, scalarPeak = 0.0f;
+		auto accumulateScalar = [&] (float v) noexcept
+		{
+			if constexpr (measure)
+			{
+				scalarSumSquares += v * v;
+				scalarPeak = std::fmax(scalarPeak, std::fabs(v));
+			}
+			return v;
+		};
+
+		//ランプ部分（各サンプルのゲインは gainAt(i) と同じ startGain + step * (elapsed + i) で、どこで区切っても同じ値）
+	   #if SIMPLOOPER_SIMD_SSE
+		{
+			const __m128 gain = _mm_set1_ps(ramp.startGain);
+			const __m128 step = _mm_set1_ps(ramp.step);
+			const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+			auto gainAt = [&] (int n) noexcept { return _mm_add_ps(gain, _mm_mul_ps(step, _mm_add_ps(_mm_set1_ps((float)(ramp.elapsed + n)), lanes))); };
+
+			for (; i + 8 <= rampLength; i += 8)
+			{
+				_mm_storeu_ps(dest + i,     _mm_add_ps(_mm_loadu_ps(dest + i),     accumulate(_mm_mul_ps(_mm_loadu_ps(src + i), gainAt(i)), 0)));
+				_mm_storeu_ps(dest + i + 4, _mm_add_ps(_mm_loadu_ps(dest + i + 4), accumulate(_mm_mul_ps(_mm_loadu_ps(src + i + 4), gainAt(i + 4)), 1)));
+			}
+			if (i + 4 <= rampLength)
+			{
+				_mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), accumulate(_mm_mul_ps(_mm_loadu_ps(src + i), gainAt(i)), 0)));
+				i += 4;
+			}
+		}
+	   #elif SIMPLOOPER_SIMD_NEON
+		{
+			const float32x4_t gain = vdupq_n_f32(ramp.startGain);
+			const float32x4_t step = vdupq_n_f32(ramp.step);
+			const float laneValues[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+			const float32x4_t lanes = vld1q_f32(laneValues);
+
+			auto gainAt = [&] (int n) noexcept { return vaddq_f32(gain, vmulq_f32(step, vaddq_f32(vdupq_n_f32((float)(ramp.elapsed + n)), lanes))); };
+
+			for (; i + 8 <= rampLength; i += 8)
+			{
+				vst1q_f32(dest + i,     vaddq_f32(vld1q_f32(dest + i),     accumulate(vmulq_f32(vld1q_f32(src + i), gainAt(i)), 0)));
+				vst1q_f32(dest + i + 4, vaddq_f32(vld1q_f32(dest + i + 4), accumulate(vmulq_f32(vld1q_f32(src + i + 4), gainAt(i + 4)), 1)));
+			}
+			if (i + 4 <= rampLength)
+			{
+				vst1q_f32(dest + i, vaddq_f32(vld1q_f32(dest + i), accumulate(vmulq_f32(vld1q_f32(src + i), gainAt(i)), 0)));
+				i += 4;
+			}
+		}
+	   #endif
+		for (; i < rampLength; ++i)
+			dest[i] += accumulateScalar(src[i] * ramp.gainAt(i));
+
+		//一定部分（ミュート中は足すものがない）
+		if (i < numSamples && ramp.endGain != 0.0f)
+		{
+			const float gain = ramp.endGain;
+
+		   #if SIMPLOOPER_SIMD_SSE
+			{
+				const __m128 g = _mm_set1_ps(gain);
+				for (; i + 8 <= numSamples; i += 8)
+				{
+					_mm_storeu_ps(dest + i,     _mm_add_ps(_mm_loadu_ps(dest + i),     accumulate(_mm_mul_ps(_mm_loadu_ps(src + i), g), 0)));
+					_mm_storeu_ps(dest + i + 4, _mm_add_ps(_mm_loadu_ps(dest + i + 4), accumulate(_mm_mul_ps(_mm_loadu_ps(src + i + 4), g), 1)));
+				}
+			}
+		   #elif SIMPLOOPER_SIMD_NEON
+			{
+				const float32x4_t g = vdupq_n_f32(gain);
+				for (; i + 8 <= numSamples; i += 8)
+				{
+					vst1q_f32(dest + i,     vaddq_f32(vld1q_f32(dest + i),     accumulate(vmulq_f32(vld1q_f32(src + i), g), 0)));
+					vst1q_f32(dest + i + 4, vaddq_f32(vld1q_f32(dest + i + 4), accumulate(vmulq_f32(vld1q_f32(src + i + 4), g), 1)));
+				}
+			}
+		   #endif
+			for (; i < numSamples; ++i)
+				dest[i] += accumulateScalar(src[i] * gain);
+		}
+
+		if constexpr (measure)
+		{
+		   #if SIMPLOOPER_SIMD_SSE
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, _mm_add_ps(sumSquares[0], sumSquares[1]));
+			scalarSumSquares += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+			_mm_store_ps(lanes, _mm_max_ps(peak[0], peak[1]));
+			scalarPeak = std::fmax(scalarPeak, std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3])));
+		   #elif SIMPLOOPER_SIMD_NEON
+			float sumLanes[4], peakLanes[4];
+			vst1q_f32(sumLanes, vaddq_f32(sumSquares[0], sumSquares[1]));
+			vst1q_f32(peakLanes, vmaxq_f32(peak[0], peak[1]));
+			scalarSumSquares += (sumLanes[0] + sumLanes[1]) + (sumLanes[2] + sumLanes[3]);
+			scalarPeak = std::fmax(scalarPeak, std::fmax(std::fmax(peakLanes[0], peakLanes[1]), std::fmax(peakLanes[2], peakLanes[3])));
+		   #endif
+			levels->sumSquares += scalarSumSquares;
+			levels->peak = std::fmax(levels->peak, scalarPeak);
+		}
+	}
+
+	inline void addWithGainRamp(float* dest, const float* src, int numSamples, const GainRamp& ramp) noexcept
+	{
+		addWithGainRampImpl<false>(dest, src, numSamples, ramp, nullptr);
+	}
+
+	//addWithGainRamp と同じ結果を足しつつ、足した信号のレベルを levels に足し込む
+	inline void addWithGainRampMeasured(float* dest, const float* src, int numSamples, const GainRamp& ramp, ChannelStats& levels) noexcept
+	{
+		addWithGainRampImpl<true>(dest, src, numSamples, ramp, &levels);
+	}
+
+	//==============================================
+	// 絶対値の最大と、隣り合うサンプルの差（勾配）の絶対値の最大を1パスで（ゲートの検出用）
+	// previous は data[0] の1つ前のサンプル
+	//==============================================
+	inline void findPeakAndSlope(const float* data, int numSamples, float previous, float& peak, float& slope) noexcept
+	{
+		peak = slope = 0.0f;
+		if (numSamples <= 0) return;
+
+		//先頭だけは前のブロックの最後と比べる
+		peak = std::fabs(data[0]);
+		slope = std::fabs(data[0] - previous);
+		int i = 1;
+
+	   #if SIMPLOOPER_SIMD_SSE
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		__m128 peaks = _mm_setzero_ps(), slopes = _mm_setzero_ps();
+
+		for (; i + 4 <= numSamples; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(data + i);
+			const __m128 before = _mm_loadu_ps(data + i - 1);
+			peaks = _mm_max_ps(peaks, _mm_and_ps(x, absMask));
+			slopes = _mm_max_ps(slopes, _mm_and_ps(_mm_sub_ps(x, before), absMask));
+		}
+
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, peaks);
+		peak = std::fmax(peak, std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3])));
+		_mm_store_ps(lanes, slopes);
+		slope = std::fmax(slope, std::fmax(std::fmax(lanes[0], lanes[1]), std::fmax(lanes[2], lanes[3])));
+
+	   #elif SIMPLOOPER_SIMD_NEON
+		float32x4_t peaks = vdupq_n_f32(0.0f), slopes = vdupq_n_f32(0.0f);
+
+		for (; i + 4 <= numSamples; i += 4)
+		{
+			const float32x4_t x = vld1q_f32(data + i);
+			peaks = vmaxq_f32(peaks, vabsq_f32(x));
+			slopes = vmaxq_f32(slopes, vabdq_f32(x, vld1q_f32(data + i - 1)));
+		}
+
+		float peakLanes[4], slopeLanes[4];
+		vst1q_f32(peakLanes, peaks);
+		vst1q_f32(slopeLanes, slopes);
+		peak = std::fmax(peak, std::fmax(std::fmax(peakLanes[0], peakLanes[1]), std::fmax(peakLanes[2], peakLanes[3])));
+		slope = std::fmax(slope, std::fmax(std::fmax(slopeLanes[0], slopeLanes[1]), std::fmax(slopeLanes[2], slopeLanes[3])));
+	   #endif
+
+		for (; i < numSamples; ++i)
+		{
+			peak = std::fmax(peak, std::fabs(data[i]));
+			slope = std::fmax(slope, std::fabs(data[i] - data[i - 1]));
+		}
+	}
+
+	//==============================================
+	// dest = src * (startGain + step * i)。dest と src は同じでもよい
+	//==============================================
+	inline void copyWithGainRamp(float* dest, const float* src, int numSamples, float startGain, float step) noexcept
+	{
+		int i = 0;
+
+	   #if SIMPLOOPER_SIMD_SSE
+		const __m128 gain = _mm_set1_ps(startGain);
+		const __m128 steps = _mm_set1_ps(step);
+		const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+		for (; i + 4 <= numSamples; i += 4)
+		{
+			const __m128 g = _mm_add_ps(gain, _mm_mul_ps(steps, _mm_add_ps(_mm_set1_ps((float)i), lanes)));
+			_mm_storeu_ps(dest + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		}
+	   #elif SIMPLOOPER_SIMD_NEON
+		const float32x4_t gain = vdupq_n_f32(startGain);
+		const float32x4_t steps = vdupq_n_f32(step);
+		const float laneValues[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+		const float32x4_t lanes = vld1q_f32(laneValues);
+
+		for (; i + 4 <= numSamples; i += 4)
+		{
+			const float32x4_t g = vaddq_f32(gain, vmulq_f32(steps, vaddq_f32(vdupq_n_f32((float)(ramp.elapsed + i)), lanes)));
+			vst1q_f32(dest + i, vmulq_f32(vld1q_f32(src + i), g));
+		}
+	   #endif
+
+		for (; i < numSamples; ++i)
+			dest[i] = src[i] * (startGain + step * (float)i);
+	}
+
+	//==============================================
+	// 内積（相互相関の1点分。レイテンシ測定用）
+	//==============================================
+	inline float dotProduct(const float* a, const float* b, int numSamples) noexcept
+	{
+		float sum = 0.0f;
+		int i = 0;
+
+	   #if SIMPLOOPER_SIMD_SSE
+		__m128 sums = _mm_setzero_ps();
+		for (; i + 4 <= numSamples; i += 4)
+			sums = _mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, sums);
+		sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	   #elif SIMPLOOPER_SIMD_NEON
+		float32x4_t sums = vdupq_n_f32(0.0f);
+		for (; i + 4 <= numSamples; i += 4)
+			sums = vmlaq_f32(sums, vld1q_f32(a + i), vld1q_f32(b + i));
+
+		float lanes[4];
+		vst1q_f32(lanes, sums);
+		sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	   #endif
+
+		for (; i < numSamples; ++i)
+			sum += a[i] * b[i];
+
+		return sum;
+	}
+}
@@ -10,11 +10,22 @@
 
 #pragma once
 #include <JuceHeader.h>
+#include "SimdKernels.h"
+#include <atomic>
+#include <vector>
 
 //------------------------------------------------------------
 // 音の振幅＆勾配を元にゲート制御を行うクラス
 // 無音区間やブレスを自動でミュートし、
 // 発声のみをスムーズに通すためのフィルタ。
+//
+// 全チャンネルを別々に判定する。判定は controlBlockSize サンプルごと
+//   ・ピークと勾配（隣り合うサンプルの差）の最大を SIMD で求める
+//   ・ピークはエンベロープ（すぐ上がってゆっくり落ちる）にしてから、
+//     開くしきい値と、それより hysteresisDb 低い閉じるしきい値で判定（ホールドあり）
+//   ・ゲインは判定ごとに直線で動かし、掛け算は SIMD で
+// setLookahead で先読みを指定すると音をその分遅らせ、判定は遅らせる前の音で行う（立ち上がりを削らない）
+// パラメータはどのスレッドから書いてもよく、オーディオスレッドはブロックの頭で読むだけ
 //------------------------------------------------------------
 
 class SmartGate
@@ -23,62 +34,242 @@ public:
 
 	SmartGate() = default;
 
+	static constexpr int maxChannels = 64;
+	static constexpr int controlBlockSize = 32;
+	static constexpr float maxLookaheadMs = 10.0f;
+
 	//==============================================
-	// メイン処理
+	// 準備（オーディオ停止中に呼ぶ。ここでだけメモリを確保する）
 	//==============================================
 
-	void processBlock(juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+	void prepare(double newSampleRate, int numChannels)
+	{
+		sampleRate = newSampleRate;
+		numPreparedChannels = juce::jlimit(1, maxChannels, numChannels);
+
+		channels.assign((size_t)numPreparedChannels, {});
+
+		//遅延は2のべき乗のリングで持つ（最大の先読み＋判定1回分）
+		const int maxLookaheadSamples = (int)std::ceil(maxLookaheadMs * sampleRate / 1000.0);
+		delaySize = juce::nextPowerOfTwo(maxLookaheadSamples + controlBlockSize);
+		delayBuffer.assign((size_t)(delaySize * numPreparedChannels), 0.0f);
+
+		appliedVersion = -1;
+		lookaheadSamples = 0;
+		latencySamples.store(0, std::memory_order_relaxed);
+		reset();
+	}
+
+	void reset() noexcept
 	{
-		const int numSamples = input.getNumSamples();
-		const float* readPtr = input.getReadPointer(0);
-		float* writePtr = input.getWritePointer(0);
+		for (auto& state : channels)
+			state = {};
+
+		std::fill(delayBuffer.begin(), delayBuffer.end(), 0.0f);
+		delayWritePos = 0;
+	}
+
+	//==============================================
+	// メイン処理（output は input と同じバッファでもよい）
+	//==============================================
+
+	void processBlock(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output)
+	{
+		const int numSamples = juce::jmin(input.getNumSamples(), output.getNumSamples());
+		const int numChannels = juce::jmin(input.getNumChannels(), output.getNumChannels(), numPreparedChannels);
+
+		updateParameters();
 
-		for(int i = 0 ; i < numSamples; ++i)
+		for (int start = 0; start < numSamples; start += controlBlockSize)
 		{
-			float amp = std::abs(readPtr[i]);
-			float slope = std::abs(readPtr[i] - prevSample);//勾配（変化量）
+			const int length = juce::jmin(controlBlockSize, numSamples - start);
 
-			//トリガー判定 : 音量か勾配のいずれかが閾値を超えたら通す
-			bool triggerd = (amp > ampThreshold) || (slope > slopeThreshold);
+			//同じ長さの区切りは係数を使い回す（端数の時だけ計算し直す）
+			const float envelopeDecay = length == controlBlockSize ? envelopeDecayPerBlock
+																   : std::pow(envelopeDecayPerBlock, (float)length / (float)controlBlockSize);
 
-			gateLevel += (triggerd ? openSpeed : -closeSpeed);
-			gateLevel  = juce::jlimit(0.0f, 1.0f, gateLevel);
+			for (int ch = 0; ch < numChannels; ++ch)
+				processChunk(ch, input.getReadPointer(ch, start), output.getWritePointer(ch, start), length, envelopeDecay);
 
-			writePtr[i] = readPtr[i] * gateLevel;
-			prevSample = readPtr[i];
+			delayWritePos = (delayWritePos + length) & (delaySize - 1);
 		}
 	}
 
 
 //==============================================
-// 各種設定
+// 各種設定（どのスレッドからでも）
 //==============================================
 
+	//開くしきい値（振幅・勾配）。どちらかを超えたら開く
 	void setThresholds(float amp, float slope)
 	{
-		ampThreshold = amp;
-		slopeThreshold = slope;
+		ampThreshold.store(amp, std::memory_order_relaxed);
+		slopeThreshold.store(slope, std::memory_order_relaxed);
+		parameterVersion.fetch_add(1, std::memory_order_release);
 	}
 
-	void setSpeeds(float open, float close)
+	//閉じるしきい値を開くしきい値よりどれだけ下げるか
+	void setHysteresis(float decibels)
 	{
-		openSpeed = open;
-		closeSpeed = close;
+		hysteresisDb.store(juce::jmax(0.0f, decibels), std::memory_order_relaxed);
+		parameterVersion.fetch_add(1, std::memory_order_release);
 	}
 
-	float getGateLevel() const noexcept {return gateLevel;}
+	//開く時間・閉じ始めるまでの保持・閉じる時間（ミリ秒）
+	void setTimes(float attackMs, float holdMs, float releaseMs)
+	{
+		attackTimeMs.store(juce::jmax(0.01f, attackMs), std::memory_order_relaxed);
+		holdTimeMs.store(juce::jmax(0.0f, holdMs), std::memory_order_relaxed);
+		releaseTimeMs.store(juce::jmax(0.01f, releaseMs), std::memory_order_relaxed);
+		parameterVersion.fetch_add(1, std::memory_order_release);
+	}
+
+	//先読み（0 で遅延なし）。変えた時は遅延中の音を捨てる
+	void setLookahead(float milliseconds)
+	{
+		lookaheadTimeMs.store(juce::jlimit(0.0f, maxLookaheadMs, milliseconds), std::memory_order_relaxed);
+		parameterVersion.fetch_add(1, std::memory_order_release);
+	}
+
+	//先読みで遅らせているサンプル数（オーディオスレッドが反映した値）
+	int getLatencySamples() const noexcept { return latencySamples.load(std::memory_order_relaxed); }
 
 
 private:
 
+	struct ChannelState
+	{
+		float envelope = 0.0f;	//ピークのエンベロープ
+		float gain = 0.0f;		//いまのゲイン（0..1）
+		float previous = 0.0f;	//勾配用の1つ前のサンプル
+		int holdRemaining = 0;	//閉じ始めるまでの残りサンプル
+		bool open = false;
+	};
+
+	void processChunk(int ch, const float* in, float* out, int length, float envelopeDecay) noexcept
+	{
+		auto& state = channels[(size_t)ch];
+
+		//判定は遅らせる前の音で
+		float peak, slope;
+		simd::findPeakAndSlope(in, length, state.previous, peak, slope);
+		state.previous = in[length - 1];
 
-	float prevSample = 0.0f;
-	float gateLevel = 0.0f;
+		state.envelope = std::fmax(peak, state.envelope * envelopeDecay);
+		if (state.envelope < 1.0e-9f) state.envelope = 0.0f; //デノーマルにしない
 
-	//パラメータ
-	float ampThreshold = 0.01f;
-	float slopeThreshold = 0.1;
-	float openSpeed = 0.05f;
-	float closeSpeed = 0.05f;
-};
+		if (state.envelope > openThreshold || slope > openSlope)
+		{
+			state.open = true;
+			state.holdRemaining = holdSamples;
+		}
+		else if (state.holdRemaining > 0)
+		{
+			state.holdRemaining -= length;
+		}
+		else if (state.envelope < closeThreshold && slope < closeSlope)
+		{
+			state.open = false;
+		}
+
+		const float target = state.open ? 1.0f : 0.0f;
+		const float maxChange = (state.open ? attackStep : releaseStep) * (float)length;
+		const float nextGain = state.open ? juce::jmin(target, state.gain + maxChange)
+										  : juce::jmax(target, state.gain - maxChange);
+
+		const float* source = in;
+		if (lookaheadSamples > 0)
+			source = delay(ch, in, length);
+
+		//閉じ切っている間は掛け算もしない
+		if (state.gain == 0.0f && nextGain == 0.0f)
+			juce::FloatVectorOperations::clear(out, length);
+		else
+			simd::copyWithGainRamp(out, source, length, state.gain, (nextGain - state.gain) / (float)length);
+
+		state.gain = nextGain;
+	}
 
+	//in をリングに書き、lookaheadSamples 前の音を返す（折り返す時は作業用に並べ直す）
+	const float* delay(int ch, const float* in, int length) noexcept
+	{
+		float* ring = delayBuffer.data() + (size_t)ch * (size_t)delaySize;
+		const int mask = delaySize - 1;
+
+		const int firstWrite = juce::jmin(length, delaySize - delayWritePos);
+		std::copy(in, in + firstWrite, ring + delayWritePos);
+		std::copy(in + firstWrite, in + length, ring);
+
+		const int readPos = (delayWritePos - lookaheadSamples) & mask;
+		if (readPos + length <= delaySize)
+			return ring + readPos;
+
+		const int firstRead = delaySize - readPos;
+		std::copy(ring + readPos, ring + delaySize, delayScratch);
+		std::copy(ring, ring + (length - firstRead), delayScratch + firstRead);
+		return delayScratch;
+	}
+
+	//設定が変わっていたら係数を作り直す（オーディオスレッド）
+	void updateParameters() noexcept
+	{
+		const int version = parameterVersion.load(std::memory_order_acquire);
+		if (version == appliedVersion) return;
+		appliedVersion = version;
+
+		const float samplesPerMs = (float)(sampleRate / 1000.0);
+		const float closeRatio = juce::Decibels::decibelsToGain(-hysteresisDb.load(std::memory_order_relaxed));
+
+		openThreshold = ampThreshold.load(std::memory_order_relaxed);
+		openSlope = slopeThreshold.load(std::memory_order_relaxed);
+		closeThreshold = openThreshold * closeRatio;
+		closeSlope = openSlope * closeRatio;
+
+		attackStep = 1.0f / (attackTimeMs.load(std::memory_order_relaxed) * samplesPerMs);
+		releaseStep = 1.0f / (releaseTimeMs.load(std::memory_order_relaxed) * samplesPerMs);
+		holdSamples = (int)(holdTimeMs.load(std::memory_order_relaxed) * samplesPerMs);
+		envelopeDecayPerBlock = std::exp(-(float)controlBlockSize / (envelopeReleaseMs * samplesPerMs));
+
+		const int newLookahead = juce::jmin(delaySize - controlBlockSize,
+											(int)std::round(lookaheadTimeMs.load(std::memory_order_relaxed) * samplesPerMs));
+		if (newLookahead != lookaheadSamples)
+		{
+			lookaheadSamples = newLookahead;
+			std::fill(delayBuffer.begin(), delayBuffer.end(), 0.0f);
+			latencySamples.store(lookaheadSamples, std::memory_order_relaxed);
+		}
+	}
+
+	//エンベロープの落ち方（判定用なので固定）
+	static constexpr float envelopeReleaseMs = 10.0f;
+
+	double sampleRate = 44100.0;
+	int numPreparedChannels = 0;
+
+	//オーディオスレッドだけが触る
+	std::vector<ChannelState> channels;
+	std::vector<float> delayBuffer;	//[チャンネル][delaySize]
+	float delayScratch[controlBlockSize] {};
+	int delaySize = 0;
+	int delayWritePos = 0;
+
+	int appliedVersion = -1;
+	float openThreshold = 0.0f, closeThreshold = 0.0f;
+	float openSlope = 0.0f, closeSlope = 0.0f;
+	float attackStep = 1.0f, releaseStep = 1.0f;
+	float envelopeDecayPerBlock = 0.0f;
+	int holdSamples = 0;
+	int lookaheadSamples = 0;
+
+	//パラメータ（UIが書き、parameterVersion を進めて知らせる）
+	std::atomic<float> ampThreshold { 0.01f };
+	std::atomic<float> slopeThreshold { 0.1f };
+	std::atomic<float> hysteresisDb { 6.0f };
+	std::atomic<float> attackTimeMs { 1.0f };
+	std::atomic<float> holdTimeMs { 50.0f };
+	std::atomic<float> releaseTimeMs { 80.0f };
+	std::atomic<float> lookaheadTimeMs { 0.0f };
+	std::atomic<int> parameterVersion { 0 };
+
+	std::atomic<int> latencySamples { 0 };
+};
@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    TempoGrid.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <cmath>
+
+//------------------------------------------------------------
+// テンポと拍子から作る拍・小節の格子
+// 位置はどれも「格子の原点から何サンプル目か」。k 拍目は round(k × 1拍のサンプル数) に置くので、
+// 1拍が端数のサンプル数でも何小節進んでもずれがたまらない
+// 係数は set で1度だけ計算し、区切りを探すのは割り算1回（呼ぶ回数によらず O(1)）
+//------------------------------------------------------------
+class TempoGrid
+{
+public:
+	enum class Division { beat, bar };
+
+	static constexpr double minBpm = 20.0;
+	static constexpr double maxBpm = 400.0;
+	static constexpr int maxBeatsPerBar = 32;
+
+	//bpm は4分音符で数える。beatUnit は拍子の分母（8 なら1拍は8分音符）。bpm が 0 以下なら格子なし
+	void set(double sampleRate, double bpm, int beatsPerBar, int beatUnit) noexcept
+	{
+		if (sampleRate <= 0.0 || bpm <= 0.0 || beatsPerBar <= 0 || beatUnit <= 0)
+		{
+			samplesPerBeat = 0.0;
+			return;
+		}
+
+		beats = juce::jmin(beatsPerBar, maxBeatsPerBar);
+		samplesPerBeat = sampleRate * 60.0 / juce::jlimit(minBpm, maxBpm, bpm) * 4.0 / (double)beatUnit;
+	}
+
+	bool isActive() const noexcept { return samplesPerBeat > 0.0; }
+
+	double getSamplesPerBeat() const noexcept { return samplesPerBeat; }
+	double getSamplesPerBar() const noexcept { return samplesPerBeat * beats; }
+	int getBeatsPerBar() const noexcept { return beats; }
+
+	//index 番目の区切りの位置
+	juce::int64 getBoundary(juce::int64 index, Division division) const noexcept
+	{
+		return (juce::int64)std::llround((double)(index * beatsPer(division)) * samplesPerBeat);
+	}
+
+	//position（0 以上）と同じか後にある最初の区切り
+	juce::int64 getNextBoundary(juce::int64 position, Division division) const noexcept
+	{
+		if (! isActive()) return position;
+
+		const double step = samplesPerBeat * beatsPer(division);
+		auto index = (juce::int64)std::ceil((double)juce::jmax<juce::int64>(0, position) / step);
+
+		//丸めで1つずれることがあるので隣を確かめる
+		if (index > 0 && getBoundary(index - 1, division) >= position)
+			--index;
+		else if (getBoundary(index, division) < position)
+			++index;
+
+		return getBoundary(index, division);
+	}
+
+	//length に一番近い小節数（1小節以上）の長さ。maxLength に収まらなければ収まるだけの小節数へ減らす
+	//startPosition がちょうど小節の頭なら、そこから数えた小節の区切りまでの長さにする
+	//（区切りで始めて区切りで止めた録音は、丸めの1サンプルも削ったり足したりしない）
+	int snapLengthToBars(int length, int maxLength, juce::int64 startPosition = 0) const noexcept
+	{
+		if (! isActive() || length <= 0) return length;
+
+		const double samplesPerBar = getSamplesPerBar();
+		auto bars = juce::jmax<juce::int64>(1, std::llround((double)length / samplesPerBar));
+
+		const auto maxBars = (juce::int64)std::floor((double)maxLength / samplesPerBar);
+		if (bars > maxBars)
+			bars = maxBars;
+
+		//1小節も入らない時はそのまま
+		if (bars < 1) return juce::jmin(length, maxLength);
+
+		const auto startBar = startPosition > 0 ? std::llround((double)startPosition / samplesPerBar) : 0;
+		const auto first = getBoundary(startBar, Division::bar) == startPosition ? startBar : 0;
+
+		return (int)juce::jmin<juce::int64>(getBoundary(first + bars, Division::bar) - getBoundary(first, Division::bar), maxLength);
+	}
+
+private:
+	int beatsPer(Division division) const noexcept { return division == Division::bar ? beats : 1; }
+
+	double samplesPerBeat = 0.0;	//0 なら格子なし
+	int beats = 4;
+};
@@ -0,0 +1,278 @@
+/*
+  ==============================================================================
+
+    TimeStretch.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "SimdKernels.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace stretch
+{
+	//これを超えて伸ばす・縮めると音が崩れるので受け付けない
+	static constexpr double minRatio = 0.5;
+	static constexpr double maxRatio = 2.0;
+
+	//------------------------------------------------------------
+	// ループ1本の長さを変える（音程はそのまま）。WSOLA
+	//   ・出力をフレームの半分ずつ進め、入力の「だいたいの位置」の前後 searchMs から、
+	//     直前のフレームの自然な続きと一番よく似た位置を選んで窓をかけて重ねる
+	//   ・似ているかは全チャンネルの内積を足した正規化相互相関で測る（位置は全チャンネル共通なので定位は崩さない）
+	//   ・探すのは coarseStep おきに粗く探してから、最良の前後を1サンプルずつ
+	// ループの頭と尻はつながっているものとして扱い、出力のつなぎ目もなめらかにする
+	// 裏のスレッド用（ここでメモリを確保する）
+	//------------------------------------------------------------
+	class LoopStretcher
+	{
+	public:
+		static constexpr double frameMs = 40.0;
+		static constexpr double searchMs = 12.0;
+		static constexpr int coarseStep = 4;
+
+		explicit LoopStretcher(double sampleRate)
+		{
+			frameLength = juce::jmax(64, juce::roundToInt(sampleRate * frameMs / 1000.0)) & ~1;
+			searchRange = juce::jmax(coarseStep, juce::roundToInt(sampleRate * searchMs / 1000.0));
+
+			window.resize((size_t)frameLength);
+			for (int i = 0; i < frameLength; ++i)
+				window[(size_t)i] = 0.5f - 0.5f * std::cos(juce::MathConstants<float>::twoPi * (float)i / (float)frameLength);
+		}
+
+		//outLength の出力を作るフレーム数（進み具合の分母）
+		int getNumFrames(int outLength) const noexcept
+		{
+			return juce::jmax(1, (int)std::lround((double)outLength / (double)(frameLength / 2)));
+		}
+
+		//input の [0, inLength) を output の [0, outLength) へ伸ばす。1フレームごとに framesDone を進める
+		//shouldExit() が true を返したら途中でやめて false
+		template <typename ShouldExit>
+		bool process(const juce::AudioBuffer<float>& input, int inLength,
+					 juce::AudioBuffer<float>& output, int outLength,
+					 std::atomic<int>& framesDone, ShouldExit&& shouldExit)
+		{
+			const int numChannels = juce::jmin(input.getNumChannels(), output.getNumChannels());
+			const int numFrames = getNumFrames(outLength);
+			output.clear();
+
+			//フレームが収まらないほど短いループは直線補間で済ませる
+			if (inLength < 2 * frameLength || outLength < 2 * frameLength)
+			{
+				resampleLinear(input, inLength, output, outLength, numChannels);
+				framesDone.fetch_add(numFrames, std::memory_order_relaxed);
+				return true;
+			}
+
+			prepareInput(input, inLength, numChannels);
+			weights.assign((size_t)outLength, 0.0f);
+
+			const int half = frameLength / 2;
+			const double outHop = (double)outLength / numFrames;
+			const double scale = (double)inLength / (double)outLength;
+
+			juce::int64 previousCentre = 0, previousOutCentre = 0;
+
+			for (int k = 0; k < numFrames; ++k)
+			{
+				if ((k & 15) == 0 && shouldExit())
+					return false;
+
+				const auto outCentre = (juce::int64)std::llround(k * outHop);
+				const auto nominal = (juce::int64)std::llround((double)outCentre * scale);
+
+				//最初のフレームはループの頭そのもの（つなぎ目の位置を動かさない）
+				juce::int64 centre = nominal;
+				if (k > 0)
+				{
+					const auto natural = wrap(previousCentre + (outCentre - previousOutCentre), inLength);
+					centre = findBestCentre(natural, nominal);
+				}
+
+				overlapAdd(centre - half, outCentre - half, outLength, numChannels, output);
+
+				previousCentre = centre;
+				previousOutCentre = outCentre;
+				framesDone.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			//重ねた窓の和で割る（フレームの間隔が端数でも音量がそろう）
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				float* out = output.getWritePointer(ch);
+				for (int i = 0; i < outLength; ++i)
+					if (weights[(size_t)i] > 1.0e-6f)
+						out[i] /= weights[(size_t)i];
+			}
+
+			return true;
+		}
+
+	private:
+		static juce::int64 wrap(juce::int64 position, int length) noexcept
+		{
+			const auto r = position % length;
+			return r < 0 ? r + length : r;
+		}
+
+		//前後に pad ずつ折り返して延ばした入力と、全チャンネルの二乗の累積和を作る
+		void prepareInput(const juce::AudioBuffer<float>& input, int inLength, int numChannels)
+		{
+			pad = frameLength / 2 + searchRange + coarseStep + 1;
+			const int size = inLength + 2 * pad;
+
+			extended.setSize(numChannels, size);
+			energy.assign((size_t)size + 1, 0.0);
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				const float* in = input.getReadPointer(ch);
+				float* ext = extended.getWritePointer(ch);
+				for (int j = 0; j < size; ++j)
+					ext[j] = in[wrap(j - pad, inLength)];
+			}
+
+			for (int j = 0; j < size; ++j)
+			{
+				double sum = 0.0;
+				for (int ch = 0; ch < numChannels; ++ch)
+				{
+					const float x = extended.getReadPointer(ch)[j];
+					sum += (double)x * x;
+				}
+				energy[(size_t)j + 1] = energy[(size_t)j] + sum;
+			}
+		}
+
+		//中心 centre のフレームの前半が、natural を中心とするフレームの前半（直前のフレームと重なる所）とどれだけ似ているか
+		float similarity(juce::int64 natural, juce::int64 centre) const noexcept
+		{
+			const int half = frameLength / 2;
+			const auto target = (int)(natural - half + pad);
+			const auto start = (int)(centre - half + pad);
+
+			const double e = energy[(size_t)(start + half)] - energy[(size_t)start];
+			if (e <= 1.0e-12) return 0.0f;
+
+			double dot = 0.0;
+			for (int ch = 0; ch < extended.getNumChannels(); ++ch)
+				dot += simd::dotProduct(extended.getReadPointer(ch, target), extended.getReadPointer(ch, start), half);
+
+			return (float)(dot / std::sqrt(e));
+		}
+
+		juce::int64 findBestCentre(juce::int64 natural, juce::int64 nominal) const noexcept
+		{
+			juce::int64 best = nominal;
+			float bestValue = -std::numeric_limits<float>::max();
+
+			for (auto c = nominal - searchRange; c <= nominal + searchRange; c += coarseStep)
+			{
+				const float value = similarity(natural, c);
+				if (value > bestValue) { bestValue = value; best = c; }
+			}
+
+			const auto coarseBest = best;
+			for (auto c = coarseBest - coarseStep + 1; c < coarseBest + coarseStep; ++c)
+			{
+				if (c == coarseBest) continue;
+				const float value = similarity(natural, c);
+				if (value > bestValue) { bestValue = value; best = c; }
+			}
+
+			return best;
+		}
+
+		//入力の inStart から1フレームを窓をかけて出力の outStart（ループで折り返す）へ足す
+		void overlapAdd(juce::int64 inStart, juce::int64 outStart, int outLength, int numChannels, juce::AudioBuffer<float>& output)
+		{
+			const int start = (int)wrap(outStart, outLength);
+			const int first = juce::jmin(frameLength, outLength - start);
+			const auto source = (size_t)(inStart + pad);
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				const float* in = extended.getReadPointer(ch) + source;
+				float* out = output.getWritePointer(ch);
+
+				juce::FloatVectorOperations::addWithMultiply(out + start, in, window.data(), first);
+				if (first < frameLength)
+					juce::FloatVectorOperations::addWithMultiply(out, in + first, window.data() + first, frameLength - first);
+			}
+
+			juce::FloatVectorOperations::add(weights.data() + start, window.data(), first);
+			if (first < frameLength)
+				juce::FloatVectorOperations::add(weights.data(), window.data() + first, frameLength - first);
+		}
+
+		static void resampleLinear(const juce::AudioBuffer<float>& input, int inLength,
+								   juce::AudioBuffer<float>& output, int outLength, int numChannels) noexcept
+		{
+			const double scale = (double)inLength / (double)outLength;
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				const float* in = input.getReadPointer(ch);
+				float* out = output.getWritePointer(ch);
+
+				for (int i = 0; i < outLength; ++i)
+				{
+					const double position = i * scale;
+					const int index = (int)position;
+					const float frac = (float)(position - index);
+					out[i] = in[index % inLength] + frac * (in[(index + 1) % inLength] - in[index % inLength]);
+				}
+			}
+		}
+
+		int frameLength = 0;
+		int searchRange = 0;
+		int pad = 0;
+		std::vector<float> window;		//Hann（周期型。半分ずつ重ねると和がほぼ1）
+		juce::AudioBuffer<float> extended;
+		std::vector<double> energy;		//extended の全チャンネルの二乗の累積和（候補ごとの正規化を O(1) で）
+		std::vector<float> weights;		//出力の各サンプルに重なった窓の和
+	};
+
+	//------------------------------------------------------------
+	// fn(context, 0..numItems-1) を numThreads 本（呼んだスレッドを含む）の低優先度スレッドで分け合う
+	// 全部終わってから戻る。裏のスレッドから呼ぶ（スレッドはその都度作って終わらせる）
+	//------------------------------------------------------------
+	using JobFunction = void (*) (void* context, int itemIndex);
+
+	inline void runInParallel(int numThreads, JobFunction fn, void* context, int numItems)
+	{
+		std::atomic<int> next { 0 };
+		const std::function<void()> work = [&]
+		{
+			for (int item = next.fetch_add(1); item < numItems; item = next.fetch_add(1))
+				fn(context, item);
+		};
+
+		struct Helper : public juce::Thread
+		{
+			explicit Helper(const std::function<void()>& w) : juce::Thread("Simplooper stretch worker"), work(w) {}
+			void run() override { work(); }
+			const std::function<void()>& work;
+		};
+
+		std::vector<std::unique_ptr<Helper>> helpers;
+		for (int i = 1; i < juce::jmin(numThreads, numItems); ++i)
+		{
+			helpers.push_back(std::make_unique<Helper>(work));
+			helpers.back()->startThread(juce::Thread::Priority::low);
+		}
+
+		work();
+
+		for (auto& helper : helpers)
+			helper->waitForThreadToExit(-1);
+	}
+}
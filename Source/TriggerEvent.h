@@ -36,7 +36,6 @@ namespace juce {
 			sampleInBlock = sample;
 			absIndex = abs;
 			triggerd.store(true);
-			DBG("Trigger is Fire🔥");
 		}
 
 		//状態確認
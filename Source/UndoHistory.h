@@ -0,0 +1,221 @@
+/*
+  ==============================================================================
+
+    UndoHistory.h
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "PagedAudioStorage.h"
+#include <array>
+
+//UNDO/REDO の1段分（変更前のトラックの中身と長さ）
+struct TrackHistory
+{
+	int trackId = -1;
+	int lengthInSample = 0;
+	int recordLength = 0;
+	int lengthMultiple = 1;	//マスターに対する長さの比（LooperAudio::LengthRatio）
+	int lengthDivision = 1;
+
+	//最初の録音を戻したときはマスター長も戻す
+	int masterTrackId = -1;
+	int masterLoopLength = 0;
+	long masterStartSample = 0;
+
+	PagedTrackBuffer pages; //ページ表を丸ごと預かる（サンプルはコピーしない）
+};
+
+
+//------------------------------------------------------------
+// 多段 UNDO/REDO（オーディオスレッド専用）
+// エントリはページ表ごと最初に確保しておき、積む/戻すはページ表の入れ替えだけ
+// 段数とページ数の予算を超えたら古い段から捨て、捨てたページは数ブロックに分けて返す
+//------------------------------------------------------------
+class UndoHistory
+{
+public:
+	static constexpr int maxLevels = 64;
+
+	UndoHistory() = default;
+
+	//メッセージスレッドで呼ぶ（オーディオ停止中）。budgetPages は履歴全体が持ってよいページ数
+	void prepare(PageArena& arena, int maxPagesPerEntry, int newBudgetPages, bool trackDiskCopies = false)
+	{
+		for (auto& e : entries)
+			e.pages.prepare(arena, maxPagesPerEntry, trackDiskCopies);
+
+		budgetPages = juce::jmax(0, newBudgetPages);
+
+		numUndo = numRedo = numReleasing = 0;
+		undoHead = 0;
+		numFree = 0;
+		for (int i = numEntries; --i >= 0;)
+			freeStack[(size_t)numFree++] = i;
+
+		publish();
+	}
+
+	//新しい変更の前に呼ぶ。やり直し分は捨て、空のエントリを UNDO の一番上に積んで返す
+	//（呼んだ側が中身を入れ替える）。空きがなければ nullptr
+	TrackHistory* push() noexcept
+	{
+		while (numRedo > 0)
+			discard(redoStack[(size_t)--numRedo]);
+
+		while (numUndo > 0 && (numUndo >= maxLevels || getNumPagesHeld() > budgetPages))
+			discard(popOldestUndo());
+
+		const int index = takeFree();
+		if (index < 0) return nullptr;
+
+		undoRing[(size_t)((undoHead + numUndo) % numEntries)] = index;
+		++numUndo;
+		publish();
+
+		auto& e = entries[(size_t)index];
+		e.trackId = -1;
+		return &e;
+	}
+
+	//UNDO の一番上を REDO 側へ移して返す（呼んだ側がトラックと中身を入れ替える）
+	TrackHistory* popUndo() noexcept
+	{
+		if (numUndo == 0) return nullptr;
+
+		--numUndo;
+		const int index = undoRing[(size_t)((undoHead + numUndo) % numEntries)];
+		redoStack[(size_t)numRedo++] = index;
+		publish();
+		return &entries[(size_t)index];
+	}
+
+	//REDO の一番上を UNDO 側へ戻して返す
+	TrackHistory* popRedo() noexcept
+	{
+		if (numRedo == 0) return nullptr;
+
+		const int index = redoStack[(size_t)--numRedo];
+		undoRing[(size_t)((undoHead + numUndo) % numEntries)] = index;
+		++numUndo;
+		publish();
+		return &entries[(size_t)index];
+	}
+
+	//録音のページが足りなくなった時に、一番古い段を手放す
+	void shedOldest() noexcept
+	{
+		if (numUndo > 0)
+			discard(popOldestUndo());
+		else if (numRedo > 0)
+			discard(redoStack[(size_t)--numRedo]);
+	}
+
+	//全部の段を捨てる（ループの長さが変わって前の中身へ戻せなくなった時）。ページは collectGarbage で返す
+	void discardAll() noexcept
+	{
+		while (numRedo > 0)
+			discard(redoStack[(size_t)--numRedo]);
+		while (numUndo > 0)
+			discard(popOldestUndo());
+	}
+
+	//捨てた段のページを最大 maxPages 枚だけアリーナへ返す（毎ブロック呼ぶ）
+	void collectGarbage(int maxPages) noexcept
+	{
+		//録音で予算を超えた分も古い段から手放す（最新の1段は残す）
+		while (numUndo > 1 && getNumPagesHeld() > budgetPages)
+			discard(popOldestUndo());
+
+		while (numReleasing > 0 && maxPages > 0)
+		{
+			auto& pages = entries[(size_t)releasingStack[(size_t)numReleasing - 1]].pages;
+			const int before = pages.getNumPagesHeld();
+			const bool done = pages.releasePages(maxPages);
+			maxPages -= before - pages.getNumPagesHeld();
+
+			if (! done) break;
+			freeStack[(size_t)numFree++] = releasingStack[(size_t)--numReleasing];
+		}
+	}
+
+	//UNDO/REDO 側が持っているページ数（捨てて返却待ちの分は含まない）
+	int getNumPagesHeld() const noexcept
+	{
+		int held = 0;
+		for (int i = 0; i < numUndo; ++i)
+			held += entries[(size_t)undoRing[(size_t)((undoHead + i) % numEntries)]].pages.getNumPagesHeld();
+		for (int i = 0; i < numRedo; ++i)
+			held += entries[(size_t)redoStack[(size_t)i]].pages.getNumPagesHeld();
+		return held;
+	}
+
+	//ディスクのテイク番号からページ表を探す（なければ nullptr）
+	PagedTrackBuffer* findPagesByTake(int takeId) noexcept
+	{
+		for (auto& e : entries)
+			if (e.pages.getTakeId() == takeId)
+				return &e.pages;
+
+		return nullptr;
+	}
+
+	//UIから段数を見る用
+	int getNumUndoLevels() const noexcept { return publishedUndo.load(std::memory_order_relaxed); }
+	int getNumRedoLevels() const noexcept { return publishedRedo.load(std::memory_order_relaxed); }
+
+private:
+	//捨てた段の返却が間に合わなくても積めるよう、段数の倍だけエントリを用意する
+	static constexpr int numEntries = maxLevels * 2;
+
+	int popOldestUndo() noexcept
+	{
+		const int index = undoRing[(size_t)undoHead];
+		undoHead = (undoHead + 1) % numEntries;
+		--numUndo;
+		publish();
+		return index;
+	}
+
+	void discard(int index) noexcept
+	{
+		entries[(size_t)index].trackId = -1;
+		releasingStack[(size_t)numReleasing++] = index;
+		publish();
+	}
+
+	int takeFree() noexcept
+	{
+		//空きがなければ返却待ちの段を1つだけその場で返し切る（まれ）
+		if (numFree == 0 && numReleasing > 0)
+		{
+			const int index = releasingStack[(size_t)--numReleasing];
+			entries[(size_t)index].pages.clear();
+			freeStack[(size_t)numFree++] = index;
+		}
+
+		return numFree > 0 ? freeStack[(size_t)--numFree] : -1;
+	}
+
+	void publish() noexcept
+	{
+		publishedUndo.store(numUndo, std::memory_order_relaxed);
+		publishedRedo.store(numRedo, std::memory_order_relaxed);
+	}
+
+	std::array<TrackHistory, numEntries> entries;
+
+	std::array<int, numEntries> undoRing {};		//古い順のリング（先頭 undoHead）
+	std::array<int, numEntries> redoStack {};
+	std::array<int, numEntries> freeStack {};
+	std::array<int, numEntries> releasingStack {};
+	int undoHead = 0, numUndo = 0, numRedo = 0, numFree = 0, numReleasing = 0;
+
+	int budgetPages = 0;
+
+	std::atomic<int> publishedUndo { 0 }, publishedRedo { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE(UndoHistory)
+};
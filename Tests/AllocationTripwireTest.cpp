@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    AllocationTripwireTest.cpp
+
+    トリップワイヤーが new/delete だけでなく malloc/free も数えることの確認
+    （juce::HeapBlock が malloc を直接呼ぶので、AudioBuffer の確保が見逃されないか）
+    ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "AllocationTripwire.h"
+#include <cstdio>
+
+namespace
+{
+	int failures = 0;
+
+	void expect(bool condition, const char* what)
+	{
+		std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+		if (! condition) ++failures;
+	}
+}
+
+int main()
+{
+	if (! AllocationTripwire::isEnabled())
+	{
+		std::printf("FAIL tripwire is not enabled in this build\n");
+		return 1;
+	}
+
+	AllocationTripwire::setMode(AllocationTripwire::Mode::count);
+
+	// 🎯 コールバック内で AudioBuffer を作ってしまう退行
+	AllocationTripwire::resetCounts();
+	{
+		AllocationTripwire::ScopedArm arm;
+		juce::AudioBuffer<float> input(2, 512);
+		input.clear();
+	}
+	expect(AllocationTripwire::getAllocationCount() > 0, "AudioBuffer allocation is counted");
+	expect(AllocationTripwire::getDeallocationCount() > 0, "AudioBuffer release is counted");
+
+	// 🧮 malloc 系を直接呼んだ場合
+	AllocationTripwire::resetCounts();
+	{
+		AllocationTripwire::ScopedArm arm;
+		void* volatile p = std::malloc(64);
+		p = std::realloc(p, 4096);
+		std::free(p);
+		p = std::calloc(16, sizeof(float));
+		std::free(p);
+	}
+	expect(AllocationTripwire::getAllocationCount() == 3, "malloc/realloc/calloc are counted");
+	expect(AllocationTripwire::getDeallocationCount() == 2, "free is counted");
+
+	// 🔕 監視していない区間と一時停止中は数えない
+	AllocationTripwire::resetCounts();
+	{
+		juce::AudioBuffer<float> unarmed(2, 512);
+
+		AllocationTripwire::ScopedArm arm;
+		AllocationTripwire::ScopedSuspend suspend;
+		juce::AudioBuffer<float> suspended(2, 512);
+	}
+	expect(AllocationTripwire::getAllocationCount() == 0, "unarmed and suspended allocations are ignored");
+
+	return failures == 0 ? 0 : 1;
+}
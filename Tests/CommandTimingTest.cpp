@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    CommandTimingTest.cpp
+
+    コマンドの実行位置と録音の打ち切り位置の確認
+    ・sampleTime T のコマンドがブロックの途中でもちょうど T から効くか
+    ・過ぎた時刻のコマンドが遅延として数えられるか
+    ・マスターに重ねる録音が1周ちょうどで再生へ切り替わるか（ブロックの大きさによらず）
+    ・クオンタイズ中のトリガー録音が、アタックではなく小節の頭ちょうどから録られるか
+    ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+
+namespace
+{
+	using Type = LooperAudio::Command::Type;
+	using test::LooperRig;
+
+	constexpr int masterLength = 5003; //ブロックの大きさで割り切れない
+
+	juce::String describe(const char* what, int blockSize)
+	{
+		return juce::String(what) + " (blocks of " + juce::String(blockSize) + ")";
+	}
+
+	//rendered の [from, to) が expected(位置, チャンネル) とビット単位で同じか
+	template <typename Expected>
+	bool matches(const LooperRig& rig, juce::int64 from, juce::int64 to, Expected expected)
+	{
+		for (int ch = 0; ch < LooperRig::numChannels; ++ch)
+			for (auto n = from; n < to; ++n)
+				if (rig.rendered[(size_t)ch][(size_t)n] != expected(n, ch))
+					return false;
+		return true;
+	}
+
+	//ブロックの途中 T で録り始め、T + masterLength で止めて再生する
+	//ループは入力の [T, T + masterLength) そのもので、T + masterLength から頭が鳴る
+	juce::int64 recordMaster(LooperRig& rig, int blockSize)
+	{
+		const juce::int64 start = 3 * blockSize + 37;
+		rig.looper.addTrack(0);
+		rig.looper.postCommand(Type::startRecording, 0, (long)start);
+		rig.looper.postCommand(Type::stopRecording, 0, (long)(start + masterLength));
+		rig.looper.postCommand(Type::startPlaying, 0, (long)(start + masterLength));
+		return start;
+	}
+
+	float masterSample(juce::int64 masterStart, juce::int64 n, int ch)
+	{
+		return LooperRig::inputSample(masterStart + (n - masterStart) % masterLength, ch);
+	}
+
+	void checkCommandOffsets(int blockSize)
+	{
+		LooperRig rig(blockSize);
+		const auto start = recordMaster(rig, blockSize);
+		const auto playStart = start + masterLength;
+		rig.processUntil(playStart + 3 * masterLength, blockSize);
+
+		test::expect(matches(rig, 0, playStart, [] (juce::int64, int) { return 0.0f; }),
+					 describe("nothing plays before the startPlaying sample", blockSize).toRawUTF8());
+		test::expect(matches(rig, playStart, rig.position, [start] (juce::int64 n, int ch) { return masterSample(start, n, ch); }),
+					 describe("the loop is the input from the startRecording sample to the stopRecording sample", blockSize).toRawUTF8());
+		test::expect(rig.looper.getLateCommandCount() == 0, describe("commands on time are not counted as late", blockSize).toRawUTF8());
+	}
+
+	void checkLateCommands(int blockSize)
+	{
+		LooperRig rig(blockSize);
+		rig.looper.addTrack(0);
+		rig.processUntil(10 * blockSize + 5, blockSize);
+
+		//もう過ぎた時刻（次のブロックの頭で実行して数える）と、まだ先の時刻
+		rig.looper.postCommand(Type::startPlaying, 0, (long)(rig.position - 3 * blockSize));
+		rig.looper.postCommand(Type::stopPlaying, 0, (long)(rig.position + 2 * blockSize));
+		rig.looper.postCommand(Type::startPlaying, 0, (long)(rig.position - 1));
+		rig.processUntil(rig.position + 4 * blockSize, blockSize);
+
+		test::expect(rig.looper.getLateCommandCount() == 2, describe("commands posted for a past sample are counted as late", blockSize).toRawUTF8());
+		test::expect(rig.looper.getCommandOverflowCount() == 0, describe("no command was dropped", blockSize).toRawUTF8());
+	}
+
+	//マスターの再生中、ブロックの途中から重ねて録る。1周録れたその1サンプルから重ねた音が鳴る
+	void checkPunchOut(int blockSize)
+	{
+		LooperRig rig(blockSize);
+		const auto start = recordMaster(rig, blockSize);
+		const auto playStart = start + masterLength;
+
+		const auto overdubStart = playStart + 2 * masterLength + blockSize / 2 + 11;
+		rig.looper.addTrack(1);
+		rig.looper.postCommand(Type::startRecording, 1, (long)overdubStart);
+
+		const auto punchOut = overdubStart + masterLength;
+		rig.processUntil(punchOut + 2 * masterLength, blockSize);
+
+		//重ねたトラックのループ位置 p には、マスターが p を鳴らしていた時の入力が入っている
+		auto layered = [start, playStart, overdubStart] (juce::int64 n, int ch)
+		{
+			const auto loopPosition = (n - playStart) % masterLength;
+			const auto overdubPosition = (overdubStart - playStart) % masterLength;
+			const auto recorded = overdubStart + (loopPosition - overdubPosition + masterLength) % masterLength;
+			return masterSample(start, n, ch) + LooperRig::inputSample(recorded, ch);
+		};
+
+		test::expect(matches(rig, playStart, punchOut, [start] (juce::int64 n, int ch) { return masterSample(start, n, ch); }),
+					 describe("only the master plays while the overdub records", blockSize).toRawUTF8());
+		test::expect(matches(rig, punchOut, rig.position, layered),
+					 describe("the overdub plays from the exact punch-out sample with every position recorded once", blockSize).toRawUTF8());
+	}
+
+	//クオンタイズ（小節）中にトリガーで録り始める。トリガーのブロックに小節の頭があってもなくても、
+	//録音はアタックからではなく小節の頭から始まり、ループはちょうど1小節分の入力になる
+	void checkQuantizedTrigger(juce::int64 triggerBlockStart, int triggerBlockLength, int blockSize)
+	{
+		constexpr int bar = 48000; //240 BPM・4/4・48 kHz
+
+		LooperRig rig(blockSize);
+		juce::TriggerEvent trigger;
+		rig.looper.setTriggerReference(trigger);
+		rig.looper.setTempo(240.0);
+		rig.looper.setQuantize(LooperAudio::Quantize::bar);
+		rig.looper.addTrack(0);
+		rig.processUntil(triggerBlockStart, blockSize);
+
+		//MainComponent と同じ手順：発火したブロックで録音を頼み、処理し終えてから消費する
+		trigger.fire(50, (long)(triggerBlockStart + 30));
+		rig.looper.postCommandFromAudioThread({ Type::startRecording, 0 });
+		rig.process(triggerBlockLength);
+		trigger.consume();
+
+		const juce::int64 loopStart = bar;
+		rig.looper.postCommand(Type::stopRecording, 0, (long)(loopStart + bar));
+		rig.looper.postCommand(Type::startPlaying, 0, (long)(loopStart + bar));
+		rig.processUntil(loopStart + 3 * bar, blockSize);
+
+		const auto what = juce::String("a quantized trigger records from the bar line, not the attack (trigger block at ")
+						+ juce::String(triggerBlockStart) + ", blocks of " + juce::String(blockSize) + ")";
+		test::expect(matches(rig, loopStart + bar, rig.position,
+							 [loopStart] (juce::int64 n, int ch) { return LooperRig::inputSample(loopStart + (n - loopStart) % bar, ch); }),
+					 what.toRawUTF8());
+	}
+}
+
+int main()
+{
+	for (const int blockSize : { 32, 64, 256, 512, 1000 })
+	{
+		checkCommandOffsets(blockSize);
+		checkLateCommands(blockSize);
+		checkPunchOut(blockSize);
+
+		//小節の頭がトリガーと同じブロックにある時と、後のブロックにある時
+		checkQuantizedTrigger(48000 - 100, 300, blockSize);
+		checkQuantizedTrigger(30000, blockSize, blockSize);
+	}
+
+	return test::result();
+}
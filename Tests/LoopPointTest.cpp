@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    LoopPointTest.cpp
+
+    マスターの時計からトラックの位置を出す計算の確認（LooperAudio::getLoopPointFor / getLoopLengthFor）
+    倍数・分数の長さで、マスターが何周しても位置がずれず、ループの頭がマスターの頭にそろうか
+    割り切れないマスター長も含める。ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+
+namespace
+{
+	using Ratio = LooperAudio::LengthRatio;
+
+	juce::String describe(int masterLength, Ratio ratio)
+	{
+		return "master " + juce::String(masterLength) + ", x" + juce::String(ratio.multiple) + "/" + juce::String(ratio.division);
+	}
+
+	//1サンプルずつ時計を進め、位置が1ずつ進んで samplesToWrap ちょうどで 0 へ戻るか
+	//区切りの長さ（最後まで回った周の長さ）を数え、最長がループ長・最短がその1つ下までか
+	void checkWalk(int masterLength, Ratio ratio, juce::int64 firstClock, int numCycles)
+	{
+		const int loopLength = LooperAudio::getLoopLengthFor(masterLength, ratio);
+		const juce::int64 period = (juce::int64)masterLength * ratio.multiple;
+
+		bool inRange = true, continuous = true, alignedToMaster = true, periodic = true;
+		int shortest = loopLength, longest = 0, wrapsInOneMasterCycle = 0;
+		int runLength = -1; //最初の区切りまでは途中から数えているので使わない
+
+		auto previous = LooperAudio::getLoopPointFor(masterLength, ratio, firstClock);
+
+		for (juce::int64 clock = firstClock + 1; clock < firstClock + period * numCycles; ++clock)
+		{
+			const auto point = LooperAudio::getLoopPointFor(masterLength, ratio, clock);
+
+			if (point.position < 0 || point.position >= loopLength || point.samplesToWrap < 1
+				|| point.position + point.samplesToWrap > loopLength)
+				inRange = false;
+
+			const bool wrapped = previous.samplesToWrap == 1;
+			if (wrapped ? point.position != 0
+						: (point.position != previous.position + 1 || point.samplesToWrap != previous.samplesToWrap - 1))
+				continuous = false;
+
+			if (wrapped)
+			{
+				if (runLength >= 0)
+				{
+					shortest = juce::jmin(shortest, runLength);
+					longest = juce::jmax(longest, runLength);
+				}
+				runLength = 0;
+			}
+			if (runLength >= 0)
+				++runLength;
+
+			//マスターの頭ではトラックも頭（倍数なら m 周に1度）
+			const auto fromOrigin = ((clock % period) + period) % period;
+			if (fromOrigin == 0 && point.position != 0)
+				alignedToMaster = false;
+
+			//マスター1周（倍数なら m 周）あとも同じ位置
+			const auto later = LooperAudio::getLoopPointFor(masterLength, ratio, clock + period);
+			if (later.position != point.position || later.samplesToWrap != point.samplesToWrap)
+				periodic = false;
+
+			if (wrapped && clock >= firstClock + period && clock < firstClock + 2 * period)
+				++wrapsInOneMasterCycle;
+
+			previous = point;
+		}
+
+		const auto name = describe(masterLength, ratio) + " from clock " + juce::String(firstClock) + ": ";
+		test::expect(inRange, (name + "positions stay inside the loop").toRawUTF8());
+		test::expect(continuous, (name + "positions advance by one and wrap to 0").toRawUTF8());
+		test::expect(alignedToMaster, (name + "the loop start lines up with the master start").toRawUTF8());
+		test::expect(periodic, (name + "positions repeat every master period").toRawUTF8());
+		test::expect(longest == loopLength && shortest >= loopLength - (ratio.division > 1 ? 1 : 0),
+					 (name + "each turn is the loop length (divisions may be one sample shorter)").toRawUTF8());
+		test::expect(wrapsInOneMasterCycle == ratio.division,
+					 (name + "wraps as many times per master period as the division").toRawUTF8());
+	}
+}
+
+int main()
+{
+	// 🎯 長さ（割り切れない時は切り上げ）
+	test::expect(LooperAudio::getLoopLengthFor(12000, { 1, 1 }) == 12000, "x1 is the master length");
+	test::expect(LooperAudio::getLoopLengthFor(12000, { 4, 1 }) == 48000, "x4 is four master lengths");
+	test::expect(LooperAudio::getLoopLengthFor(12000, { 1, 2 }) == 6000, "1/2 of an even master");
+	test::expect(LooperAudio::getLoopLengthFor(12001, { 1, 2 }) == 6001, "1/2 of an odd master rounds up");
+	test::expect(LooperAudio::getLoopLengthFor(10, { 1, 3 }) == 4, "1/3 of 10 rounds up to 4");
+	test::expect(LooperAudio::getLoopLengthFor(44100, { 1, 8 }) == 5513, "1/8 of 44100 rounds up");
+	test::expect(LooperAudio::getLoopLengthFor(200000000, { 8, 1 }) == 1600000000, "x8 of a long master does not overflow");
+
+	// 🎯 区切りの位置（k × マスター長 / division を四捨五入）
+	{
+		const auto beforeSplit = LooperAudio::getLoopPointFor(12001, { 1, 2 }, 6000);
+		const auto atSplit = LooperAudio::getLoopPointFor(12001, { 1, 2 }, 6001);
+		test::expect(beforeSplit.position == 6000 && beforeSplit.samplesToWrap == 1, "odd master 1/2: the first half is 6001 samples");
+		test::expect(atSplit.position == 0 && atSplit.samplesToWrap == 6000, "odd master 1/2: the second half is 6000 samples");
+
+		const auto secondCycle = LooperAudio::getLoopPointFor(12000, { 2, 1 }, 12000 + 5);
+		test::expect(secondCycle.position == 12005 && secondCycle.samplesToWrap == 24000 - 12005,
+					 "x2 reads the second half on the second master cycle");
+
+		const auto beforeStart = LooperAudio::getLoopPointFor(12000, { 1, 1 }, -3);
+		test::expect(beforeStart.position == 11997 && beforeStart.samplesToWrap == 3, "a clock before zero wraps from the end");
+	}
+
+	// 🎯 マスターが何周しても、倍数・分数のトラックがずれない
+	const Ratio ratios[] = { { 1, 1 }, { 2, 1 }, { 3, 1 }, { 8, 1 }, { 1, 2 }, { 1, 3 }, { 1, 4 }, { 1, 7 }, { 1, 8 } };
+	for (const int masterLength : { 12000, 12001, 4097, 1001 })
+		for (const auto ratio : ratios)
+			checkWalk(masterLength, ratio, -(juce::int64)masterLength * ratio.multiple / 2 - 1, 4);
+
+	//何時間も回した後の大きな時計でも同じ
+	for (const auto ratio : ratios)
+		checkWalk(44101, ratio, (juce::int64)44101 * 8 * 1000003 + 17, 2);
+
+	return test::result();
+}
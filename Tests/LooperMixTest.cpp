@@ -0,0 +1,223 @@
+/*
+  ==============================================================================
+
+    LooperMixTest.cpp
+
+    トラックのミックスの確認
+    ・想定より大きいブロック（部分バスを何回かに分けて回す）でも、想定どおりのブロックと同じ音になるか
+    ・ワーカーと分け合ってミックスしても、直列とビット単位で同じ音になるか
+    ・ゲインのランプは、どこで区切って足してもビット単位で同じになるか
+    ・1/2 のトラックを短い周から録っても、録り始めの音が折り返しで上書きされないか
+    ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	constexpr int masterLength = 12000;
+
+	//マスターを録ってから、残りのトラックを少しずつずらして録る（長さ・ゲイン・パンはトラックごとに変える）
+	//録り終えたトラックは1周で自動的に再生へ切り替わる
+	void recordScenario(test::LooperRig& rig, int numTracks)
+	{
+		auto& looper = rig.looper;
+		using Type = LooperAudio::Command::Type;
+
+		for (int id = 0; id < numTracks; ++id)
+		{
+			looper.addTrack(id);
+			looper.setTrackGain(id, 0.2f + 0.05f * (float)(id % 5));
+			looper.setTrackPan(id, (float)(id % 3 - 1) * 0.5f);
+
+			static constexpr LooperAudio::LengthRatio ratios[] = { { 1, 1 }, { 2, 1 }, { 1, 2 }, { 1, 3 } };
+			looper.setTrackLengthRatio(id, ratios[id % 4]);
+		}
+
+		looper.postCommand(Type::startRecording, 0, 0);
+		looper.postCommand(Type::stopRecording, 0, masterLength);
+		looper.postCommand(Type::startPlaying, 0, masterLength);
+
+		for (int id = 1; id < numTracks; ++id)
+			looper.postCommand(Type::startRecording, id, masterLength + 37 * id);
+	}
+
+	float maxDifference(const std::vector<float>& a, const std::vector<float>& b)
+	{
+		if (a.size() != b.size()) return INFINITY;
+
+		float result = 0.0f;
+		for (size_t i = 0; i < a.size(); ++i)
+			result = std::max(result, std::abs(a[i] - b[i]));
+		return result;
+	}
+
+	bool isBitIdentical(const test::LooperRig& a, const test::LooperRig& b)
+	{
+		for (int ch = 0; ch < test::LooperRig::numChannels; ++ch)
+		{
+			const auto& x = a.rendered[(size_t)ch];
+			const auto& y = b.rendered[(size_t)ch];
+			if (x.size() != y.size() || std::memcmp(x.data(), y.data(), x.size() * sizeof(float)) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	//同じ録音を直列（ワーカーなし）と並列で鳴らして比べる
+	void checkSerialMatchesParallel(int prepared, int blockSize, int numTracks)
+	{
+		constexpr int numWorkers = 3;
+		const juce::int64 end = (juce::int64)masterLength * 5;
+
+		test::LooperRig serial(prepared, 0);
+		recordScenario(serial, numTracks);
+		serial.processUntil(end, blockSize);
+
+		test::LooperRig parallel(prepared, numWorkers);
+		recordScenario(parallel, numTracks);
+		parallel.processUntil(end, blockSize);
+
+		const auto what = juce::String("serial and parallel mixes are bit-identical (prepared ") + juce::String(prepared)
+						+ ", blocks " + juce::String(blockSize) + ", " + juce::String(numTracks) + " tracks)";
+		test::expect(parallel.looper.getNumMixWorkers() == numWorkers && isBitIdentical(serial, parallel), what.toRawUTF8());
+	}
+
+	//ランプ中の区間をばらばらの長さ（SIMD の4の倍数にならない所も含む）で区切って足し、一度に足したものと比べる
+	void checkSplitRamp()
+	{
+		constexpr int length = 3000;
+		std::vector<float> source((size_t)length), whole((size_t)length, 0.0f), split((size_t)length, 0.0f);
+		for (int i = 0; i < length; ++i)
+			source[(size_t)i] = test::LooperRig::inputSample(i, 0);
+
+		simd::GainRamp ramp;
+		ramp.snapTo(0.3f);
+		ramp.setTarget(0.9f, 2203);
+
+		simd::addWithGainRamp(whole.data(), source.data(), length, ramp);
+
+		int done = 0;
+		for (const int chunk : { 5, 3, 77, 1, 1, 400, 13, 1000, 1500 })
+		{
+			const int n = std::min(chunk, length - done);
+			simd::addWithGainRamp(split.data() + done, source.data() + done, n, ramp);
+			ramp = ramp.advancedBy(n);
+			done += n;
+		}
+
+		test::expect(done == length && std::memcmp(whole.data(), split.data(), sizeof(float) * (size_t)length) == 0,
+					 "a gain ramp split at arbitrary points adds bit for bit the same as the whole ramp");
+	}
+
+	//マスターを奇数の長さにすると 1/2 のトラックの周は 6001 と 6000 で交互に来る
+	//startClock の周で録り始め、その周の折り返しで1周とする（短い周なら最後の1サンプルは手前の音を延ばす）
+	void checkDivisionTake(juce::int64 startClock, const char* what)
+	{
+		using Type = LooperAudio::Command::Type;
+		constexpr int oddMaster = 12001;
+		constexpr LooperAudio::LengthRatio half { 1, 2 };
+		constexpr int blockSize = 256;
+
+		test::LooperRig rig(blockSize);
+		auto& looper = rig.looper;
+		looper.addTrack(0);
+		looper.addTrack(1);
+		looper.setTrackMute(0, true);	//出力はトラック1の音だけにする
+		looper.setTrackLengthRatio(1, half);
+
+		const juce::int64 start = oddMaster + startClock;
+		looper.postCommand(Type::startRecording, 0, 0);
+		looper.postCommand(Type::stopRecording, 0, oddMaster);
+		looper.postCommand(Type::startPlaying, 0, oddMaster);
+		looper.postCommand(Type::startRecording, 1, (long)start);
+
+		const juce::int64 from = 4 * (juce::int64)oddMaster;
+		const juce::int64 end = from + oddMaster;
+		rig.processUntil(end, blockSize);
+
+		const int loopLength = LooperAudio::getLoopLengthFor(oddMaster, half);
+		const auto first = LooperAudio::getLoopPointFor(oddMaster, half, startClock);
+		const int takeLength = first.position + first.samplesToWrap;
+
+		//ループ位置 p に書いたのは、録り始めから (p - 録り始めの位置) だけ後の入力
+		auto expected = [&] (int position, int ch)
+		{
+			const int p = juce::jmin(position, takeLength - 1);
+			return test::LooperRig::inputSample(start + (p - first.position + takeLength) % takeLength, ch);
+		};
+
+		int headsHeard = 0, headsIntact = 0;
+		bool matches = true;
+		for (int ch = 0; ch < test::LooperRig::numChannels; ++ch)
+			for (auto n = from; n < end; ++n)
+			{
+				const int position = LooperAudio::getLoopPointFor(oddMaster, half, n - oddMaster).position;
+				const float heard = rig.rendered[(size_t)ch][(size_t)n];
+				matches = matches && heard == expected(position, ch);
+
+				if (position == first.position)
+				{
+					++headsHeard;
+					headsIntact += heard == test::LooperRig::inputSample(start, ch) ? 1 : 0;
+				}
+			}
+
+		const bool headSurvives = headsHeard > 0 && headsIntact == headsHeard;
+
+		test::expect(loopLength == 6001 && headSurvives, (juce::String("the first recorded sample survives the wrap (") + what + ")").toRawUTF8());
+		test::expect(matches, (juce::String("the take plays back as recorded (") + what + ")").toRawUTF8());
+	}
+
+	bool isSilent(const std::vector<float>& samples, size_t from)
+	{
+		for (size_t i = from; i < samples.size(); ++i)
+			if (samples[i] != 0.0f) return false;
+		return true;
+	}
+}
+
+int main()
+{
+	// 🎯 想定の2倍のブロックで来ても、部分バスを2回に分けて回した音が想定どおりのブロックと同じか
+	{
+		constexpr int prepared = 256;
+		constexpr int numTracks = 12;	//部分バスを通る（2グループ以上）
+		const juce::int64 end = (juce::int64)masterLength * 5;
+
+		test::LooperRig expected(prepared);
+		recordScenario(expected, numTracks);
+		expected.processUntil(end, prepared);
+
+		test::LooperRig oversized(prepared);
+		recordScenario(oversized, numTracks);
+		oversized.processUntil(end, prepared * 2);
+
+		test::expect(! isSilent(expected.rendered[0], (size_t)masterLength), "the scenario plays back something");
+
+		float worst = 0.0f;
+		for (int ch = 0; ch < test::LooperRig::numChannels; ++ch)
+			worst = std::max(worst, maxDifference(expected.rendered[(size_t)ch], oversized.rendered[(size_t)ch]));
+
+		std::printf("     max difference with 2x blocks: %g\n", (double)worst);
+		test::expect(worst < 1.0e-5f, "blocks of twice the prepared size mix the same audio");
+	}
+
+	// 🎯 並列ミックスでも足し合わせる順は直列と同じ（グループ数・区間の切れ方が変わっても）
+	for (const int blockSize : { 64, 256, 1000 })
+		for (const int numTracks : { 4, 12, 20, 40 })
+			checkSerialMatchesParallel(blockSize, blockSize, numTracks);
+
+	checkSerialMatchesParallel(256, 512, 40);
+
+	checkSplitRamp();
+
+	checkDivisionTake(6001 + 100, "starting in the short turn");
+	checkDivisionTake(100, "starting in the long turn");
+
+	return test::result();
+}
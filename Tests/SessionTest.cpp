@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    SessionTest.cpp
+
+    セッションの保存と読み込みの確認
+    ・保存したルーパーと、そのファイルを読み込んだルーパーが、ループの頭からビット単位で同じ音になるか
+    （ゲイン・パン・ミュート・再生中かどうかと、2倍・1/2 のトラックの長さの比もファイルから戻る）
+    ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+#include <cstring>
+
+namespace
+{
+	using Type = LooperAudio::Command::Type;
+	using test::LooperRig;
+
+	constexpr int blockSize = 512;
+	constexpr int masterLength = 9001; //ページの境目をまたぐ
+
+	//マスターの後に、ゲインとパンを変えたトラック・ミュートしたトラック・止めたトラック・2倍と1/2のトラックを重ねる
+	void recordScenario(LooperRig& rig)
+	{
+		auto& looper = rig.looper;
+		for (int id = 0; id < 6; ++id)
+			looper.addTrack(id);
+
+		looper.setTrackGain(1, 0.5f);
+		looper.setTrackPan(1, -0.5f);
+		looper.setTrackMute(2, true);
+		looper.setTrackLengthRatio(4, { 2, 1 });
+		looper.setTrackLengthRatio(5, { 1, 2 });
+
+		looper.postCommand(Type::startRecording, 0, 0);
+		looper.postCommand(Type::stopRecording, 0, masterLength);
+		looper.postCommand(Type::startPlaying, 0, masterLength);
+
+		looper.postCommand(Type::startRecording, 1, masterLength + masterLength / 3);
+		looper.postCommand(Type::startRecording, 2, masterLength + 200);
+		looper.postCommand(Type::startRecording, 3, 2 * masterLength + 77);
+		looper.postCommand(Type::stopPlaying, 3, 4 * masterLength);
+		looper.postCommand(Type::startRecording, 4, masterLength + 500);
+		looper.postCommand(Type::startRecording, 5, 2 * masterLength + 300);
+	}
+
+	//保存を頼んで、書き終わるまで待つ（ページの写し取りはブロック境界なので、その間もルーパーは回す）
+	bool saveAndWait(LooperRig& rig, const juce::File& file)
+	{
+		if (! rig.looper.saveSession(file))
+			return false;
+
+		for (;;)
+		{
+			const auto state = rig.looper.getSaveState();
+			if (state == LooperAudio::SaveState::succeeded) return true;
+			if (state == LooperAudio::SaveState::failed) return false;
+
+			if (state == LooperAudio::SaveState::waitingForSnapshot)
+				rig.process(blockSize);
+
+			juce::Thread::sleep(1);
+		}
+	}
+
+	bool isBitIdentical(const LooperRig& a, juce::int64 fromA, const LooperRig& b, juce::int64 fromB, juce::int64 length)
+	{
+		for (int ch = 0; ch < LooperRig::numChannels; ++ch)
+			if (std::memcmp(a.rendered[(size_t)ch].data() + fromA, b.rendered[(size_t)ch].data() + fromB,
+							(size_t)length * sizeof(float)) != 0)
+				return false;
+		return true;
+	}
+}
+
+int main()
+{
+	juce::TemporaryFile session(LooperAudio::sessionFileExtension);
+
+	//録り終えてから、マスターの頭（2倍のトラックの頭でもある）から2周分を控えておく
+	const juce::int64 compareStart = 5 * (juce::int64)masterLength;
+	const juce::int64 compareLength = 2 * (juce::int64)masterLength;
+
+	LooperRig saved(blockSize);
+	recordScenario(saved);
+	saved.processUntil(compareStart + compareLength, blockSize);
+
+	test::expect(saveAndWait(saved, session.getFile()), "the session is saved");
+
+	//読み込んだ側はマスターの頭から鳴る
+	LooperRig loaded(blockSize);
+	test::expect(loaded.looper.loadSession(session.getFile()), "the session is loaded");
+	test::expect(loaded.looper.getSessionSampleRate() == 48000.0, "the session keeps its sample rate");
+	loaded.processUntil(compareLength, blockSize);
+
+	test::expect(isBitIdentical(saved, compareStart, loaded, 0, compareLength),
+				 "the loaded session plays bit for bit what was saved");
+
+	return test::result();
+}
@@ -0,0 +1,96 @@
+/*
+  ==============================================================================
+
+    TestHelpers.h
+
+    Tests/ の各テストで使う小物（結果の記録と、決まった入力でルーパーを回す台）
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include "LooperAudio.h"
+#include <array>
+#include <cstdio>
+#include <vector>
+
+namespace test
+{
+	inline int failures = 0;
+
+	inline void expect(bool condition, const char* what)
+	{
+		std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+		if (! condition) ++failures;
+	}
+
+	inline int result() { return failures == 0 ? 0 : 1; }
+
+	//------------------------------------------------------------
+	// 決まった入力をブロックごとに流してルーパーを回す台
+	// 入力は絶対位置とチャンネルだけで決まる雑音なので、同じ手順なら何度でも同じ音になる
+	// モニターとつなぎ目のフェードは切ってある（出力はループの音だけ）
+	//------------------------------------------------------------
+	struct LooperRig
+	{
+		static constexpr int numChannels = 2;
+		static constexpr int budgetPages = 1024;
+
+		explicit LooperRig(int samplesPerBlockExpected, int numWorkers = 0, double sampleRate = 48000.0)
+			: looper((size_t)budgetPages * PageArena::bytesPerPage(LooperAudio::numStorageChannels, LooperAudio::pageSize))
+		{
+			looper.setMonitorMute(true);
+			looper.setSeamFadeMs(0.0f);
+			looper.setParallelMixing(numWorkers);
+			looper.prepareToPlay(samplesPerBlockExpected, sampleRate);
+		}
+
+		~LooperRig() { looper.releaseResources(); }
+
+		static float inputSample(juce::int64 position, int channel) noexcept
+		{
+			auto x = (juce::uint64)position * 0x9E3779B97F4A7C15ull + (juce::uint64)(channel + 1) * 0xBF58476D1CE4E5B9ull;
+			x ^= x >> 31;
+			x *= 0x94D049BB133111EBull;
+			x ^= x >> 29;
+			return (float)((double)(x >> 40) / (double)(1ull << 24)) - 0.5f;
+		}
+
+		//numSamples を1ブロックとして処理し、出力を rendered の後ろへ足す
+		void process(int numSamples)
+		{
+			input.setSize(numChannels, numSamples, false, false, true);
+			output.setSize(numChannels, numSamples, false, false, true);
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				auto* data = input.getWritePointer(ch);
+				for (int i = 0; i < numSamples; ++i)
+					data[i] = inputSample(position + i, ch);
+			}
+
+			looper.processBlock(output, input, position);
+
+			for (int ch = 0; ch < numChannels; ++ch)
+			{
+				const auto* data = output.getReadPointer(ch);
+				rendered[(size_t)ch].insert(rendered[(size_t)ch].end(), data, data + numSamples);
+			}
+
+			position += numSamples;
+		}
+
+		//end の手前まで blockSize ずつ（最後は端数）
+		void processUntil(juce::int64 end, int blockSize)
+		{
+			while (position < end)
+				process((int)juce::jmin<juce::int64>(blockSize, end - position));
+		}
+
+		LooperAudio looper;
+		juce::AudioBuffer<float> input, output;
+		juce::int64 position = 0;
+		std::array<std::vector<float>, numChannels> rendered;
+	};
+}
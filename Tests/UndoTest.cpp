@@ -0,0 +1,140 @@
+/*
+  ==============================================================================
+
+    UndoTest.cpp
+
+    多段 UNDO/REDO の確認
+    ・録って、録り直して、2回戻して1回やり直すと、最初のテイクがビット単位でそのまま鳴るか
+    ・履歴がページ予算を超えて古い段を手放しても、一番新しい段は戻せるか
+    ctest から走らせる。失敗したら 1 を返す
+
+  ==============================================================================
+*/
+
+#include "TestHelpers.h"
+#include <array>
+#include <cstring>
+
+namespace
+{
+	using Type = LooperAudio::Command::Type;
+	using test::LooperRig;
+
+	juce::String describe(const char* what, int blockSize)
+	{
+		return juce::String(what) + " (blocks of " + juce::String(blockSize) + ")";
+	}
+
+	//マスター（トラック0）を [0, masterLength) で録って、そのまま再生する
+	void recordMaster(LooperRig& rig, int masterLength)
+	{
+		rig.looper.addTrack(0);
+		rig.looper.addTrack(1);
+		rig.looper.postCommand(Type::startRecording, 0, 0);
+		rig.looper.postCommand(Type::stopRecording, 0, masterLength);
+		rig.looper.postCommand(Type::startPlaying, 0, masterLength);
+	}
+
+	//トラック1を start から重ねて録ったテイクの、位置 n での音（マスターは masterLength から鳴っている）
+	float takeSample(juce::int64 start, int masterLength, juce::int64 n, int ch)
+	{
+		const auto loopPosition = (n - masterLength) % masterLength;
+		const auto startPosition = (start - masterLength) % masterLength;
+		return LooperRig::inputSample(start + (loopPosition - startPosition + masterLength) % masterLength, ch);
+	}
+
+	bool isBitIdentical(const LooperRig& a, const LooperRig& b, juce::int64 from, juce::int64 to)
+	{
+		for (int ch = 0; ch < LooperRig::numChannels; ++ch)
+			if (std::memcmp(a.rendered[(size_t)ch].data() + from, b.rendered[(size_t)ch].data() + from,
+							(size_t)(to - from) * sizeof(float)) != 0)
+				return false;
+		return true;
+	}
+
+	//1テイク目 → 録り直し → UNDO ×2 → REDO で1テイク目に戻ったトラックを、
+	//1テイク目しか録っていないルーパーと同じ位置から鳴らして比べる
+	void checkUndoRedo(int blockSize)
+	{
+		constexpr int masterLength = 9001; //ページの境目をまたぐ
+		const juce::int64 firstTake = masterLength + masterLength / 3;
+		const juce::int64 secondTake = 3 * masterLength + masterLength / 2;
+		const juce::int64 restart = 6 * masterLength + 5;
+		const juce::int64 end = restart + 2 * masterLength;
+
+		LooperRig edited(blockSize);
+		recordMaster(edited, masterLength);
+		edited.looper.postCommand(Type::startRecording, 1, (long)firstTake);
+		edited.looper.postCommand(Type::startRecording, 1, (long)secondTake);
+		edited.looper.postCommand(Type::undo, -1, (long)restart);
+		edited.looper.postCommand(Type::undo, -1, (long)restart);
+		edited.looper.postCommand(Type::redo, -1, (long)restart);
+		edited.looper.postCommand(Type::startPlaying, 1, (long)restart);
+		edited.processUntil(end, blockSize);
+
+		LooperRig reference(blockSize);
+		recordMaster(reference, masterLength);
+		reference.looper.postCommand(Type::startRecording, 1, (long)firstTake);
+		reference.looper.postCommand(Type::stopPlaying, 1, (long)restart);
+		reference.looper.postCommand(Type::startPlaying, 1, (long)restart);
+		reference.processUntil(end, blockSize);
+
+		test::expect(isBitIdentical(edited, reference, restart, end),
+					 describe("undo twice and redo once plays the first take bit for bit", blockSize).toRawUTF8());
+		test::expect(edited.looper.getNumUndoLevels() == 2 && edited.looper.getNumRedoLevels() == 1,
+					 describe("two levels are left to undo and one to redo", blockSize).toRawUTF8());
+	}
+
+	//1テイク64ページを、履歴の予算（アリーナの historyBudgetPercent）を超えるまで録り直す
+	void checkSheddingKeepsNewest()
+	{
+		constexpr int blockSize = 1024;
+		constexpr int masterLength = 64 * LooperAudio::pageSize;
+		constexpr int historyPages = LooperRig::budgetPages * LooperAudio::historyBudgetPercent / 100;
+		constexpr int numTakes = historyPages / 64 + 2;
+		constexpr int gap = 1000;
+
+		LooperRig rig(blockSize);
+		recordMaster(rig, masterLength);
+
+		std::array<juce::int64, numTakes> takeStart {};
+		for (int take = 0; take < numTakes; ++take)
+		{
+			takeStart[(size_t)take] = masterLength + (juce::int64)take * (masterLength + gap);
+			rig.looper.postCommand(Type::startRecording, 1, (long)takeStart[(size_t)take]);
+		}
+
+		const juce::int64 undoAt = takeStart[(size_t)numTakes - 1] + masterLength + gap;
+		rig.processUntil(undoAt, blockSize);
+
+		//マスターの分と、テイクごとに1段ずつ積んだ
+		const int levels = rig.looper.getNumUndoLevels();
+		test::expect(levels > 0 && levels < numTakes + 1, "levels over the history budget are shed");
+
+		rig.looper.postCommand(Type::undo, -1, (long)undoAt);
+		rig.looper.postCommand(Type::startPlaying, 1, (long)undoAt);
+		rig.processUntil(undoAt + masterLength, blockSize);
+
+		const auto previous = takeStart[(size_t)numTakes - 2];
+		bool matches = true;
+		for (int ch = 0; ch < LooperRig::numChannels; ++ch)
+			for (auto n = undoAt; n < rig.position && matches; ++n)
+			{
+				const float loop = LooperRig::inputSample((n - masterLength) % masterLength, ch) + takeSample(previous, masterLength, n, ch);
+				matches = rig.rendered[(size_t)ch][(size_t)n] == loop;
+			}
+
+		test::expect(matches, "the newest level survives shedding and undoes to the previous take");
+		test::expect(rig.looper.getDroppedRecordSampleCount() == 0, "no recording ran out of pages");
+	}
+}
+
+int main()
+{
+	for (const int blockSize : { 64, 512, 1000 })
+		checkUndoRedo(blockSize);
+
+	checkSheddingKeepsNewest();
+
+	return test::result();
+}